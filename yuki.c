@@ -1,3 +1,21 @@
+/* For MAP_ANONYMOUS and MAP_NORESERVE under -std=c99 */
+#define _DEFAULT_SOURCE
+
+/* Before misc.h, whose debug allocation macros break stdlib.h and
+ * mm_malloc.h, and which only includes stdlib.h in release builds */
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* For rdtsc, if YK_INSTRUMENT_CYCLES is set */
+#ifdef _MSC_VER
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
 #include "yuki.h"
 #include "psyche.h"
 
@@ -8,8 +26,17 @@
 #include <stdbool.h>
 #include <time.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <signal.h>
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#endif
+
 #include "random.h"
 
 #define YK_MARK_BIT ((YkUint)1)
@@ -28,11 +55,19 @@ typedef struct YkCompilerVar {
 	} type;
 	YkType value_type;
 	struct YkCompilerVar* next;
+
+	/* Summary of this variable and the ones after it, set by
+	 * yk_compiler_var_link: one bit per hash of the symbols bound, the
+	 * number of stack slots taken and the closest environment */
+	uint64_t symbols;
+	YkUint depth;
+	struct YkCompilerVar* environnement;
 } YkCompilerVar;
 
 typedef struct YkClosedVar {
 	YkCompilerVar* lexical_stack;
 	struct YkClosedVar* next;
+	uint64_t symbols;
 } YkClosedVar;
 
 typedef struct {
@@ -41,7 +76,7 @@ typedef struct {
 	YkCompilerVar* cont_stack;
 	YkCompilerVar* lexical_stack;
 
-	DynamicArray* warnings;
+	YkWarning** warnings;
 
 	YkClosedVar* var_upenvs;
 	YkClosedVar* cont_upenvs;
@@ -49,6 +84,12 @@ typedef struct {
 	YkCompilerVar* closed_vars;
 	YkCompilerVar* closed_conts;
 
+	/* Bytecode of the global function being compiled, that has to be
+	 * recompiled if one of the functions inlined into it changes. NIL at
+	 * toplevel, t inside closures where nothing can be inlined. */
+	YkObject inline_owner;
+	bool is_inlined;
+
 	bool is_tail;
 } YkCompilerState;
 
@@ -57,18 +98,99 @@ static union YkUnion* yk_free_list;
 static YkUint yk_workspace_size;
 static YkUint yk_free_space;
 
-#define YK_ARRAY_ALLOCATOR_SIZE 0x20000
+#define YK_ARRAY_ALLOCATOR_SIZE 0x800000
 static char* yk_array_allocator;
 static char* yk_array_allocator_top;
+static char* yk_array_allocator_rover;
+
+/* Heap census: while `yk_census' is set, the collector counts each live
+ * object it marks, and the arena blocks it marks for that object */
+typedef struct {
+	YkUint count;
+	YkUint bytes;		/* Of the array arena blocks */
+} YkCensusEntry;
+
+typedef struct {
+	YkCensusEntry types[yk_t_sequence + 1];
+	YkObject* classes;
+	YkCensusEntry* class_entries;
+	YkUint classes_count;
+	YkUint classes_capacity;
+	YkCensusEntry* current_type;	/* The owner of the next blocks marked */
+	YkCensusEntry* current_class;
+} YkCensus;
+
+static YkCensus* yk_census;
+
+/* Allocation sites: every `yk_allocation_sample_interval' allocations of a
+ * cell or an arena block, the bytecode offset running is charged with that
+ * many allocations */
+typedef struct {
+	YkObject bytecode;	/* nil for allocations made outside of bytecode */
+	YkUint offset;
+	YkUint cells;
+	YkUint bytes;
+} YkAllocationSite;
+
+#define YK_ALLOCATION_SITES_SIZE 0x1000
+#define YK_ALLOCATION_REPORT_SIZE 32
 
-#define YK_SYMBOL_TABLE_SIZE 4096
-static YkObject *yk_symbol_table;
+static YkAllocationSite yk_allocation_sites[YK_ALLOCATION_SITES_SIZE];
+static YkUint yk_allocation_sites_count, yk_allocation_sample_interval,
+	yk_allocation_countdown;
+
+/* Open addressing symbol table with linear probing. Entries cache the hash
+ * and length of the name, so probing seldom has to touch the heap. */
+typedef struct {
+	YkObject symbol;
+	uint32_t hash;
+	uint32_t length;
+} YkSymbolTableEntry;
+
+#define YK_SYMBOL_TABLE_MIN_SIZE 4096
+#define YK_SYMBOL_TABLE_TOMBSTONE YK_NIL	/* nil itself is stored as yk_nil */
+#define YK_SYMBOL_TABLE_LIVE(e) ((e)->symbol != NULL && (e)->symbol != YK_SYMBOL_TABLE_TOMBSTONE)
+
+static YkSymbolTableEntry *yk_symbol_table;
+static YkUint yk_symbol_table_size;
+static YkUint yk_symbol_table_count;	/* Live entries */
+static YkUint yk_symbol_table_used;		/* Live entries and tombstones */
 
 /* Registers */
 YkObject yk_value_register;
+
+/* Multiple values: `yk_values_count' is reset to 1 by every instruction that
+ * writes the value register, so only a `values' call in tail position of the
+ * producer reaches a `receive' form. */
+#define YK_VALUES_MAX_COUNT 16
+static YkObject yk_values_buffer[YK_VALUES_MAX_COUNT];
+static YkUint yk_values_count;
 static YkInstruction* yk_program_counter;
 static YkObject yk_bytecode_register;
 
+/* Global functions and the bytecodes they were inlined into. Bytecodes
+ * are held weakly: their entries go when they are collected. */
+typedef struct {
+	YkObject callee;
+	YkObject owner;
+} YkInlineDependency;
+
+static YkInlineDependency* yk_inline_dependencies;
+static YkUint yk_inline_dependencies_count, yk_inline_dependencies_capacity;
+
+/* Bytecodes to compile again once they stop running */
+static YkObject yk_pending_recompiles;
+
+/* Expansions keyed by (expander . form), emptied by the GC, and lambdas
+ * without free variables keyed by their source, for as long as they are
+ * the global value of their name. Both are kept with the globals and
+ * classes read to produce them. */
+static YkObject yk_macro_expansions;
+static YkObject yk_compiled_lambdas;
+/* List of (symbol value . class) for the macros expanded and the globals
+ * and classes read while expanding or compiling a cached lambda, or t */
+static YkObject yk_expansion_reads;
+
 /* Symbols */
 YkObject yk_tee, yk_nil, yk_debugger, yk_var_output;
 
@@ -82,24 +204,166 @@ YkUint yk_gc_stack_size;
 static jmp_buf yk_jump_point;
 static uint yk_jump_stack_size;
 
-#define YK_STACK_MAX_SIZE 1024
-static YkObject yk_lisp_stack[YK_STACK_MAX_SIZE];
+/* Each yk_run can be jumped back to from the yk_runs nested in it by C
+ * functions calling Lisp: exiting to a continuation of an outer run, or
+ * signaling an error from a builtin, skips the C frames in between */
+#define YK_RUN_TAIL_CALL 2
+#define YK_RUN_ESCAPE 3
+
+typedef struct YkRunFrame {
+	jmp_buf jump;
+	uint32_t depth;
+	YkUint gc_stack_size;
+	uint jump_stack_size;
+	struct YkRunFrame* previous;
+} YkRunFrame;
+
+static YkRunFrame* yk_run_frame;
+static uint32_t yk_run_depth;
+static YkObject yk_escape_continuation;
+
+/* The Lisp, dynamic bindings and continuations stacks each reserve
+ * yk_stack_max_size entries of address space up front, and commit it one
+ * segment at a time as they grow downwards. The reservation never moves, so
+ * pointers into the stacks (frame pointers, continuations) stay valid. */
+#define YK_STACK_DEFAULT_MAX_SIZE (1 << 20)
+#define YK_STACK_SEGMENT_SIZE 0x10000
+#define YK_STACK_RED_ZONE 16
+/* Entries left to the error handlers once a stack overflows */
+#define YK_STACK_OVERFLOW_RESERVE 4096
+
+typedef struct {
+	char* reserved;		/* Lowest reserved address, the hard limit */
+	char* committed;	/* Lowest committed address */
+	char* limit;		/* Pushing past this commits a new segment */
+	char* bottom;		/* Highest address, where the stack starts */
+	char* floor;		/* Pushing past this is a stack overflow */
+	char* overflow_floor;	/* Floor while handling a stack overflow */
+	size_t element_size;
+} YkStack;
+
+static YkUint yk_stack_max_size = YK_STACK_DEFAULT_MAX_SIZE;
+
+static YkStack yk_lisp_stack;
 static YkObject* yk_lisp_stack_top;
 
 static YkObject* yk_lisp_frame_ptr;
 
-static YkDynamicBinding yk_dynamic_bindings_stack[YK_STACK_MAX_SIZE];
+static YkStack yk_dynamic_bindings_stack;
 static YkDynamicBinding* yk_dynamic_bindings_stack_top;
 
-static YkObject yk_continuations_stack[YK_STACK_MAX_SIZE];
+static YkStack yk_continuations_stack;
 static YkObject* yk_continuations_stack_top;
 
+#define YK_STACK_BOTTOM(stack, type) ((type*)(stack).bottom)
+
+/* Makes sure `n' more entries can be pushed on top of `top'. Costs one
+ * comparison unless a new segment has to be committed. */
+#define YK_STACK_RESERVE(stack, top, n)							\
+	do {															\
+		if ((char*)((top) - (n)) <= (stack).limit)					\
+			yk_stack_grow(&(stack), (char*)((top) - (n)));			\
+	} while (0)
+
 #define YK_PUSH(stack, x) *(--(stack)) = ((void*)x)
 #define YK_POP(stack, type, x) x = *((type)((stack)++))
 
 #define YK_LISP_STACK_PUSH(x) YK_PUSH(yk_lisp_stack_top, x)
 #define YK_LISP_STACK_POP(x, type) YK_POP(yk_lisp_stack_top, type, x)
 
+static void* yk_stack_reserve_memory(size_t size) {
+#ifdef _WIN32
+	return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+	void* memory = mmap(NULL, size, PROT_NONE,
+						MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return memory == MAP_FAILED ? NULL : memory;
+#endif
+}
+
+static bool yk_stack_commit_memory(void* start, size_t size) {
+#ifdef _WIN32
+	return VirtualAlloc(start, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+	return mprotect(start, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+static void yk_go_back(YkObject value, int code);
+static void yk_signal_error(YkObject class, ...);
+
+static bool yk_stack_overflowing;
+
+/* Signals a stack-overflow-error, that the handlers have the rest of the
+ * reservation to deal with. Aborts to toplevel if they overflow it too. */
+static void yk_stack_overflow(YkStack* stack) {
+	if (stack->floor == stack->overflow_floor) {
+		printf("Stack overflow!\n");
+		yk_go_back(yk_make_symbol_cstr("stack-overflow"), 1);
+	}
+
+	stack->floor = stack->overflow_floor;
+	stack->limit = max(stack->committed + YK_STACK_RED_ZONE * stack->element_size,
+					   stack->floor);
+	yk_stack_overflowing = true;
+	yk_signal_error(yk_make_symbol_cstr("stack-overflow-error"), NULL);
+}
+
+static void yk_stack_grow(YkStack* stack, char* needed) {
+	while (needed <= stack->limit) {
+		if (needed <= stack->floor)
+			yk_stack_overflow(stack);
+
+		size_t size = min((size_t)YK_STACK_SEGMENT_SIZE,
+						  (size_t)(stack->committed - stack->reserved));
+
+		if (size == 0 || !yk_stack_commit_memory(stack->committed - size, size))
+			yk_stack_overflow(stack);
+
+		stack->committed -= size;
+		stack->limit = max(stack->committed + YK_STACK_RED_ZONE * stack->element_size,
+						   stack->floor);
+	}
+}
+
+/* Gives the overflow reserve back once the stack has unwound out of it */
+static bool yk_stack_rearm(YkStack* stack, char* top) {
+	size_t reserve = min((size_t)YK_STACK_OVERFLOW_RESERVE, yk_stack_max_size / 2);
+	char* floor = stack->reserved + (reserve + YK_STACK_RED_ZONE) * stack->element_size;
+
+	if (top <= floor + YK_STACK_RED_ZONE * stack->element_size)
+		return false;
+
+	stack->floor = floor;
+	stack->limit = max(stack->limit, floor);
+	return true;
+}
+
+static void yk_stack_create(YkStack* stack, size_t element_size) {
+	size_t size = yk_stack_max_size * element_size;
+	size = (size + YK_STACK_SEGMENT_SIZE - 1) & ~((size_t)YK_STACK_SEGMENT_SIZE - 1);
+
+	stack->reserved = yk_stack_reserve_memory(size);
+	if (stack->reserved == NULL)
+		panic("Could not reserve stack!");
+
+	stack->element_size = element_size;
+	stack->bottom = stack->reserved + size;
+	stack->committed = stack->bottom;
+	stack->limit = stack->bottom;
+	stack->overflow_floor = stack->reserved + YK_STACK_RED_ZONE * element_size;
+	stack->floor = stack->overflow_floor;
+	yk_stack_rearm(stack, stack->bottom);
+
+	yk_stack_grow(stack, stack->bottom);
+}
+
+/* Sets the maximum number of entries of each stack. Only takes effect if
+ * called before yk_init. */
+void yk_set_stack_max_size(YkUint size) {
+	yk_stack_max_size = max(size, (YkUint)YK_STACK_RED_ZONE * 2);
+}
+
 /* Error handling */
 #define YK_ASSERT(cond) if (!(cond)) { yk_assert(#cond, __FILE__, __LINE__); }
 
@@ -118,10 +382,13 @@ static YkObject yk_make_array(YkUint size, YkObject element);
 static void yk_assert(const char* expression, const char* file, uint32_t line);
 void yk_bytecode_disassemble(YkObject bytecode);
 static YkObject yk_make_string(const char* cstr, size_t cstr_size);
+static YkObject yk_alloc_string(YkUint size);
+static YkUint yk_string_length(YkObject string);
 inline static char* yk_symbol_cstr(YkObject sym);
 
 static YkCompilerVar* yk_find_closed_vars(YkObject expr, YkClosedVar* upenvs, YkObject env);
 static YkCompilerVar* yk_find_closed_conts(YkObject expr, YkClosedVar* upenvs, YkObject env);
+static void yk_invalidate_inlined(YkObject symbol);
 
 static YkObject yk_make_cpointer(void* cptr);
 static void* yk_cpointer_value(YkObject cpointer);
@@ -130,8 +397,24 @@ static YkObject yk_find_class(YkObject symbol);
 YkObject yk_apply(YkObject function, YkObject args);
 static YkObject yk_type_of(YkObject object);
 static void yk_tail_apply(YkObject function, YkObject args);
-static void yk_go_back(YkObject value, int code);
-static void yk_signal_error(YkObject class, ...);
+static inline void yk_push_apply_frame(YkUint argcount);
+static YkObject yk_apply_pushed(YkObject function, YkUint argcount);
+static void yk_flush_method_cache();
+static void yk_flush_compiler_caches();
+static void yk_record_read(YkObject symbol);
+static void yk_symbol_table_sweep();
+static void yk_finalizable_sweep();
+static void yk_inline_dependencies_sweep();
+static void yk_recompile_pending();
+static YkObject yk_intern(YkObject string, bool weak);
+static YkObject yk_apply_n(YkObject function, YkUint argcount, YkObject* args);
+static void yk_profile_mark();
+static void yk_allocation_sites_mark();
+
+#if YK_INSTRUMENT
+extern char* yk_opcode_names[];
+static void yk_instrument_mark();
+#endif
 
 static YkObject yk_arglist_cfun,
 	yk_symbol_file_mode_input, yk_symbol_file_mode_output, yk_symbol_file_mode_append,
@@ -141,7 +424,9 @@ static YkObject yk_arglist_cfun,
 	yk_symbol_type_float, yk_symbol_type_symbol, yk_symbol_type_function, yk_symbol_type_array,
 	yk_symbol_type_string, yk_symbol_type_cpointer, yk_symbol_type_string_stream,
 	yk_symbol_type_file_stream, yk_symbol_type_class, yk_symbol_type_builtin_class,
-	yk_symbol_type_object, yk_symbol_type_object_class,
+	yk_symbol_type_object, yk_symbol_type_object_class, yk_symbol_type_hash_table,
+	yk_symbol_type_persistent_map, yk_symbol_type_persistent_vector, yk_symbol_type_typed_array,
+	yk_symbol_type_sequence,
 	yk_class_class = NULL, yk_class_builtin_class = NULL, yk_class_object_class = NULL,
 	yk_class_object, yk_class_number, yk_class_function, yk_class_symbol, yk_class_string,
 	yk_class_stream, yk_class_string_stream, yk_class_file_stream,
@@ -174,6 +459,41 @@ static void yk_allocator_init() {
 	yk_free_space = yk_workspace_size;
 }
 
+static void yk_allocation_sample(YkUint cells, YkUint bytes) {
+	YkObject bytecode = yk_bytecode_register;
+	YkUint offset = 0;
+	yk_allocation_countdown = yk_allocation_sample_interval;
+
+	if (YK_BYTECODEP(bytecode) && yk_program_counter >= YK_PTR(bytecode)->bytecode.code &&
+		yk_program_counter < YK_PTR(bytecode)->bytecode.code + YK_PTR(bytecode)->bytecode.code_size)
+	{
+		offset = yk_program_counter - YK_PTR(bytecode)->bytecode.code;
+	} else {
+		bytecode = YK_NIL;
+	}
+
+	YkUint i = (((YkUint)bytecode >> 6) * 31 + offset) & (YK_ALLOCATION_SITES_SIZE - 1);
+	while (yk_allocation_sites[i].bytecode != bytecode ||
+		   yk_allocation_sites[i].offset != offset)
+	{
+		if (yk_allocation_sites[i].bytecode == NULL) {
+			/* Keep a free entry, so that lookups always end */
+			if (yk_allocation_sites_count == YK_ALLOCATION_SITES_SIZE - 1)
+				return;
+
+			yk_allocation_sites_count++;
+			yk_allocation_sites[i].bytecode = bytecode;
+			yk_allocation_sites[i].offset = offset;
+			break;
+		}
+
+		i = (i + 1) & (YK_ALLOCATION_SITES_SIZE - 1);
+	}
+
+	yk_allocation_sites[i].cells += cells * yk_allocation_sample_interval;
+	yk_allocation_sites[i].bytes += bytes * yk_allocation_sample_interval;
+}
+
 #define YK_GC_STRESS 0
 
 static YkObject yk_alloc() {
@@ -182,6 +502,9 @@ static YkObject yk_alloc() {
 
 	assert(yk_free_space > 0);
 
+	if (yk_allocation_sample_interval != 0 && --yk_allocation_countdown == 0)
+		yk_allocation_sample(1, 0);
+
 	YkObject first = yk_free_list;
 	yk_free_list = first->cons.car;
 	yk_free_space--;
@@ -189,6 +512,39 @@ static YkObject yk_alloc() {
 	return first;
 }
 
+/* Counts a live object the first time the collector reaches it */
+static void yk_census_count(YkObject o) {
+	YkType type = YK_TYPEOF(o);
+	yk_census->current_type = &yk_census->types[type];
+	yk_census->current_type->count++;
+	yk_census->current_class = NULL;
+
+	if (type == yk_t_instance) {
+		YkObject class = YK_PTR(o)->instance.class;
+		YkUint i = 0;
+
+		while (i < yk_census->classes_count && yk_census->classes[i] != class)
+			i++;
+
+		if (i == yk_census->classes_count) {
+			if (yk_census->classes_count == yk_census->classes_capacity) {
+				yk_census->classes_capacity = max(2 * yk_census->classes_capacity, (YkUint)16);
+				yk_census->classes = realloc(yk_census->classes,
+											 yk_census->classes_capacity * sizeof(YkObject));
+				yk_census->class_entries = realloc(yk_census->class_entries,
+												   yk_census->classes_capacity * sizeof(YkCensusEntry));
+			}
+
+			yk_census->classes[i] = class;
+			yk_census->class_entries[i] = (YkCensusEntry){ 0, 0 };
+			yk_census->classes_count++;
+		}
+
+		yk_census->current_class = &yk_census->class_entries[i];
+		yk_census->current_class->count++;
+	}
+}
+
 static void yk_mark(YkObject o) {
 mark:
 	if (YK_FLOATP(o) || YK_INTP(o) ||
@@ -197,6 +553,9 @@ mark:
 		YK_MARKED(o))
 		return;
 
+	if (yk_census != NULL)
+		yk_census_count(o);
+
 	if (YK_CONSP(o)) {
 		yk_mark(YK_CAR(o));
 		YK_CAR(o) = YK_TAG(YK_CAR(o), YK_MARK_BIT);
@@ -209,6 +568,7 @@ mark:
 
 		yk_mark(YK_PTR(o)->symbol.value);
 		yk_mark(YK_PTR(o)->symbol.class_value);
+		yk_mark(YK_PTR(o)->symbol.module);
 		o = YK_PTR(o)->symbol.name;
 		goto mark;
 	}
@@ -230,6 +590,8 @@ mark:
 			yk_mark(bytecode->bytecode.code[i].ptr);
 		}
 
+		yk_mark(bytecode->bytecode.source);
+
 		o = docstring;
 		goto mark;
 	}
@@ -263,6 +625,7 @@ mark:
 	}
 	else if (YK_TYPEOF(o) == yk_t_string) {
 		yk_mark_block_data(YK_PTR(o)->string.data);
+		yk_mark_block_data(YK_PTR(o)->string.index);
 		YK_CAR(o) = YK_TAG(YK_CAR(o), YK_MARK_BIT);
 	}
 	else if (YK_TYPEOF(o) == yk_t_file_stream) {
@@ -286,6 +649,49 @@ mark:
 		for (uint i = 0; i < slots_count; i++) {
 			yk_mark(slots[i]);
 		}
+	} else if (YK_TYPEOF(o) == yk_t_hash_table) {
+		YkHashTable* table = &YK_PTR(o)->hash_table;
+
+		YK_CAR(o) = YK_TAG(YK_CAR(o), YK_MARK_BIT);
+		yk_mark_block_data(table->entries);
+		yk_mark_block_data(table->old_entries);
+
+		for (uint i = 0; i < 2 * table->capacity; i++) {
+			yk_mark(table->entries[i]);
+		}
+
+		if (table->old_entries != NULL) {
+			for (uint i = 0; i < 2 * table->old_capacity; i++) {
+				yk_mark(table->old_entries[i]);
+			}
+		}
+		} else if (YK_TYPEOF(o) == yk_t_typed_array) {
+		YK_CAR(o) = YK_TAG(YK_CAR(o), YK_MARK_BIT);
+		if (!YK_PTR(o)->typed_array.foreign)
+			yk_mark_block_data(YK_PTR(o)->typed_array.data);
+	} else if (YK_TYPEOF(o) == yk_t_sequence) {
+		YK_CAR(o) = YK_TAG(YK_CAR(o), YK_MARK_BIT);
+		yk_mark(YK_PTR(o)->sequence.function);
+		o = YK_PTR(o)->sequence.source;
+		goto mark;
+	} else if (YK_TYPEOF(o) == yk_t_trie_node) {
+		YkTrieNode* node = &YK_PTR(o)->trie_node;
+
+		YK_CAR(o) = YK_TAG(YK_CAR(o), YK_MARK_BIT);
+		yk_mark_block_data(node->slots);
+
+		for (uint i = 0; i < node->size; i++) {
+			yk_mark(node->slots[i]);
+		}
+	} else if (YK_TYPEOF(o) == yk_t_persistent_map) {
+		YK_CAR(o) = YK_TAG(YK_CAR(o), YK_MARK_BIT);
+		o = YK_PTR(o)->persistent_map.root;
+		goto mark;
+	} else if (YK_TYPEOF(o) == yk_t_persistent_vector) {
+		YK_CAR(o) = YK_TAG(YK_CAR(o), YK_MARK_BIT);
+		yk_mark(YK_PTR(o)->persistent_vector.root);
+		o = YK_PTR(o)->persistent_vector.tail;
+		goto mark;
 	}
 	else {
 		assert(0);
@@ -327,6 +733,9 @@ static void yk_permanent_gc_protect(YkObject object) {
 }
 
 static void yk_gc() {
+	yk_flush_method_cache();
+	yk_flush_compiler_caches();
+
 	yk_mark(yk_value_register);
 	yk_mark(yk_bytecode_register);
 
@@ -334,29 +743,48 @@ static void yk_gc() {
 		yk_mark(yk_gc_protected_stack[i]);
 	}
 
-	for (size_t i = 0; i < YK_SYMBOL_TABLE_SIZE; i++)
-		yk_mark(yk_symbol_table[i]);
+	for (size_t i = 0; i < yk_values_count; i++)
+		yk_mark(yk_values_buffer[i]);
+
+	yk_mark(yk_pending_recompiles);
+	yk_mark(yk_compiled_lambdas);
+	yk_mark(yk_expansion_reads);
+	yk_profile_mark();
+	yk_allocation_sites_mark();
+#if YK_INSTRUMENT
+	yk_instrument_mark();
+#endif
+
+	for (size_t i = 0; i < yk_symbol_table_size; i++) {
+		YkSymbolTableEntry* entry = &yk_symbol_table[i];
+		if (YK_SYMBOL_TABLE_LIVE(entry) && !YK_PTR(entry->symbol)->symbol.weak)
+			yk_mark(entry->symbol);
+	}
 
 	printf("GC stack: %ld\n", yk_gc_stack_size);
 	for (size_t i = 0; i < yk_gc_stack_size; i++)
 		yk_mark(*yk_gc_stack[i]);
 
-	for (long i = 0; i < YK_STACK_MAX_SIZE - (yk_lisp_stack_top - yk_lisp_stack); i++)
+	for (long i = 0; i < YK_STACK_BOTTOM(yk_lisp_stack, YkObject) - yk_lisp_stack_top; i++)
 		yk_mark(yk_lisp_stack_top[i]);
 
-	for (long i = 0; i < YK_STACK_MAX_SIZE -
-			 (yk_continuations_stack_top - yk_continuations_stack); i++)
+	for (long i = 0;
+		 i < YK_STACK_BOTTOM(yk_continuations_stack, YkObject) - yk_continuations_stack_top; i++)
 	{
 		yk_mark(yk_continuations_stack_top[i]);
 	}
 
-	for (long i = 0; i < YK_STACK_MAX_SIZE -
-			 (yk_dynamic_bindings_stack_top - yk_dynamic_bindings_stack); i++)
+	for (long i = 0;
+		 i < YK_STACK_BOTTOM(yk_dynamic_bindings_stack, YkDynamicBinding) -
+			 yk_dynamic_bindings_stack_top; i++)
 	{
 		yk_mark(yk_dynamic_bindings_stack_top[i].symbol);
 		yk_mark(yk_dynamic_bindings_stack_top[i].old_value);
 	}
 
+	yk_symbol_table_sweep();
+	yk_finalizable_sweep();
+	yk_inline_dependencies_sweep();
 	yk_array_allocator_sweep();
 	yk_sweep();
 }
@@ -370,54 +798,131 @@ static void yk_gc() {
 static void yk_array_allocator_init() {
 	yk_array_allocator = malloc(YK_ARRAY_ALLOCATOR_SIZE);
 	yk_array_allocator_top = yk_array_allocator;
+	yk_array_allocator_rover = yk_array_allocator;
 }
 
-static void* yk_array_allocator_alloc(YkUint size) {
-	char* block_ptr;
-	bool has_gc = false;
+/* Splits the free `block' to use `size' bytes of it */
+static void* yk_array_allocator_take(YkArrayAllocatorBlock* block, YkUint size) {
+	YkUint original_size = block->size;
+	block->size = size;
+	block->flags = YK_BLOCK_USED_BIT;
 
-start:
-	block_ptr = yk_array_allocator;
-	while (block_ptr < yk_array_allocator_top) {
-		YkArrayAllocatorBlock* block = (YkArrayAllocatorBlock*)block_ptr;
+	YkUint new_block_size = original_size - size;
+	if (new_block_size > sizeof(YkArrayAllocatorBlock)) {
+		YkArrayAllocatorBlock* next_block =
+			(YkArrayAllocatorBlock*)(block->data + size);
 
-		if (!YK_BLOCK_USED(block) && block->size >= size) {
-			YkUint original_size = block->size;
-			block->size = size;
-			block->flags = YK_BLOCK_USED_BIT;
+		next_block->size = new_block_size - sizeof(YkArrayAllocatorBlock);
+		next_block->flags = 0x0;
+	} else {
+		block->size = original_size;
+	}
 
-			YkUint new_block_size = original_size - size;
-			if (new_block_size > sizeof(YkArrayAllocatorBlock)) {
-				YkArrayAllocatorBlock* next_block =
-					(YkArrayAllocatorBlock*)(block_ptr + sizeof(YkArrayAllocatorBlock) + size);
+	yk_array_allocator_rover = block->data + block->size;
+	return block->data;
+}
 
-				next_block->size = new_block_size - sizeof(YkArrayAllocatorBlock);
-				next_block->flags = 0x0;
-			} else {
-				block->size = original_size;
-			}
+/* First fit from `from' to `to' */
+static void* yk_array_allocator_search(char* from, char* to, YkUint size) {
+	for (char* block_ptr = from; block_ptr < to;) {
+		YkArrayAllocatorBlock* block = (YkArrayAllocatorBlock*)block_ptr;
 
-			return block->data;
-		}
+		if (!YK_BLOCK_USED(block) && block->size >= size)
+			return yk_array_allocator_take(block, size);
 
 		block_ptr += block->size + sizeof(YkArrayAllocatorBlock);
 	}
 
-	if ((int64_t)size >=
+	return NULL;
+}
+
+/* Next fit: the search resumes after the last allocated block, so that
+ * runs of small blocks (trie nodes) don't rescan the whole arena. */
+static void* yk_array_allocator_alloc(YkUint size) {
+	void* data;
+	bool has_gc = false;
+
+	size = (size + 7) & ~(YkUint)7;
+
+	if (yk_allocation_sample_interval != 0 && --yk_allocation_countdown == 0)
+		yk_allocation_sample(0, size);
+
+start:
+	data = yk_array_allocator_search(yk_array_allocator_rover, yk_array_allocator_top, size);
+	if (data != NULL)
+		return data;
+
+	if ((int64_t)(size + sizeof(YkArrayAllocatorBlock)) <=
 		(YK_ARRAY_ALLOCATOR_SIZE - (yk_array_allocator_top - yk_array_allocator)))
 	{
-		assert(!has_gc);
-		has_gc = true;
-		yk_gc();
-		goto start;
+		YkArrayAllocatorBlock* block = (YkArrayAllocatorBlock*)yk_array_allocator_top;
+		block->size = size;
+		block->flags = YK_BLOCK_USED_BIT;
+		yk_array_allocator_top += sizeof(YkArrayAllocatorBlock) + size;
+		yk_array_allocator_rover = yk_array_allocator_top;
+
+		return block->data;
 	}
 
-	YkArrayAllocatorBlock* block = (YkArrayAllocatorBlock*)yk_array_allocator_top;
-	block->size = size;
-	block->flags = YK_BLOCK_USED_BIT;
-	yk_array_allocator_top += sizeof(YkArrayAllocatorBlock) + size;
+	data = yk_array_allocator_search(yk_array_allocator, yk_array_allocator_rover, size);
+	if (data != NULL)
+		return data;
 
-	return block->data;
+	assert(!has_gc);
+	has_gc = true;
+	yk_gc();
+	goto start;
+}
+
+/* Grows the block of `data' to `size' bytes without moving it, when it ends
+ * the arena or is followed by a large enough free block */
+static bool yk_array_allocator_grow(void* data, YkUint size) {
+	YkArrayAllocatorBlock* block = (YkArrayAllocatorBlock*)
+		((char*)data - sizeof(YkArrayAllocatorBlock));
+	char* end = block->data + block->size;
+
+	size = (size + 7) & ~(YkUint)7;
+	if (size <= block->size)
+		return true;
+
+	if (end == yk_array_allocator_top) {
+		if ((int64_t)(size - block->size) >
+			(YK_ARRAY_ALLOCATOR_SIZE - (yk_array_allocator_top - yk_array_allocator)))
+			return false;
+
+		yk_array_allocator_top += size - block->size;
+		block->size = size;
+	} else {
+		YkArrayAllocatorBlock* next_block = (YkArrayAllocatorBlock*)end;
+		YkUint available = block->size + sizeof(YkArrayAllocatorBlock) + next_block->size;
+
+		if (YK_BLOCK_USED(next_block) || available < size)
+			return false;
+
+		if (available - size > sizeof(YkArrayAllocatorBlock)) {
+			YkArrayAllocatorBlock* rest = (YkArrayAllocatorBlock*)(block->data + size);
+			rest->size = available - size - sizeof(YkArrayAllocatorBlock);
+			rest->flags = 0x0;
+			block->size = size;
+		} else {
+			block->size = available;
+		}
+	}
+
+	/* The rover may not point inside of the block anymore */
+	if (yk_array_allocator_rover >= end && yk_array_allocator_rover < block->data + block->size)
+		yk_array_allocator_rover = block->data + block->size;
+
+	return true;
+}
+
+/* Hands the block of `data' back before the next collection, for buffers
+ * nothing else points to */
+static void yk_array_allocator_release(void* data) {
+	YkArrayAllocatorBlock* block = (YkArrayAllocatorBlock*)
+		((char*)data - sizeof(YkArrayAllocatorBlock));
+
+	block->flags &= ~YK_BLOCK_USED_BIT;
 }
 
 static void yk_mark_block_data(void* data) {
@@ -425,6 +930,12 @@ static void yk_mark_block_data(void* data) {
 		YkArrayAllocatorBlock* block = (YkArrayAllocatorBlock*)
 			((char*)data - sizeof(YkArrayAllocatorBlock));
 
+		if (yk_census != NULL && yk_census->current_type != NULL && !YK_BLOCK_MARKED(block)) {
+			yk_census->current_type->bytes += block->size;
+			if (yk_census->current_class != NULL)
+				yk_census->current_class->bytes += block->size;
+		}
+
 		block->flags |= YK_BLOCK_MARKED_BIT;
 	}
 }
@@ -469,14 +980,88 @@ static void yk_array_allocator_sweep() {
 		block_ptr += block->size + sizeof(YkArrayAllocatorBlock);
 	}
 
+	yk_array_allocator_rover = yk_array_allocator;
 	printf("Freed %d blocks of memory!\n", freed);
 }
 
 static void yk_symbol_table_init() {
-	yk_symbol_table = malloc(sizeof(YkObject) * YK_SYMBOL_TABLE_SIZE);
+	yk_symbol_table_size = YK_SYMBOL_TABLE_MIN_SIZE;
+	yk_symbol_table_count = 0;
+	yk_symbol_table_used = 0;
+	yk_symbol_table = malloc(yk_symbol_table_size * sizeof(YkSymbolTableEntry));
+	memset(yk_symbol_table, 0, yk_symbol_table_size * sizeof(YkSymbolTableEntry));
+}
+
+/* FNV-1a */
+static uint64_t yk_hash_bytes(const char* data, YkUint size) {
+	uint64_t hash = 0xcbf29ce484222325;
+
+	for (YkUint i = 0; i < size; i++) {
+		hash ^= (uchar)data[i];
+		hash *= 0x100000001b3;
+	}
+
+	return hash;
+}
+
+/* Returns the entry of the symbol called `name', or the free entry where it
+ * should be inserted. */
+static YkSymbolTableEntry* yk_symbol_table_find(const char* name, uint32_t length, uint32_t hash) {
+	YkUint mask = yk_symbol_table_size - 1;
+	YkSymbolTableEntry* free_entry = NULL;
+
+	for (YkUint i = hash & mask;; i = (i + 1) & mask) {
+		YkSymbolTableEntry* entry = &yk_symbol_table[i];
+
+		if (entry->symbol == NULL) {
+			return free_entry != NULL ? free_entry : entry;
+		} else if (entry->symbol == YK_SYMBOL_TABLE_TOMBSTONE) {
+			if (free_entry == NULL)
+				free_entry = entry;
+		} else if (entry->hash == hash && entry->length == length &&
+				   memcmp(yk_string_to_c_str(YK_PTR(entry->symbol)->symbol.name),
+						  name, length) == 0)
+		{
+			return entry;
+		}
+	}
+}
+
+static void yk_symbol_table_resize(YkUint new_size) {
+	YkSymbolTableEntry* old_table = yk_symbol_table;
+	YkUint old_size = yk_symbol_table_size;
+
+	yk_symbol_table = malloc(new_size * sizeof(YkSymbolTableEntry));
+	memset(yk_symbol_table, 0, new_size * sizeof(YkSymbolTableEntry));
+	yk_symbol_table_size = new_size;
+	yk_symbol_table_used = yk_symbol_table_count;
+
+	for (YkUint i = 0; i < old_size; i++) {
+		if (!YK_SYMBOL_TABLE_LIVE(&old_table[i]))
+			continue;
+
+		YkUint j = old_table[i].hash & (new_size - 1);
+		while (yk_symbol_table[j].symbol != NULL) {
+			j = (j + 1) & (new_size - 1);
+		}
+
+		yk_symbol_table[j] = old_table[i];
+	}
+
+	free(old_table);
+}
+
+/* Drops the weak symbols that were not marked */
+static void yk_symbol_table_sweep() {
+	for (YkUint i = 0; i < yk_symbol_table_size; i++) {
+		YkSymbolTableEntry* entry = &yk_symbol_table[i];
 
-	for (uint i = 0; i < YK_SYMBOL_TABLE_SIZE; i++) {
-		yk_symbol_table[i] = NULL;
+		if (YK_SYMBOL_TABLE_LIVE(entry) && YK_PTR(entry->symbol)->symbol.weak &&
+			!YK_MARKED(entry->symbol))
+		{
+			entry->symbol = YK_SYMBOL_TABLE_TOMBSTONE;
+			yk_symbol_table_count--;
+		}
 	}
 }
 
@@ -532,11 +1117,34 @@ char* yk_string_to_c_str(YkObject string) {
 #define YK_CLASS_SIZE(x)        (x->instance.slots[2])
 #define YK_OBJECT_METHODS(x)    (x->instance.slots[3])
 #define YK_OBJECT_SUBCLASSES(x) (x->instance.slots[4])
+#define YK_OBJECT_METHOD_TABLE(x) (x->instance.slots[5])
 
 #define YK_CLASS_INVALIDATE(x)	do { YK_CLASS_SIZE(x) = YK_MAKE_INT(-1); } while (0)
 #define YK_CLASS_INVALID(x)		(YK_CLASS_SIZE(x) == YK_MAKE_INT(-1))
 
+/* Global (class, selector) -> method cache, in front of the per-class
+ * method tables. It holds no references: it is flushed on every GC, and
+ * whenever a method is defined or a class invalidated. */
+#define YK_METHOD_CACHE_SIZE 256
+#define YK_METHOD_CACHE_INDEX(class, selector)							\
+	((((uintptr_t)(class) >> 4) ^ ((uintptr_t)(selector) >> 3)) & (YK_METHOD_CACHE_SIZE - 1))
+
+typedef struct {
+	YkObject class;
+	YkObject selector;
+	YkObject method;
+} YkMethodCacheEntry;
+
+static YkMethodCacheEntry yk_method_cache[YK_METHOD_CACHE_SIZE];
+
+static void yk_flush_method_cache() {
+	memset(yk_method_cache, 0, sizeof(yk_method_cache));
+}
+
 static inline YkObject yk_find_class(YkObject symbol) {
+	if (yk_expansion_reads != yk_tee)
+		yk_record_read(symbol);
+
 	YkObject value = YK_PTR(symbol)->symbol.class_value;
 	YK_ASSERT(value != NULL);
 
@@ -588,6 +1196,7 @@ static void yk_invalidate_class(YkObject class) {
 	}
 
 	YK_CLASS_INVALIDATE(class);
+	yk_flush_method_cache();
 }
 
 static YkObject yk_make_class(YkObject metaclass, YkObject name, YkObject parent, YkUint size) {
@@ -595,8 +1204,9 @@ static YkObject yk_make_class(YkObject metaclass, YkObject name, YkObject parent
 	new_class->instance.slots[0] = name;
 	new_class->instance.slots[1] = parent;
 
-	if (metaclass == yk_class_object_class && parent != yk_class_object) {
-		new_class->instance.slots[2] = YK_MAKE_INT(size + 1);
+	/* Instances are flat: the parent's slots come first, then ours. */
+	if (metaclass == yk_class_object_class) {
+		new_class->instance.slots[2] = YK_MAKE_INT(YK_INT(YK_CLASS_SIZE(parent)) + size);
 	} else {
 		new_class->instance.slots[2] = YK_MAKE_INT(size);
 	}
@@ -615,6 +1225,15 @@ static YkObject yk_make_class(YkObject metaclass, YkObject name, YkObject parent
 	return new_class;
 }
 
+/* Streams are only used from the VM thread, the stdio locks can be skipped */
+#ifdef _WIN32
+#define YK_GETC(file) _getc_nolock(file)
+#define YK_PUTC(c, file) _putc_nolock(c, file)
+#else
+#define YK_GETC(file) getc_unlocked(file)
+#define YK_PUTC(c, file) putc_unlocked(c, file)
+#endif
+
 static YkObject yk_make_file_stream(YkObject path, YkObject mode, FILE* optional_fptr) {
 	YK_GC_PROTECT2(path, mode);
 
@@ -647,6 +1266,7 @@ static YkObject yk_make_file_stream(YkObject path, YkObject mode, FILE* optional
 	if (optional_fptr == NULL) {
 		FILE* file = fopen(yk_string_to_c_str(path), s_mode);
 		YK_ASSERT(file != NULL);
+		setvbuf(file, NULL, _IOFBF, YK_FILE_STREAM_BUFFER_SIZE);
 		stream->file_stream.file_ptr = file;
 	} else {
 		stream->file_stream.file_ptr = optional_fptr;
@@ -690,100 +1310,216 @@ YkObject yk_make_output_string_stream() {
 	return stream;
 }
 
-static void yk_stream_write_byte(YkObject stream, YkInt byte) {
-	YK_GC_PROTECT1(stream);
-	YK_ASSERT(stream->t.t == yk_t_file_stream);
-	YK_ASSERT(stream->file_stream.flags & YK_STREAM_WRITE_BIT &&
-			  stream->file_stream.flags & YK_STREAM_BINARY_BIT);
-	YK_ASSERT(!(stream->file_stream.flags & YK_STREAM_FINISHED_BIT));
-	YK_ASSERT(byte >= 0 && byte <= 255);
+/* Room for `size' more bytes and the final NUL at the end of a string
+ * output stream. The capacity at least doubles, and the buffer is extended
+ * in place when the arena allows it. */
+static char* yk_string_stream_reserve(YkObject stream, YkUint size) {
+	YkStringStream* ss = &stream->string_stream;
+	YkUint needed = ss->size + size + 1;
 
-	if (putc(byte, stream->file_stream.file_ptr) == EOF)
-		YK_ASSERT(0);
+	if (needed > ss->capacity) {
+		YkUint capacity = needed > 2 * ss->capacity ? needed : 2 * ss->capacity;
 
-	YK_GC_UNPROTECT;
-}
+		if (!yk_array_allocator_grow(ss->buffer, capacity)) {
+			YK_GC_PROTECT1(stream);
+			char* new_buffer = yk_array_allocator_alloc(capacity);
+			YK_GC_UNPROTECT;
 
-static YkInt yk_stream_read_byte(YkObject stream) {
-	YK_ASSERT(stream->t.t == yk_t_file_stream);
-	YK_ASSERT(!(stream->file_stream.flags & YK_STREAM_FINISHED_BIT));
-	YK_ASSERT(stream->file_stream.flags & YK_STREAM_READ_BIT &&
-			  stream->file_stream.flags & YK_STREAM_BINARY_BIT);
+			memcpy(new_buffer, ss->buffer, ss->size);
 
-	int c = getc(stream->file_stream.file_ptr);
-	if (c < 0)
-		return -1;
+			if (!(ss->flags & YK_STREAM_SHARED_BIT))
+				yk_array_allocator_release(ss->buffer);
 
-	return c;
+			ss->flags &= ~YK_STREAM_SHARED_BIT;
+			ss->buffer = new_buffer;
+		}
+
+		ss->capacity = capacity;
+	}
+
+	return ss->buffer + ss->size;
 }
 
-static void yk_stream_write_char(YkObject stream, YkInt byte) {
+static inline void yk_string_stream_commit(YkObject stream, YkUint size) {
+	stream->string_stream.size += size;
+	stream->string_stream.buffer[stream->string_stream.size] = '\0';
+}
+
+/* Writes `size' bytes of text */
+static void yk_stream_write(YkObject stream, const char* data, size_t size) {
 	if (stream->t.t == yk_t_file_stream) {
 		YK_ASSERT(!(stream->file_stream.flags & YK_STREAM_FINISHED_BIT));
-		YK_ASSERT(stream->file_stream.flags & YK_STREAM_WRITE_BIT &&
-				  !(stream->file_stream.flags & YK_STREAM_BINARY_BIT));
-
-		char string[5] = { 0, 0, 0, 0, 0 };
-		u_codepoint_to_string(string, byte);
+		YK_ASSERT(!(stream->file_stream.flags & YK_STREAM_BINARY_BIT));
+		YK_ASSERT(stream->file_stream.flags & YK_STREAM_WRITE_BIT);
 
-		char* c = string;
-		do {
-			if (putc(*c, stream->file_stream.file_ptr) == EOF)
-				YK_ASSERT(0);
-		} while (*++c != '\0');
-	} else if (stream->t.t == yk_t_string_stream) {
+		if (fwrite(data, 1, size, stream->file_stream.file_ptr) != size)
+			YK_ASSERT(0);
+	} else {
+		YK_ASSERT(stream->t.t == yk_t_string_stream);
 		YK_ASSERT(!(stream->string_stream.flags & YK_STREAM_FINISHED_BIT));
-		YK_ASSERT(stream->string_stream.flags & YK_STREAM_WRITE_BIT &&
-				  !(stream->string_stream.flags & YK_STREAM_BINARY_BIT));
+		YK_ASSERT(stream->string_stream.flags & YK_STREAM_WRITE_BIT);
 
-		char string[5] = { 0, 0, 0, 0, 0 };
-		u_codepoint_to_string(string, byte);
+		memcpy(yk_string_stream_reserve(stream, size), data, size);
+		yk_string_stream_commit(stream, size);
+	}
+}
 
-		size_t s_size = strlen(string),
-			old_size = stream->string_stream.size;
+#define YK_STREAM_WRITE_LITERAL(stream, literal) \
+	yk_stream_write(stream, literal, sizeof(literal) - 1)
 
-		stream->string_stream.size += s_size;
+/* Decimal digits of `x', written backwards from `end' */
+static char* yk_format_int(char* end, long x) {
+	unsigned long digits = x < 0 ? -(unsigned long)x : (unsigned long)x;
 
-		if (stream->string_stream.size >= stream->string_stream.capacity) {
-			stream->string_stream.capacity = stream->string_stream.size * 2;
+	do {
+		*--end = '0' + digits % 10;
+		digits /= 10;
+	} while (digits != 0);
 
-			char* new_buffer = yk_array_allocator_alloc(stream->string_stream.capacity);
-			memcpy(new_buffer, stream->string_stream.buffer, old_size);
-			stream->string_stream.buffer = new_buffer;
-		}
+	if (x < 0)
+		*--end = '-';
 
-		memcpy(stream->string_stream.buffer + old_size, string, s_size);
-		stream->string_stream.buffer[old_size + s_size] = 0;
-	}
+	return end;
 }
 
-static YkInt yk_stream_read_char(YkObject stream) {
-	if (stream->t.t == yk_t_file_stream) {
-		YK_ASSERT(!(stream->file_stream.flags & YK_STREAM_FINISHED_BIT));
-		YK_ASSERT(stream->file_stream.flags & YK_STREAM_READ_BIT &&
-				  !(stream->file_stream.flags & YK_STREAM_BINARY_BIT));
+/* Same digits as "%f", written backwards from `end'. A float has 24
+ * significant bits, so its product by 10^6 is exact as a double and
+ * rounding it to the nearest integer rounds like printf. */
+static char* yk_format_float(char* end, float x) {
+	double scaled = fabs((double)x) * 1e6;
 
-		int c = getc(stream->file_stream.file_ptr);
-		if (c < 0)
-			return -1;
+	if (!(scaled < 1e18)) {
+		char buffer[64];
+		int size = snprintf(buffer, sizeof(buffer), "%f", x);
+		if (size < 0 || size >= (int)sizeof(buffer))
+			size = snprintf(buffer, sizeof(buffer), "%g", x);
+
+		end -= size;
+		memcpy(end, buffer, size);
+		return end;
+	}
+
+	uint64_t units = (uint64_t)nearbyint(scaled);
+
+	for (uint i = 0; i < 6; i++) {
+		*--end = '0' + units % 10;
+		units /= 10;
+	}
+
+	*--end = '.';
+
+	do {
+		*--end = '0' + units % 10;
+		units /= 10;
+	} while (units != 0);
+
+	if (signbit(x))
+		*--end = '-';
+
+	return end;
+}
+
+#define YK_FORMAT_BUFFER_SIZE 64
+
+static void yk_stream_write_int(YkObject stream, long x) {
+	char buffer[YK_FORMAT_BUFFER_SIZE];
+	char* end = buffer + sizeof(buffer);
+	char* begin = yk_format_int(end, x);
+
+	yk_stream_write(stream, begin, end - begin);
+}
+
+static void yk_stream_write_float(YkObject stream, float x) {
+	char buffer[YK_FORMAT_BUFFER_SIZE];
+	char* end = buffer + sizeof(buffer);
+	char* begin = yk_format_float(end, x);
+
+	yk_stream_write(stream, begin, end - begin);
+}
+
+static void yk_stream_write_byte(YkObject stream, YkInt byte) {
+	YK_GC_PROTECT1(stream);
+	YK_ASSERT(stream->t.t == yk_t_file_stream);
+	YK_ASSERT(stream->file_stream.flags & YK_STREAM_WRITE_BIT &&
+			  stream->file_stream.flags & YK_STREAM_BINARY_BIT);
+	YK_ASSERT(!(stream->file_stream.flags & YK_STREAM_FINISHED_BIT));
+	YK_ASSERT(byte >= 0 && byte <= 255);
+
+	if (YK_PUTC(byte, stream->file_stream.file_ptr) == EOF)
+		YK_ASSERT(0);
+
+	YK_GC_UNPROTECT;
+}
+
+static YkInt yk_stream_read_byte(YkObject stream) {
+	YK_ASSERT(stream->t.t == yk_t_file_stream);
+	YK_ASSERT(!(stream->file_stream.flags & YK_STREAM_FINISHED_BIT));
+	YK_ASSERT(stream->file_stream.flags & YK_STREAM_READ_BIT &&
+			  stream->file_stream.flags & YK_STREAM_BINARY_BIT);
+
+	int c = YK_GETC(stream->file_stream.file_ptr);
+	if (c < 0)
+		return -1;
+
+	return c;
+}
+
+static void yk_stream_write_char(YkObject stream, YkInt byte) {
+	char string[5] = { byte, 0, 0, 0, 0 };
+	size_t s_size = 1;
+
+	if (byte > 0x7f) {
+		u_codepoint_to_string(string, byte);
+		s_size = strlen(string);
+	}
+
+	if (stream->t.t == yk_t_file_stream) {
+		YK_ASSERT(!(stream->file_stream.flags & YK_STREAM_FINISHED_BIT));
+		YK_ASSERT(stream->file_stream.flags & YK_STREAM_WRITE_BIT &&
+				  !(stream->file_stream.flags & YK_STREAM_BINARY_BIT));
+
+		FILE* file = stream->file_stream.file_ptr;
+
+		if (s_size == 1) {
+			if (YK_PUTC(byte, file) == EOF)
+				YK_ASSERT(0);
+		} else if (fwrite(string, 1, s_size, file) != s_size) {
+			YK_ASSERT(0);
+		}
+	} else if (stream->t.t == yk_t_string_stream) {
+		YK_ASSERT(!(stream->string_stream.flags & YK_STREAM_FINISHED_BIT));
+		YK_ASSERT(stream->string_stream.flags & YK_STREAM_WRITE_BIT &&
+				  !(stream->string_stream.flags & YK_STREAM_BINARY_BIT));
+
+		memcpy(yk_string_stream_reserve(stream, s_size), string, s_size);
+		yk_string_stream_commit(stream, s_size);
+	}
+}
+
+static YkInt yk_stream_read_char(YkObject stream) {
+	if (stream->t.t == yk_t_file_stream) {
+		YK_ASSERT(!(stream->file_stream.flags & YK_STREAM_FINISHED_BIT));
+		YK_ASSERT(stream->file_stream.flags & YK_STREAM_READ_BIT &&
+				  !(stream->file_stream.flags & YK_STREAM_BINARY_BIT));
+
+		FILE* file = stream->file_stream.file_ptr;
+		int c = YK_GETC(file);
+		if (c <= 0x7f)
+			return c < 0 ? -1 : c;
 
 		uint8_t byte = (uint8_t)c;
-		uint8_t utf8_string[4];
-
-		if (byte <= 0x7f) {
-			utf8_string[0] = byte;
-		} else if (byte >> 3 == 0x1e) {
-			utf8_string[0] = byte;
-			utf8_string[1] = (uint8_t)getc(stream->file_stream.file_ptr);
-			utf8_string[2] = (uint8_t)getc(stream->file_stream.file_ptr);
-			utf8_string[3] = (uint8_t)getc(stream->file_stream.file_ptr);
-		} else if (byte >> 4 == 0xe) {
-			utf8_string[0] = byte;
-			utf8_string[1] = (uint8_t)getc(stream->file_stream.file_ptr);
-			utf8_string[2] = (uint8_t)getc(stream->file_stream.file_ptr);
-		} else if (byte >> 5 == 6) {
-			utf8_string[0] = byte;
-			utf8_string[1] = (uint8_t)getc(stream->file_stream.file_ptr);
+		uint8_t utf8_string[4] = { byte, 0, 0, 0 };
+		uint continuation_count = 0;
+
+		if (byte >> 3 == 0x1e)
+			continuation_count = 3;
+		else if (byte >> 4 == 0xe)
+			continuation_count = 2;
+		else if (byte >> 5 == 6)
+			continuation_count = 1;
+
+		for (uint i = 1; i <= continuation_count; i++) {
+			utf8_string[i] = (uint8_t)YK_GETC(file);
 		}
 
 		return u_string_to_codepoint(utf8_string);
@@ -817,27 +1553,23 @@ static void yk_stream_format(YkObject stream, const char* format, ...) {
 		YK_ASSERT(!(stream->string_stream.flags & YK_STREAM_BINARY_BIT));
 		YK_ASSERT(stream->string_stream.flags & YK_STREAM_WRITE_BIT);
 
-		size_t size, old_size = stream->string_stream.size;
+		/* Formatted straight into the buffer, again only if it was too short */
+		YkUint room = YK_FORMAT_BUFFER_SIZE;
+		char* buffer = yk_string_stream_reserve(stream, room);
 
 		va_start(arguments, format);
-		size = vsnprintf(NULL, 0, format, arguments);
+		YkUint size = vsnprintf(buffer, room + 1, format, arguments);
 		va_end(arguments);
 
-		stream->string_stream.size += size;
-
-		if (stream->string_stream.size >= stream->string_stream.capacity) {
-			stream->string_stream.capacity = stream->string_stream.size * 2;
+		if (size > room) {
+			buffer = yk_string_stream_reserve(stream, size);
 
-			char* new_buffer = yk_array_allocator_alloc(stream->string_stream.capacity);
-			memcpy(new_buffer, stream->string_stream.buffer, old_size);
-			stream->string_stream.buffer = new_buffer;
+			va_start(arguments, format);
+			vsnprintf(buffer, size + 1, format, arguments);
+			va_end(arguments);
 		}
 
-		va_start(arguments, format);
-		vsprintf(stream->string_stream.buffer + old_size, format, arguments);
-		va_end(arguments);
-
-		stream->string_stream.buffer[old_size + size] = 0;
+		yk_string_stream_commit(stream, size);
 	}
 }
 
@@ -865,6 +1597,9 @@ YkObject yk_stream_string(YkObject stream) {
 	string->string.t = yk_t_string;
 	string->string.size = stream->string_stream.size;
 	string->string.data = stream->string_stream.buffer;
+	string->string.length = YK_STRING_LENGTH_UNKNOWN;
+	string->string.index = NULL;
+	stream->string_stream.flags |= YK_STREAM_SHARED_BIT;
 
 	return string;
 }
@@ -914,7 +1649,7 @@ static YkObject yk_builtin_nsup(YkUint nargs) {
 
 	if (YK_INTP(yk_lisp_stack_top[0])) {
 		if (YK_INTP(yk_lisp_stack_top[1])) {
-			return yk_lisp_stack_top[0] > yk_lisp_stack_top[1] ? yk_tee : YK_NIL;
+			return (YkInt)yk_lisp_stack_top[0] > (YkInt)yk_lisp_stack_top[1] ? yk_tee : YK_NIL;
 		} else {
 			return yk_fixnum_to_float(yk_lisp_stack_top[0]) >
 				YK_FLOAT(yk_lisp_stack_top[1]) ? yk_tee : YK_NIL;
@@ -936,7 +1671,7 @@ static YkObject yk_builtin_ninf(YkUint nargs) {
 
 	if (YK_INTP(yk_lisp_stack_top[0])) {
 		if (YK_INTP(yk_lisp_stack_top[1])) {
-			return yk_lisp_stack_top[0] < yk_lisp_stack_top[1] ? yk_tee : YK_NIL;
+			return (YkInt)yk_lisp_stack_top[0] < (YkInt)yk_lisp_stack_top[1] ? yk_tee : YK_NIL;
 		} else {
 			return yk_fixnum_to_float(yk_lisp_stack_top[0]) <
 				YK_FLOAT(yk_lisp_stack_top[1]) ? yk_tee : YK_NIL;
@@ -958,7 +1693,7 @@ static YkObject yk_builtin_nsupeq(YkUint nargs) {
 
 	if (YK_INTP(yk_lisp_stack_top[0])) {
 		if (YK_INTP(yk_lisp_stack_top[1])) {
-			return yk_lisp_stack_top[0] >= yk_lisp_stack_top[1] ? yk_tee : YK_NIL;
+			return (YkInt)yk_lisp_stack_top[0] >= (YkInt)yk_lisp_stack_top[1] ? yk_tee : YK_NIL;
 		} else {
 			return yk_fixnum_to_float(yk_lisp_stack_top[0]) >=
 				YK_FLOAT(yk_lisp_stack_top[1]) ? yk_tee : YK_NIL;
@@ -980,7 +1715,7 @@ static YkObject yk_builtin_ninfeq(YkUint nargs) {
 
 	if (YK_INTP(yk_lisp_stack_top[0])) {
 		if (YK_INTP(yk_lisp_stack_top[1])) {
-			return yk_lisp_stack_top[0] <= yk_lisp_stack_top[1] ? yk_tee : YK_NIL;
+			return (YkInt)yk_lisp_stack_top[0] <= (YkInt)yk_lisp_stack_top[1] ? yk_tee : YK_NIL;
 		} else {
 			return yk_fixnum_to_float(yk_lisp_stack_top[0]) <=
 				YK_FLOAT(yk_lisp_stack_top[1]) ? yk_tee : YK_NIL;
@@ -1255,6 +1990,119 @@ static YkObject yk_builtin_nreverse(YkUint nargs) {
 	return yk_nreverse(yk_lisp_stack_top[0]);
 }
 
+/* List of `n' NILs before `tail'. Its cells are taken off the free list
+ * in runs, rather than through one yk_alloc per cons. */
+static YkObject yk_make_list(YkUint n, YkObject tail) {
+	YkObject list = tail;
+	YK_GC_PROTECT1(list);
+
+	while (n > 0) {
+		/* yk_alloc keeps 20 cells in reserve */
+		YkUint run = yk_free_space > 20 ? yk_free_space - 20 : 0;
+		if (run == 0) {
+			list = yk_cons(YK_NIL, list);
+			n--;
+			continue;
+		}
+
+		if (run > n)
+			run = n;
+
+		for (YkUint i = 0; i < run; i++) {
+			YkObject cell = yk_free_list;
+			yk_free_list = cell->cons.car;
+
+			cell->cons.car = YK_NIL;
+			cell->cons.cdr = list;
+			list = YK_TAG_LIST(cell);
+		}
+
+		yk_free_space -= run;
+		n -= run;
+	}
+
+	YK_GC_UNPROTECT;
+	return list;
+}
+
+/* The list functions below call their argument in order with yk_apply_n,
+ * which pushes the arguments without consing a list of them. */
+static YkObject yk_builtin_map(YkUint nargs) {
+	YkObject function = yk_lisp_stack_top[0],
+		list = yk_lisp_stack_top[1],
+		result = YK_NIL;
+	YK_ASSERT(YK_LISTP(list));
+	YK_GC_PROTECT3(function, list, result);
+
+	result = yk_make_list(yk_length(list), YK_NIL);
+
+	for (YkObject r = result, l = list; YK_CONSP(l) && YK_CONSP(r); l = YK_CDR(l), r = YK_CDR(r)) {
+		YkObject element = YK_CAR(l);
+		YK_CAR(r) = yk_apply_n(function, 1, &element);
+	}
+
+	YK_GC_UNPROTECT;
+	return result;
+}
+
+static YkObject yk_builtin_enumerate(YkUint nargs) {
+	YkObject function = yk_lisp_stack_top[0],
+		list = yk_lisp_stack_top[1],
+		result = YK_NIL;
+	YK_ASSERT(YK_LISTP(list));
+	YK_GC_PROTECT3(function, list, result);
+
+	result = yk_make_list(yk_length(list), YK_NIL);
+
+	YkInt i = 0;
+	for (YkObject r = result, l = list; YK_CONSP(l) && YK_CONSP(r); l = YK_CDR(l), r = YK_CDR(r)) {
+		YkObject args[2] = { YK_MAKE_INT(i++), YK_CAR(l) };
+		YK_CAR(r) = yk_apply_n(function, 2, args);
+	}
+
+	YK_GC_UNPROTECT;
+	return result;
+}
+
+static YkObject yk_builtin_filter(YkUint nargs) {
+	YkObject function = yk_lisp_stack_top[0],
+		list = yk_lisp_stack_top[1],
+		result = YK_NIL, last = YK_NIL;
+	YK_ASSERT(YK_LISTP(list));
+	YK_GC_PROTECT4(function, list, result, last);
+
+	for (YkObject l = list; YK_CONSP(l); l = YK_CDR(l)) {
+		YkObject element = YK_CAR(l);
+		if (yk_apply_n(function, 1, &element) == YK_NIL)
+			continue;
+
+		YkObject cell = yk_cons(YK_CAR(l), YK_NIL);
+		if (last == YK_NIL)
+			result = cell;
+		else
+			YK_CDR(last) = cell;
+
+		last = cell;
+	}
+
+	YK_GC_UNPROTECT;
+	return result;
+}
+
+static YkObject yk_builtin_range(YkUint nargs) {
+	YkObject max = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_INTP(max) && (YkInt)yk_signed_fixnum_to_long(YK_INT(max)) >= 0);
+
+	YkObject list = yk_make_list(YK_INT(max) + 1, YK_NIL);
+
+	YkInt i = 0;
+	YK_LIST_FOREACH(list, l) {
+		YK_CAR(l) = YK_MAKE_INT(i++);
+	}
+
+	return list;
+}
+
 static YkObject yk_builtin_intp(YkUint nargs) {
 	return YK_INTP(yk_lisp_stack_top[0]) ? yk_tee : YK_NIL;
 }
@@ -1311,13 +2159,17 @@ static YkObject yk_builtin_disassemble(YkUint nargs) {
 static YkObject yk_builtin_gensym(YkUint nargs) {
 	char symbol_string[9];
 	symbol_string[0] = '%';
-
-	for (uint i = 1; i < 8; i++)
-		symbol_string[i] = 'A' + (random_randint() % ('Z' - 'A'));
-
 	symbol_string[8] = '\0';
 
-	return yk_make_symbol_cstr(symbol_string);
+	/* Gensyms are weak: they are forgotten by the symbol table once
+	 * unreachable, but a fresh one never aliases a live symbol. */
+	do {
+		for (uint i = 1; i < 8; i++)
+			symbol_string[i] = 'A' + (random_randint() % ('Z' - 'A'));
+	} while (YK_SYMBOL_TABLE_LIVE(yk_symbol_table_find(symbol_string, 8,
+													   yk_hash_bytes(symbol_string, 8))));
+
+	return yk_intern(yk_make_string(symbol_string, 8), true);
 }
 
 static YkObject yk_builtin_clock(YkUint nargs) {
@@ -1344,8 +2196,15 @@ static YkObject yk_builtin_set_global(YkUint nargs) {
 	if (YK_PTR(symbol)->symbol.value != NULL)
 		YK_ASSERT(YK_PTR(symbol)->symbol.type != yk_s_constant);
 
+	/* Reevaluating an unchanged definition gives back the same bytecode */
+	if (YK_PTR(symbol)->symbol.value == value)
+		return value;
+
 	YK_PTR(symbol)->symbol.value = value;
 
+	if (YK_PTR(symbol)->symbol.inlined)
+		yk_invalidate_inlined(symbol);
+
 	return value;
 }
 
@@ -1355,9 +2214,13 @@ static YkObject yk_builtin_set_macro(YkUint nargs) {
 
 	YK_ASSERT(YK_SYMBOLP(symbol) && symbol != YK_NIL);
 
+	bool changed = YK_PTR(symbol)->symbol.value != value;
 	YK_PTR(symbol)->symbol.type = yk_s_macro;
 	YK_PTR(symbol)->symbol.value = value;
 
+	if (changed && YK_PTR(symbol)->symbol.inlined)
+		yk_invalidate_inlined(symbol);
+
 	return symbol;
 }
 
@@ -1383,6 +2246,9 @@ static YkObject yk_builtin_register_function(YkUint nargs) {
 
 
 static YkObject yk_builtin_length(YkUint nargs) {
+	if (YK_TYPEOF(yk_lisp_stack_top[0]) == yk_t_string)
+		return YK_MAKE_INT(yk_string_length(yk_lisp_stack_top[0]));
+
 	YK_ASSERT(YK_LISTP(yk_lisp_stack_top[0]));
 
 	return YK_MAKE_INT(yk_length(yk_lisp_stack_top[0]));
@@ -1474,1673 +2340,5378 @@ static YkObject yk_builtin_array_to_list(YkUint nargs) {
 	return list;
 }
 
-static YkObject yk_string_ref(YkObject string, YkInt i) {
-	uchar* string_ptr = (uchar*)YK_PTR(string)->string.data;
-	YK_ASSERT(*string_ptr != '\0');
-
-	while (--i >= 0) {
-		if (*string_ptr <= 0x7f) {
-			string_ptr++;
-		} else if (*string_ptr >> 6 == 2) {
-			YK_ASSERT("error in encoding" == 0);
-		} else if (*string_ptr >> 3 == 0x1e) {
-			string_ptr += 4;
-		} else if (*string_ptr >> 4 == 0xe) {
-			string_ptr += 3;
-		} else if (*string_ptr >> 5 == 6) {
-			string_ptr += 2;
-		}
-
-		YK_ASSERT(*string_ptr != '\0');
-	}
+/* Typed arrays */
+static const uint yk_element_sizes[] = {
+	[YK_ELEMENT_U8] = sizeof(uint8_t),
+	[YK_ELEMENT_I32] = sizeof(int32_t),
+	[YK_ELEMENT_F32] = sizeof(float),
+	[YK_ELEMENT_F64] = sizeof(double),
+};
 
-	return YK_MAKE_INT(u_string_to_codepoint(string_ptr));
-}
+static const char* yk_element_names[] = {
+	[YK_ELEMENT_U8] = "u8",
+	[YK_ELEMENT_I32] = "i32",
+	[YK_ELEMENT_F32] = "f32",
+	[YK_ELEMENT_F64] = "f64",
+};
 
-static YkObject yk_builtin_aref(YkUint nargs) {
-	YkObject array = yk_lisp_stack_top[0];
-	YkInt index = YK_INT(yk_lisp_stack_top[1]);
+#define YK_ELEMENT_FLOATP(type) ((type) == YK_ELEMENT_F32 || (type) == YK_ELEMENT_F64)
 
-	if (YK_TYPEOF(array) == yk_t_array) {
-		YK_ASSERT(index < (YkInt)YK_PTR(array)->array.size && index >= 0);
+static YkElementType yk_element_type_from_symbol(YkObject symbol) {
+	YK_ASSERT(YK_SYMBOLP(symbol));
 
-		return YK_PTR(array)->array.data[index];
-	} else if (YK_TYPEOF(array) == yk_t_string) {
-		return yk_string_ref(array, index);
-	} else {
-		YK_ASSERT(0);
+	for (uint i = 0; i < sizeof(yk_element_names) / sizeof(yk_element_names[0]); i++) {
+		if (symbol == yk_make_symbol_cstr(yk_element_names[i]))
+			return i;
 	}
 
-	return YK_NIL;
+	YK_ASSERT("unknown element type" == 0);
+	return YK_ELEMENT_U8;
 }
 
-static YkObject yk_builtin_mod(YkUint nargs) {
-	YK_ASSERT(YK_INTP(yk_lisp_stack_top[0]) && YK_INTP(yk_lisp_stack_top[1]));
-	YkInt a = YK_INT(yk_lisp_stack_top[0]),
-		b = YK_INT(yk_lisp_stack_top[1]);
-
-	YkInt x = a % b;
-	if (x < 0)
-		x = b - a;
+static double yk_number_to_double(YkObject number) {
+	if (YK_INTP(number))
+		return (double)yk_signed_fixnum_to_long(YK_INT(number));
 
-	return YK_MAKE_INT(x);
+	YK_ASSERT(YK_FLOATP(number));
+	return YK_FLOAT(number);
 }
 
-static YkObject yk_builtin_aset(YkUint nargs) {
-	YkObject array = yk_lisp_stack_top[0];
-	YkInt index = YK_INT(yk_lisp_stack_top[1]);
-	YkObject value = yk_lisp_stack_top[2];
+static YkObject yk_make_typed_array(YkElementType type, YkUint size) {
+	YkObject array = yk_alloc();
+	array->typed_array.t = yk_t_typed_array;
+	array->typed_array.dummy = YK_NIL;
+	array->typed_array.element_type = type;
+	array->typed_array.foreign = false;
+	array->typed_array.size = 0;
+	array->typed_array.stride = yk_element_sizes[type];
+	array->typed_array.data = NULL;
+	array->typed_array.finalizer = NULL;
 
-	YK_ASSERT(YK_TYPEOF(array) == yk_t_array);
+	YK_GC_PROTECT1(array);
 
-	YK_ASSERT(index < (YkInt)YK_PTR(array)->array.size && index >= 0);
-	YK_PTR(array)->array.data[index] = value;
+	array->typed_array.data = yk_array_allocator_alloc(size * yk_element_sizes[type]);
+	memset(array->typed_array.data, 0, size * yk_element_sizes[type]);
+	array->typed_array.size = size;
 
-	return value;
+	YK_GC_UNPROTECT;
+	return array;
 }
 
-static YkObject yk_builtin_make_symbol(YkUint nargs) {
-	YkObject string = yk_lisp_stack_top[0];
-	YK_ASSERT(YK_TYPEOF(string) == yk_t_string);
+/* Foreign views with a finalizer, weakly held */
+static YkObject* yk_finalizable;
+static YkUint yk_finalizable_count, yk_finalizable_capacity;
+
+YkObject yk_make_buffer_view(void* data, YkElementType type, YkUint size, YkUint stride,
+							 YkFinalizer finalizer) {
+	YkObject view = yk_alloc();
+	view->typed_array.t = yk_t_typed_array;
+	view->typed_array.dummy = YK_NIL;
+	view->typed_array.element_type = type;
+	view->typed_array.foreign = true;
+	view->typed_array.size = size;
+	view->typed_array.stride = stride == 0 ? yk_element_sizes[type] : stride;
+	view->typed_array.data = data;
+	view->typed_array.finalizer = finalizer;
+
+	if (finalizer != NULL) {
+		if (yk_finalizable_count == yk_finalizable_capacity) {
+			yk_finalizable_capacity = yk_finalizable_capacity == 0 ? 16 : 2 * yk_finalizable_capacity;
+			yk_finalizable = realloc(yk_finalizable, yk_finalizable_capacity * sizeof(YkObject));
+		}
 
-	return yk_make_symbol_from_string(string);
-}
+		yk_finalizable[yk_finalizable_count++] = view;
+	}
 
-static YkObject yk_builtin_symbol_string(YkUint nargs) {
-	YkObject symbol = yk_lisp_stack_top[0];
-	YK_ASSERT(YK_SYMBOLP(symbol));
-	return YK_PTR(symbol)->symbol.name;
+	return view;
 }
 
-static YkObject yk_builtin_string_concat(YkUint nargs) {
-	YkObject end_string = YK_NIL;
-	YK_GC_PROTECT1(end_string);
-	YkUint total_size = 0, j = 0;
-
-	for (uint i = 0; i < nargs; i++) {
-		total_size += YK_PTR(yk_lisp_stack_top[i])->string.size;
-	}
+/* Runs the finalizers of the unmarked views */
+static void yk_finalizable_sweep() {
+	YkUint live = 0;
 
-	end_string = yk_make_string("", 0);
-	end_string->string.data = yk_array_allocator_alloc(total_size + 1);
-	end_string->string.size = total_size;
+	for (YkUint i = 0; i < yk_finalizable_count; i++) {
+		YkObject view = yk_finalizable[i];
 
-	for (uint i = 0; i < nargs; i++) {
-		memcpy(end_string->string.data + j, yk_lisp_stack_top[i]->string.data,
-			   yk_lisp_stack_top[i]->string.size);
-		j += yk_lisp_stack_top[i]->string.size;
+		if (YK_MARKED(view)) {
+			yk_finalizable[live++] = view;
+		} else {
+			view->typed_array.finalizer(view->typed_array.data);
+			view->typed_array.finalizer = NULL;
+		}
 	}
 
-	end_string->string.data[j] = '\0';
+	yk_finalizable_count = live;
+}
 
-	YK_GC_UNPROTECT;
-	return end_string;
+static inline bool yk_typed_array_packed(YkTypedArray* a) {
+	return a->stride == yk_element_sizes[a->element_type];
 }
 
-static YkObject yk_builtin_make_file_stream(YkUint nargs) {
-	return yk_make_file_stream(yk_lisp_stack_top[0], yk_lisp_stack_top[1], NULL);
+#define YK_ELEMENT(a, ctype, i) (*(ctype*)((char*)(a)->data + (YkUint)(i) * (a)->stride))
+
+/* Elements as the widest number of their kind, for the strided loops */
+static inline YkInt yk_element_int(YkTypedArray* a, YkUint i) {
+	return a->element_type == YK_ELEMENT_U8 ?
+		YK_ELEMENT(a, uint8_t, i) : YK_ELEMENT(a, int32_t, i);
 }
 
-static YkObject yk_builtin_make_input_string_stream(YkUint nargs) {
-	YK_ASSERT(yk_lisp_stack_top[0]->t.t == yk_t_string);
+static inline double yk_element_float(YkTypedArray* a, YkUint i) {
+	return a->element_type == YK_ELEMENT_F32 ?
+		YK_ELEMENT(a, float, i) : YK_ELEMENT(a, double, i);
+}
 
-	return yk_make_input_string_stream(yk_string_to_c_str(yk_lisp_stack_top[0]));
+static inline void yk_element_set_int(YkTypedArray* a, YkUint i, YkInt x) {
+	if (a->element_type == YK_ELEMENT_U8)
+		YK_ELEMENT(a, uint8_t, i) = (uint8_t)x;
+	else
+		YK_ELEMENT(a, int32_t, i) = (int32_t)(uint32_t)x;
 }
 
-static YkObject yk_builtin_make_output_string_stream(YkUint nargs) {
-	return yk_make_output_string_stream();
+static inline void yk_element_set_float(YkTypedArray* a, YkUint i, double x) {
+	if (a->element_type == YK_ELEMENT_F32)
+		YK_ELEMENT(a, float, i) = (float)x;
+	else
+		YK_ELEMENT(a, double, i) = x;
 }
 
-static YkObject yk_builtin_stream_string(YkUint nargs) {
-	YK_ASSERT(yk_lisp_stack_top[0]->t.t == yk_t_string_stream);
-	YK_ASSERT(!(yk_lisp_stack_top[0]->string_stream.flags & YK_STREAM_FINISHED_BIT));
+static YkObject yk_typed_array_ref(YkObject array, YkUint i) {
+	YkTypedArray* a = &YK_PTR(array)->typed_array;
+	YK_ASSERT(i < a->size);
 
-	return yk_stream_string(yk_lisp_stack_top[0]);
+	if (YK_ELEMENT_FLOATP(a->element_type))
+		return YK_MAKE_FLOAT((float)yk_element_float(a, i));
+	else
+		return YK_MAKE_INT(yk_element_int(a, i));
 }
 
-static YkObject yk_builtin_stream_read_byte(YkUint nargs) {
-	YkObject stream = yk_lisp_stack_top[0];
-	YkInt byte = yk_stream_read_byte(stream);
+static void yk_typed_array_set(YkObject array, YkUint i, YkObject value) {
+	YkTypedArray* a = &YK_PTR(array)->typed_array;
+	YK_ASSERT(i < a->size);
 
-	if (byte < 0)
-		return yk_symbol_eof;
+	if (YK_ELEMENT_FLOATP(a->element_type)) {
+		yk_element_set_float(a, i, yk_number_to_double(value));
+	} else {
+		YK_ASSERT(YK_INTP(value));
+		yk_element_set_int(a, i, YK_INT(value));
+	}
+}
+
+/* The bulk operations run over raw element pointers. The SSE2 kernels
+ * handle floats, whose reductions the compiler may not vectorize by itself
+ * since reassociating them changes the result; the integer loops are left
+ * to the auto-vectorizer. */
+#define YK_ELEMENTWISE_LOOP(ctype, dst, a, b, scalar, n, op)			\
+	do {																\
+		ctype *_d = (ctype*)(dst), *_a = (ctype*)(a), *_b = (ctype*)(b); \
+		if (_b != NULL) {												\
+			for (YkUint _i = 0; _i < (n); _i++) _d[_i] = _a[_i] op _b[_i]; \
+		} else {														\
+			ctype _s = (ctype)(scalar);									\
+			for (YkUint _i = 0; _i < (n); _i++) _d[_i] = _a[_i] op _s;	\
+		}																\
+	} while (0)
+
+#define YK_ELEMENTWISE(ctype, arith, dst, a, b, scalar, n)				\
+	do {																\
+		switch (arith) {												\
+		case YK_ARITH_ADD: YK_ELEMENTWISE_LOOP(ctype, dst, a, b, scalar, n, +); break; \
+		case YK_ARITH_SUB: YK_ELEMENTWISE_LOOP(ctype, dst, a, b, scalar, n, -); break; \
+		case YK_ARITH_MUL: YK_ELEMENTWISE_LOOP(ctype, dst, a, b, scalar, n, *); break; \
+		case YK_ARITH_DIV: YK_ELEMENTWISE_LOOP(ctype, dst, a, b, scalar, n, /); break; \
+		default: break;													\
+		}																\
+	} while (0)
+
+#ifdef __SSE2__
+/* Defines the kernels of one float type, `sfx' being the suffix of its
+ * intrinsics (ps or pd) and `width' its number of lanes */
+#define YK_DEFINE_SIMD_KERNELS(name, ctype, vtype, sfx, width)			\
+	static void yk_##name##_elementwise(YkArithOp arith, ctype* dst, const ctype* a, \
+										const ctype* b, ctype scalar, YkUint n) { \
+		YkUint i = 0;													\
+		vtype s = _mm_set1_##sfx(scalar);								\
+		for (; i + (width) <= n; i += (width)) {						\
+			vtype x = _mm_loadu_##sfx(a + i),							\
+				y = b != NULL ? _mm_loadu_##sfx(b + i) : s;				\
+			switch (arith) {											\
+			case YK_ARITH_ADD: x = _mm_add_##sfx(x, y); break;			\
+			case YK_ARITH_SUB: x = _mm_sub_##sfx(x, y); break;			\
+			case YK_ARITH_MUL: x = _mm_mul_##sfx(x, y); break;			\
+			default: x = _mm_div_##sfx(x, y); break;					\
+			}															\
+			_mm_storeu_##sfx(dst + i, x);								\
+		}																\
+		YK_ELEMENTWISE(ctype, arith, dst + i, a + i, b != NULL ? b + i : NULL, \
+					   scalar, n - i);									\
+	}																	\
+																		\
+	static double yk_##name##_dot(const ctype* a, const ctype* b, YkUint n) { \
+		YkUint i = 0;													\
+		vtype sum = _mm_setzero_##sfx();								\
+		for (; i + (width) <= n; i += (width)) {						\
+			vtype y = b != NULL ? _mm_loadu_##sfx(b + i) : _mm_set1_##sfx(1); \
+			sum = _mm_add_##sfx(sum, _mm_mul_##sfx(_mm_loadu_##sfx(a + i), y)); \
+		}																\
+		ctype lanes[width];												\
+		_mm_storeu_##sfx(lanes, sum);									\
+		double result = 0;												\
+		for (uint j = 0; j < (width); j++) result += lanes[j];			\
+		for (; i < n; i++) result += a[i] * (b != NULL ? b[i] : 1);		\
+		return result;													\
+	}																	\
+																		\
+	static ctype yk_##name##_extremum(const ctype* a, YkUint n, bool max) { \
+		YkUint i = 0;													\
+		vtype m = _mm_set1_##sfx(a[0]);									\
+		for (; i + (width) <= n; i += (width)) {						\
+			vtype x = _mm_loadu_##sfx(a + i);							\
+			m = max ? _mm_max_##sfx(m, x) : _mm_min_##sfx(m, x);		\
+		}																\
+		ctype lanes[width];												\
+		_mm_storeu_##sfx(lanes, m);										\
+		ctype result = lanes[0];										\
+		for (uint j = 1; j < (width); j++)								\
+			result = (max ? lanes[j] > result : lanes[j] < result) ? lanes[j] : result; \
+		for (; i < n; i++)												\
+			result = (max ? a[i] > result : a[i] < result) ? a[i] : result; \
+		return result;													\
+	}
+#else
+#define YK_DEFINE_SIMD_KERNELS(name, ctype, vtype, sfx, width)			\
+	static void yk_##name##_elementwise(YkArithOp arith, ctype* dst, const ctype* a, \
+										const ctype* b, ctype scalar, YkUint n) { \
+		YK_ELEMENTWISE(ctype, arith, dst, a, b, scalar, n);				\
+	}																	\
+																		\
+	static double yk_##name##_dot(const ctype* a, const ctype* b, YkUint n) { \
+		double result = 0;												\
+		for (YkUint i = 0; i < n; i++) result += a[i] * (b != NULL ? b[i] : 1); \
+		return result;													\
+	}																	\
+																		\
+	static ctype yk_##name##_extremum(const ctype* a, YkUint n, bool max) { \
+		ctype result = a[0];											\
+		for (YkUint i = 1; i < n; i++)									\
+			result = (max ? a[i] > result : a[i] < result) ? a[i] : result; \
+		return result;													\
+	}
+#endif
 
-	return YK_MAKE_INT(byte);
+YK_DEFINE_SIMD_KERNELS(f32, float, __m128, ps, 4)
+YK_DEFINE_SIMD_KERNELS(f64, double, __m128d, pd, 2)
+
+#define YK_INTEGER_DOT(ctype, a, b, n)									\
+	do {																\
+		const ctype *_a = (ctype*)(a), *_b = (ctype*)(b);				\
+		YkInt _sum = 0;													\
+		if (_b != NULL) {												\
+			for (YkUint _i = 0; _i < (n); _i++) _sum += (YkInt)_a[_i] * _b[_i]; \
+		} else {														\
+			for (YkUint _i = 0; _i < (n); _i++) _sum += _a[_i];			\
+		}																\
+		return YK_MAKE_INT(_sum);										\
+	} while (0)
+
+#define YK_INTEGER_EXTREMUM(ctype, a, n, max)							\
+	do {																\
+		const ctype *_a = (ctype*)(a);									\
+		ctype _m = _a[0];												\
+		for (YkUint _i = 1; _i < (n); _i++)								\
+			_m = ((max) ? _a[_i] > _m : _a[_i] < _m) ? _a[_i] : _m;		\
+		return YK_MAKE_INT((YkInt)_m);									\
+	} while (0)
+
+/* Element by element versions of the kernels, for strided views. `y' may
+ * be NULL, as in the kernels. */
+static void yk_strided_elementwise(YkArithOp arith, YkTypedArray* d, YkTypedArray* x,
+								   YkTypedArray* y, double scalar) {
+	bool floatp = YK_ELEMENT_FLOATP(d->element_type);
+
+	for (YkUint i = 0; i < d->size; i++) {
+		if (floatp) {
+			double a = yk_element_float(x, i), b = y != NULL ? yk_element_float(y, i) : scalar;
+			yk_element_set_float(d, i, arith == YK_ARITH_ADD ? a + b :
+								 arith == YK_ARITH_SUB ? a - b :
+								 arith == YK_ARITH_MUL ? a * b : a / b);
+		} else {
+			YkInt a = yk_element_int(x, i), b = y != NULL ? yk_element_int(y, i) : (YkInt)scalar;
+			yk_element_set_int(d, i, arith == YK_ARITH_ADD ? a + b :
+							   arith == YK_ARITH_SUB ? a - b : a * b);
+		}
+	}
 }
 
-static YkObject yk_builtin_stream_write_byte(YkUint nargs) {
-	YkObject stream = yk_lisp_stack_top[0],
-		byte = yk_lisp_stack_top[1];
+static YkObject yk_strided_dot(YkTypedArray* x, YkTypedArray* y) {
+	if (YK_ELEMENT_FLOATP(x->element_type)) {
+		double sum = 0;
+		for (YkUint i = 0; i < x->size; i++)
+			sum += yk_element_float(x, i) * (y != NULL ? yk_element_float(y, i) : 1);
 
-	yk_stream_write_byte(stream, YK_INT(byte));
-	return YK_NIL;
+		return YK_MAKE_FLOAT((float)sum);
+	} else {
+		YkInt sum = 0;
+		for (YkUint i = 0; i < x->size; i++)
+			sum += yk_element_int(x, i) * (y != NULL ? yk_element_int(y, i) : 1);
+
+		return YK_MAKE_INT(sum);
+	}
 }
 
-static YkObject yk_builtin_stream_read_char(YkUint nargs) {
-	YkObject stream = yk_lisp_stack_top[0];
-	YkInt character = yk_stream_read_char(stream);
+static YkObject yk_strided_extremum(YkTypedArray* x, bool max) {
+	if (YK_ELEMENT_FLOATP(x->element_type)) {
+		double m = yk_element_float(x, 0);
+		for (YkUint i = 1; i < x->size; i++) {
+			double e = yk_element_float(x, i);
+			m = (max ? e > m : e < m) ? e : m;
+		}
 
-	if (character < 0)
-		return yk_symbol_eof;
+		return YK_MAKE_FLOAT((float)m);
+	} else {
+		YkInt m = yk_element_int(x, 0);
+		for (YkUint i = 1; i < x->size; i++) {
+			YkInt e = yk_element_int(x, i);
+			m = (max ? e > m : e < m) ? e : m;
+		}
 
-	return YK_MAKE_INT(character);
+		return YK_MAKE_INT(m);
+	}
 }
 
-static YkObject yk_builtin_stream_write_char(YkUint nargs) {
-	YkObject stream = yk_lisp_stack_top[0],
-		character = yk_lisp_stack_top[1];
+/* Sum of the products of the elements of `a' and `b', or of the elements
+ * of `a' if `b' is NIL */
+static YkObject yk_typed_array_dot(YkObject a, YkObject b) {
+	YkTypedArray* x = &YK_PTR(a)->typed_array;
+	YkTypedArray* y_array = b != YK_NIL ? &YK_PTR(b)->typed_array : NULL;
 
-	yk_stream_write_char(stream, YK_INT(character));
-	return YK_NIL;
-}
+	if (!yk_typed_array_packed(x) || (y_array != NULL && !yk_typed_array_packed(y_array)))
+		return yk_strided_dot(x, y_array);
+
+	void* y = y_array != NULL ? y_array->data : NULL;
+	switch (x->element_type) {
+	case YK_ELEMENT_U8: YK_INTEGER_DOT(uint8_t, x->data, y, x->size);
+	case YK_ELEMENT_I32: YK_INTEGER_DOT(int32_t, x->data, y, x->size);
+	case YK_ELEMENT_F32: return YK_MAKE_FLOAT((float)yk_f32_dot(x->data, y, x->size));
+	case YK_ELEMENT_F64: return YK_MAKE_FLOAT((float)yk_f64_dot(x->data, y, x->size));
+	}
 
-static YkObject yk_builtin_stream_close(YkUint nargs) {
-	yk_stream_close(yk_lisp_stack_top[0]);
 	return YK_NIL;
 }
 
-static YkObject yk_builtin_gc(YkUint nargs) {
-	yk_gc();
+static YkObject yk_typed_array_extremum(YkObject a, bool max) {
+	YkTypedArray* x = &YK_PTR(a)->typed_array;
+	YK_ASSERT(x->size > 0);
+
+	if (!yk_typed_array_packed(x))
+		return yk_strided_extremum(x, max);
+
+	switch (x->element_type) {
+	case YK_ELEMENT_U8: YK_INTEGER_EXTREMUM(uint8_t, x->data, x->size, max);
+	case YK_ELEMENT_I32: YK_INTEGER_EXTREMUM(int32_t, x->data, x->size, max);
+	case YK_ELEMENT_F32: return YK_MAKE_FLOAT(yk_f32_extremum(x->data, x->size, max));
+	case YK_ELEMENT_F64: return YK_MAKE_FLOAT((float)yk_f64_extremum(x->data, x->size, max));
+	}
+
 	return YK_NIL;
 }
 
-static YkObject yk_builtin_set_class(YkUint nargs) {
-	YkObject name = yk_lisp_stack_top[0],
-		parent = yk_lisp_stack_top[1],
-		size = yk_lisp_stack_top[2];
+/* (typed-array-OP! dst a b) stores `a OP b' into `dst', `b' being a typed
+ * array or a number applied to every element. Integer elements wrap
+ * around, and can't be divided. */
+static YkObject yk_typed_array_elementwise(YkArithOp arith) {
+	YkObject dst = yk_lisp_stack_top[0],
+		a = yk_lisp_stack_top[1],
+		b = yk_lisp_stack_top[2];
+	YK_ASSERT(YK_TYPED_ARRAYP(dst) && YK_TYPED_ARRAYP(a));
+
+	YkTypedArray *d = &YK_PTR(dst)->typed_array, *x = &YK_PTR(a)->typed_array;
+	YK_ASSERT(d->element_type == x->element_type && d->size == x->size);
+	YK_ASSERT(arith != YK_ARITH_DIV || YK_ELEMENT_FLOATP(d->element_type));
+
+	YkTypedArray* y_array = NULL;
+	void* y = NULL;
+	double scalar = 0;
+	if (YK_TYPED_ARRAYP(b)) {
+		y_array = &YK_PTR(b)->typed_array;
+		YK_ASSERT(y_array->element_type == d->element_type && y_array->size == d->size);
+		y = y_array->data;
+	} else {
+		YK_ASSERT(YK_ELEMENT_FLOATP(d->element_type) || YK_INTP(b));
+		scalar = yk_number_to_double(b);
+	}
 
-	YK_ASSERT(YK_SYMBOLP(name) && YK_SYMBOLP(parent) && YK_INTP(size));
-	YkObject parent_class = yk_find_class(parent);
+	if (!yk_typed_array_packed(d) || !yk_typed_array_packed(x) ||
+		(y_array != NULL && !yk_typed_array_packed(y_array)))
+	{
+		yk_strided_elementwise(arith, d, x, y_array, scalar);
+		return dst;
+	}
 
-	YK_ASSERT(parent_class == yk_class_object || yk_subclassp(parent_class, yk_class_object));
+	switch (d->element_type) {
+	case YK_ELEMENT_U8:
+		YK_ELEMENTWISE(uint8_t, arith, d->data, x->data, y, (YkInt)scalar, d->size);
+		break;
+	case YK_ELEMENT_I32:
+		/* Unsigned, as signed overflow is undefined */
+		YK_ELEMENTWISE(uint32_t, arith, d->data, x->data, y, (YkInt)scalar, d->size);
+		break;
+	case YK_ELEMENT_F32:
+		yk_f32_elementwise(arith, d->data, x->data, y, scalar, d->size);
+		break;
+	case YK_ELEMENT_F64:
+		yk_f64_elementwise(arith, d->data, x->data, y, scalar, d->size);
+		break;
+	}
 
-	return yk_make_class(yk_class_object_class, name, parent_class, YK_INT(size));
+	return dst;
 }
 
-static YkObject yk_builtin_make_instance(YkUint nargs) {
-	YkObject type = yk_lisp_stack_top[0];
-
-	YK_ASSERT(YK_SYMBOLP(type));
-	YkObject class = YK_PTR(type)->symbol.class_value;
-	YK_ASSERT(class != NULL);
+static YkObject yk_builtin_make_typed_array(YkUint nargs) {
+	YkObject size = yk_lisp_stack_top[1];
+	YK_ASSERT(YK_INTP(size) && YK_INT(size) >= 0);
 
-	YkObject instance = yk_make_instance(class);
+	YkElementType type = yk_element_type_from_symbol(yk_lisp_stack_top[0]);
+	YkObject array = yk_make_typed_array(type, YK_INT(size));
 
-	YkObject last_instance = instance;
-	YkObject instances = yk_cons(instance, YK_NIL);
-	YkUint arg_count = 0;
-	if (YK_CLASS_OF(class) == yk_class_object_class) {
-		for (YkObject parent = YK_CLASS_PARENT(class);
-			 parent != yk_class_object;
-			 parent = YK_CLASS_PARENT(parent)) {
-			YkObject i = yk_make_instance(parent);
-			last_instance->instance.slots[0] = i;
-			instances = yk_cons(i, instances);
-			last_instance = i;
-		}
-
-		YK_LIST_FOREACH(instances, pair) {
-			YkObject inst = YK_CAR(pair);
-
-			YkUint class_size, i;
-			YkObject class = inst->instance.class;
-			class_size = YK_INT(YK_CLASS_SIZE(class));
-			if (YK_CLASS_PARENT(class) == yk_class_object)
-				i = 0;
-			else
-				i = 1;
-
-			for (; i < class_size; i++) {
-				YK_ASSERT(1 + arg_count <= nargs);
-				inst->instance.slots[i] = yk_lisp_stack_top[1 + arg_count++];
-			}
+	if (nargs > 2) {
+		for (YkUint i = 0; i < YK_PTR(array)->typed_array.size; i++) {
+			yk_typed_array_set(array, i, yk_lisp_stack_top[2]);
 		}
+	}
 
-		YK_ASSERT(1 + arg_count == nargs);
-	} else {
-		YkUint class_size = YK_INT(YK_CLASS_SIZE(class));
-		YK_ASSERT(class_size == (nargs - 1));
+	return array;
+}
+
+static YkObject yk_builtin_list_to_typed_array(YkUint nargs) {
+	YkObject list = yk_lisp_stack_top[1];
+	YK_ASSERT(YK_LISTP(list));
+
+	YkElementType type = yk_element_type_from_symbol(yk_lisp_stack_top[0]);
+	YkObject array = yk_make_typed_array(type, yk_length(list));
+
+	uint i = 0;
+	YK_LIST_FOREACH(list, l) {
+		yk_typed_array_set(array, i++, YK_CAR(l));
+	}
+
+	return array;
+}
+
+static YkObject yk_builtin_typed_array_to_list(YkUint nargs) {
+	YkObject array = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_TYPED_ARRAYP(array));
+
+	YkObject list = YK_NIL;
+	YK_GC_PROTECT1(list);
+
+	for (YkInt i = (YkInt)YK_PTR(array)->typed_array.size - 1; i >= 0; i--) {
+		list = yk_cons(yk_typed_array_ref(array, i), list);
+	}
+
+	YK_GC_UNPROTECT;
+	return list;
+}
+
+static YkObject yk_builtin_typed_array_length(YkUint nargs) {
+	YkObject array = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_TYPED_ARRAYP(array));
+
+	return YK_MAKE_INT(YK_PTR(array)->typed_array.size);
+}
+
+static YkObject yk_builtin_typed_array_type(YkUint nargs) {
+	YkObject array = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_TYPED_ARRAYP(array));
+
+	return yk_make_symbol_cstr(yk_element_names[YK_PTR(array)->typed_array.element_type]);
+}
+
+static YkObject yk_builtin_typed_array_add(YkUint nargs) {
+	return yk_typed_array_elementwise(YK_ARITH_ADD);
+}
+
+static YkObject yk_builtin_typed_array_sub(YkUint nargs) {
+	return yk_typed_array_elementwise(YK_ARITH_SUB);
+}
+
+static YkObject yk_builtin_typed_array_mul(YkUint nargs) {
+	return yk_typed_array_elementwise(YK_ARITH_MUL);
+}
+
+static YkObject yk_builtin_typed_array_div(YkUint nargs) {
+	return yk_typed_array_elementwise(YK_ARITH_DIV);
+}
+
+static YkObject yk_builtin_typed_array_fill(YkUint nargs) {
+	YkObject array = yk_lisp_stack_top[0],
+		value = yk_lisp_stack_top[1];
+	YK_ASSERT(YK_TYPED_ARRAYP(array));
 
-		for (uint i = 0; i < class_size; i++) {
-			instance->instance.slots[i] = yk_lisp_stack_top[1 + i];
+	YkTypedArray* a = &YK_PTR(array)->typed_array;
+	if (a->size == 0)
+		return array;
+
+	/* Store the first element, then double the filled prefix */
+	yk_typed_array_set(array, 0, value);
+
+	if (!yk_typed_array_packed(a)) {
+		for (YkUint i = 1; i < a->size; i++) {
+			yk_typed_array_set(array, i, value);
 		}
+
+		return array;
 	}
-	return instance;
+
+	YkUint element_size = yk_element_sizes[a->element_type],
+		filled = 1;
+	while (filled < a->size) {
+		YkUint count = filled < a->size - filled ? filled : a->size - filled;
+		memcpy((char*)a->data + filled * element_size, a->data, count * element_size);
+		filled += count;
+	}
+
+	return array;
 }
 
-static YkObject yk_builtin_find_class(YkUint nargs) {
-	YkObject type = yk_lisp_stack_top[0];
-	YK_ASSERT(YK_SYMBOLP(type));
+static YkObject yk_builtin_typed_array_sum(YkUint nargs) {
+	YK_ASSERT(YK_TYPED_ARRAYP(yk_lisp_stack_top[0]));
 
-	return yk_find_class(type);
+	return yk_typed_array_dot(yk_lisp_stack_top[0], YK_NIL);
 }
 
-static YkObject yk_builtin_subtypep(YkUint nargs) {
-	YkObject t1 = yk_lisp_stack_top[0],
-		t2 = yk_lisp_stack_top[1];
+static YkObject yk_builtin_typed_array_dot(YkUint nargs) {
+	YkObject a = yk_lisp_stack_top[0],
+		b = yk_lisp_stack_top[1];
+	YK_ASSERT(YK_TYPED_ARRAYP(a) && YK_TYPED_ARRAYP(b));
+	YK_ASSERT(YK_PTR(a)->typed_array.element_type == YK_PTR(b)->typed_array.element_type &&
+			  YK_PTR(a)->typed_array.size == YK_PTR(b)->typed_array.size);
 
-	YK_ASSERT(YK_SYMBOLP(t1) && YK_SYMBOLP(t2));
-	return yk_subtypep(t1, t2) ? yk_tee : YK_NIL;
+	return yk_typed_array_dot(a, b);
 }
 
-static YkObject yk_builtin_set_slot(YkUint nargs) {
-	YkObject instance = yk_lisp_stack_top[0],
-		slot = yk_lisp_stack_top[1],
-		value = yk_lisp_stack_top[2];
+static YkObject yk_builtin_typed_array_min(YkUint nargs) {
+	YK_ASSERT(YK_TYPED_ARRAYP(yk_lisp_stack_top[0]));
 
-	YK_ASSERT(YK_TYPEOF(instance) == yk_t_instance && YK_INTP(slot) &&
-			  YK_INT(slot) >= 0 && YK_INT(slot) < (YkInt)instance->instance.slots_count &&
-			  !YK_CLASS_INVALID(instance->instance.class));
+	return yk_typed_array_extremum(yk_lisp_stack_top[0], false);
+}
 
-	instance->instance.slots[YK_INT(slot)] = value;
-	return value;
+static YkObject yk_builtin_typed_array_max(YkUint nargs) {
+	YK_ASSERT(YK_TYPED_ARRAYP(yk_lisp_stack_top[0]));
+
+	return yk_typed_array_extremum(yk_lisp_stack_top[0], true);
 }
 
-static YkObject yk_builtin_get_slot(YkUint args) {
-	YkObject instance = yk_lisp_stack_top[0],
-		slot = yk_lisp_stack_top[1];
+/* Lazy sequences */
+static YkObject yk_make_sequence(YkSequenceKind kind, YkObject source, YkObject function) {
+	YK_GC_PROTECT2(source, function);
 
-	YK_ASSERT(YK_TYPEOF(instance) == yk_t_instance && YK_INTP(slot) &&
-			  YK_INT(slot) >= 0 && YK_INT(slot) < (YkInt)instance->instance.slots_count &&
-			  !YK_CLASS_INVALID(instance->instance.class));
+	YkObject seq = yk_alloc();
+	seq->sequence.t = yk_t_sequence;
+	seq->sequence.dummy = YK_NIL;
+	seq->sequence.kind = kind;
+	seq->sequence.source = source;
+	seq->sequence.function = function;
+	seq->sequence.index = 0;
+	seq->sequence.end = 0;
+	seq->sequence.step = 1;
 
-	return instance->instance.slots[YK_INT(slot)];
+	YK_GC_UNPROTECT;
+	return seq;
 }
 
-static YkObject yk_builtin_class_size(YkUint nargs) {
-	YkObject class = yk_find_class(yk_lisp_stack_top[0]);
-	return YK_CLASS_SIZE(class);
+/* Sequence over the elements of a list, an array or a typed array */
+static YkObject yk_to_sequence(YkObject x) {
+	if (YK_SEQUENCEP(x))
+		return x;
+
+	if (YK_LISTP(x))
+		return yk_make_sequence(YK_SEQUENCE_LIST, x, YK_NIL);
+
+	YK_ASSERT(YK_TYPEOF(x) == yk_t_array || YK_TYPED_ARRAYP(x));
+	return yk_make_sequence(YK_SEQUENCE_ARRAY, x, YK_NIL);
 }
 
-static YkObject yk_builtin_set_method(YkUint nargs) {
-	YkObject class = yk_lisp_stack_top[0],
-		name = yk_lisp_stack_top[1],
-		function = yk_lisp_stack_top[2];
+static YkObject yk_sequence_next(YkObject seq);
 
-	YK_LIST_FOREACH(class->instance.slots[3], pair) {
-		if (YK_CDR(YK_CAR(pair)) == name) {
-			YK_CDR(YK_CAR(pair)) = function;
-			return function;
+/* Next element of the sequences calling functions or other sequences */
+static YkObject yk_sequence_pull(YkObject seq) {
+	YkSequence* s = &YK_PTR(seq)->sequence;
+	YkObject x = yk_symbol_eof;
+	YK_GC_PROTECT1(seq);
+
+	switch (s->kind) {
+	case YK_SEQUENCE_GENERATOR:
+		x = yk_apply_n(s->function, 0, NULL);
+		break;
+	case YK_SEQUENCE_MAP:
+		x = yk_sequence_next(s->source);
+		if (x != yk_symbol_eof)
+			x = yk_apply_n(s->function, 1, &x);
+		break;
+	case YK_SEQUENCE_FILTER:
+		while ((x = yk_sequence_next(s->source)) != yk_symbol_eof &&
+			   yk_apply_n(s->function, 1, &x) == YK_NIL);
+		break;
+	case YK_SEQUENCE_TAKE:
+		if (s->index < s->end) {
+			s->index++;
+			x = yk_sequence_next(s->source);
 		}
+		break;
 	}
 
-	class->instance.slots[3] = yk_cons(yk_cons(name, function),
-									   class->instance.slots[3]);
+	YK_GC_UNPROTECT;
+	return x;
+}
 
-	return function;
+/* Next element of `seq', or eof once it is exhausted. Each stage pulls a
+ * single element from the one below it, so no intermediate list is made. */
+static YkObject yk_sequence_next(YkObject seq) {
+	YkSequence* s = &YK_PTR(seq)->sequence;
+	YkObject x = yk_symbol_eof;
+
+	switch (s->kind) {
+	case YK_SEQUENCE_DONE:
+		return yk_symbol_eof;
+	case YK_SEQUENCE_RANGE:
+		if (s->step > 0 ? s->index < s->end : s->index > s->end) {
+			x = YK_MAKE_INT(s->index);
+			s->index += s->step;
+		}
+		break;
+	case YK_SEQUENCE_LIST:
+		if (YK_CONSP(s->source)) {
+			x = YK_CAR(s->source);
+			s->source = YK_CDR(s->source);
+		}
+		break;
+	case YK_SEQUENCE_ARRAY:
+		if (YK_TYPEOF(s->source) == yk_t_array) {
+			if ((YkUint)s->index < YK_PTR(s->source)->array.size)
+				x = YK_PTR(s->source)->array.data[s->index++];
+		} else if ((YkUint)s->index < YK_PTR(s->source)->typed_array.size) {
+			x = yk_typed_array_ref(s->source, s->index++);
+		}
+		break;
+	default:
+		x = yk_sequence_pull(seq);
+	}
+
+	if (x == yk_symbol_eof) {
+		/* Let go of the source, and never pull from it again */
+		s->kind = YK_SEQUENCE_DONE;
+		s->source = YK_NIL;
+		s->function = YK_NIL;
+	}
+
+	return x;
 }
 
-static YkObject yk_builtin_call_method(YkUint nargs) {
-	YkObject object = yk_lisp_stack_top[0],
-		name = yk_lisp_stack_top[1],
-		args = YK_NIL,
-		function;
+static YkObject yk_builtin_seq(YkUint nargs) {
+	return yk_to_sequence(yk_lisp_stack_top[0]);
+}
 
-	YK_GC_PROTECT1(args);
+/* (seq-range end), (seq-range start end) or (seq-range start end step),
+ * `end' excluded */
+static YkObject yk_builtin_seq_range(YkUint nargs) {
+	YK_ASSERT(nargs <= 3);
+	for (uint i = 0; i < nargs; i++) {
+		YK_ASSERT(YK_INTP(yk_lisp_stack_top[i]));
+	}
 
-	YkObject class = object->instance.class;
+	YkObject seq = yk_make_sequence(YK_SEQUENCE_RANGE, YK_NIL, YK_NIL);
+	YkSequence* s = &YK_PTR(seq)->sequence;
 
-	for (uint i = 2; i < nargs; i++) {
-		args = yk_cons(yk_lisp_stack_top[i], args);
+	if (nargs == 1) {
+		s->end = yk_signed_fixnum_to_long(YK_INT(yk_lisp_stack_top[0]));
+	} else {
+		s->index = yk_signed_fixnum_to_long(YK_INT(yk_lisp_stack_top[0]));
+		s->end = yk_signed_fixnum_to_long(YK_INT(yk_lisp_stack_top[1]));
 	}
-	args = yk_nreverse(args);
 
-	for (YkObject c = class; c != yk_class_object; c = c->instance.slots[1]) {
-		YK_LIST_FOREACH(c->instance.slots[3], pair) {
-			if (YK_CAR(YK_CAR(pair)) == name) {
-				args = yk_cons(object, args);
-				function = YK_CDR(YK_CAR(pair));
-				YK_GC_UNPROTECT;
-				yk_tail_apply(function, args);
-			}
-		}
-		object = object->instance.slots[0];
+	if (nargs == 3) {
+		s->step = yk_signed_fixnum_to_long(YK_INT(yk_lisp_stack_top[2]));
+		YK_ASSERT(s->step != 0);
 	}
 
-	YK_ASSERT(0);
-	return YK_NIL;
+	return seq;
 }
 
-static YkObject yk_builtin_make_window(YkUint nargs) {
-	YkObject title = yk_lisp_stack_top[0];
-	YK_ASSERT(YK_TYPEOF(title) == yk_t_string);
+/* Sequence of the values returned by `function', called without arguments
+ * until it returns eof */
+static YkObject yk_builtin_generator(YkUint nargs) {
+	return yk_make_sequence(YK_SEQUENCE_GENERATOR, YK_NIL, yk_lisp_stack_top[0]);
+}
 
-	PsWidget* window = ps_window_create(yk_string_to_c_str(title));
-	return yk_make_cpointer(window);
+static YkObject yk_builtin_seq_map(YkUint nargs) {
+	YkObject function = yk_lisp_stack_top[0];
+	YkObject source = yk_to_sequence(yk_lisp_stack_top[1]);
+
+	return yk_make_sequence(YK_SEQUENCE_MAP, source, function);
 }
 
-static YkObject yk_builtin_window_destroy(YkUint nargs) {
-	YkObject window = yk_lisp_stack_top[0];
-	YK_ASSERT(YK_TYPEOF(window) == yk_t_cpointer);
+static YkObject yk_builtin_seq_filter(YkUint nargs) {
+	YkObject function = yk_lisp_stack_top[0];
+	YkObject source = yk_to_sequence(yk_lisp_stack_top[1]);
 
-	ps_window_destroy(yk_cpointer_value(window));
-	window->pointer.cpointer = NULL;
-	return YK_NIL;
+	return yk_make_sequence(YK_SEQUENCE_FILTER, source, function);
 }
 
-static YkObject yk_builtin_make_box(YkUint nargs) {
-	YkObject direction = yk_lisp_stack_top[0],
-		margin = yk_lisp_stack_top[1];
+static YkObject yk_builtin_seq_take(YkUint nargs) {
+	YkObject count = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_INTP(count));
 
-	YK_ASSERT(YK_SYMBOLP(direction) && YK_FLOATP(margin));
+	YkObject source = yk_to_sequence(yk_lisp_stack_top[1]);
+	YkObject seq = yk_make_sequence(YK_SEQUENCE_TAKE, source, YK_NIL);
+	YK_PTR(seq)->sequence.end = yk_signed_fixnum_to_long(YK_INT(count));
 
-	PsDirection dir;
+	return seq;
+}
 
-	if (yk_make_symbol_cstr("vertical") == direction) {
-		dir = PS_DIRECTION_VERTICAL;
-	} else if (yk_make_symbol_cstr("horizontal") == direction) {
-		dir = PS_DIRECTION_HORIZONTAL;
-	} else {
-		YK_ASSERT(0);
+static YkObject yk_builtin_seq_next(YkUint nargs) {
+	YkObject seq = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_SEQUENCEP(seq));
+
+	return yk_sequence_next(seq);
+}
+
+/* Folds `function' over the elements, in constant space */
+static YkObject yk_builtin_seq_reduce(YkUint nargs) {
+	YkObject function = yk_lisp_stack_top[0],
+		accumulator = yk_lisp_stack_top[1],
+		seq = YK_NIL;
+	YK_GC_PROTECT3(function, accumulator, seq);
+
+	seq = yk_to_sequence(yk_lisp_stack_top[2]);
+
+	YkObject args[2];
+	while ((args[1] = yk_sequence_next(seq)) != yk_symbol_eof) {
+		args[0] = accumulator;
+		accumulator = yk_apply_n(function, 2, args);
 	}
 
-	PsWidget* vbox = ps_box_create(dir, YK_FLOAT(margin));
-	return yk_make_cpointer(vbox);
+	YK_GC_UNPROTECT;
+	return accumulator;
 }
 
-static YkObject yk_builtin_window_set_root(YkUint nargs) {
-	YkObject window = yk_lisp_stack_top[0],
-		root = yk_lisp_stack_top[1];
+static YkObject yk_builtin_seq_for_each(YkUint nargs) {
+	YkObject function = yk_lisp_stack_top[0],
+		seq = YK_NIL;
+	YK_GC_PROTECT2(function, seq);
 
-	YK_ASSERT(YK_TYPEOF(window) == yk_t_cpointer &&
-			  YK_TYPEOF(root) == yk_t_cpointer);
+	seq = yk_to_sequence(yk_lisp_stack_top[1]);
 
-	ps_window_set_root(yk_cpointer_value(window), yk_cpointer_value(root));
+	YkObject x;
+	while ((x = yk_sequence_next(seq)) != yk_symbol_eof) {
+		yk_apply_n(function, 1, &x);
+	}
+
+	YK_GC_UNPROTECT;
 	return YK_NIL;
 }
 
-static YkObject yk_builtin_make_button(YkUint nargs) {
-	YkObject text = yk_lisp_stack_top[0],
-		margin = yk_lisp_stack_top[1];
+static YkObject yk_builtin_seq_to_list(YkUint nargs) {
+	YkObject seq = yk_lisp_stack_top[0],
+		result = YK_NIL, last = YK_NIL, x = YK_NIL;
+	YK_ASSERT(YK_SEQUENCEP(seq));
+	YK_GC_PROTECT4(seq, result, last, x);
 
-	YK_ASSERT(YK_TYPEOF(text) == yk_t_string && YK_FLOATP(margin));
+	while ((x = yk_sequence_next(seq)) != yk_symbol_eof) {
+		YkObject cell = yk_cons(x, YK_NIL);
+		if (last == YK_NIL)
+			result = cell;
+		else
+			YK_CDR(last) = cell;
 
-	PsWidget* button = ps_button_create(yk_string_to_c_str(text), YK_FLOAT(margin));
-	return yk_make_cpointer(button);
+		last = cell;
+	}
+
+	YK_GC_UNPROTECT;
+	return result;
 }
 
-static YkObject yk_builtin_widget_destroy(YkUint nargs) {
-	YkObject widget = yk_lisp_stack_top[0];
-	YK_ASSERT(YK_TYPEOF(widget) == yk_t_cpointer);
+#define YK_UTF8_CONTINUATIONP(byte) (((byte) & 0xc0) == 0x80)
 
-	ps_widget_destroy(yk_cpointer_value(widget));
-	widget->pointer.cpointer = NULL;
+/* Characters are counted once, as the bytes not continuing a sequence */
+static YkUint yk_string_length(YkObject string) {
+	YkString* s = &YK_PTR(string)->string;
 
-	return YK_NIL;
+	if (s->length == YK_STRING_LENGTH_UNKNOWN) {
+		YkUint length = 0;
+
+		for (YkUint i = 0; i < s->size; i++) {
+			length += !YK_UTF8_CONTINUATIONP((uchar)s->data[i]);
+		}
+
+		s->length = length;
+	}
+
+	return s->length;
 }
 
-static YkObject yk_arglist(YkUint nargs) {
-	YkObject list = YK_NIL;
-	YK_GC_PROTECT1(list);
+static void yk_string_build_index(YkObject string) {
+	YK_GC_PROTECT1(string);
 
-	YkObject* last_frame_ptr = (YkObject*) *yk_lisp_frame_ptr,
-		*last_stack_ptr = yk_lisp_stack_top + 4;
+	YkString* s = &YK_PTR(string)->string;
+	YkUint entries = (yk_string_length(string) + YK_STRING_INDEX_STRIDE - 1) / YK_STRING_INDEX_STRIDE;
+	uint32_t* index = yk_array_allocator_alloc(entries * sizeof(uint32_t));
 
-	YkUint argcount = last_frame_ptr - last_stack_ptr,
-		offset = YK_INT(yk_lisp_stack_top[0]);
+	YkUint character = 0;
+	for (YkUint i = 0; i < s->size; i++) {
+		if (!YK_UTF8_CONTINUATIONP((uchar)s->data[i])) {
+			if (character % YK_STRING_INDEX_STRIDE == 0)
+				index[character / YK_STRING_INDEX_STRIDE] = i;
 
-	for (int i = argcount - offset - 1; i >= 0; i--) {
-		list = yk_cons(last_stack_ptr[offset + i], list);
+			character++;
+		}
 	}
 
+	s->index = index;
 	YK_GC_UNPROTECT;
-	return list;
 }
 
-static YkObject yk_builtin_breakpoint(YkUint nargs) {
-	raise(SIGINT);
-	return YK_NIL;
+/* Byte offset of the character `i' (up to the length), walking at most
+ * YK_STRING_INDEX_STRIDE - 1 characters from the closest index entry */
+static YkUint yk_string_offset(YkObject string, YkUint i) {
+	YkUint length = yk_string_length(string);
+	YK_ASSERT(i <= length);
+
+	YkString* s = &YK_PTR(string)->string;
+	if (length == s->size)
+		return i;
+
+	if (i == length)
+		return s->size;
+
+	if (s->index == NULL) {
+		yk_string_build_index(string);
+		s = &YK_PTR(string)->string;
+	}
+
+	YkUint offset = s->index[i / YK_STRING_INDEX_STRIDE];
+	for (YkUint steps = i % YK_STRING_INDEX_STRIDE; steps > 0; steps--) {
+		do {
+			offset++;
+		} while (YK_UTF8_CONTINUATIONP((uchar)s->data[offset]));
+	}
+
+	return offset;
 }
 
-static YkObject yk_type_of(YkObject object) {
-	if (object == YK_NIL) {
-		return YK_NIL;
+static YkObject yk_string_ref(YkObject string, YkInt i) {
+	YK_ASSERT(i >= 0 && (YkUint)i < yk_string_length(string));
+
+	uchar* string_ptr = (uchar*)YK_PTR(string)->string.data + yk_string_offset(string, i);
+	if (*string_ptr <= 0x7f)
+		return YK_MAKE_INT(*string_ptr);
+
+	return YK_MAKE_INT(u_string_to_codepoint(string_ptr));
+}
+
+/* (substring s start [end]), characters `start' to `end' (excluded) */
+static YkObject yk_builtin_substring(YkUint nargs) {
+	YkObject string = yk_lisp_stack_top[0];
+	YK_ASSERT(nargs <= 3);
+	YK_ASSERT(YK_TYPEOF(string) == yk_t_string);
+	YK_ASSERT(YK_INTP(yk_lisp_stack_top[1]));
+
+	YkInt start = YK_INT(yk_lisp_stack_top[1]),
+		end = yk_string_length(string);
+
+	if (nargs == 3) {
+		YK_ASSERT(YK_INTP(yk_lisp_stack_top[2]));
+		end = YK_INT(yk_lisp_stack_top[2]);
 	}
 
-	switch(YK_TYPEOF(object)) {
-	case yk_t_list:
-		return yk_symbol_type_list;
-		break;
-	case yk_t_int:
-		return yk_symbol_type_int;
-		break;
-	case yk_t_float:
-		return yk_symbol_type_float;
-		break;
-	case yk_t_symbol:
-		return yk_symbol_type_symbol;
-		break;
-	case yk_t_c_proc:
-		return yk_symbol_type_function;
-		break;
-	case yk_t_closure:
-		return yk_symbol_type_function;
-		break;
-	case yk_t_bytecode:
-		return yk_symbol_type_function;
-		break;
-	case yk_t_instance:
-		return YK_CLASS_NAME(YK_CLASS_OF(object));
-		break;
-	case yk_t_array:
-		return yk_symbol_type_array;
-		break;
-	case yk_t_string:
-		return yk_symbol_type_string;
-		break;
-	case yk_t_cpointer:
-		return yk_symbol_type_cpointer;
-		break;
-	case yk_t_string_stream:
-		return yk_symbol_type_string_stream;
-		break;
-	case yk_t_file_stream:
-		return yk_symbol_type_file_stream;
-		break;
-	default:
-		return YK_NIL;
+	YK_ASSERT(start >= 0 && start <= end && (YkUint)end <= yk_string_length(string));
+
+	YkUint begin_offset = yk_string_offset(string, start),
+		end_offset = yk_string_offset(string, end);
+
+	YkObject result = yk_alloc_string(end_offset - begin_offset);
+	memcpy(result->string.data, YK_PTR(string)->string.data + begin_offset,
+		   end_offset - begin_offset);
+	result->string.length = end - start;
+
+	return result;
+}
+
+static YkObject yk_builtin_aref(YkUint nargs) {
+	YkObject array = yk_lisp_stack_top[0];
+	YkInt index = YK_INT(yk_lisp_stack_top[1]);
+
+	if (YK_TYPEOF(array) == yk_t_array) {
+		YK_ASSERT(index < (YkInt)YK_PTR(array)->array.size && index >= 0);
+
+		return YK_PTR(array)->array.data[index];
+	} else if (YK_TYPEOF(array) == yk_t_typed_array) {
+		return yk_typed_array_ref(array, index);
+	} else if (YK_TYPEOF(array) == yk_t_string) {
+		return yk_string_ref(array, index);
+	} else {
+		YK_ASSERT(0);
 	}
+
+	return YK_NIL;
 }
 
-static YkObject yk_builtin_type_of(YkUint nargs) {
-	return yk_type_of(yk_lisp_stack_top[0]);
+static YkObject yk_builtin_mod(YkUint nargs) {
+	YK_ASSERT(YK_INTP(yk_lisp_stack_top[0]) && YK_INTP(yk_lisp_stack_top[1]));
+	YkInt a = YK_INT(yk_lisp_stack_top[0]),
+		b = YK_INT(yk_lisp_stack_top[1]);
+
+	YkInt x = a % b;
+	if (x < 0)
+		x = b - a;
+
+	return YK_MAKE_INT(x);
 }
 
-static YkObject yk_default_debugger(YkUint nargs) {
-	YkObject error = yk_lisp_stack_top[0];
+static YkObject yk_builtin_aset(YkUint nargs) {
+	YkObject array = yk_lisp_stack_top[0];
+	YkInt index = YK_INT(yk_lisp_stack_top[1]);
+	YkObject value = yk_lisp_stack_top[2];
 
-	printf("Unhandled error ");
-	yk_print(error);
-	printf("\n");
+	if (YK_TYPEOF(array) == yk_t_typed_array) {
+		yk_typed_array_set(array, index, value);
+		return value;
+	}
 
-	YkObject *stack_ptr = yk_lisp_stack_top,
-		*frame_ptr = yk_lisp_frame_ptr;
+	YK_ASSERT(YK_TYPEOF(array) == yk_t_array);
 
-	while (stack_ptr < yk_lisp_stack + YK_STACK_MAX_SIZE) {
-		for (; stack_ptr != frame_ptr; stack_ptr++) {
-			printf("\t");
-			yk_print(*stack_ptr);
-			printf("\n");
-		}
+	YK_ASSERT(index < (YkInt)YK_PTR(array)->array.size && index >= 0);
+	YK_PTR(array)->array.data[index] = value;
 
-		if (frame_ptr < yk_lisp_stack + YK_STACK_MAX_SIZE) {
-			YkObject bytecode = frame_ptr[2];
-			printf("---%s----\n", yk_symbol_cstr(YK_PTR(bytecode)->bytecode.name));
+	return value;
+}
 
-			frame_ptr = (YkObject*) *frame_ptr;
-			stack_ptr += 3;
-		}
-	}
+/* Arrays double as vectors: `size' is their fill pointer, and the slots
+ * up to `capacity' are reserved for it to grow into. */
+static void yk_array_reserve(YkObject array, YkUint capacity) {
+	if (capacity <= YK_PTR(array)->array.capacity)
+		return;
 
-	printf("1] ABORT TO TOPLEVEL\n"
-		"2] DEBBUGER BREAKPOINT\n");
+	YK_GC_PROTECT1(array);
 
-make_choice:
-	printf("> ");
-	int choice;
-	m_scanf("%d", &choice);
+	YkObject* data = yk_array_allocator_alloc(capacity * sizeof(YkObject));
+	memcpy(data, YK_PTR(array)->array.data, YK_PTR(array)->array.size * sizeof(YkObject));
 
-	if (choice == 1) {
-		yk_go_back(error, 1);
-	}
-	if (choice == 2) {
-		assert(0);
-	}
-	else {
-		goto make_choice;
-	}
+	YK_PTR(array)->array.data = data;
+	YK_PTR(array)->array.capacity = capacity;
 
-	return YK_NIL;
+	YK_GC_UNPROTECT;
 }
 
-static YkUint yk_length(YkObject list) {
-	YkUint i = 0;
-	YK_LIST_FOREACH(list, l) {
-		i++;
+static YkObject yk_builtin_vector_push(YkUint nargs) {
+	YkObject array = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_TYPEOF(array) == yk_t_array);
+
+	YkUint size = YK_PTR(array)->array.size;
+	if (size == YK_PTR(array)->array.capacity) {
+		yk_array_reserve(array, size < 4 ? 8 : 2 * size);
 	}
 
-	return i;
+	YK_PTR(array)->array.data[size] = yk_lisp_stack_top[1];
+	YK_PTR(array)->array.size = size + 1;
+
+	return YK_MAKE_INT(size);
 }
 
-static bool yk_member(YkObject element, YkObject list) {
-	YK_LIST_FOREACH(list, e) {
-		if (YK_CAR(e) == element)
-			return true;
-	}
+static YkObject yk_builtin_vector_pop(YkUint nargs) {
+	YkObject array = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_TYPEOF(array) == yk_t_array && YK_PTR(array)->array.size > 0);
 
-	return false;
+	return YK_PTR(array)->array.data[--YK_PTR(array)->array.size];
 }
 
-YkObject yk_apply(YkObject function, YkObject args) {
-	YkObject result = YK_NIL;
+static YkObject yk_builtin_vector_reserve(YkUint nargs) {
+	YkObject array = yk_lisp_stack_top[0],
+		capacity = yk_lisp_stack_top[1];
+	YK_ASSERT(YK_TYPEOF(array) == yk_t_array && YK_INTP(capacity) && YK_INT(capacity) >= 0);
 
-	YK_GC_PROTECT2(args, result);
+	yk_array_reserve(array, YK_INT(capacity));
+	return array;
+}
 
-	YkInt argcount = 0;
+static YkObject yk_builtin_vector_length(YkUint nargs) {
+	YkObject array = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_TYPEOF(array) == yk_t_array);
 
-	static YkInstruction yk_end = {YK_NIL, 0, YK_OP_END};
-	YkObject value_register = yk_value_register;
-	YkInstruction *program_counter = yk_program_counter;
+	return YK_MAKE_INT(YK_PTR(array)->array.size);
+}
 
-	YK_PUSH(yk_lisp_stack_top, yk_bytecode_register);
-	YK_PUSH(yk_lisp_stack_top, &yk_end);
-	YK_PUSH(yk_lisp_stack_top, yk_lisp_frame_ptr);
+static YkObject yk_builtin_vector_capacity(YkUint nargs) {
+	YkObject array = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_TYPEOF(array) == yk_t_array);
 
-	yk_lisp_frame_ptr = yk_lisp_stack_top;
+	return YK_MAKE_INT(YK_PTR(array)->array.capacity);
+}
 
-	args = yk_reverse(args);
-	YK_LIST_FOREACH(args, e) {
-		YK_PUSH(yk_lisp_stack_top, YK_CAR(e));
-		argcount++;
-	}
+static bool yk_equal(YkObject a, YkObject b) {
+start:
+	if (a == b)
+		return true;
+	else if (YK_TYPEOF(a) != YK_TYPEOF(b))
+		return false;
 
-	if (YK_BYTECODEP(function)) {
-		YkInt nargs = YK_PTR(function)->bytecode.nargs;
-		if (nargs >= 0) {
-			YK_ASSERT(argcount == nargs);
-		}
-		else {
-			YK_ASSERT(argcount >= -(nargs + 1));
-		}
+	switch (YK_TYPEOF(a)) {
+	case yk_t_list:
+		if (!YK_CONSP(a) || !YK_CONSP(b) || !yk_equal(YK_CAR(a), YK_CAR(b)))
+			return false;
 
-		yk_run(function);
-		result = yk_value_register;
-	} else if (YK_CPROCP(function)) {
-		YkInt nargs = YK_PTR(function)->c_proc.nargs;
-		if (nargs >= 0) {
-			YK_ASSERT(argcount == nargs);
-		}
-		else {
-			YK_ASSERT(argcount >= -(nargs + 1));
-		}
+		a = YK_CDR(a);
+		b = YK_CDR(b);
+		goto start;
+	case yk_t_string:
+		return YK_PTR(a)->string.size == YK_PTR(b)->string.size &&
+			memcmp(YK_PTR(a)->string.data, YK_PTR(b)->string.data,
+				   YK_PTR(a)->string.size) == 0;
+	case yk_t_array:
+		if (YK_PTR(a)->array.size != YK_PTR(b)->array.size)
+			return false;
 
-		result = YK_PTR(function)->c_proc.cfun(argcount);
-		yk_lisp_stack_top = yk_lisp_frame_ptr;
+		for (uint i = 0; i < YK_PTR(a)->array.size; i++) {
+			if (!yk_equal(YK_PTR(a)->array.data[i], YK_PTR(b)->array.data[i]))
+				return false;
+		}
 
-		YK_LISP_STACK_POP(yk_lisp_frame_ptr, YkObject**);
-		YK_LISP_STACK_POP(yk_program_counter, YkInstruction**);
-		YK_LISP_STACK_POP(yk_bytecode_register, YkObject*);
-	} else {
-		assert(0);
+		return true;
+	default:
+		return false;
 	}
+}
 
-	yk_program_counter = program_counter;
-	yk_value_register = value_register;
+static YkObject yk_builtin_equal(YkUint nargs) {
+	return yk_equal(yk_lisp_stack_top[0], yk_lisp_stack_top[1]) ? yk_tee : YK_NIL;
+}
 
-	YK_GC_UNPROTECT;
-	return result;
+/* Hash tables */
+#define YK_HASH_EMPTY NULL
+#define YK_HASH_TOMBSTONE ((YkObject)1)
+#define YK_HASH_LIVE(key) ((key) != YK_HASH_EMPTY && (key) != YK_HASH_TOMBSTONE)
+#define YK_HASH_MIN_CAPACITY 8
+#define YK_HASH_MIGRATE_STEP 8
+/* How many elements of a list or array `equal' hashing looks at */
+#define YK_HASH_EQUAL_WIDTH 8
+#define YK_HASH_EQUAL_DEPTH 3
+
+static uint64_t yk_hash_word(YkUint word) {
+	word ^= word >> 33;
+	word *= 0xff51afd7ed558ccd;
+	word ^= word >> 33;
+
+	return word;
 }
 
-static YkObject yk_funcall(const char* fn_name, ushort nargs, ...) {
-	YkObject args = YK_NIL;
-	YK_GC_PROTECT1(args);
+static uint64_t yk_equal_hash(YkObject o, uint depth) {
+	uint64_t hash = 17;
+	uint i = 0;
 
-	va_list arguments;
-	va_start(arguments, nargs);
+	switch (YK_TYPEOF(o)) {
+	case yk_t_string:
+		return yk_hash_bytes(YK_PTR(o)->string.data, YK_PTR(o)->string.size);
+	case yk_t_list:
+		if (o == YK_NIL)
+			break;
+		else if (depth == 0)
+			return hash;
 
-	for (uint i = 0; i < nargs; i++) {
-		YkObject o = va_arg(arguments, YkObject);
-		args = yk_cons(o, args);
+		for (YkObject l = o; YK_CONSP(l) && i < YK_HASH_EQUAL_WIDTH; l = YK_CDR(l), i++) {
+			hash = hash * 31 + yk_equal_hash(YK_CAR(l), depth - 1);
+		}
+
+		return hash;
+	case yk_t_array:
+		if (depth == 0)
+			return YK_PTR(o)->array.size;
+
+		hash += YK_PTR(o)->array.size;
+		for (; i < YK_PTR(o)->array.size && i < YK_HASH_EQUAL_WIDTH; i++) {
+			hash = hash * 31 + yk_equal_hash(YK_PTR(o)->array.data[i], depth - 1);
+		}
+
+		return hash;
+	default:
+		break;
 	}
 
-	va_end(arguments);
+	return yk_hash_word((YkUint)o);
+}
 
-	return yk_apply(YK_PTR(yk_make_symbol_cstr(fn_name))->symbol.value, yk_nreverse(args));
+static inline uint64_t yk_hash_table_hash(YkHashTable* table, YkObject key) {
+	return table->test == YK_HASH_EQ ?
+		yk_hash_word((YkUint)key) : yk_equal_hash(key, YK_HASH_EQUAL_DEPTH);
+}
 
-	YK_GC_UNPROTECT;
+static inline bool yk_hash_table_same(YkHashTable* table, YkObject a, YkObject b) {
+	return a == b || (table->test == YK_HASH_EQUAL && yk_equal(a, b));
 }
 
-static void yk_tail_apply(YkObject function, YkObject args) {
-	YkInt argcount = 0;
+/* Returns the index of the pair holding `key' in `entries', or -1 */
+static YkInt yk_hash_entries_find(YkHashTable* table, YkObject* entries, YkUint capacity,
+								  YkObject key, uint64_t hash) {
+	YkUint mask = capacity - 1;
 
-	yk_lisp_stack_top = yk_lisp_frame_ptr;
+	for (YkUint i = hash & mask;; i = (i + 1) & mask) {
+		YkObject k = entries[2 * i];
 
-	args = yk_nreverse(args);
-	YK_LIST_FOREACH(args, a) {
-		YK_LISP_STACK_PUSH(YK_CAR(a));
-		argcount++;
+		if (k == YK_HASH_EMPTY)
+			return -1;
+		else if (k != YK_HASH_TOMBSTONE && yk_hash_table_same(table, k, key))
+			return i;
 	}
+}
 
-	YK_ASSERT(YK_BYTECODEP(function));
+/* Stores a key that is not in `entries' yet. Returns true if it took an
+ * empty bucket rather than a tombstone. */
+static bool yk_hash_entries_insert(YkObject* entries, YkUint capacity,
+								   YkObject key, YkObject value, uint64_t hash) {
+	YkUint mask = capacity - 1;
+	YkUint i = hash & mask;
 
-	YkInt nargs = YK_PTR(function)->bytecode.nargs;
-	if (nargs >= 0) {
-		YK_ASSERT(argcount == nargs);
-	}
-	else {
-		YK_ASSERT(argcount >= -(nargs + 1));
+	while (YK_HASH_LIVE(entries[2 * i])) {
+		i = (i + 1) & mask;
 	}
 
-	yk_bytecode_register = function;
-	yk_program_counter = YK_PTR(function)->bytecode.code;
+	bool was_empty = entries[2 * i] == YK_HASH_EMPTY;
+	entries[2 * i] = key;
+	entries[2 * i + 1] = value;
 
-	yk_go_back(function, 2);
+	return was_empty;
 }
 
-static void yk_signal_error(YkObject class, ...) {
-	va_list args;
-	va_start(args, class);
-
-	YkObject arglist = yk_cons(class, YK_NIL);
-	YK_GC_PROTECT1(arglist);
+static YkObject* yk_hash_entries_alloc(YkUint capacity) {
+	YkObject* entries = yk_array_allocator_alloc(2 * capacity * sizeof(YkObject));
 
-	YkObject arg = va_arg(args, YkObject);
-	while (arg != NULL) {
-		arglist = yk_cons(arg, arglist);
-		arg = va_arg(args, YkObject);
+	for (YkUint i = 0; i < 2 * capacity; i++) {
+		entries[i] = YK_HASH_EMPTY;
 	}
 
-	va_end(args);
+	return entries;
+}
 
-	YK_GC_UNPROTECT;
+static YkObject yk_make_hash_table(YkHashTest test, YkUint capacity) {
+	YkObject table = yk_alloc();
+	table->hash_table.t = yk_t_hash_table;
+	table->hash_table.dummy = YK_NIL;
+	table->hash_table.test = test;
+	table->hash_table.count = 0;
+	table->hash_table.used = 0;
+	table->hash_table.entries = NULL;
+	table->hash_table.old_entries = NULL;
+	table->hash_table.old_capacity = 0;
+	table->hash_table.migrated = 0;
+	table->hash_table.capacity = 0;
 
-	arglist = yk_nreverse(arglist);
+	YK_GC_PROTECT1(table);
 
-	YkObject error = yk_apply(YK_PTR(yk_make_symbol_cstr("make-instance"))->symbol.value, arglist);
-	yk_tail_apply(YK_PTR(yk_make_symbol_cstr("error"))->symbol.value, yk_cons(error, YK_NIL));
-}
+	YkUint size = YK_HASH_MIN_CAPACITY;
+	while (size < 2 * capacity) {
+		size *= 2;
+	}
 
-static YkObject yk_keyword_quote, yk_keyword_let, yk_keyword_lambda, yk_keyword_setq,
-	yk_keyword_comptime, yk_keyword_do, yk_keyword_if, yk_keyword_dynamic_let,
-	yk_keyword_with_cont, yk_keyword_exit, yk_keyword_loop,
-	yk_stream_console_output, yk_stream_console_input,
-	yk_make_closure_cfun;
+	table->hash_table.entries = yk_hash_entries_alloc(size);
+	table->hash_table.capacity = size;
 
-void yk_init() {
-	yk_gc_stack_size = 0;
-	yk_gc_protected_stack_size = 0;
+	YK_GC_UNPROTECT;
+	return table;
+}
 
-	yk_lisp_stack_top = yk_lisp_stack + YK_STACK_MAX_SIZE;
-	yk_lisp_frame_ptr = yk_lisp_stack_top;
-	yk_dynamic_bindings_stack_top = yk_dynamic_bindings_stack + YK_STACK_MAX_SIZE;
-	yk_continuations_stack_top = yk_continuations_stack + YK_STACK_MAX_SIZE;
-	yk_value_register = YK_NIL;
-	yk_program_counter = NULL;
+/* Moves up to `steps' buckets of the old pairs to the current ones */
+static void yk_hash_table_migrate(YkHashTable* table, YkUint steps) {
+	if (table->old_entries == NULL)
+		return;
 
-	yk_jump_stack_size = 0;
+	for (; steps > 0 && table->migrated < table->old_capacity; steps--) {
+		YkObject* pair = &table->old_entries[2 * table->migrated++];
 
-	yk_allocator_init();
-	yk_array_allocator_init();
-	yk_symbol_table_init();
+		if (YK_HASH_LIVE(pair[0])) {
+			uint64_t hash = yk_hash_table_hash(table, pair[0]);
+			if (yk_hash_entries_insert(table->entries, table->capacity, pair[0], pair[1], hash))
+				table->used++;
 
-	/* Special symbols */
-	yk_tee = yk_make_symbol_cstr("t");
-	YK_PTR(yk_tee)->symbol.value = yk_tee;
-	YK_PTR(yk_tee)->symbol.class_value = yk_tee;
-	YK_PTR(yk_tee)->symbol.type = yk_s_constant;
+			/* Not emptied: probe sequences of the remaining pairs go through it */
+			pair[0] = YK_HASH_TOMBSTONE;
+		}
+	}
 
-	yk_symbol_environnement = yk_make_symbol_cstr("*environnement*");
+	if (table->migrated == table->old_capacity) {
+		table->old_entries = NULL;
+		table->old_capacity = 0;
+	}
+}
 
-	yk_symbol_type_list = yk_make_symbol_cstr("list");
-	yk_symbol_type_object = yk_make_symbol_cstr("object");
-	yk_symbol_type_number = yk_make_symbol_cstr("number");
-	yk_symbol_type_stream = yk_make_symbol_cstr("stream");
-	yk_symbol_type_int = yk_make_symbol_cstr("int");
-	yk_symbol_type_float = yk_make_symbol_cstr("float");
-	yk_symbol_type_symbol = yk_make_symbol_cstr("symbol");
-	yk_symbol_type_function = yk_make_symbol_cstr("function");
-	yk_symbol_type_array = yk_make_symbol_cstr("array");
-	yk_symbol_type_string = yk_make_symbol_cstr("string");
-	yk_symbol_type_cpointer = yk_make_symbol_cstr("cpointer");
-	yk_symbol_type_string_stream = yk_make_symbol_cstr("string-stream");
-	yk_symbol_type_file_stream = yk_make_symbol_cstr("file-stream");
-	yk_symbol_type_class = yk_make_symbol_cstr("class");
-	yk_symbol_type_object_class = yk_make_symbol_cstr("object-class");
-	yk_symbol_type_builtin_class = yk_make_symbol_cstr("builtin-class");
+/* Starts moving to a fresh array of pairs if the current one is half full.
+ * `table' must be GC protected. */
+static void yk_hash_table_reserve(YkObject table) {
+	YkHashTable* t = &YK_PTR(table)->hash_table;
 
-	yk_nil = yk_make_symbol_cstr("nil");
-	YK_PTR(yk_nil)->symbol.value = YK_NIL;
-	YK_PTR(yk_nil)->symbol.type = yk_s_constant;
+	if (2 * (t->used + 1) <= t->capacity)
+		return;
 
-	yk_class_class = yk_alloc();
-	yk_class_class->t.t = yk_t_instance;
-	yk_class_class->instance.class = yk_class_class;
-	yk_class_class->instance.slots = yk_array_allocator_alloc(sizeof(YkObject) * 4);
-	yk_class_class->instance.slots[0] = yk_symbol_type_class;
-	yk_class_class->instance.slots[1] = yk_tee;
-	yk_class_class->instance.slots[2] = YK_MAKE_INT(3);
-	yk_class_class->instance.slots[3] = YK_NIL;
+	/* Only one resize can be in flight */
+	yk_hash_table_migrate(t, t->old_capacity);
 
-	YK_PTR(yk_symbol_type_class)->symbol.class_value = yk_class_class;
+	YkUint new_capacity = 4 * (t->count + 1) > t->capacity ? 2 * t->capacity : t->capacity;
+	YkObject* new_entries = yk_hash_entries_alloc(new_capacity);
 
-	yk_class_builtin_class = yk_make_class(yk_class_class, yk_symbol_type_builtin_class, yk_class_class, 3);
-	yk_class_object_class = yk_make_class(yk_class_class, yk_symbol_type_object_class, yk_class_class, 5);
-	yk_class_object = yk_make_class(yk_class_class, yk_symbol_type_object, yk_tee, 0);
-	yk_class_number = yk_make_class(yk_class_builtin_class, yk_symbol_type_number, yk_tee, 0);
-	yk_class_function = yk_make_class(yk_class_builtin_class, yk_symbol_type_function, yk_tee, 0);
-	yk_class_symbol = yk_make_class(yk_class_builtin_class, yk_symbol_type_symbol, yk_tee, 0);
-	yk_class_string = yk_make_class(yk_class_builtin_class, yk_symbol_type_string, yk_tee, 0);
-	yk_class_stream = yk_make_class(yk_class_class, yk_symbol_type_stream, yk_tee, 0);
-	yk_class_string_stream = yk_make_class(yk_class_builtin_class, yk_symbol_type_string_stream, yk_class_stream, 0);
-	yk_class_file_stream = yk_make_class(yk_class_builtin_class, yk_symbol_type_file_stream, yk_class_stream, 0);
-	yk_class_int = yk_make_class(yk_class_builtin_class, yk_symbol_type_int, yk_class_number, 0);
-	yk_class_float = yk_make_class(yk_class_builtin_class, yk_symbol_type_float, yk_class_number, 0);
+	t->old_entries = t->entries;
+	t->old_capacity = t->capacity;
+	t->migrated = 0;
+	t->entries = new_entries;
+	t->capacity = new_capacity;
+	t->used = 0;
+}
 
-	yk_keyword_quote = yk_make_symbol_cstr("quote");
-	yk_keyword_let = yk_make_symbol_cstr("let");
-	yk_keyword_setq = yk_make_symbol_cstr("set!");
-	yk_keyword_lambda = yk_make_symbol_cstr("named-lambda");
-	yk_keyword_comptime = yk_make_symbol_cstr("comptime");
-	yk_keyword_do = yk_make_symbol_cstr("do");
-	yk_keyword_if = yk_make_symbol_cstr("if");
-	yk_keyword_dynamic_let = yk_make_symbol_cstr("dynamic-let");
-	yk_keyword_with_cont = yk_make_symbol_cstr("with-cont");
-	yk_keyword_exit = yk_make_symbol_cstr("exit");
-	yk_keyword_loop = yk_make_symbol_cstr("loop");
+/* Finds the pair of `key', looking in the old pairs of an ongoing resize */
+static YkObject* yk_hash_table_find(YkHashTable* table, YkObject key) {
+	uint64_t hash = yk_hash_table_hash(table, key);
 
-	yk_symbol_file_mode_input = yk_make_symbol_cstr("input");
-	yk_symbol_file_mode_output = yk_make_symbol_cstr("output");
-	yk_symbol_file_mode_append = yk_make_symbol_cstr("append");
-	yk_symbol_file_mode_binary_input = yk_make_symbol_cstr("binary-input");
-	yk_symbol_file_mode_binary_output = yk_make_symbol_cstr("binary-output");
-	yk_symbol_file_mode_binary_append = yk_make_symbol_cstr("binary-append");
+	YkInt i = yk_hash_entries_find(table, table->entries, table->capacity, key, hash);
+	if (i >= 0)
+		return &table->entries[2 * i];
 
-	yk_symbol_eof = yk_make_symbol_cstr("eof");
+	if (table->old_entries != NULL) {
+		i = yk_hash_entries_find(table, table->old_entries, table->old_capacity, key, hash);
+		if (i >= 0)
+			return &table->old_entries[2 * i];
+	}
 
-	/* Streams */
-	yk_stream_console_output = yk_make_file_stream(YK_NIL, yk_symbol_file_mode_output, stdout);
-	yk_permanent_gc_protect(yk_stream_console_output);
+	return NULL;
+}
 
-	yk_stream_console_input = yk_make_file_stream(YK_NIL, yk_symbol_file_mode_input, stdin);
-	yk_permanent_gc_protect(yk_stream_console_input);
+YkObject yk_hash_table_ref(YkObject table, YkObject key, YkObject default_value) {
+	YkObject* pair = yk_hash_table_find(&YK_PTR(table)->hash_table, key);
+	return pair != NULL ? pair[1] : default_value;
+}
 
-	yk_var_output = yk_make_symbol_cstr("*output*");
-	YK_PTR(yk_var_output)->symbol.declared = true;
-	YK_PTR(yk_var_output)->symbol.value = yk_stream_console_output;
+void yk_hash_table_set(YkObject table, YkObject key, YkObject value) {
+	YK_GC_PROTECT3(table, key, value);
 
-	/* Functions */
-	YkObject arglist_symbol = yk_make_symbol_cstr("arglist");
-	yk_arglist_cfun = yk_make_global_function(arglist_symbol, 1, yk_arglist);
+	YkHashTable* t = &YK_PTR(table)->hash_table;
+	yk_hash_table_migrate(t, YK_HASH_MIGRATE_STEP);
 
-	yk_permanent_gc_protect(yk_arglist_cfun);
+	YkObject* pair = yk_hash_table_find(t, key);
+	if (pair != NULL && pair >= t->entries && pair < t->entries + 2 * t->capacity) {
+		pair[1] = value;
+	} else {
+		/* A pair still in the old array moves over now */
+		if (pair != NULL) {
+			pair[0] = YK_HASH_TOMBSTONE;
+			t->count--;
+		}
 
-	/* Builtin functions */
-	yk_make_builtin("+", -1, yk_builtin_add);
-	yk_make_builtin("*", -1, yk_builtin_mul);
-	yk_make_builtin("/", -1, yk_builtin_div);
-	yk_make_builtin("-", -2, yk_builtin_sub);
-	yk_make_builtin("**", 2, yk_builtin_pow);
-	yk_make_builtin("mod", 2, yk_builtin_mod);
+		yk_hash_table_reserve(table);
 
-	yk_make_builtin("=", 2, yk_builtin_neq);
-	yk_make_builtin(">", 2, yk_builtin_nsup);
-	yk_make_builtin("<", 2, yk_builtin_ninf);
-	yk_make_builtin(">=", 2, yk_builtin_nsupeq);
-	yk_make_builtin("<=", 2, yk_builtin_ninfeq);
+		if (yk_hash_entries_insert(t->entries, t->capacity, key, value,
+								   yk_hash_table_hash(t, key)))
+			t->used++;
+		t->count++;
+	}
 
-	yk_make_builtin("eq?", 2, yk_builtin_eq);
+	YK_GC_UNPROTECT;
+}
 
-	yk_make_builtin(":", 2, yk_builtin_cons);
-	yk_make_builtin("head", 1, yk_builtin_head);
-	yk_make_builtin("tail", 1, yk_builtin_tail);
-	yk_make_builtin("first", 1, yk_builtin_head);
-	yk_make_builtin("second", 1, yk_builtin_second);
-	yk_make_builtin("third", 1, yk_builtin_third);
-	yk_make_builtin("list", -1, yk_builtin_list);
-	yk_make_builtin("length", 1, yk_builtin_length);
-	yk_make_builtin("lambda-list-length", 1, yk_builtin_arguments_length);
-	yk_make_builtin("not", 1, yk_builtin_not);
-	yk_make_builtin("append", -1, yk_builtin_append);
-	yk_make_builtin("reverse", 1, yk_builtin_reverse);
-	yk_make_builtin("reverse!", 1, yk_builtin_nreverse);
+bool yk_hash_table_remove(YkObject table, YkObject key) {
+	YkHashTable* t = &YK_PTR(table)->hash_table;
+	yk_hash_table_migrate(t, YK_HASH_MIGRATE_STEP);
 
-	YkObject array_sym = yk_make_symbol_cstr("array");
-	yk_array_cfun = yk_make_global_function(array_sym, -1, yk_builtin_array);
-	yk_permanent_gc_protect(yk_array_cfun);
+	YkObject* pair = yk_hash_table_find(t, key);
+	if (pair == NULL)
+		return false;
 
-	YK_PTR(array_sym)->symbol.value = yk_array_cfun;
-	YK_PTR(array_sym)->symbol.declared = 1;
-	YK_PTR(array_sym)->symbol.type = yk_s_function;
-	YK_PTR(array_sym)->symbol.function_nargs = -1;
+	pair[0] = YK_HASH_TOMBSTONE;
+	pair[1] = YK_NIL;
+	t->count--;
 
-	yk_make_closure_cfun = yk_make_global_function(yk_make_symbol_cstr("make-closure"),
-												   2, yk_builtin_make_closure);
-	yk_permanent_gc_protect(yk_make_closure_cfun);
+	return true;
+}
 
-	yk_make_builtin("make-array", 2, yk_builtin_make_array);
-	yk_make_builtin("aref", 2, yk_builtin_aref);
-	yk_make_builtin("aset!", 3, yk_builtin_aset);
-	yk_make_builtin("list->array", 1, yk_builtin_list_to_array);
-	yk_make_builtin("array->list", 1, yk_builtin_array_to_list);
+static YkObject yk_builtin_make_hash_table(YkUint nargs) {
+	YkObject test = nargs > 0 ? yk_lisp_stack_top[0] : YK_NIL;
+	YkHashTest hash_test = YK_HASH_EQ;
 
-	yk_make_builtin("make-file-stream", 2, yk_builtin_make_file_stream);
-	yk_make_builtin("make-string-input-stream", 1, yk_builtin_make_input_string_stream);
-	yk_make_builtin("make-string-output-stream", 0, yk_builtin_make_output_string_stream);
+	if (test == yk_make_symbol_cstr("equal")) {
+		hash_test = YK_HASH_EQUAL;
+	} else {
+		YK_ASSERT(test == YK_NIL || test == yk_make_symbol_cstr("eq"));
+	}
 
-	yk_make_builtin("stream-string", 1, yk_builtin_stream_string);
+	return yk_make_hash_table(hash_test, 0);
+}
 
-	yk_make_builtin("read-byte", 1, yk_builtin_stream_read_byte);
-	yk_make_builtin("write-byte!", 2, yk_builtin_stream_write_byte);
-	yk_make_builtin("read-char", 1, yk_builtin_stream_read_char);
-	yk_make_builtin("write-char!", 2, yk_builtin_stream_write_char);
+static YkObject yk_builtin_hash_ref(YkUint nargs) {
+	YkObject table = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_HASH_TABLEP(table));
 
-	yk_make_builtin("stream-close", 1, yk_builtin_stream_close);
+	return yk_hash_table_ref(table, yk_lisp_stack_top[1],
+							 nargs > 2 ? yk_lisp_stack_top[2] : YK_NIL);
+}
 
-	yk_make_builtin("gc", 0, yk_builtin_gc);
+static YkObject yk_builtin_hash_set(YkUint nargs) {
+	YkObject table = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_HASH_TABLEP(table));
 
-	yk_make_builtin("int?", 1, yk_builtin_intp);
-	yk_make_builtin("float?", 1, yk_builtin_floatp);
-	yk_make_builtin("pair?", 1, yk_builtin_consp);
-	yk_make_builtin("null?", 1, yk_builtin_nullp);
-	yk_make_builtin("list?", 1, yk_builtin_listp);
-	yk_make_builtin("symbol?", 1, yk_builtin_symbolp);
-	yk_make_builtin("function?", 1, yk_builtin_functionp);
+	yk_hash_table_set(table, yk_lisp_stack_top[1], yk_lisp_stack_top[2]);
+	return yk_lisp_stack_top[2];
+}
 
-	yk_make_builtin("documentation", 1, yk_builtin_documentation);
-	yk_make_builtin("disassemble", 1, yk_builtin_disassemble);
-	yk_make_builtin("bound?", 1, yk_builtin_boundp);
-	yk_make_builtin("gensym", 0, yk_builtin_gensym);
+static YkObject yk_builtin_hash_remove(YkUint nargs) {
+	YkObject table = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_HASH_TABLEP(table));
 
-	yk_make_builtin("set-global!", 2, yk_builtin_set_global);
-	yk_make_builtin("set-macro!", 2, yk_builtin_set_macro);
-	yk_make_builtin("register-global!", 1, yk_builtin_register_global);
-	yk_make_builtin("register-function!", 2, yk_builtin_register_function);
+	return yk_hash_table_remove(table, yk_lisp_stack_top[1]) ? yk_tee : YK_NIL;
+}
 
-	yk_make_builtin("make-symbol", 1, yk_builtin_make_symbol);
-	yk_make_builtin("symbol-string", 1, yk_builtin_symbol_string);
-	yk_make_builtin("string-concat", -1, yk_builtin_string_concat);
+static YkObject yk_builtin_hash_count(YkUint nargs) {
+	YkObject table = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_HASH_TABLEP(table));
 
-	yk_make_builtin("set-class!", 3, yk_builtin_set_class);
-	yk_make_builtin("make-instance", -2, yk_builtin_make_instance);
-	yk_make_builtin("find-class", 1, yk_builtin_find_class);
-	yk_make_builtin("subtype?", 2, yk_builtin_subtypep);
-	yk_make_builtin("set-slot!", 3, yk_builtin_set_slot);
-	yk_make_builtin("get-slot", 2, yk_builtin_get_slot);
-	yk_make_builtin("class-size", 1, yk_builtin_class_size);
-	yk_make_builtin("set-method!", 3, yk_builtin_set_method);
-	yk_make_builtin("call-method", -3, yk_builtin_call_method);
+	return YK_MAKE_INT(YK_PTR(table)->hash_table.count);
+}
 
-	yk_make_builtin("type-of", 1, yk_builtin_type_of);
+/* Calls `function' on every key and value. The function may change or
+ * remove the pair it is given, but adding keys skips or repeats pairs. */
+static YkObject yk_builtin_hash_for_each(YkUint nargs) {
+	YkObject table = yk_lisp_stack_top[0],
+		function = yk_lisp_stack_top[1];
+	YK_ASSERT(YK_HASH_TABLEP(table));
 
-	yk_make_builtin("clock", 0, yk_builtin_clock);
-	yk_make_builtin("random", 1, yk_builtin_random);
+	YkHashTable* t = &YK_PTR(table)->hash_table;
+	yk_hash_table_migrate(t, t->old_capacity);
 
-	yk_make_builtin("print", 1, yk_builtin_print);
+	for (YkUint i = 0; i < YK_PTR(table)->hash_table.capacity; i++) {
+		YkObject* entries = YK_PTR(table)->hash_table.entries;
+		if (!YK_HASH_LIVE(entries[2 * i]))
+			continue;
 
-	yk_make_builtin("breakpoint", 0, yk_builtin_breakpoint);
-	yk_make_builtin("invoke-debugger", 1, yk_default_debugger);
+		YkObject pair[2] = { entries[2 * i], entries[2 * i + 1] };
+		yk_apply_n(function, 2, pair);
+	}
 
-	/* User interface functions */
-	yk_make_builtin("ps-make-window", 1, yk_builtin_make_window);
-	yk_make_builtin("ps-window-destroy", 1, yk_builtin_window_destroy);
-	yk_make_builtin("ps-make-box", 2, yk_builtin_make_box);
-	yk_make_builtin("ps-window-set-root", 2, yk_builtin_window_set_root);
-	yk_make_builtin("ps-make-button", 2, yk_builtin_make_button);
-	yk_make_builtin("ps-widget-destroy", 1, yk_builtin_widget_destroy);
+	return YK_NIL;
 }
 
-static void yk_assert(const char* expression, const char* file, uint32_t line) {
-	char error_name[100];
-	snprintf(error_name, sizeof(error_name), "<assertion-error '%s' at %s:%d>", expression, file, line);
+/* Persistent maps and vectors */
+#define YK_TRIE_BITS 5
+#define YK_TRIE_WIDTH (1 << YK_TRIE_BITS)
+#define YK_TRIE_MASK (YK_TRIE_WIDTH - 1)
+/* Map levels past the hash bits hold colliding pairs, unindexed */
+#define YK_HAMT_MAX_SHIFT 64
 
-	YkObject sym = yk_make_symbol_cstr(error_name);
+static uint32_t yk_transient_counter;
 
-	yk_funcall("invoke-debugger", 1, sym);
+static inline uint yk_popcount(uint32_t x) {
+#ifdef __GNUC__
+	return __builtin_popcount(x);
+#else
+	x = x - ((x >> 1) & 0x55555555);
+	x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+	return (((x + (x >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+#endif
 }
 
-static YkObject yk_make_symbol_from_string(YkObject string) {
-	YkObject sym = YK_NIL;
-	YK_GC_PROTECT2(sym, string);
+static YkObject yk_make_trie_node(uint32_t bitmap, uint32_t size, uint32_t edit) {
+	YkObject node = yk_alloc();
+	node->trie_node.t = yk_t_trie_node;
+	node->trie_node.dummy = YK_NIL;
+	node->trie_node.bitmap = bitmap;
+	node->trie_node.edit = edit;
+	node->trie_node.slots = NULL;
+	node->trie_node.size = 0;
 
-	uint64_t string_hash = hash_string((uchar*)yk_string_to_c_str(string), string->string.size);
-	uint16_t index = string_hash % YK_SYMBOL_TABLE_SIZE;
+	YK_GC_PROTECT1(node);
 
-	if (yk_symbol_table[index] == NULL) {
-		sym = yk_alloc();
+	YkObject* slots = yk_array_allocator_alloc(size * sizeof(YkObject));
+	for (uint32_t i = 0; i < size; i++) {
+		slots[i] = NULL;
+	}
 
-		sym->symbol.name = string;
-		sym->symbol.hash = string_hash;
-		sym->symbol.value = NULL;
-		sym->symbol.class_value = NULL;
-		sym->symbol.next_sym = NULL;
-		sym->symbol.type = yk_s_normal;
-		sym->symbol.function_nargs = 0;
-		sym->symbol.declared = 0;
+	node->trie_node.slots = slots;
+	node->trie_node.size = size;
 
-		sym = YK_TAG_SYMBOL(sym);
-		yk_symbol_table[index] = sym;
+	YK_GC_UNPROTECT;
+	return node;
+}
 
-		YK_GC_UNPROTECT;
-		return sym;
-	} else {
-		YkObject s;
-		for (s = yk_symbol_table[index];
-			 YK_PTR(s)->symbol.hash != string_hash &&
-				 YK_PTR(s)->symbol.next_sym != NULL;
-			 s = YK_PTR(s)->symbol.next_sym);
-
-		if (YK_PTR(s)->symbol.hash == string_hash) {
-			if (s == yk_nil) {
-				YK_GC_UNPROTECT;
-				return YK_NIL;
-			} else {
-				YK_GC_UNPROTECT;
-				return s;
-			}
-		} else {
-			sym = yk_alloc();
+/* Returns `node' itself if the transient `edit' owns it, or a copy it owns */
+static YkObject yk_trie_node_editable(YkObject node, uint32_t edit) {
+	if (edit != 0 && node->trie_node.edit == edit)
+		return node;
+
+	YK_GC_PROTECT1(node);
+	YkObject copy = yk_make_trie_node(node->trie_node.bitmap, node->trie_node.size, edit);
+	memcpy(copy->trie_node.slots, node->trie_node.slots, node->trie_node.size * sizeof(YkObject));
+	YK_GC_UNPROTECT;
 
-			sym->symbol.name = string;
-			sym->symbol.hash = string_hash;
-			sym->symbol.value = NULL;
-			sym->symbol.class_value = NULL;
-			sym->symbol.next_sym = NULL;
-			sym->symbol.type = yk_s_normal;
-			sym->symbol.function_nargs = 0;
-			sym->symbol.declared = 0;
+	return copy;
+}
 
-			sym = YK_TAG_SYMBOL(sym);
-			YK_PTR(s)->symbol.next_sym = sym;
+/* Copy of `node' with `count' slots inserted (count > 0) or removed
+ * (count < 0) at `index' */
+static YkObject yk_trie_node_resize(YkObject node, uint32_t bitmap, uint32_t index, YkInt count,
+									uint32_t edit) {
+	YK_GC_PROTECT1(node);
+	YkUint size = node->trie_node.size;
+	YkObject copy = yk_make_trie_node(bitmap, size + count, edit);
 
-			YK_GC_UNPROTECT;
-			return sym;
-		}
+	YkObject *from = node->trie_node.slots, *to = copy->trie_node.slots;
+	if (count > 0) {
+		memcpy(to, from, index * sizeof(YkObject));
+		memcpy(to + index + count, from + index, (size - index) * sizeof(YkObject));
+	} else {
+		memcpy(to, from, index * sizeof(YkObject));
+		memcpy(to + index, from + index - count, (size - index + count) * sizeof(YkObject));
 	}
-}
 
-YkObject yk_make_symbol(const char* name, uint size) {
-	YK_ASSERT(*name != '\0');
-	YkObject string = YK_NIL;
-	YK_GC_PROTECT1(string);
-	string = yk_make_string(name, size);
 	YK_GC_UNPROTECT;
-	return yk_make_symbol_from_string(string);
+	return copy;
 }
 
-YkObject yk_make_symbol_cstr(const char* cstr) {
-	return yk_make_symbol(cstr, strlen(cstr));
+static inline uint64_t yk_hamt_hash(YkObject key) {
+	return yk_equal_hash(key, YK_HASH_EQUAL_DEPTH);
 }
 
-inline static char* yk_symbol_cstr(YkObject sym) {
-	return yk_string_to_c_str(YK_PTR(sym)->symbol.name);
-}
+/* Node holding two pairs whose hashes agree below `shift' */
+static YkObject yk_hamt_pair_node(uint shift, YkObject k1, YkObject v1, uint64_t h1,
+								  YkObject k2, YkObject v2, uint64_t h2, uint32_t edit) {
+	YkObject node = YK_NIL, child = YK_NIL;
+	YK_GC_PROTECT5(k1, v1, k2, v2, child);
 
-static YkObject yk_make_continuation(uint16_t offset) {
-	YkObject cont = yk_alloc();
-	cont->continuation.t = yk_t_continuation;
+	if (shift >= YK_HAMT_MAX_SHIFT) {
+		node = yk_make_trie_node(0, 4, edit);
+		YkObject pairs[4] = { k1, v1, k2, v2 };
+		memcpy(node->trie_node.slots, pairs, sizeof(pairs));
+	} else {
+		uint b1 = (h1 >> shift) & YK_TRIE_MASK, b2 = (h2 >> shift) & YK_TRIE_MASK;
 
-	cont->continuation.lisp_stack_pointer = yk_lisp_stack_top;
-	cont->continuation.lisp_frame_pointer = yk_lisp_frame_ptr;
-	cont->continuation.dynamic_bindings_stack_pointer = yk_dynamic_bindings_stack_top;
-	cont->continuation.bytecode_register = yk_bytecode_register;
-	cont->continuation.program_counter = YK_PTR(yk_bytecode_register)->bytecode.code + offset;
-	cont->continuation.exited = 0;
+		if (b1 == b2) {
+			child = yk_hamt_pair_node(shift + YK_TRIE_BITS, k1, v1, h1, k2, v2, h2, edit);
+			node = yk_make_trie_node(1U << b1, 2, edit);
+			node->trie_node.slots[1] = child;
+		} else {
+			node = yk_make_trie_node((1U << b1) | (1U << b2), 4, edit);
+			uint first = b1 < b2 ? 0 : 2;
+			node->trie_node.slots[first] = k1;
+			node->trie_node.slots[first + 1] = v1;
+			node->trie_node.slots[2 - first] = k2;
+			node->trie_node.slots[3 - first] = v2;
+		}
+	}
 
-	return cont;
+	YK_GC_UNPROTECT;
+	return node;
 }
 
-static YkObject yk_make_array(YkUint size, YkObject element) {
-	YkObject array = YK_NIL;
-	YK_GC_PROTECT2(element, array);
-	array = yk_alloc();
+static YkObject yk_hamt_ref(YkObject node, uint64_t hash, YkObject key, YkObject default_value) {
+	for (uint shift = 0; node != NULL; shift += YK_TRIE_BITS) {
+		YkObject* slots = node->trie_node.slots;
 
-	array->array.t = yk_t_array;
-	array->array.size = size;
-	array->array.capacity = size;
-	array->array.dummy = YK_NIL;
-	array->array.data = NULL;
+		if (shift >= YK_HAMT_MAX_SHIFT) {
+			for (uint i = 0; i < node->trie_node.size; i += 2) {
+				if (yk_equal(slots[i], key))
+					return slots[i + 1];
+			}
 
-	array->array.data = yk_array_allocator_alloc(size * sizeof(YkObject));
+			return default_value;
+		}
 
-	for (uint i = 0; i < size; i++) {
-		array->array.data[i] = element;
+		uint32_t bit = 1U << ((hash >> shift) & YK_TRIE_MASK);
+		if (!(node->trie_node.bitmap & bit))
+			return default_value;
+
+		uint index = 2 * yk_popcount(node->trie_node.bitmap & (bit - 1));
+		if (slots[index] == NULL)
+			node = slots[index + 1];
+		else if (yk_equal(slots[index], key))
+			return slots[index + 1];
+		else
+			return default_value;
+	}
+
+	return default_value;
+}
+
+/* Returns `node' (or NULL) with `key' bound to `value', sharing all it can.
+ * Nodes owned by the transient `edit' are changed in place. */
+static YkObject yk_hamt_set(YkObject node, uint shift, uint64_t hash, YkObject key,
+							YkObject value, uint32_t edit, bool* added) {
+	YkObject child = YK_NIL;
+	YK_GC_PROTECT4(node, key, value, child);
+
+	if (node == NULL) {
+		*added = true;
+		uint32_t bitmap = shift >= YK_HAMT_MAX_SHIFT ? 0 : 1U << ((hash >> shift) & YK_TRIE_MASK);
+
+		node = yk_make_trie_node(bitmap, 2, edit);
+		node->trie_node.slots[0] = key;
+		node->trie_node.slots[1] = value;
+	} else if (shift >= YK_HAMT_MAX_SHIFT) {
+		uint i;
+		for (i = 0; i < node->trie_node.size && !yk_equal(node->trie_node.slots[i], key); i += 2);
+
+		if (i == node->trie_node.size) {
+			*added = true;
+			node = yk_trie_node_resize(node, 0, i, 2, edit);
+			node->trie_node.slots[i] = key;
+			node->trie_node.slots[i + 1] = value;
+		} else if (node->trie_node.slots[i + 1] != value) {
+			node = yk_trie_node_editable(node, edit);
+			node->trie_node.slots[i + 1] = value;
+		}
+	} else {
+		uint32_t bitmap = node->trie_node.bitmap,
+			bit = 1U << ((hash >> shift) & YK_TRIE_MASK);
+		uint index = 2 * yk_popcount(bitmap & (bit - 1));
+
+		if (!(bitmap & bit)) {
+			*added = true;
+			node = yk_trie_node_resize(node, bitmap | bit, index, 2, edit);
+			node->trie_node.slots[index] = key;
+			node->trie_node.slots[index + 1] = value;
+		} else if (node->trie_node.slots[index] == NULL) {
+			child = node->trie_node.slots[index + 1];
+			YkObject new_child = yk_hamt_set(child, shift + YK_TRIE_BITS, hash, key, value,
+											 edit, added);
+			if (new_child != child) {
+				child = new_child;
+				node = yk_trie_node_editable(node, edit);
+				node->trie_node.slots[index + 1] = child;
+			}
+		} else if (yk_equal(node->trie_node.slots[index], key)) {
+			if (node->trie_node.slots[index + 1] != value) {
+				node = yk_trie_node_editable(node, edit);
+				node->trie_node.slots[index + 1] = value;
+			}
+		} else {
+			YkObject other = node->trie_node.slots[index];
+
+			*added = true;
+			child = yk_hamt_pair_node(shift + YK_TRIE_BITS,
+									  other, node->trie_node.slots[index + 1], yk_hamt_hash(other),
+									  key, value, hash, edit);
+			node = yk_trie_node_editable(node, edit);
+			node->trie_node.slots[index] = NULL;
+			node->trie_node.slots[index + 1] = child;
+		}
 	}
 
 	YK_GC_UNPROTECT;
-	return array;
+	return node;
 }
 
-static YkObject yk_make_string(const char* cstr, size_t cstr_size) {
-	YkObject string = yk_alloc();
-	YkUint size = cstr_size + 1;
+/* Returns `node' without `key', or NULL once it is empty */
+static YkObject yk_hamt_remove(YkObject node, uint shift, uint64_t hash, YkObject key,
+							   uint32_t edit, bool* removed) {
+	if (node == NULL)
+		return NULL;
 
-	string->string.t = yk_t_string;
-	string->string.size = size - 1;
-	string->string.data = yk_array_allocator_alloc(size);
-	memcpy(string->string.data, cstr, size - 1);
-	string->string.data[size - 1] = '\0';
-	string->string.dummy = YK_NIL;
+	YkObject child = YK_NIL;
+	YK_GC_PROTECT3(node, key, child);
 
-	return string;
+	if (shift >= YK_HAMT_MAX_SHIFT) {
+		uint i;
+		for (i = 0; i < node->trie_node.size && !yk_equal(node->trie_node.slots[i], key); i += 2);
+
+		if (i < node->trie_node.size) {
+			*removed = true;
+			node = node->trie_node.size == 2 ? NULL : yk_trie_node_resize(node, 0, i, -2, edit);
+		}
+	} else {
+		uint32_t bitmap = node->trie_node.bitmap,
+			bit = 1U << ((hash >> shift) & YK_TRIE_MASK);
+		uint index = 2 * yk_popcount(bitmap & (bit - 1));
+		bool remove_entry = false;
+
+		if (!(bitmap & bit)) {
+			/* Not there */
+		} else if (node->trie_node.slots[index] == NULL) {
+			child = node->trie_node.slots[index + 1];
+			YkObject new_child = yk_hamt_remove(child, shift + YK_TRIE_BITS, hash, key,
+												edit, removed);
+			if (new_child == NULL) {
+				remove_entry = true;
+			} else if (new_child != child) {
+				child = new_child;
+				node = yk_trie_node_editable(node, edit);
+				node->trie_node.slots[index + 1] = child;
+			}
+		} else if (yk_equal(node->trie_node.slots[index], key)) {
+			*removed = true;
+			remove_entry = true;
+		}
+
+		if (remove_entry) {
+			node = bitmap == bit ? NULL :
+				yk_trie_node_resize(node, bitmap & ~bit, index, -2, edit);
+		}
+	}
+
+	YK_GC_UNPROTECT;
+	return node;
 }
 
-YkObject yk_cons(YkObject car, YkObject cdr) {
-	YK_GC_PROTECT2(car, cdr);
+static void yk_hamt_for_each(YkObject node, uint shift, YkObject function) {
+	if (node == NULL)
+		return;
 
-	YkObject o = yk_alloc();
-	o->cons.car = car;
-	o->cons.cdr = cdr;
+	YK_GC_PROTECT2(node, function);
+
+	for (uint i = 0; i < node->trie_node.size; i += 2) {
+		if (node->trie_node.slots[i] == NULL && shift < YK_HAMT_MAX_SHIFT) {
+			yk_hamt_for_each(node->trie_node.slots[i + 1], shift + YK_TRIE_BITS, function);
+		} else {
+			YkObject pair[2] = { node->trie_node.slots[i], node->trie_node.slots[i + 1] };
+			yk_apply_n(function, 2, pair);
+		}
+	}
 
 	YK_GC_UNPROTECT;
-	return YK_TAG_LIST(o);
 }
 
-#define BYTECODE_DEFAULT_SIZE 8
+static YkObject yk_make_persistent_map(YkUint count, YkObject root, uint32_t edit) {
+	YK_GC_PROTECT1(root);
 
-YkObject yk_make_bytecode_begin(YkObject name, YkInt nargs) {
-	YkObject bytecode = YK_NIL;
-	YK_GC_PROTECT2(bytecode, name);		/* This function can GC */
+	YkObject map = yk_alloc();
+	map->persistent_map.t = yk_t_persistent_map;
+	map->persistent_map.dummy = YK_NIL;
+	map->persistent_map.count = count;
+	map->persistent_map.root = root;
+	map->persistent_map.edit = edit;
 
-	bytecode = yk_alloc();
-	bytecode->bytecode.name = name;
-	bytecode->bytecode.docstring = YK_NIL;
-	bytecode->bytecode.code = yk_array_allocator_alloc(8 * sizeof(YkInstruction));
-	bytecode->bytecode.code_size = 0;
-	bytecode->bytecode.code_capacity = 8;
-	bytecode->bytecode.nargs = nargs;
+	YK_GC_UNPROTECT;
+	return map;
+}
+
+/* Binds `key' in `map': in place for a transient, else in a new map */
+static YkObject yk_persistent_map_set(YkObject map, YkObject key, YkObject value) {
+	YK_GC_PROTECT1(map);
+
+	bool added = false;
+	uint32_t edit = map->persistent_map.edit;
+	YkObject root = yk_hamt_set(map->persistent_map.root, 0, yk_hamt_hash(key), key, value,
+								edit, &added);
+	YkUint count = map->persistent_map.count + (added ? 1 : 0);
+
+	if (edit != 0) {
+		map->persistent_map.root = root;
+		map->persistent_map.count = count;
+	} else if (root != map->persistent_map.root) {
+		map = yk_make_persistent_map(count, root, 0);
+	}
 
 	YK_GC_UNPROTECT;
-	return YK_TAG(bytecode, yk_t_bytecode);
+	return map;
 }
 
-void yk_bytecode_emit(YkObject bytecode, YkOpcode op, uint16_t modifier, YkObject ptr) {
-	YK_GC_PROTECT1(bytecode);
+static YkObject yk_persistent_map_remove(YkObject map, YkObject key) {
+	YK_GC_PROTECT1(map);
 
-	YK_ASSERT(YK_BYTECODEP(bytecode));
-	YkObject bytecode_ptr = YK_PTR(bytecode);
+	bool removed = false;
+	uint32_t edit = map->persistent_map.edit;
+	YkObject root = yk_hamt_remove(map->persistent_map.root, 0, yk_hamt_hash(key), key,
+								   edit, &removed);
+	YkUint count = map->persistent_map.count - (removed ? 1 : 0);
 
-	if (bytecode_ptr->bytecode.code_size >= bytecode_ptr->bytecode.code_capacity) {
-		bytecode_ptr->bytecode.code_capacity *= 2;
-		YkInstruction* old_code = bytecode_ptr->bytecode.code;
-		bytecode_ptr->bytecode.code = yk_array_allocator_alloc(sizeof(YkInstruction) * bytecode_ptr->bytecode.code_capacity);
-		memcpy(bytecode_ptr->bytecode.code, old_code, bytecode_ptr->bytecode.code_size * sizeof(YkInstruction));
+	if (edit != 0) {
+		map->persistent_map.root = root;
+		map->persistent_map.count = count;
+	} else if (removed) {
+		map = yk_make_persistent_map(count, root, 0);
 	}
 
-	YkInstruction* last_i = bytecode_ptr->bytecode.code + bytecode_ptr->bytecode.code_size++;
-	last_i->ptr = ptr;
-	last_i->modifier = modifier;
-	last_i->opcode = op;
 	YK_GC_UNPROTECT;
+	return map;
 }
 
-static YkObject yk_make_cpointer(void* cptr) {
-	YkObject obj = yk_alloc();
-	obj->pointer.dummy = YK_NIL;
-	obj->pointer.cpointer = cptr;
-	obj->pointer.t = yk_t_cpointer;
+static YkObject yk_make_persistent_vector(YkUint count, uint32_t shift, YkObject root,
+										  YkObject tail, uint32_t edit) {
+	YK_GC_PROTECT2(root, tail);
 
-	return obj;
+	YkObject vector = yk_alloc();
+	vector->persistent_vector.t = yk_t_persistent_vector;
+	vector->persistent_vector.dummy = YK_NIL;
+	vector->persistent_vector.count = count;
+	vector->persistent_vector.shift = shift;
+	vector->persistent_vector.root = root;
+	vector->persistent_vector.tail = tail;
+	vector->persistent_vector.edit = edit;
+
+	YK_GC_UNPROTECT;
+	return vector;
 }
 
-static void* yk_cpointer_value(YkObject cpointer) {
-	YK_ASSERT(cpointer->pointer.cpointer != NULL);
-	return cpointer->pointer.cpointer;
+static YkObject yk_make_empty_persistent_vector(uint32_t edit) {
+	YkObject root = YK_NIL, tail = YK_NIL;
+	YK_GC_PROTECT2(root, tail);
+
+	root = yk_make_trie_node(0, YK_TRIE_WIDTH, edit);
+	tail = yk_make_trie_node(0, YK_TRIE_WIDTH, edit);
+	YkObject vector = yk_make_persistent_vector(0, YK_TRIE_BITS, root, tail, edit);
+
+	YK_GC_UNPROTECT;
+	return vector;
 }
 
-static YkObject yk_nreverse(YkObject list) {
-	YK_ASSERT(YK_LISTP(list));
+/* Index of the first element stored in the tail */
+static inline YkUint yk_pvector_tail_offset(YkUint count) {
+	return count < YK_TRIE_WIDTH ? 0 : ((count - 1) >> YK_TRIE_BITS) << YK_TRIE_BITS;
+}
 
-	YkObject current = list,
-		next, previous = YK_NIL,
-		last = YK_NIL;
+/* Leaf node holding element `i' */
+static YkObject yk_pvector_leaf(YkObject vector, YkUint i) {
+	YkPersistentVector* v = &vector->persistent_vector;
 
-	while (current != YK_NIL) {
-		next = YK_CDR(current);
-		YK_CDR(current) = previous;
-		previous = current;
-		last = current;
-		current = next;
+	if (i >= yk_pvector_tail_offset(v->count))
+		return v->tail;
+
+	YkObject node = v->root;
+	for (uint32_t level = v->shift; level > 0; level -= YK_TRIE_BITS) {
+		node = node->trie_node.slots[(i >> level) & YK_TRIE_MASK];
 	}
 
-	return last;
+	return node;
 }
 
-static YkObject yk_reverse(YkObject list) {
-	YkObject new_list = YK_NIL;
+static YkObject yk_pvector_ref(YkObject vector, YkUint i) {
+	YK_ASSERT(i < vector->persistent_vector.count);
+	return yk_pvector_leaf(vector, i)->trie_node.slots[i & YK_TRIE_MASK];
+}
 
-	YK_GC_PROTECT2(new_list, list);
+static YkObject yk_pvector_set_in(YkObject node, uint32_t level, YkUint i, YkObject value,
+								  uint32_t edit) {
+	YkObject child = YK_NIL;
+	YK_GC_PROTECT3(node, value, child);
 
-	YK_LIST_FOREACH(list, l) {
-		new_list = yk_cons(YK_CAR(l), new_list);
+	node = yk_trie_node_editable(node, edit);
+	if (level == 0) {
+		node->trie_node.slots[i & YK_TRIE_MASK] = value;
+	} else {
+		uint subindex = (i >> level) & YK_TRIE_MASK;
+		child = yk_pvector_set_in(node->trie_node.slots[subindex], level - YK_TRIE_BITS,
+								  i, value, edit);
+		node->trie_node.slots[subindex] = child;
 	}
 
 	YK_GC_UNPROTECT;
-	return new_list;
+	return node;
 }
 
-static YkObject yk_delete(YkObject element, YkObject partial_list) {
-	YkObject final_list = partial_list,
-		previous = YK_NIL;
-
-	if (partial_list == YK_NIL)
-		return YK_NIL;
+/* Path of single-child nodes from `level' down to `leaf' */
+static YkObject yk_pvector_new_path(uint32_t level, YkObject leaf, uint32_t edit) {
+	if (level == 0)
+		return leaf;
 
-	for (YkObject pair = partial_list; pair != YK_NIL; pair = YK_CDR(pair)) {
-		if (YK_CAR(pair) == element) {
-			if (pair == final_list) {
-				final_list = YK_CDR(pair);
-			} else {
-				YK_CDR(previous) = YK_CDR(pair);
-			}
-		}
+	YkObject node = YK_NIL;
+	YK_GC_PROTECT2(leaf, node);
 
-		previous = pair;
-	}
+	leaf = yk_pvector_new_path(level - YK_TRIE_BITS, leaf, edit);
+	node = yk_make_trie_node(0, YK_TRIE_WIDTH, edit);
+	node->trie_node.slots[0] = leaf;
 
-	return final_list;
+	YK_GC_UNPROTECT;
+	return node;
 }
 
-#define IS_BLANK(x) ((x) == ' ' || (x) == '\n' || (x) == '\t')
+/* Appends the full `leaf' to the tree of a vector of `count' elements */
+static YkObject yk_pvector_push_leaf(YkUint count, uint32_t level, YkObject parent,
+									 YkObject leaf, uint32_t edit) {
+	YkObject child = YK_NIL;
+	YK_GC_PROTECT3(parent, leaf, child);
 
-static YkToken yk_read_get_token(const char* string, uint32_t *offset) {
-start:
-	for (; IS_BLANK(string[*offset]); (*offset)++);
+	uint subindex = ((count - 1) >> level) & YK_TRIE_MASK;
+	parent = yk_trie_node_editable(parent, edit);
 
-	char a = string[(*offset)++];
-	YkToken token;
+	if (level == YK_TRIE_BITS) {
+		child = leaf;
+	} else if (parent->trie_node.slots[subindex] != NULL) {
+		child = yk_pvector_push_leaf(count, level - YK_TRIE_BITS,
+									 parent->trie_node.slots[subindex], leaf, edit);
+	} else {
+		child = yk_pvector_new_path(level - YK_TRIE_BITS, leaf, edit);
+	}
 
-	if (a == '(') {
-		token.type = YK_TOKEN_LEFT_PAREN;
-		return token;
-	} else if (a == ')') {
-		token.type = YK_TOKEN_RIGHT_PAREN;
-		return token;
-	} else if (a == '"') {
-		uint32_t begin_index = *offset;
+	parent->trie_node.slots[subindex] = child;
 
-		while (true) {
-			a = string[(*offset)++];
-
-			if (a == '"') {
-				YkToken t;
-				t.type = YK_TOKEN_STRING;
-				t.data.string_info.size = *offset - begin_index - 1;
-				t.data.string_info.begin_index = begin_index;
-				return t;
-			} else if (a == '\0') {
-				YK_ASSERT("No closing double quote" && 0);
-			}
-		}
-	} else if (a == '\0') {
-		token.type = YK_TOKEN_EOF;
-		return token;
-	} else if (a == '.') {
-		token.type = YK_TOKEN_DOT;
-		return token;
-	} else if (a == '\'') {
-		token.type = YK_TOKEN_QUOTE;
-		return token;
-	} else if (a == ';') {
-		char b;
-		do {
-			b = string[(*offset)++];
-		} while(b != '\n' || b == '\0');
-		goto start;
-	} else {
-		uint32_t begin_index = *offset - 1;
+	YK_GC_UNPROTECT;
+	return parent;
+}
 
-		while (true) {
-			a = string[(*offset)++];
+/* Removes the last leaf from the tree of a vector of `count' elements,
+ * returning NULL if nothing is left under `node' */
+static YkObject yk_pvector_pop_leaf(YkUint count, uint32_t level, YkObject node, uint32_t edit) {
+	YkObject child = YK_NIL;
+	YK_GC_PROTECT2(node, child);
 
-			if (IS_BLANK(a) || a == '(' || a == ')' ||
-				a == '"' || a == '\0')
-			{
-				uint32_t size = *offset - begin_index - 1;
-
-				YkInt integer;
-				double dfloating;
-
-				int type = parse_number(string + begin_index, size, &integer, &dfloating);
-
-				(*offset)--;
-
-				if (type == 0) {
-					token.type = YK_TOKEN_INT;
-					token.data.integer = integer;
-					return token;
-				} else if (type == 1) {
-					token.type = YK_TOKEN_FLOAT;
-					token.data.floating = dfloating;
-					return token;
-				} else {
-					token.type = YK_TOKEN_SYMBOL;
-					token.data.string_info.begin_index = begin_index;
-					token.data.string_info.size = size;
-					return token;
-				}
-			}
+	uint subindex = ((count - 2) >> level) & YK_TRIE_MASK;
+
+	if (level > YK_TRIE_BITS) {
+		child = yk_pvector_pop_leaf(count, level - YK_TRIE_BITS,
+									node->trie_node.slots[subindex], edit);
+		if (child == NULL && subindex == 0) {
+			node = NULL;
+		} else {
+			node = yk_trie_node_editable(node, edit);
+			node->trie_node.slots[subindex] = child;
 		}
+	} else if (subindex == 0) {
+		node = NULL;
+	} else {
+		node = yk_trie_node_editable(node, edit);
+		node->trie_node.slots[subindex] = NULL;
 	}
+
+	YK_GC_UNPROTECT;
+	return node;
 }
 
-static YkObject yk_read_parse_expression(const char* string, uint32_t* offset);
+/* The vector operations below work in place on transients, and return a
+ * new vector otherwise. */
+static YkObject yk_pvector_set(YkObject vector, YkUint i, YkObject value) {
+	YkPersistentVector* v = &vector->persistent_vector;
+	YK_ASSERT(i < v->count);
 
-static YkObject yk_read_parse_sexp(const char* string, uint32_t* offset) {
-	YkObject list = YK_NIL;
-	YK_GC_PROTECT1(list);
+	YkObject root = v->root, tail = v->tail;
+	YK_GC_PROTECT4(vector, value, root, tail);
+
+	uint32_t edit = v->edit;
+	if (i >= yk_pvector_tail_offset(v->count)) {
+		tail = yk_trie_node_editable(tail, edit);
+		tail->trie_node.slots[i & YK_TRIE_MASK] = value;
+	} else {
+		root = yk_pvector_set_in(root, vector->persistent_vector.shift, i, value, edit);
+	}
 
-	uint32_t new_offset = *offset;
-	YkToken	t = yk_read_get_token(string, &new_offset);
+	v = &vector->persistent_vector;
+	if (edit != 0) {
+		v->root = root;
+		v->tail = tail;
+	} else {
+		vector = yk_make_persistent_vector(v->count, v->shift, root, tail, 0);
+	}
 
-	if (t.type == YK_TOKEN_RIGHT_PAREN) {
-		*offset = new_offset;
-		return list;
-	} else if (t.type == YK_TOKEN_DOT) {
-		YkObject temp;
-		YK_GC_PROTECT1(temp);
+	YK_GC_UNPROTECT;
+	return vector;
+}
 
-		*offset = new_offset;
-		list = yk_read_parse_expression(string, offset);
+static YkObject yk_pvector_push(YkObject vector, YkObject value) {
+	YkPersistentVector* v = &vector->persistent_vector;
+	YkObject root = v->root, tail = v->tail, new_root = YK_NIL;
+	YK_GC_PROTECT5(vector, value, root, tail, new_root);
 
-		t = yk_read_get_token(string, offset);
-		YK_ASSERT(t.type == YK_TOKEN_RIGHT_PAREN);
+	uint32_t edit = v->edit, shift = v->shift;
+	YkUint count = v->count;
 
-		YK_GC_UNPROTECT;
+	if (count - yk_pvector_tail_offset(count) < YK_TRIE_WIDTH) {
+		tail = yk_trie_node_editable(tail, edit);
+		tail->trie_node.slots[count & YK_TRIE_MASK] = value;
 	} else {
-		YkObject temp;
-		YK_GC_PROTECT1(temp);
+		/* The tail is full: it moves into the tree */
+		if ((count >> YK_TRIE_BITS) > (1U << shift)) {
+			new_root = yk_make_trie_node(0, YK_TRIE_WIDTH, edit);
+			new_root->trie_node.slots[0] = root;
+			root = new_root;
+			new_root = yk_pvector_new_path(shift, tail, edit);
+			root->trie_node.slots[1] = new_root;
+			shift += YK_TRIE_BITS;
+		} else {
+			root = yk_pvector_push_leaf(count, shift, root, tail, edit);
+		}
 
-		temp = yk_read_parse_expression(string, offset);
-		list = yk_cons(temp, yk_read_parse_sexp(string, offset));
+		tail = yk_make_trie_node(0, YK_TRIE_WIDTH, edit);
+		tail->trie_node.slots[0] = value;
+	}
 
-		YK_GC_UNPROTECT;
+	if (edit != 0) {
+		v = &vector->persistent_vector;
+		v->root = root;
+		v->tail = tail;
+		v->shift = shift;
+		v->count = count + 1;
+	} else {
+		vector = yk_make_persistent_vector(count + 1, shift, root, tail, 0);
 	}
 
 	YK_GC_UNPROTECT;
-	return list;
+	return vector;
 }
 
-static YkObject yk_read_parse_expression(const char* string, uint32_t* offset) {
-    YkToken t = yk_read_get_token(string, offset);
-
-	switch (t.type) {
-	case YK_TOKEN_LEFT_PAREN:
-		return yk_read_parse_sexp(string, offset);
-	case YK_TOKEN_QUOTE:
-		return yk_cons(yk_keyword_quote, yk_cons(yk_read_parse_expression(string, offset), YK_NIL));
-	case YK_TOKEN_STRING:
-		return yk_make_string(string + t.data.string_info.begin_index,
-							  t.data.string_info.size);
-	case YK_TOKEN_INT:
-		return YK_MAKE_INT(t.data.integer);
-	case YK_TOKEN_FLOAT:
-		return YK_MAKE_FLOAT(t.data.floating);
-	case YK_TOKEN_SYMBOL:
-		return yk_make_symbol(string + t.data.string_info.begin_index,
-							  t.data.string_info.size);
-	default:
-		YK_ASSERT("Unexpected token" && 0);
+static YkObject yk_pvector_pop(YkObject vector) {
+	YkPersistentVector* v = &vector->persistent_vector;
+	YK_ASSERT(v->count > 0);
+
+	YkObject root = v->root, tail = v->tail;
+	YK_GC_PROTECT3(vector, root, tail);
+
+	uint32_t edit = v->edit, shift = v->shift;
+	YkUint count = v->count;
+
+	if (count == 1) {
+		tail = yk_trie_node_editable(tail, edit);
+		tail->trie_node.slots[0] = NULL;
+	} else if (count - yk_pvector_tail_offset(count) > 1) {
+		tail = yk_trie_node_editable(tail, edit);
+		tail->trie_node.slots[(count - 1) & YK_TRIE_MASK] = NULL;
+	} else {
+		/* The last leaf of the tree becomes the tail */
+		tail = yk_pvector_leaf(vector, count - 2);
+		root = yk_pvector_pop_leaf(count, shift, root, edit);
+
+		if (root == NULL) {
+			root = yk_make_trie_node(0, YK_TRIE_WIDTH, edit);
+		} else if (shift > YK_TRIE_BITS && root->trie_node.slots[1] == NULL) {
+			root = root->trie_node.slots[0];
+			shift -= YK_TRIE_BITS;
+		}
 	}
 
-	return YK_NIL;
+	if (edit != 0) {
+		v = &vector->persistent_vector;
+		v->root = root;
+		v->tail = tail;
+		v->shift = shift;
+		v->count = count - 1;
+	} else {
+		vector = yk_make_persistent_vector(count - 1, shift, root, tail, 0);
+	}
+
+	YK_GC_UNPROTECT;
+	return vector;
 }
 
-static YkObject yk_read_parse_top(const char* string, uint32_t* offset) {
-	YkObject list = YK_NIL, element = YK_NIL;
-	YK_GC_PROTECT2(list, element);
+static YkObject yk_builtin_persistent_map(YkUint nargs) {
+	YK_ASSERT(nargs % 2 == 0);
 
-	uint32_t new_offset  = *offset;
-	YkToken	t = yk_read_get_token(string, &new_offset);
+	YkObject map = yk_make_persistent_map(0, NULL, ++yk_transient_counter);
+	YK_GC_PROTECT1(map);
 
-	if (t.type != YK_TOKEN_EOF) {
-		element = yk_read_parse_expression(string, offset);
-		list = yk_cons(element, yk_read_parse_top(string, offset));
+	for (uint i = 0; i < nargs; i += 2) {
+		yk_persistent_map_set(map, yk_lisp_stack_top[i], yk_lisp_stack_top[i + 1]);
 	}
 
+	map->persistent_map.edit = 0;
+
 	YK_GC_UNPROTECT;
-	return list;
+	return map;
 }
 
-YkObject yk_read(const char* string) {
-	uint32_t offset = 0;
-	YkObject r = yk_read_parse_top(string, &offset);
-	return YK_CAR(r);
+static YkObject yk_builtin_pmap_ref(YkUint nargs) {
+	YkObject map = yk_lisp_stack_top[0],
+		key = yk_lisp_stack_top[1];
+	YK_ASSERT(YK_PERSISTENT_MAPP(map));
+
+	return yk_hamt_ref(map->persistent_map.root, yk_hamt_hash(key), key,
+					   nargs > 2 ? yk_lisp_stack_top[2] : YK_NIL);
 }
 
-void yk_print(YkObject o) {
-	YkObject output = YK_PTR(yk_var_output)->symbol.value;
+static YkObject yk_builtin_pmap_set(YkUint nargs) {
+	YkObject map = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_PERSISTENT_MAPP(map) && map->persistent_map.edit == 0);
 
-	switch (YK_TYPEOF(o)) {
-	case yk_t_list:
-		if (YK_NULL(o)) {
-			yk_stream_format(output, "nil");
-		} else {
-			YkObject c;
-			yk_stream_format(output, "(");
+	return yk_persistent_map_set(map, yk_lisp_stack_top[1], yk_lisp_stack_top[2]);
+}
 
-			for (c = o; YK_CONSP(c); c = YK_CDR(c)) {
-				yk_print(YK_CAR(c));
+static YkObject yk_builtin_pmap_remove(YkUint nargs) {
+	YkObject map = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_PERSISTENT_MAPP(map) && map->persistent_map.edit == 0);
 
-				if (YK_CONSP(YK_CDR(c)))
-					yk_stream_format(output, " ");
-			}
+	return yk_persistent_map_remove(map, yk_lisp_stack_top[1]);
+}
 
-			if (!YK_NULL(c)) {
-				yk_stream_format(output, " . ");
-				yk_print(c);
-			}
+static YkObject yk_builtin_pmap_set_transient(YkUint nargs) {
+	YkObject map = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_PERSISTENT_MAPP(map) && map->persistent_map.edit != 0);
 
-			yk_stream_format(output, ")");
-		}
-		break;
-	case yk_t_int:
-		yk_stream_format(output, "%ld", yk_signed_fixnum_to_long(YK_INT(o)));
-		break;
-	case yk_t_float:
-		yk_stream_format(output, "%f", YK_FLOAT(o));
-		break;
-	case yk_t_symbol:
-		yk_stream_format(output, "%s", yk_symbol_cstr(o));
-		break;
-	case yk_t_bytecode:
-		yk_stream_format(output, "<bytecode %s at %p>",
-						 yk_symbol_cstr(YK_PTR(o)->bytecode.name),
-						 YK_PTR(o));
-		break;
-	case yk_t_closure:
-		yk_stream_format(output, "<closure at %p closing ", YK_PTR(o));
-		yk_print(YK_PTR(o)->closure.lexical_env);
-		yk_stream_format(output, ">");
-		break;
-	case yk_t_c_proc:
-#if YK_PROFILE
-		yk_stream_format(output, "<compiled-function %s at %p (called %ld times totaling %g s)>",
-						 yk_symbol_cstr(YK_PTR(o)->c_proc.name),
-						 YK_PTR(o), YK_PTR(o)->c_proc.calls,
-						 (YK_PTR(o)->c_proc.time_called) / CLOCKS_PER_SEC);
-#else
-		yk_stream_format(output, "<compiled-function %s at %p>",
-						 yk_symbol_cstr(YK_PTR(o)->c_proc.name),
-						 YK_PTR(o));
-#endif
-		break;
-	case yk_t_array:
-		yk_stream_format(output, "[");
-		for (uint i = 0; i < YK_PTR(o)->array.size; i++) {
-			yk_print(YK_PTR(o)->array.data[i]);
+	return yk_persistent_map_set(map, yk_lisp_stack_top[1], yk_lisp_stack_top[2]);
+}
 
-			if (i != YK_PTR(o)->array.size - 1)
-				yk_stream_format(output, " ");
-		}
-		yk_stream_format(output, "]");
-		break;
-	case yk_t_string:
-		yk_stream_format(output, "\"");
-		yk_stream_format(output, "%s\"", YK_PTR(o)->string.data);
-		break;
-	case yk_t_file_stream:
-		yk_stream_format(output, "<file stream at %p>", YK_PTR(o));
-		break;
-	case yk_t_string_stream:
-		yk_stream_format(output, "<string stream at %p>", YK_PTR(o));
-		break;
-	case yk_t_continuation:
-		yk_stream_format(output, "<continuation at %p>", YK_PTR(o));
-		break;
-	case yk_t_cpointer:
-		yk_stream_format(output, "<foreign pointer at %p>", YK_PTR(o));
-		break;
-	case yk_t_instance:
-		if (YK_CLASS_INVALID(YK_CLASS_OF(o))) {
-			yk_stream_format(output, "<invalid instance at %p>", YK_PTR(o));
-		} else {
-			yk_stream_format(output, "<%s at %p>", yk_symbol_cstr(YK_CLASS_NAME(YK_CLASS_OF(o))),
-							 YK_PTR(o));
-		}
-		break;
-	default:
-		yk_stream_format(output, "Unknown type 0x%lx!\n", YK_TYPEOF(o));
-	}
+static YkObject yk_builtin_pmap_remove_transient(YkUint nargs) {
+	YkObject map = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_PERSISTENT_MAPP(map) && map->persistent_map.edit != 0);
+
+	return yk_persistent_map_remove(map, yk_lisp_stack_top[1]);
 }
 
-static inline void yk_exit_continuation(YkObject exit, YkObject* cont_stack_top) {
-	YK_ASSERT(!(YK_PTR(exit)->continuation.exited));
+static YkObject yk_builtin_pmap_count(YkUint nargs) {
+	YkObject map = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_PERSISTENT_MAPP(map));
 
-	for (YkObject* o_ptr = yk_continuations_stack_top; o_ptr != cont_stack_top; o_ptr++) {
-		YK_PTR(*o_ptr)->continuation.exited = 1;
-	}
+	return YK_MAKE_INT(map->persistent_map.count);
+}
 
-	yk_continuations_stack_top = cont_stack_top;
+static YkObject yk_builtin_pmap_for_each(YkUint nargs) {
+	YkObject map = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_PERSISTENT_MAPP(map));
 
-	YkDynamicBinding* ptr = yk_dynamic_bindings_stack_top;
-	YkDynamicBinding* next_ptr = YK_PTR(exit)->continuation.dynamic_bindings_stack_pointer;
-	for (; ptr != next_ptr; ptr++) { /* todo */
-		YK_PTR(ptr->symbol)->symbol.value = ptr->old_value;
+	yk_hamt_for_each(map->persistent_map.root, 0, yk_lisp_stack_top[1]);
+	return YK_NIL;
+}
+
+static YkObject yk_builtin_persistent_vector(YkUint nargs) {
+	YkObject vector = yk_make_empty_persistent_vector(++yk_transient_counter);
+	YK_GC_PROTECT1(vector);
+
+	for (uint i = 0; i < nargs; i++) {
+		yk_pvector_push(vector, yk_lisp_stack_top[i]);
 	}
 
-	yk_dynamic_bindings_stack_top = YK_PTR(exit)->continuation.dynamic_bindings_stack_pointer;
-	yk_lisp_stack_top = YK_PTR(exit)->continuation.lisp_stack_pointer;
-	yk_lisp_frame_ptr = YK_PTR(exit)->continuation.lisp_frame_pointer;
-	yk_bytecode_register = YK_PTR(exit)->continuation.bytecode_register;
-	yk_program_counter = YK_PTR(exit)->continuation.program_counter;
+	vector->persistent_vector.edit = 0;
 
-	YK_PTR(exit)->continuation.exited = 1;
+	YK_GC_UNPROTECT;
+	return vector;
 }
 
-static void yk_debug_info() {
-	printf("\n ______STACK_____\n");
-	YkObject* stack_ptr = yk_lisp_stack_top,
-		*frame_ptr = yk_lisp_frame_ptr;
-	if (yk_lisp_stack_top - yk_lisp_stack < YK_STACK_MAX_SIZE) {
-		while (stack_ptr < yk_lisp_stack + YK_STACK_MAX_SIZE) {
-			for (; stack_ptr != frame_ptr; stack_ptr++) {
-				printf(" | ");
-				yk_print(*stack_ptr);
-				printf("\t\t|\n");
-			}
+static YkObject yk_builtin_pvector_ref(YkUint nargs) {
+	YkObject vector = yk_lisp_stack_top[0],
+		index = yk_lisp_stack_top[1];
+	YK_ASSERT(YK_PERSISTENT_VECTORP(vector) && YK_INTP(index) && YK_INT(index) >= 0);
 
-			if (frame_ptr != yk_lisp_stack + YK_STACK_MAX_SIZE) {
-				printf(" | RET ");
-				yk_print(stack_ptr[2]);
-				printf("\t|\n");
-			}
+	return yk_pvector_ref(vector, YK_INT(index));
+}
 
-			frame_ptr = (YkObject*)*stack_ptr;
-			stack_ptr += 3;
-		}
-	}
-	else {
-		printf(" | EMPTY\t|\n");
-	}
-	printf(" ----------------\n");
+static YkObject yk_builtin_pvector_set(YkUint nargs) {
+	YkObject vector = yk_lisp_stack_top[0],
+		index = yk_lisp_stack_top[1];
+	YK_ASSERT(YK_PERSISTENT_VECTORP(vector) && vector->persistent_vector.edit == 0 &&
+			  YK_INTP(index) && YK_INT(index) >= 0);
 
-	printf("VALUE: ");
-	yk_print(yk_value_register);
-	printf("\n");
+	return yk_pvector_set(vector, YK_INT(index), yk_lisp_stack_top[2]);
 }
 
-static void yk_go_back(YkObject value, int code) {
-	assert(yk_jump_stack_size > 0);
-	yk_value_register = value;
-	yk_jump_stack_size = 0;
+static YkObject yk_builtin_pvector_push(YkUint nargs) {
+	YkObject vector = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_PERSISTENT_VECTORP(vector) && vector->persistent_vector.edit == 0);
 
-	longjmp(yk_jump_point, code);
+	return yk_pvector_push(vector, yk_lisp_stack_top[1]);
 }
 
-#define YK_RUN_DEBUG 0
+static YkObject yk_builtin_pvector_pop(YkUint nargs) {
+	YkObject vector = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_PERSISTENT_VECTORP(vector) && vector->persistent_vector.edit == 0);
 
-int yk_run(YkObject bytecode) {
-	YK_ASSERT(YK_BYTECODEP(bytecode));
+	return yk_pvector_pop(vector);
+}
 
-	yk_program_counter = YK_PTR(bytecode)->bytecode.code;
-	yk_bytecode_register = bytecode;
+static YkObject yk_builtin_pvector_set_transient(YkUint nargs) {
+	YkObject vector = yk_lisp_stack_top[0],
+		index = yk_lisp_stack_top[1];
+	YK_ASSERT(YK_PERSISTENT_VECTORP(vector) && vector->persistent_vector.edit != 0 &&
+			  YK_INTP(index) && YK_INT(index) >= 0);
 
-	int return_code = 0;
-	YkObject local_exit_cont = yk_make_continuation(YK_PTR(bytecode)->bytecode.code_size - 1);
-	YK_GC_PROTECT1(local_exit_cont);
+	return yk_pvector_set(vector, YK_INT(index), yk_lisp_stack_top[2]);
+}
 
-	if (yk_jump_stack_size == 0) {
-		int code = setjmp(yk_jump_point);
-		if (code == 1) {
-			yk_exit_continuation(local_exit_cont, yk_continuations_stack + YK_STACK_MAX_SIZE);
-			yk_jump_stack_size++;
-			return_code = -1;
-			goto end;
-		} else if (code == 2) {
-			printf("Jumped!\n");
-		}
-	}
+static YkObject yk_builtin_pvector_push_transient(YkUint nargs) {
+	YkObject vector = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_PERSISTENT_VECTORP(vector) && vector->persistent_vector.edit != 0);
 
-	yk_jump_stack_size++;
+	return yk_pvector_push(vector, yk_lisp_stack_top[1]);
+}
 
-start:
-	switch (yk_program_counter->opcode) {
-	case YK_OP_FETCH_LITERAL:
-		yk_value_register = yk_program_counter->ptr;
-		yk_program_counter++;
-		break;
-	case YK_OP_FETCH_GLOBAL:
-	{
-		YkObject val = YK_PTR(yk_program_counter->ptr)->symbol.value;
-		YK_ASSERT(val != NULL);	/* Unbound variable */
-		yk_value_register = val;
-		yk_program_counter++;
-	}
-		break;
-	case YK_OP_LEXICAL_VAR:
-		yk_value_register = yk_lisp_stack_top[yk_program_counter->modifier];
-		yk_program_counter++;
-		break;
-	case YK_OP_PUSH:
-		if (yk_lisp_stack_top <= yk_lisp_stack)
-			panic("Stack overflow!\n");
+static YkObject yk_builtin_pvector_pop_transient(YkUint nargs) {
+	YkObject vector = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_PERSISTENT_VECTORP(vector) && vector->persistent_vector.edit != 0);
 
-		YK_LISP_STACK_PUSH(yk_value_register);
-		yk_program_counter++;
-		break;
-	case YK_OP_PREPARE_CALL:
-	{
-		YkInstruction* next_instruction =
-			YK_PTR(yk_bytecode_register)->bytecode.code + yk_program_counter->modifier;
+	return yk_pvector_pop(vector);
+}
 
-		YK_LISP_STACK_PUSH(yk_bytecode_register);
-		YK_LISP_STACK_PUSH(next_instruction);
-		YK_LISP_STACK_PUSH(yk_lisp_frame_ptr);
+static YkObject yk_builtin_pvector_count(YkUint nargs) {
+	YkObject vector = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_PERSISTENT_VECTORP(vector));
+
+	return YK_MAKE_INT(vector->persistent_vector.count);
+}
+
+static YkObject yk_builtin_pvector_to_list(YkUint nargs) {
+	YkObject vector = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_PERSISTENT_VECTORP(vector));
+
+	YkObject list = YK_NIL;
+	YK_GC_PROTECT1(list);
+
+	for (YkInt i = (YkInt)vector->persistent_vector.count - 1; i >= 0; i--) {
+		list = yk_cons(yk_pvector_ref(vector, i), list);
 	}
 
-		yk_lisp_frame_ptr = yk_lisp_stack_top;
-		yk_program_counter++;
-		break;
-	case YK_OP_CALL:
-		if (YK_CLOSUREP(yk_value_register)) {
-			YK_LISP_STACK_PUSH(YK_PTR(yk_value_register)->closure.lexical_env);
-			yk_value_register = YK_PTR(yk_value_register)->closure.bytecode;
+	YK_GC_UNPROTECT;
+	return list;
+}
 
-			goto bytecode_call_label;
-		}
-		else if (YK_BYTECODEP(yk_value_register)) {
-			YkObject code;
-			YkInt nargs;
+/* A transient shares the nodes of its source, copying them the first time
+ * it changes them and then changing its copies in place. */
+static YkObject yk_builtin_transient(YkUint nargs) {
+	YkObject collection = yk_lisp_stack_top[0];
 
-		bytecode_call_label:
-			code = yk_value_register;
-			nargs = YK_PTR(code)->bytecode.nargs;
-			if (nargs >= 0) {
-				YK_ASSERT(yk_program_counter->modifier == nargs);
-			} else {
-				YK_ASSERT(yk_program_counter->modifier >= -(nargs + 1));
-			}
+	if (YK_PERSISTENT_MAPP(collection)) {
+		YK_ASSERT(collection->persistent_map.edit == 0);
+		return yk_make_persistent_map(collection->persistent_map.count,
+									  collection->persistent_map.root, ++yk_transient_counter);
+	} else {
+		YK_ASSERT(YK_PERSISTENT_VECTORP(collection) && collection->persistent_vector.edit == 0);
+		YkPersistentVector* v = &collection->persistent_vector;
+		return yk_make_persistent_vector(v->count, v->shift, v->root, v->tail,
+										 ++yk_transient_counter);
+	}
+}
 
-			yk_bytecode_register = code;
-			yk_program_counter = YK_PTR(code)->bytecode.code;
-		}
-		else if (YK_CPROCP(yk_value_register)) {
-			YkObject proc = YK_PTR(yk_value_register);
-			YkInt nargs = proc->c_proc.nargs;
-			if (nargs >= 0) {
-				YK_ASSERT(yk_program_counter->modifier == nargs);
-			}
-			else {
-				YK_ASSERT(yk_program_counter->modifier >= -(nargs + 1));
-			}
+/* Freezes a transient: it may not be changed in place anymore */
+static YkObject yk_builtin_persistent(YkUint nargs) {
+	YkObject collection = yk_lisp_stack_top[0];
 
-			yk_value_register = proc->c_proc.cfun(yk_program_counter->modifier);
-			yk_lisp_stack_top = yk_lisp_frame_ptr;
+	if (YK_PERSISTENT_MAPP(collection)) {
+		YK_ASSERT(collection->persistent_map.edit != 0);
+		collection->persistent_map.edit = 0;
+	} else {
+		YK_ASSERT(YK_PERSISTENT_VECTORP(collection) && collection->persistent_vector.edit != 0);
+		collection->persistent_vector.edit = 0;
+	}
 
-			YK_LISP_STACK_POP(yk_lisp_frame_ptr, YkObject**);
-			YK_LISP_STACK_POP(yk_program_counter, YkInstruction**);
-			YK_LISP_STACK_POP(yk_bytecode_register, YkObject*);
-		}
-		else {
-			YK_ASSERT(0);
-		}
-		break;
-	case YK_OP_TAIL_CALL:
-		if (YK_CPROCP(yk_value_register)) {
-			YkObject proc = YK_PTR(yk_value_register);
-			YkInt nargs = proc->c_proc.nargs;
-			if (nargs >= 0) {
-				YK_ASSERT(yk_program_counter->modifier == nargs);
-			}
-			else {
-				YK_ASSERT(yk_program_counter->modifier >= -(nargs + 1));
-			}
+	return collection;
+}
 
-			yk_value_register = proc->c_proc.cfun(yk_program_counter->modifier);
-			yk_lisp_stack_top = yk_lisp_frame_ptr;
+static YkObject yk_builtin_make_symbol(YkUint nargs) {
+	YkObject string = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_TYPEOF(string) == yk_t_string);
 
-			YK_LISP_STACK_POP(yk_lisp_frame_ptr, YkObject**);
-			YK_LISP_STACK_POP(yk_program_counter, YkInstruction**);
-			YK_LISP_STACK_POP(yk_bytecode_register, YkObject*);
-		} else {
-			YkObject code;
-			YkInt nargs, argcount;
+	return yk_make_symbol_from_string(string);
+}
 
-			if (YK_CLOSUREP(yk_value_register)) {
-				YK_LISP_STACK_PUSH(YK_PTR(yk_value_register)->closure.lexical_env);
-				code = YK_PTR(yk_value_register)->closure.bytecode;
-				nargs = YK_PTR(code)->bytecode.nargs;
-				argcount = yk_program_counter->modifier + 1;
-			} else if (YK_BYTECODEP(yk_value_register)) {
-				code = yk_value_register;
-				nargs = YK_PTR(code)->bytecode.nargs;
-				argcount = yk_program_counter->modifier;
-			} else {
-				YK_ASSERT(0);
-			}
+static YkObject yk_builtin_symbol_string(YkUint nargs) {
+	YkObject symbol = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_SYMBOLP(symbol));
+	return YK_PTR(symbol)->symbol.name;
+}
 
-			if (nargs >= 0) {
-				YK_ASSERT(yk_program_counter->modifier == nargs);
-			} else {
-				YK_ASSERT(yk_program_counter->modifier >= -(nargs + 1));
-			}
+static YkObject yk_builtin_string_concat(YkUint nargs) {
+	YkUint total_size = 0, total_length = 0, j = 0;
 
-			YkObject* stack_ptr = yk_lisp_stack_top + argcount;
-			for (uint i = 0; i < argcount; i++) {
-				*(yk_lisp_frame_ptr - i - 1) = *(stack_ptr - i - 1);
-			}
+	for (uint i = 0; i < nargs; i++) {
+		YK_ASSERT(YK_TYPEOF(yk_lisp_stack_top[i]) == yk_t_string);
+		YkString* s = &YK_PTR(yk_lisp_stack_top[i])->string;
 
-			yk_lisp_stack_top = yk_lisp_frame_ptr - argcount;
+		total_size += s->size;
+		if (total_length != YK_STRING_LENGTH_UNKNOWN)
+			total_length = s->length == YK_STRING_LENGTH_UNKNOWN ?
+				YK_STRING_LENGTH_UNKNOWN : total_length + s->length;
+	}
 
-			yk_bytecode_register = code;
-			yk_program_counter = YK_PTR(code)->bytecode.code;
-		}
-		break;
-	case YK_OP_RET:
-		yk_lisp_stack_top = yk_lisp_frame_ptr;
-		YK_LISP_STACK_POP(yk_lisp_frame_ptr, YkObject**);
-		YK_LISP_STACK_POP(yk_program_counter, YkInstruction**);
-		YK_LISP_STACK_POP(yk_bytecode_register, YkObject*);
-		break;
-	case YK_OP_JMP:
-		yk_program_counter =
-			YK_PTR(yk_bytecode_register)->bytecode.code + yk_program_counter->modifier;
-		break;
-	case YK_OP_JNIL:
-		if (yk_value_register == YK_NIL) {
-			yk_program_counter =
-				YK_PTR(yk_bytecode_register)->bytecode.code + yk_program_counter->modifier;
-		}
-		else {
-			yk_program_counter++;
-		}
-		break;
-	case YK_OP_UNBIND:
-		yk_lisp_stack_top += yk_program_counter->modifier;
-		yk_program_counter++;
-		break;
-	case YK_OP_BIND_DYNAMIC:
-	{
-		YkObject sym = yk_program_counter->ptr;
-		yk_dynamic_bindings_stack_top--;
-		yk_dynamic_bindings_stack_top->symbol = sym;
-		yk_dynamic_bindings_stack_top->old_value = YK_PTR(sym)->symbol.value;
+	YkObject end_string = yk_alloc_string(total_size);
+	end_string->string.length = total_length;
 
-		YK_PTR(sym)->symbol.value = yk_value_register;
+	for (uint i = 0; i < nargs; i++) {
+		memcpy(end_string->string.data + j, yk_lisp_stack_top[i]->string.data,
+			   yk_lisp_stack_top[i]->string.size);
+		j += yk_lisp_stack_top[i]->string.size;
 	}
-		yk_program_counter++;
-		break;
-	case YK_OP_UNBIND_DYNAMIC:
+
+	return end_string;
+}
+
+static YkObject yk_builtin_make_file_stream(YkUint nargs) {
+	return yk_make_file_stream(yk_lisp_stack_top[0], yk_lisp_stack_top[1], NULL);
+}
+
+static YkObject yk_builtin_make_input_string_stream(YkUint nargs) {
+	YK_ASSERT(yk_lisp_stack_top[0]->t.t == yk_t_string);
+
+	return yk_make_input_string_stream(yk_string_to_c_str(yk_lisp_stack_top[0]));
+}
+
+static YkObject yk_builtin_make_output_string_stream(YkUint nargs) {
+	return yk_make_output_string_stream();
+}
+
+static YkObject yk_builtin_stream_string(YkUint nargs) {
+	YK_ASSERT(yk_lisp_stack_top[0]->t.t == yk_t_string_stream);
+	YK_ASSERT(!(yk_lisp_stack_top[0]->string_stream.flags & YK_STREAM_FINISHED_BIT));
+
+	return yk_stream_string(yk_lisp_stack_top[0]);
+}
+
+static YkObject yk_builtin_stream_read_byte(YkUint nargs) {
+	YkObject stream = yk_lisp_stack_top[0];
+	YkInt byte = yk_stream_read_byte(stream);
+
+	if (byte < 0)
+		return yk_symbol_eof;
+
+	return YK_MAKE_INT(byte);
+}
+
+static YkObject yk_builtin_stream_write_byte(YkUint nargs) {
+	YkObject stream = yk_lisp_stack_top[0],
+		byte = yk_lisp_stack_top[1];
+
+	yk_stream_write_byte(stream, YK_INT(byte));
+	return YK_NIL;
+}
+
+static YkObject yk_builtin_stream_read_char(YkUint nargs) {
+	YkObject stream = yk_lisp_stack_top[0];
+	YkInt character = yk_stream_read_char(stream);
+
+	if (character < 0)
+		return yk_symbol_eof;
+
+	return YK_MAKE_INT(character);
+}
+
+static void yk_assert_text_input_stream(YkObject stream) {
+	if (stream->t.t == yk_t_file_stream) {
+		YK_ASSERT(!(stream->file_stream.flags & YK_STREAM_FINISHED_BIT));
+		YK_ASSERT(stream->file_stream.flags & YK_STREAM_READ_BIT &&
+				  !(stream->file_stream.flags & YK_STREAM_BINARY_BIT));
+	} else {
+		YK_ASSERT(stream->t.t == yk_t_string_stream);
+		YK_ASSERT(!(stream->string_stream.flags & YK_STREAM_FINISHED_BIT));
+		YK_ASSERT(stream->string_stream.flags & YK_STREAM_READ_BIT &&
+				  !(stream->string_stream.flags & YK_STREAM_BINARY_BIT));
+	}
+}
+
+static void yk_reader_init_memory(YkReader* reader, const char* data, size_t size);
+
+/* (read stream), next form of a character input stream or eof */
+static YkObject yk_builtin_read(YkUint nargs) {
+	YkObject stream = yk_lisp_stack_top[0];
+	YkReader reader;
+	bool eof;
+	yk_assert_text_input_stream(stream);
+
+	if (stream->t.t == yk_t_file_stream) {
+		/* A byte at a time, so that only the lookahead has to be given back */
+		yk_reader_init_file(&reader, stream->file_stream.file_ptr, 1);
+	} else {
+		YkStringStream* ss = &stream->string_stream;
+		yk_reader_init_memory(&reader, ss->buffer + ss->read_bytes, ss->size - ss->read_bytes);
+	}
+
+	YkObject form = yk_read_form(&reader, &eof);
+
+	if (stream->t.t == yk_t_file_stream) {
+		if (reader.position < reader.size)
+			ungetc(reader.data[reader.position], stream->file_stream.file_ptr);
+	} else {
+		stream->string_stream.read_bytes += reader.position;
+	}
+
+	yk_reader_close(&reader);
+	return eof ? yk_symbol_eof : form;
+}
+
+static YkObject yk_builtin_stream_write_char(YkUint nargs) {
+	YkObject stream = yk_lisp_stack_top[0],
+		character = yk_lisp_stack_top[1];
+
+	yk_stream_write_char(stream, YK_INT(character));
+	return YK_NIL;
+}
+
+/* (read-bytes! stream array), fills a typed array with the raw elements of
+ * a binary input stream, returning how many were read */
+static YkObject yk_builtin_stream_read_bytes(YkUint nargs) {
+	YkObject stream = yk_lisp_stack_top[0],
+		array = yk_lisp_stack_top[1];
+	YK_ASSERT(stream->t.t == yk_t_file_stream);
+	YK_ASSERT(!(stream->file_stream.flags & YK_STREAM_FINISHED_BIT));
+	YK_ASSERT(stream->file_stream.flags & YK_STREAM_READ_BIT &&
+			  stream->file_stream.flags & YK_STREAM_BINARY_BIT);
+	YK_ASSERT(YK_TYPED_ARRAYP(array));
+
+	YkTypedArray* a = &YK_PTR(array)->typed_array;
+	YkUint element_size = yk_element_sizes[a->element_type];
+	FILE* file = stream->file_stream.file_ptr;
+	size_t count;
+
+	if (yk_typed_array_packed(a)) {
+		count = fread(a->data, element_size, a->size, file);
+	} else {
+		for (count = 0; count < a->size; count++) {
+			if (fread((char*)a->data + count * a->stride, element_size, 1, file) != 1)
+				break;
+		}
+	}
+
+	return YK_MAKE_INT(count);
+}
+
+/* (write-bytes! stream array), writes the raw elements of a typed array */
+static YkObject yk_builtin_stream_write_bytes(YkUint nargs) {
+	YkObject stream = yk_lisp_stack_top[0],
+		array = yk_lisp_stack_top[1];
+	YK_ASSERT(stream->t.t == yk_t_file_stream);
+	YK_ASSERT(!(stream->file_stream.flags & YK_STREAM_FINISHED_BIT));
+	YK_ASSERT(stream->file_stream.flags & YK_STREAM_WRITE_BIT &&
+			  stream->file_stream.flags & YK_STREAM_BINARY_BIT);
+	YK_ASSERT(YK_TYPED_ARRAYP(array));
+
+	YkTypedArray* a = &YK_PTR(array)->typed_array;
+	YkUint element_size = yk_element_sizes[a->element_type];
+	FILE* file = stream->file_stream.file_ptr;
+
+	if (yk_typed_array_packed(a)) {
+		if (fwrite(a->data, element_size, a->size, file) != a->size)
+			YK_ASSERT(0);
+	} else {
+		for (YkUint i = 0; i < a->size; i++) {
+			if (fwrite((char*)a->data + i * a->stride, element_size, 1, file) != 1)
+				YK_ASSERT(0);
+		}
+	}
+
+	return YK_NIL;
+}
+
+/* (read-line stream), next line of a character input stream without its
+ * newline, or eof */
+static YkObject yk_builtin_stream_read_line(YkUint nargs) {
+	YkObject stream = yk_lisp_stack_top[0];
+	yk_assert_text_input_stream(stream);
+
+	if (stream->t.t == yk_t_string_stream) {
+		YkStringStream* ss = &stream->string_stream;
+		if (ss->read_bytes >= ss->size)
+			return yk_symbol_eof;
+
+		char* line = ss->buffer + ss->read_bytes;
+		char* newline = memchr(line, '\n', ss->size - ss->read_bytes);
+		size_t length = newline != NULL ? (size_t)(newline - line) : ss->size - ss->read_bytes;
+
+		ss->read_bytes += length + (newline != NULL);
+		return yk_make_string(line, length);
+	}
+
+	FILE* file = stream->file_stream.file_ptr;
+	char small_line[256];
+	char* line = small_line;
+	size_t length = 0, capacity = sizeof(small_line);
+	int c;
+
+	while ((c = YK_GETC(file)) != EOF && c != '\n') {
+		if (length == capacity) {
+			capacity *= 2;
+
+			if (line == small_line) {
+				line = malloc(capacity);
+				memcpy(line, small_line, length);
+			} else {
+				line = realloc(line, capacity);
+			}
+		}
+
+		line[length++] = c;
+	}
+
+	YkObject result = c == EOF && length == 0 ?
+		yk_symbol_eof : yk_make_string(line, length);
+
+	if (line != small_line)
+		free(line);
+
+	return result;
+}
+
+/* (read-all stream), rest of a character input stream as a string */
+static YkObject yk_builtin_stream_read_all(YkUint nargs) {
+	YkObject stream = yk_lisp_stack_top[0];
+	yk_assert_text_input_stream(stream);
+
+	if (stream->t.t == yk_t_string_stream) {
+		YkStringStream* ss = &stream->string_stream;
+		size_t offset = ss->read_bytes < ss->size ? ss->read_bytes : ss->size;
+
+		ss->read_bytes = ss->size;
+		return yk_make_string(ss->buffer + offset, ss->size - offset);
+	}
+
+	FILE* file = stream->file_stream.file_ptr;
+	size_t capacity = YK_FILE_STREAM_BUFFER_SIZE, length = 0, count;
+
+#ifndef _WIN32
+	/* Regular files are read with a single call */
+	struct stat st;
+	long offset = ftell(file);
+
+	if (offset >= 0 && fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode) &&
+		st.st_size > offset)
+		capacity = st.st_size - offset + 1;
+#endif
+
+	char* data = malloc(capacity);
+
+	while ((count = fread(data + length, 1, capacity - length, file)) > 0) {
+		length += count;
+
+		if (length == capacity) {
+			capacity *= 2;
+			data = realloc(data, capacity);
+		}
+	}
+
+	YkObject result = yk_make_string(data, length);
+	free(data);
+
+	return result;
+}
+
+static YkObject yk_builtin_stream_close(YkUint nargs) {
+	yk_stream_close(yk_lisp_stack_top[0]);
+	return YK_NIL;
+}
+
+static YkObject yk_builtin_gc(YkUint nargs) {
+	yk_gc();
+	return YK_NIL;
+}
+
+static YkObject yk_builtin_set_class(YkUint nargs) {
+	YkObject name = yk_lisp_stack_top[0],
+		parent = yk_lisp_stack_top[1],
+		size = yk_lisp_stack_top[2];
+
+	YK_ASSERT(YK_SYMBOLP(name) && YK_SYMBOLP(parent) && YK_INTP(size));
+	YkObject parent_class = yk_find_class(parent);
+
+	YK_ASSERT(parent_class == yk_class_object || yk_subclassp(parent_class, yk_class_object));
+
+	return yk_make_class(yk_class_object_class, name, parent_class, YK_INT(size));
+}
+
+static YkObject yk_builtin_make_instance(YkUint nargs) {
+	YkObject type = yk_lisp_stack_top[0];
+
+	YK_ASSERT(YK_SYMBOLP(type));
+	YkObject class = YK_PTR(type)->symbol.class_value;
+	YK_ASSERT(class != NULL);
+
+	YkObject instance = yk_make_instance(class);
+
+	YkUint class_size = YK_INT(YK_CLASS_SIZE(class));
+	YK_ASSERT(class_size == (nargs - 1));
+
+	for (uint i = 0; i < class_size; i++) {
+		instance->instance.slots[i] = yk_lisp_stack_top[1 + i];
+	}
+
+	return instance;
+}
+
+static YkObject yk_builtin_find_class(YkUint nargs) {
+	YkObject type = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_SYMBOLP(type));
+
+	return yk_find_class(type);
+}
+
+static YkObject yk_builtin_subtypep(YkUint nargs) {
+	YkObject t1 = yk_lisp_stack_top[0],
+		t2 = yk_lisp_stack_top[1];
+
+	YK_ASSERT(YK_SYMBOLP(t1) && YK_SYMBOLP(t2));
+	return yk_subtypep(t1, t2) ? yk_tee : YK_NIL;
+}
+
+static YkObject yk_builtin_set_slot(YkUint nargs) {
+	YkObject instance = yk_lisp_stack_top[0],
+		slot = yk_lisp_stack_top[1],
+		value = yk_lisp_stack_top[2];
+
+	YK_ASSERT(YK_TYPEOF(instance) == yk_t_instance && YK_INTP(slot) &&
+			  YK_INT(slot) >= 0 && YK_INT(slot) < (YkInt)instance->instance.slots_count &&
+			  !YK_CLASS_INVALID(instance->instance.class));
+
+	instance->instance.slots[YK_INT(slot)] = value;
+	return value;
+}
+
+static YkObject yk_builtin_get_slot(YkUint args) {
+	YkObject instance = yk_lisp_stack_top[0],
+		slot = yk_lisp_stack_top[1];
+
+	YK_ASSERT(YK_TYPEOF(instance) == yk_t_instance && YK_INTP(slot) &&
+			  YK_INT(slot) >= 0 && YK_INT(slot) < (YkInt)instance->instance.slots_count &&
+			  !YK_CLASS_INVALID(instance->instance.class));
+
+	return instance->instance.slots[YK_INT(slot)];
+}
+
+static YkObject yk_builtin_class_size(YkUint nargs) {
+	YkObject class = yk_find_class(yk_lisp_stack_top[0]);
+	return YK_CLASS_SIZE(class);
+}
+
+/* The method table of a class is an open addressing hash table from
+ * selectors to methods, inherited ones included, filled lazily. It is
+ * stored as an array: the entry count, then key/value pairs. */
+#define YK_METHOD_TABLE_HASH(selector) ((uintptr_t)(selector) >> 3)
+#define YK_METHOD_TABLE_MIN_SIZE 8
+
+static YkObject yk_method_table_get(YkObject table, YkObject selector) {
+	if (table == YK_NIL)
+		return NULL;
+
+	YkObject* data = YK_PTR(table)->array.data;
+	YkUint mask = (YK_PTR(table)->array.size - 1) / 2 - 1;
+
+	for (YkUint i = YK_METHOD_TABLE_HASH(selector) & mask;; i = (i + 1) & mask) {
+		if (data[1 + 2 * i] == selector)
+			return data[2 + 2 * i];
+		else if (data[1 + 2 * i] == YK_NIL)
+			return NULL;
+	}
+}
+
+static void yk_method_table_insert(YkObject table, YkObject selector, YkObject method) {
+	YkObject* data = YK_PTR(table)->array.data;
+	YkUint mask = (YK_PTR(table)->array.size - 1) / 2 - 1;
+
+	YkUint i = YK_METHOD_TABLE_HASH(selector) & mask;
+	while (data[1 + 2 * i] != YK_NIL) {
+		i = (i + 1) & mask;
+	}
+
+	data[1 + 2 * i] = selector;
+	data[2 + 2 * i] = method;
+	data[0] = YK_MAKE_INT(YK_INT(data[0]) + 1);
+}
+
+/* Adds a resolved method to the table of `class', keeping it at most half
+ * full. */
+static void yk_method_table_add(YkObject class, YkObject selector, YkObject method) {
+	YK_GC_PROTECT3(class, selector, method);
+
+	YkObject table = YK_OBJECT_METHOD_TABLE(class);
+	YkUint size = table == YK_NIL ? 0 : (YK_PTR(table)->array.size - 1) / 2;
+	YkUint count = table == YK_NIL ? 0 : YK_INT(YK_PTR(table)->array.data[0]);
+
+	if (2 * (count + 1) > size) {
+		YkUint new_size = size == 0 ? YK_METHOD_TABLE_MIN_SIZE : 2 * size;
+		YkObject new_table = yk_make_array(1 + 2 * new_size, YK_NIL);
+		YK_PTR(new_table)->array.data[0] = YK_MAKE_INT(0);
+
+		table = YK_OBJECT_METHOD_TABLE(class);
+		for (YkUint i = 0; i < size; i++) {
+			YkObject key = YK_PTR(table)->array.data[1 + 2 * i];
+			if (key != YK_NIL)
+				yk_method_table_insert(new_table, key, YK_PTR(table)->array.data[2 + 2 * i]);
+		}
+
+		YK_OBJECT_METHOD_TABLE(class) = table = new_table;
+	}
+
+	yk_method_table_insert(table, selector, method);
+	YK_GC_UNPROTECT;
+}
+
+/* Forgets the resolved methods of `class' and of its subclasses */
+static void yk_flush_method_tables(YkObject class) {
+	YK_OBJECT_METHOD_TABLE(class) = YK_NIL;
+
+	YK_LIST_FOREACH(YK_OBJECT_SUBCLASSES(class), pair) {
+		yk_flush_method_tables(YK_CAR(pair));
+	}
+}
+
+static YkObject yk_find_method(YkObject class, YkObject selector) {
+	YkMethodCacheEntry* entry = &yk_method_cache[YK_METHOD_CACHE_INDEX(class, selector)];
+	if (entry->class == class && entry->selector == selector)
+		return entry->method;
+
+	YK_ASSERT(YK_CLASS_OF(class) == yk_class_object_class);
+
+	YkObject method = yk_method_table_get(YK_OBJECT_METHOD_TABLE(class), selector);
+	if (method == NULL) {
+		for (YkObject c = class; c != yk_class_object && method == NULL; c = YK_CLASS_PARENT(c)) {
+			YK_LIST_FOREACH(YK_OBJECT_METHODS(c), pair) {
+				if (YK_CAR(YK_CAR(pair)) == selector) {
+					method = YK_CDR(YK_CAR(pair));
+					break;
+				}
+			}
+		}
+
+		YK_ASSERT(method != NULL);	/* No such method */
+		yk_method_table_add(class, selector, method);
+	}
+
+	/* Adding to the table may have flushed the cache */
+	entry->class = class;
+	entry->selector = selector;
+	entry->method = method;
+
+	return method;
+}
+
+/* Turns the (object selector . args) arguments of a call-method frame into
+ * (object . args), and returns the method to call on them. */
+static YkObject yk_prepare_method_call(YkUint argcount) {
+	YK_ASSERT(argcount >= 2);
+
+	YkObject object = yk_lisp_stack_top[0],
+		selector = yk_lisp_stack_top[1];
+
+	YK_ASSERT(YK_TYPEOF(object) == yk_t_instance);
+	YkObject method = yk_find_method(YK_CLASS_OF(object), selector);
+
+	yk_lisp_stack_top[1] = object;
+	yk_lisp_stack_top++;
+
+	return method;
+}
+
+static YkObject yk_builtin_set_method(YkUint nargs) {
+	YkObject class = yk_lisp_stack_top[0],
+		name = yk_lisp_stack_top[1],
+		function = yk_lisp_stack_top[2];
+
+	YK_ASSERT(YK_TYPEOF(class) == yk_t_instance &&
+			  YK_CLASS_OF(class) == yk_class_object_class);
+
+	yk_flush_method_tables(class);
+	yk_flush_method_cache();
+
+	YK_LIST_FOREACH(YK_OBJECT_METHODS(class), pair) {
+		if (YK_CAR(YK_CAR(pair)) == name) {
+			YK_CDR(YK_CAR(pair)) = function;
+			return function;
+		}
+	}
+
+	YK_OBJECT_METHODS(class) = yk_cons(yk_cons(name, function),
+									   YK_OBJECT_METHODS(class));
+
+	return function;
+}
+
+/* Calls from bytecode are dispatched directly by the VM, this is only
+ * reached through apply. */
+static YkObject yk_builtin_call_method(YkUint nargs) {
+	YkObject method = yk_prepare_method_call(nargs);
+	YkObject* args = yk_lisp_stack_top;
+
+	nargs--;
+	yk_push_apply_frame(nargs);
+	yk_lisp_stack_top -= nargs;
+
+	for (uint i = 0; i < nargs; i++) {
+		yk_lisp_stack_top[i] = args[i];
+	}
+
+	return yk_apply_pushed(method, nargs);
+}
+
+static YkObject yk_builtin_make_window(YkUint nargs) {
+	YkObject title = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_TYPEOF(title) == yk_t_string);
+
+	PsWidget* window = ps_window_create(yk_string_to_c_str(title));
+	return yk_make_cpointer(window);
+}
+
+static YkObject yk_builtin_window_destroy(YkUint nargs) {
+	YkObject window = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_TYPEOF(window) == yk_t_cpointer);
+
+	ps_window_destroy(yk_cpointer_value(window));
+	window->pointer.cpointer = NULL;
+	return YK_NIL;
+}
+
+static YkObject yk_builtin_make_box(YkUint nargs) {
+	YkObject direction = yk_lisp_stack_top[0],
+		margin = yk_lisp_stack_top[1];
+
+	YK_ASSERT(YK_SYMBOLP(direction) && YK_FLOATP(margin));
+
+	PsDirection dir;
+
+	if (yk_make_symbol_cstr("vertical") == direction) {
+		dir = PS_DIRECTION_VERTICAL;
+	} else if (yk_make_symbol_cstr("horizontal") == direction) {
+		dir = PS_DIRECTION_HORIZONTAL;
+	} else {
+		YK_ASSERT(0);
+	}
+
+	PsWidget* vbox = ps_box_create(dir, YK_FLOAT(margin));
+	return yk_make_cpointer(vbox);
+}
+
+static YkObject yk_builtin_window_set_root(YkUint nargs) {
+	YkObject window = yk_lisp_stack_top[0],
+		root = yk_lisp_stack_top[1];
+
+	YK_ASSERT(YK_TYPEOF(window) == yk_t_cpointer &&
+			  YK_TYPEOF(root) == yk_t_cpointer);
+
+	ps_window_set_root(yk_cpointer_value(window), yk_cpointer_value(root));
+	return YK_NIL;
+}
+
+static YkObject yk_builtin_make_button(YkUint nargs) {
+	YkObject text = yk_lisp_stack_top[0],
+		margin = yk_lisp_stack_top[1];
+
+	YK_ASSERT(YK_TYPEOF(text) == yk_t_string && YK_FLOATP(margin));
+
+	PsWidget* button = ps_button_create(yk_string_to_c_str(text), YK_FLOAT(margin));
+	return yk_make_cpointer(button);
+}
+
+static YkObject yk_builtin_widget_destroy(YkUint nargs) {
+	YkObject widget = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_TYPEOF(widget) == yk_t_cpointer);
+
+	ps_widget_destroy(yk_cpointer_value(widget));
+	widget->pointer.cpointer = NULL;
+
+	return YK_NIL;
+}
+
+static YkObject yk_arglist(YkUint nargs) {
+	YkObject list = YK_NIL;
+	YK_GC_PROTECT1(list);
+
+	YkObject* last_frame_ptr = (YkObject*) *yk_lisp_frame_ptr,
+		*last_stack_ptr = yk_lisp_stack_top + 4;
+
+	YkUint argcount = last_frame_ptr - last_stack_ptr,
+		offset = YK_INT(yk_lisp_stack_top[0]);
+
+	for (int i = argcount - offset - 1; i >= 0; i--) {
+		list = yk_cons(last_stack_ptr[offset + i], list);
+	}
+
+	YK_GC_UNPROTECT;
+	return list;
+}
+
+static YkObject yk_builtin_values(YkUint nargs) {
+	YK_ASSERT(nargs <= YK_VALUES_MAX_COUNT);
+
+	for (uint i = 0; i < nargs; i++) {
+		yk_values_buffer[i] = yk_lisp_stack_top[i];
+	}
+
+	yk_values_count = nargs;
+	return nargs == 0 ? YK_NIL : yk_lisp_stack_top[0];
+}
+
+static YkObject yk_builtin_apply(YkUint nargs) {
+	YK_ASSERT(YK_LISTP(yk_lisp_stack_top[1]));
+	return yk_apply(yk_lisp_stack_top[0], yk_lisp_stack_top[1]);
+}
+
+/* Builtins return a single value, except `values' and `apply', whose
+ * callee may have left several */
+static inline YkObject yk_call_cfun(YkObject proc, YkUint argcount) {
+	YkCfun cfun = YK_PTR(proc)->c_proc.cfun;
+	YkObject result = cfun(argcount);
+
+	if (cfun != yk_builtin_values && cfun != yk_builtin_apply) {
+		yk_values_count = 1;
+	}
+
+	return result;
+}
+
+static YkObject yk_builtin_breakpoint(YkUint nargs) {
+	raise(SIGINT);
+	return YK_NIL;
+}
+
+static YkObject yk_type_of(YkObject object) {
+	if (object == YK_NIL) {
+		return YK_NIL;
+	}
+
+	switch(YK_TYPEOF(object)) {
+	case yk_t_list:
+		return yk_symbol_type_list;
+		break;
+	case yk_t_int:
+		return yk_symbol_type_int;
+		break;
+	case yk_t_float:
+		return yk_symbol_type_float;
+		break;
+	case yk_t_symbol:
+		return yk_symbol_type_symbol;
+		break;
+	case yk_t_c_proc:
+		return yk_symbol_type_function;
+		break;
+	case yk_t_closure:
+		return yk_symbol_type_function;
+		break;
+	case yk_t_bytecode:
+		return yk_symbol_type_function;
+		break;
+	case yk_t_instance:
+		return YK_CLASS_NAME(YK_CLASS_OF(object));
+		break;
+	case yk_t_array:
+		return yk_symbol_type_array;
+		break;
+	case yk_t_string:
+		return yk_symbol_type_string;
+		break;
+	case yk_t_cpointer:
+		return yk_symbol_type_cpointer;
+		break;
+	case yk_t_string_stream:
+		return yk_symbol_type_string_stream;
+		break;
+	case yk_t_file_stream:
+		return yk_symbol_type_file_stream;
+		break;
+	case yk_t_hash_table:
+		return yk_symbol_type_hash_table;
+		break;
+	case yk_t_persistent_map:
+		return yk_symbol_type_persistent_map;
+		break;
+	case yk_t_persistent_vector:
+		return yk_symbol_type_persistent_vector;
+		break;
+	case yk_t_typed_array:
+		return yk_symbol_type_typed_array;
+		break;
+	case yk_t_sequence:
+		return yk_symbol_type_sequence;
+		break;
+	default:
+		return YK_NIL;
+	}
+}
+
+static YkObject yk_builtin_type_of(YkUint nargs) {
+	return yk_type_of(yk_lisp_stack_top[0]);
+}
+
+static YkObject yk_default_debugger(YkUint nargs) {
+	YkObject error = yk_lisp_stack_top[0];
+
+	printf("Unhandled error ");
+	yk_print(error);
+	printf("\n");
+
+	YkObject *stack_ptr = yk_lisp_stack_top,
+		*frame_ptr = yk_lisp_frame_ptr;
+
+	while (stack_ptr < YK_STACK_BOTTOM(yk_lisp_stack, YkObject)) {
+		for (; stack_ptr != frame_ptr; stack_ptr++) {
+			printf("\t");
+			yk_print(*stack_ptr);
+			printf("\n");
+		}
+
+		if (frame_ptr < YK_STACK_BOTTOM(yk_lisp_stack, YkObject)) {
+			YkObject bytecode = frame_ptr[2];
+			printf("---%s----\n", yk_symbol_cstr(YK_PTR(bytecode)->bytecode.name));
+
+			frame_ptr = (YkObject*) *frame_ptr;
+			stack_ptr += 3;
+		}
+	}
+
+	printf("1] ABORT TO TOPLEVEL\n"
+		"2] DEBBUGER BREAKPOINT\n");
+
+make_choice:
+	printf("> ");
+	int choice;
+	m_scanf("%d", &choice);
+
+	if (choice == 1) {
+		yk_go_back(error, 1);
+	}
+	if (choice == 2) {
+		assert(0);
+	}
+	else {
+		goto make_choice;
+	}
+
+	return YK_NIL;
+}
+
+static YkUint yk_length(YkObject list) {
+	YkUint i = 0;
+	YK_LIST_FOREACH(list, l) {
+		i++;
+	}
+
+	return i;
+}
+
+static bool yk_member(YkObject element, YkObject list) {
+	YK_LIST_FOREACH(list, e) {
+		if (YK_CAR(e) == element)
+			return true;
+	}
+
+	return false;
+}
+
+static YkInstruction yk_end_instruction = {YK_NIL, 0, YK_OP_END};
+
+/* Pushes a call frame returning to an END instruction, so that the callee
+ * gives control back to C. Arguments are then written directly on the Lisp
+ * stack by the caller, with the first argument on top. */
+static inline void yk_push_apply_frame(YkUint argcount) {
+	YK_STACK_RESERVE(yk_lisp_stack, yk_lisp_stack_top, argcount + 4);
+
+	YK_LISP_STACK_PUSH(yk_bytecode_register);
+	YK_LISP_STACK_PUSH(&yk_end_instruction);
+	YK_LISP_STACK_PUSH(yk_lisp_frame_ptr);
+
+	yk_lisp_frame_ptr = yk_lisp_stack_top;
+}
+
+/* Calls `function' on the `argcount' arguments already pushed on top of a
+ * frame made by yk_push_apply_frame. Nothing is consed. */
+static YkObject yk_apply_pushed(YkObject function, YkUint argcount) {
+	YkObject result = YK_NIL;
+
+	YkObject value_register = yk_value_register;
+	YkInstruction *program_counter = yk_program_counter;
+
+	if (YK_CLOSUREP(function)) {
+		YK_LISP_STACK_PUSH(YK_PTR(function)->closure.lexical_env);
+		function = YK_PTR(function)->closure.bytecode;
+	}
+
+	if (YK_BYTECODEP(function)) {
+		YkInt nargs = YK_PTR(function)->bytecode.nargs;
+		if (nargs >= 0) {
+			YK_ASSERT((YkInt)argcount == nargs);
+		}
+		else {
+			YK_ASSERT((YkInt)argcount >= -(nargs + 1));
+		}
+
+		yk_run(function);
+		result = yk_value_register;
+	} else if (YK_CPROCP(function)) {
+		YkInt nargs = YK_PTR(function)->c_proc.nargs;
+		if (nargs >= 0) {
+			YK_ASSERT((YkInt)argcount == nargs);
+		}
+		else {
+			YK_ASSERT((YkInt)argcount >= -(nargs + 1));
+		}
+
+		result = yk_call_cfun(function, argcount);
+		yk_lisp_stack_top = yk_lisp_frame_ptr;
+
+		YK_LISP_STACK_POP(yk_lisp_frame_ptr, YkObject**);
+		YK_LISP_STACK_POP(yk_program_counter, YkInstruction**);
+		YK_LISP_STACK_POP(yk_bytecode_register, YkObject*);
+	} else {
+		assert(0);
+	}
+
+	yk_program_counter = program_counter;
+	yk_value_register = value_register;
+
+	return result;
+}
+
+/* Calls `function' on the C array `args'. The arguments are copied straight
+ * to the Lisp stack. */
+static YkObject yk_apply_n(YkObject function, YkUint argcount, YkObject* args) {
+	YK_GC_PROTECT1(function);
+
+	yk_push_apply_frame(argcount);
+	yk_lisp_stack_top -= argcount;
+
+	for (uint i = 0; i < argcount; i++) {
+		yk_lisp_stack_top[i] = args[i];
+	}
+
+	YkObject result = yk_apply_pushed(function, argcount);
+
+	YK_GC_UNPROTECT;
+	return result;
+}
+
+YkObject yk_apply(YkObject function, YkObject args) {
+	YK_GC_PROTECT1(function);
+
+	YkUint argcount = yk_length(args);
+
+	yk_push_apply_frame(argcount);
+	yk_lisp_stack_top -= argcount;
+
+	YkUint i = 0;
+	YK_LIST_FOREACH(args, e) {
+		yk_lisp_stack_top[i++] = YK_CAR(e);
+	}
+
+	YkObject result = yk_apply_pushed(function, argcount);
+
+	YK_GC_UNPROTECT;
+	return result;
+}
+
+static YkObject yk_funcall(const char* fn_name, ushort nargs, ...) {
+	va_list arguments;
+	va_start(arguments, nargs);
+
+	yk_push_apply_frame(nargs);
+	yk_lisp_stack_top -= nargs;
+
+	for (uint i = 0; i < nargs; i++) {
+		yk_lisp_stack_top[i] = va_arg(arguments, YkObject);
+	}
+
+	va_end(arguments);
+
+	/* The arguments are on the Lisp stack now, so interning can GC */
+	YkObject function = YK_PTR(yk_make_symbol_cstr(fn_name))->symbol.value;
+	return yk_apply_pushed(function, nargs);
+}
+
+static void yk_tail_apply(YkObject function, YkObject args) {
+	YkInt argcount = 0;
+
+	yk_lisp_stack_top = yk_lisp_frame_ptr;
+
+	args = yk_nreverse(args);
+	YK_LIST_FOREACH(args, a) {
+		YK_STACK_RESERVE(yk_lisp_stack, yk_lisp_stack_top, 1);
+		YK_LISP_STACK_PUSH(YK_CAR(a));
+		argcount++;
+	}
+
+	YK_ASSERT(YK_BYTECODEP(function));
+
+	YkInt nargs = YK_PTR(function)->bytecode.nargs;
+	if (nargs >= 0) {
+		YK_ASSERT(argcount == nargs);
+	}
+	else {
+		YK_ASSERT(argcount >= -(nargs + 1));
+	}
+
+	yk_bytecode_register = function;
+	yk_program_counter = YK_PTR(function)->bytecode.code;
+
+	/* Run by the yk_run that called the builtin */
+	if (yk_run_frame != NULL) {
+		yk_value_register = function;
+		longjmp(yk_run_frame->jump, YK_RUN_TAIL_CALL);
+	}
+
+	yk_go_back(function, YK_RUN_TAIL_CALL);
+}
+
+#define YK_SIGNAL_ERROR_MAX_ARGS 8
+
+static void yk_signal_error(YkObject class, ...) {
+	YkObject make_instance = YK_PTR(yk_make_symbol_cstr("make-instance"))->symbol.value;
+	YkObject arguments[YK_SIGNAL_ERROR_MAX_ARGS];
+	YkUint argcount = 0;
+
+	va_list args;
+	va_start(args, class);
+
+	arguments[argcount++] = class;
+
+	YkObject arg = va_arg(args, YkObject);
+	while (arg != NULL) {
+		YK_ASSERT(argcount < YK_SIGNAL_ERROR_MAX_ARGS);
+		arguments[argcount++] = arg;
+		arg = va_arg(args, YkObject);
+	}
+
+	va_end(args);
+
+	YkObject error = yk_apply_n(make_instance, argcount, arguments);
+	yk_tail_apply(YK_PTR(yk_make_symbol_cstr("error"))->symbol.value, yk_cons(error, YK_NIL));
+}
+
+/* Sampling profiler */
+
+/* Set by the profiling timer, checked by yk_run on calls and jumps */
+static volatile sig_atomic_t yk_profile_pending;
+static bool yk_profile_running;
+
+/* Each sample is its count, its depth and the names of its functions,
+ * innermost first. A sample identical to the previous one only increments
+ * its count. */
+static YkObject* yk_profile_samples;
+static YkUint yk_profile_samples_size, yk_profile_last_sample, yk_profile_dropped;
+
+/* Processor time spent profiling, which the samples are a share of: the
+ * timer ticks no more often than the kernel's clock, whatever the interval */
+static clock_t yk_profile_clock, yk_profile_elapsed;
+
+typedef struct {
+	YkObject name;
+	YkUint self;
+	YkUint total;
+	YkUint last_sample;
+} YkProfileEntry;
+
+#ifndef _WIN32
+static void yk_profile_signal(int signal) {
+	yk_profile_pending = 1;
+}
+
+static void yk_profile_set_timer(YkUint interval) {
+	struct itimerval timer;
+	timer.it_interval.tv_sec = interval / 1000000;
+	timer.it_interval.tv_usec = interval % 1000000;
+	timer.it_value = timer.it_interval;
+
+	setitimer(ITIMER_PROF, &timer, NULL);
+}
+#endif
+
+/* Starts sampling the Lisp stack every `interval' microseconds of CPU time,
+ * forgetting the previous samples. Returns false where there is no
+ * profiling timer. */
+bool yk_profile_start(YkUint interval) {
+#ifdef _WIN32
+	return false;
+#else
+	if (yk_profile_samples == NULL)
+		yk_profile_samples = malloc(YK_PROFILE_BUFFER_SIZE * sizeof(YkObject));
+
+	yk_profile_samples_size = 0;
+	yk_profile_dropped = 0;
+	yk_profile_pending = 0;
+	yk_profile_clock = clock();
+	yk_profile_elapsed = 0;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = yk_profile_signal;
+	action.sa_flags = SA_RESTART;	/* Reads and writes are not interrupted */
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGPROF, &action, NULL);
+
+	yk_profile_running = true;
+	yk_profile_set_timer(max(interval, (YkUint)1));
+	return true;
+#endif
+}
+
+/* Stops sampling, keeping the samples for the reports */
+void yk_profile_stop() {
+#ifndef _WIN32
+	if (yk_profile_running) {
+		yk_profile_set_timer(0);
+		yk_profile_elapsed = clock() - yk_profile_clock;
+	}
+#endif
+
+	yk_profile_running = false;
+	yk_profile_pending = 0;
+}
+
+/* Records the running function, then the caller saved in each frame. A
+ * frame still being filled with arguments looks just like an entered one,
+ * so consecutive frames of the same function are folded into one, which
+ * also folds direct recursion. Functions are told apart by name, so that a
+ * redefined function is still the same one. */
+static void yk_profile_sample() {
+	YkObject stack[YK_PROFILE_MAX_DEPTH];
+	YkUint depth = 0;
+	YkObject* frame_ptr = yk_lisp_frame_ptr;
+
+	yk_profile_pending = 0;
+	if (!yk_profile_running)
+		return;
+
+	stack[depth++] = YK_PTR(yk_bytecode_register)->bytecode.name;
+	while (frame_ptr < YK_STACK_BOTTOM(yk_lisp_stack, YkObject) && depth < YK_PROFILE_MAX_DEPTH) {
+		YkObject caller = frame_ptr[2];
+		if (YK_BYTECODEP(caller) && YK_PTR(caller)->bytecode.name != stack[depth - 1])
+			stack[depth++] = YK_PTR(caller)->bytecode.name;
+
+		frame_ptr = (YkObject*)*frame_ptr;
+	}
+
+	YkObject* sample = yk_profile_samples + yk_profile_last_sample;
+	if (yk_profile_samples_size > 0 && (YkUint)YK_INT(sample[1]) == depth &&
+		memcmp(sample + 2, stack, depth * sizeof(YkObject)) == 0)
+	{
+		sample[0] = YK_MAKE_INT(YK_INT(sample[0]) + 1);
+	} else if (yk_profile_samples_size + depth + 2 <= YK_PROFILE_BUFFER_SIZE) {
+		sample = yk_profile_samples + yk_profile_samples_size;
+		sample[0] = YK_MAKE_INT(1);
+		sample[1] = YK_MAKE_INT(depth);
+		memcpy(sample + 2, stack, depth * sizeof(YkObject));
+
+		yk_profile_last_sample = yk_profile_samples_size;
+		yk_profile_samples_size += depth + 2;
+	} else {
+		yk_profile_dropped++;
+	}
+}
+
+/* The sampled names stay alive until the next profile-start */
+static void yk_profile_mark() {
+	for (YkUint i = 0; i < yk_profile_samples_size; i += YK_INT(yk_profile_samples[i + 1]) + 2) {
+		for (YkUint j = 0; j < (YkUint)YK_INT(yk_profile_samples[i + 1]); j++)
+			yk_mark(yk_profile_samples[i + 2 + j]);
+	}
+}
+
+static YkProfileEntry* yk_profile_entry(YkProfileEntry* entries, YkUint capacity,
+										YkObject name)
+{
+	YkUint i = YK_PTR(name)->symbol.hash & (capacity - 1);
+	while (entries[i].name != NULL && entries[i].name != name)
+		i = (i + 1) & (capacity - 1);
+
+	entries[i].name = name;
+	return &entries[i];
+}
+
+static int yk_profile_entry_compare(const void* a, const void* b) {
+	const YkProfileEntry *x = a, *y = b;
+	if (x->self != y->self)
+		return x->self < y->self ? 1 : -1;
+
+	return x->total < y->total ? 1 : x->total > y->total ? -1 : 0;
+}
+
+/* (profile-report), prints for each function how long it was running
+ * (self) and on the stack (total), and returns the number of samples */
+static YkObject yk_builtin_profile_report(YkUint nargs) {
+	YkObject output = YK_PTR(yk_var_output)->symbol.value;
+	YkUint capacity = 16, samples = 0, sample_index = 0, count = 0;
+
+	while (capacity < 2 * yk_profile_samples_size)
+		capacity *= 2;
+
+	YkProfileEntry* entries = malloc(capacity * sizeof(YkProfileEntry));
+	memset(entries, 0, capacity * sizeof(YkProfileEntry));
+
+	for (YkUint i = 0; i < yk_profile_samples_size; sample_index++) {
+		YkUint sample_count = YK_INT(yk_profile_samples[i]),
+			depth = YK_INT(yk_profile_samples[i + 1]);
+		samples += sample_count;
+
+		for (YkUint j = 0; j < depth; j++) {
+			YkProfileEntry* e = yk_profile_entry(entries, capacity, yk_profile_samples[i + 2 + j]);
+			if (j == 0)
+				e->self += sample_count;
+
+			/* Counted once per sample, however often it is on the stack */
+			if (e->last_sample != sample_index + 1) {
+				e->total += sample_count;
+				e->last_sample = sample_index + 1;
+			}
+		}
+
+		i += depth + 2;
+	}
+
+	for (YkUint i = 0; i < capacity; i++) {
+		if (entries[i].name != NULL)
+			entries[count++] = entries[i];
+	}
+
+	qsort(entries, count, sizeof(YkProfileEntry), yk_profile_entry_compare);
+
+	clock_t elapsed = yk_profile_running ? clock() - yk_profile_clock : yk_profile_elapsed;
+	double percent = samples ? 100.0 / samples : 0,
+		ms = percent * 10.0 * elapsed / CLOCKS_PER_SEC;
+	yk_stream_format(output, "%10s %7s %10s %7s  %s\n",
+					 "self ms", "self", "total ms", "total", "function");
+
+	for (YkUint i = 0; i < count; i++) {
+		yk_stream_format(output, "%10.1f %6.1f%% %10.1f %6.1f%%  ",
+						 entries[i].self * ms, entries[i].self * percent,
+						 entries[i].total * ms, entries[i].total * percent);
+		yk_print(entries[i].name);
+		YK_STREAM_WRITE_LITERAL(output, "\n");
+	}
+
+	if (yk_profile_dropped > 0)
+		yk_stream_format(output, "%lu samples dropped, the buffer was full\n", yk_profile_dropped);
+
+	free(entries);
+	return YK_MAKE_INT(samples);
+}
+
+static int yk_profile_sample_compare(const void* a, const void* b) {
+	const YkObject *x = yk_profile_samples + *(const YkUint*)a,
+		*y = yk_profile_samples + *(const YkUint*)b;
+
+	if (x[1] != y[1])
+		return YK_INT(x[1]) < YK_INT(y[1]) ? -1 : 1;
+
+	return memcmp(x + 2, y + 2, YK_INT(x[1]) * sizeof(YkObject));
+}
+
+/* (profile-stacks), prints each distinct stack on a line, outermost
+ * function first and separated by semicolons, followed by its number of
+ * samples: the collapsed format read by flamegraph.pl */
+static YkObject yk_builtin_profile_stacks(YkUint nargs) {
+	YkObject output = YK_PTR(yk_var_output)->symbol.value;
+	YkUint count = 0;
+
+	for (YkUint i = 0; i < yk_profile_samples_size; i += YK_INT(yk_profile_samples[i + 1]) + 2)
+		count++;
+
+	YkUint* offsets = malloc(max(count, (YkUint)1) * sizeof(YkUint));
+	count = 0;
+	for (YkUint i = 0; i < yk_profile_samples_size; i += YK_INT(yk_profile_samples[i + 1]) + 2)
+		offsets[count++] = i;
+
+	/* Equal stacks end up next to each other */
+	qsort(offsets, count, sizeof(YkUint), yk_profile_sample_compare);
+
+	for (YkUint i = 0; i < count;) {
+		YkObject* sample = yk_profile_samples + offsets[i];
+		YkUint depth = YK_INT(sample[1]);
+		long sample_count = 0;
+
+		do {
+			sample_count += YK_INT(yk_profile_samples[offsets[i]]);
+			i++;
+		} while (i < count && yk_profile_sample_compare(&offsets[i - 1], &offsets[i]) == 0);
+
+		for (YkUint j = depth; j > 0; j--) {
+			yk_print(sample[j + 1]);
+			if (j > 1)
+				YK_STREAM_WRITE_LITERAL(output, ";");
+		}
+
+		YK_STREAM_WRITE_LITERAL(output, " ");
+		yk_stream_write_int(output, sample_count);
+		YK_STREAM_WRITE_LITERAL(output, "\n");
+	}
+
+	free(offsets);
+	return YK_NIL;
+}
+
+/* (profile-start) or (profile-start interval), in microseconds */
+static YkObject yk_builtin_profile_start(YkUint nargs) {
+	YkUint interval = YK_PROFILE_DEFAULT_INTERVAL;
+	if (nargs > 0) {
+		YK_ASSERT(YK_INTP(yk_lisp_stack_top[0]) && YK_INT(yk_lisp_stack_top[0]) > 0);
+		interval = YK_INT(yk_lisp_stack_top[0]);
+	}
+
+	return yk_profile_start(interval) ? yk_tee : YK_NIL;
+}
+
+static YkObject yk_builtin_profile_stop(YkUint nargs) {
+	yk_profile_stop();
+	return YK_NIL;
+}
+
+/* Heap census */
+
+static const char* yk_type_names[] = {
+	[yk_t_list] = "cons",
+	[yk_t_symbol] = "symbol",
+	[yk_t_c_proc] = "c-proc",
+	[yk_t_closure] = "closure",
+	[yk_t_bytecode] = "bytecode",
+	[yk_t_continuation] = "continuation",
+	[yk_t_boxed] = "boxed",
+	[yk_t_instance] = "instance",
+	[yk_t_array] = "array",
+	[yk_t_string] = "string",
+	[yk_t_cpointer] = "cpointer",
+	[yk_t_string_stream] = "string-stream",
+	[yk_t_file_stream] = "file-stream",
+	[yk_t_hash_table] = "hash-table",
+	[yk_t_trie_node] = "trie-node",
+	[yk_t_persistent_map] = "persistent-map",
+	[yk_t_persistent_vector] = "persistent-vector",
+	[yk_t_typed_array] = "typed-array",
+	[yk_t_sequence] = "sequence"
+};
+
+/* Arena blocks are counted by powers of two of their size, from 16 bytes */
+#define YK_CENSUS_BUCKETS 24
+
+/* (heap-census), collects the garbage, then prints the live objects per
+ * type and per class of instance, and the arena blocks per size */
+static YkObject yk_builtin_heap_census(YkUint nargs) {
+	YkObject output = YK_PTR(yk_var_output)->symbol.value;
+	YkCensus census;
+	memset(&census, 0, sizeof(census));
+
+	yk_census = &census;
+	yk_gc();
+	yk_census = NULL;
+
+	yk_stream_format(output, "%-20s %10s %12s %12s\n", "type", "count", "cell bytes", "arena bytes");
+	for (YkUint i = 0; i <= yk_t_sequence; i++) {
+		if (census.types[i].count > 0) {
+			yk_stream_format(output, "%-20s %10lu %12lu %12lu\n", yk_type_names[i],
+							 census.types[i].count, census.types[i].count * sizeof(union YkUnion),
+							 census.types[i].bytes);
+		}
+	}
+
+	if (census.classes_count > 0)
+		yk_stream_format(output, "\n%10s %12s  %s\n", "count", "arena bytes", "class");
+
+	for (YkUint i = 0; i < census.classes_count; i++) {
+		yk_stream_format(output, "%10lu %12lu  ", census.class_entries[i].count,
+						 census.class_entries[i].bytes);
+		yk_print(YK_CLASS_NAME(census.classes[i]));
+		YK_STREAM_WRITE_LITERAL(output, "\n");
+	}
+
+	free(census.classes);
+	free(census.class_entries);
+
+	/* The collection merged the free blocks next to each other */
+	YkCensusEntry used[YK_CENSUS_BUCKETS] = { { 0 } }, unused[YK_CENSUS_BUCKETS] = { { 0 } };
+	YkUint free_bytes = YK_ARRAY_ALLOCATOR_SIZE - (yk_array_allocator_top - yk_array_allocator),
+		largest_free = free_bytes;
+
+	for (char* block_ptr = yk_array_allocator; block_ptr < yk_array_allocator_top;) {
+		YkArrayAllocatorBlock* block = (YkArrayAllocatorBlock*)block_ptr;
+		YkUint bucket = 0;
+
+		while (bucket < YK_CENSUS_BUCKETS - 1 && ((YkUint)16 << bucket) < block->size)
+			bucket++;
+
+		YkCensusEntry* entry = YK_BLOCK_USED(block) ? &used[bucket] : &unused[bucket];
+		entry->count++;
+		entry->bytes += block->size;
+
+		if (!YK_BLOCK_USED(block)) {
+			free_bytes += block->size;
+			largest_free = max(largest_free, (YkUint)block->size);
+		}
+
+		block_ptr += block->size + sizeof(YkArrayAllocatorBlock);
+	}
+
+	yk_stream_format(output, "\n%-12s %10s %12s %10s %12s\n",
+					 "block size", "used", "used bytes", "free", "free bytes");
+	for (YkUint i = 0; i < YK_CENSUS_BUCKETS; i++) {
+		if (used[i].count > 0 || unused[i].count > 0) {
+			yk_stream_format(output, "<= %-9lu %10lu %12lu %10lu %12lu\n", (YkUint)16 << i,
+							 used[i].count, used[i].bytes, unused[i].count, unused[i].bytes);
+		}
+	}
+
+	yk_stream_format(output, "\ncells: %lu of %lu free\n", yk_free_space, yk_workspace_size);
+	yk_stream_format(output, "arena: %lu of %u bytes free, largest free block %lu bytes, "
+					 "fragmentation %.1f%%\n", free_bytes, YK_ARRAY_ALLOCATOR_SIZE, largest_free,
+					 free_bytes ? 100.0 * (1.0 - (double)largest_free / free_bytes) : 0.0);
+
+	return YK_NIL;
+}
+
+/* (heap-sample-allocations interval), charges every interval-th allocation
+ * to the bytecode offset running, forgetting the previous samples; 0 stops
+ * sampling */
+static YkObject yk_builtin_heap_sample_allocations(YkUint nargs) {
+	YkObject interval = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_INTP(interval) && YK_INT(interval) >= 0);
+
+	if (YK_INT(interval) != 0) {
+		memset(yk_allocation_sites, 0, sizeof(yk_allocation_sites));
+		yk_allocation_sites_count = 0;
+	}
+
+	yk_allocation_sample_interval = YK_INT(interval);
+	yk_allocation_countdown = yk_allocation_sample_interval;
+	return YK_NIL;
+}
+
+static void yk_allocation_sites_mark() {
+	for (YkUint i = 0; i < YK_ALLOCATION_SITES_SIZE; i++) {
+		if (yk_allocation_sites[i].bytecode != NULL)
+			yk_mark(yk_allocation_sites[i].bytecode);
+	}
+}
+
+static int yk_allocation_site_compare(const void* a, const void* b) {
+	const YkAllocationSite *x = a, *y = b;
+	YkUint x_bytes = x->cells * sizeof(union YkUnion) + x->bytes,
+		y_bytes = y->cells * sizeof(union YkUnion) + y->bytes;
+
+	return x_bytes < y_bytes ? 1 : x_bytes > y_bytes ? -1 : 0;
+}
+
+/* (heap-allocation-sites), prints the bytecode offsets that allocated the
+ * most since heap-sample-allocations, in estimated bytes */
+static YkObject yk_builtin_heap_allocation_sites(YkUint nargs) {
+	YkObject output = YK_PTR(yk_var_output)->symbol.value;
+	YkAllocationSite* sites = malloc(max(yk_allocation_sites_count, (YkUint)1) *
+									 sizeof(YkAllocationSite));
+	YkUint count = 0;
+
+	for (YkUint i = 0; i < YK_ALLOCATION_SITES_SIZE; i++) {
+		if (yk_allocation_sites[i].bytecode != NULL)
+			sites[count++] = yk_allocation_sites[i];
+	}
+
+	qsort(sites, count, sizeof(YkAllocationSite), yk_allocation_site_compare);
+
+	yk_stream_format(output, "%12s %12s  %s\n", "cells", "arena bytes", "function+offset");
+	for (YkUint i = 0; i < min(count, (YkUint)YK_ALLOCATION_REPORT_SIZE); i++) {
+		yk_stream_format(output, "%12lu %12lu  ", sites[i].cells, sites[i].bytes);
+
+		if (sites[i].bytecode == YK_NIL) {
+			YK_STREAM_WRITE_LITERAL(output, "(outside of bytecode)\n");
+		} else {
+			yk_print(YK_PTR(sites[i].bytecode)->bytecode.name);
+			yk_stream_format(output, "+%lu\n", sites[i].offset);
+		}
+	}
+
+	free(sites);
+	return YK_NIL;
+}
+
+#if YK_INSTRUMENT
+/* Instrumentation of yk_run */
+
+#define YK_OPCODES_COUNT (YK_OP_END + 1)
+
+#if YK_INSTRUMENT_CYCLES
+#define YK_INSTRUMENT_CLOCK() __rdtsc()
+#else
+#define YK_INSTRUMENT_CLOCK() 0
+#endif
+
+typedef struct {
+	YkObject bytecode;
+	YkUint offset;
+	uint64_t count;
+	uint64_t cycles;
+} YkInstrumentSite;
+
+static uint64_t yk_instrument_counts[YK_OPCODES_COUNT],
+	yk_instrument_cycles[YK_OPCODES_COUNT],
+	yk_instrument_pairs[YK_OPCODES_COUNT * YK_OPCODES_COUNT],
+	yk_instrument_dropped_sites, yk_instrument_clock;
+
+/* Open addressing on (bytecode, offset) */
+static YkInstrumentSite yk_instrument_sites[YK_INSTRUMENT_SITES_SIZE];
+static YkUint yk_instrument_sites_count;
+
+/* The previous instruction, which the time since it started is charged to,
+ * or YK_OPCODES_COUNT before the first one */
+static YkInstrumentSite* yk_instrument_last_site;
+static YkUint yk_instrument_last_opcode = YK_OPCODES_COUNT;
+
+static bool yk_instrument_tracing;
+
+void yk_instrument_reset() {
+	memset(yk_instrument_counts, 0, sizeof(yk_instrument_counts));
+	memset(yk_instrument_cycles, 0, sizeof(yk_instrument_cycles));
+	memset(yk_instrument_pairs, 0, sizeof(yk_instrument_pairs));
+	memset(yk_instrument_sites, 0, sizeof(yk_instrument_sites));
+
+	yk_instrument_sites_count = 0;
+	yk_instrument_dropped_sites = 0;
+	yk_instrument_last_site = NULL;
+	yk_instrument_last_opcode = YK_OPCODES_COUNT;
+}
+
+static YkInstrumentSite* yk_instrument_site(YkObject bytecode, YkUint offset) {
+	YkUint i = (((YkUint)bytecode >> 6) * 31 + offset) & (YK_INSTRUMENT_SITES_SIZE - 1);
+
+	while (yk_instrument_sites[i].bytecode != bytecode ||
+		   yk_instrument_sites[i].offset != offset)
+	{
+		if (yk_instrument_sites[i].bytecode == NULL) {
+			/* Keep a free entry, so that lookups always end */
+			if (yk_instrument_sites_count == YK_INSTRUMENT_SITES_SIZE - 1) {
+				yk_instrument_dropped_sites++;
+				return NULL;
+			}
+
+			yk_instrument_sites_count++;
+			yk_instrument_sites[i].bytecode = bytecode;
+			yk_instrument_sites[i].offset = offset;
+			break;
+		}
+
+		i = (i + 1) & (YK_INSTRUMENT_SITES_SIZE - 1);
+	}
+
+	return &yk_instrument_sites[i];
+}
+
+/* Called before each instruction is dispatched */
+static inline void yk_instrument_step(YkObject bytecode, YkInstruction* program_counter) {
+	YkOpcode opcode = program_counter->opcode;
+	YkUint offset = program_counter - YK_PTR(bytecode)->bytecode.code;
+	uint64_t clock = YK_INSTRUMENT_CLOCK();
+
+	if (yk_instrument_last_opcode != YK_OPCODES_COUNT) {
+		yk_instrument_cycles[yk_instrument_last_opcode] += clock - yk_instrument_clock;
+		yk_instrument_pairs[yk_instrument_last_opcode * YK_OPCODES_COUNT + opcode]++;
+
+		if (yk_instrument_last_site != NULL)
+			yk_instrument_last_site->cycles += clock - yk_instrument_clock;
+	}
+
+	yk_instrument_counts[opcode]++;
+	yk_instrument_last_site = yk_instrument_site(bytecode, offset);
+	if (yk_instrument_last_site != NULL)
+		yk_instrument_last_site->count++;
+
+	yk_instrument_last_opcode = opcode;
+
+	if (yk_instrument_tracing) {
+		fprintf(stderr, "%s+%lu\t%s\n", yk_symbol_cstr(YK_PTR(bytecode)->bytecode.name),
+				offset, yk_opcode_names[opcode]);
+	}
+
+	/* The tracing above is not charged to the instruction */
+	yk_instrument_clock = YK_INSTRUMENT_CLOCK();
+}
+
+static void yk_instrument_mark() {
+	for (YkUint i = 0; i < YK_INSTRUMENT_SITES_SIZE; i++) {
+		if (yk_instrument_sites[i].bytecode != NULL)
+			yk_mark(yk_instrument_sites[i].bytecode);
+	}
+}
+
+static int yk_instrument_site_compare(const void* a, const void* b) {
+	const YkInstrumentSite *x = a, *y = b;
+	return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+/* The sites run most often, first. The caller frees the array. */
+static YkInstrumentSite* yk_instrument_sorted_sites() {
+	YkInstrumentSite* sites = malloc(max(yk_instrument_sites_count, (YkUint)1) *
+									 sizeof(YkInstrumentSite));
+	YkUint count = 0;
+
+	for (YkUint i = 0; i < YK_INSTRUMENT_SITES_SIZE; i++) {
+		if (yk_instrument_sites[i].bytecode != NULL)
+			sites[count++] = yk_instrument_sites[i];
+	}
+
+	qsort(sites, count, sizeof(YkInstrumentSite), yk_instrument_site_compare);
+	return sites;
+}
+
+/* Pairs of opcodes as first * YK_OPCODES_COUNT + second, most frequent
+ * first: the candidates for superinstructions */
+static YkUint yk_instrument_sorted_pairs(YkUint* pairs) {
+	YkUint count = 0;
+	for (YkUint i = 0; i < YK_OPCODES_COUNT * YK_OPCODES_COUNT; i++) {
+		if (yk_instrument_pairs[i] == 0)
+			continue;
+
+		YkUint j = count++;
+		for (; j > 0 && yk_instrument_pairs[pairs[j - 1]] < yk_instrument_pairs[i]; j--)
+			pairs[j] = pairs[j - 1];
+
+		pairs[j] = i;
+	}
+
+	return count;
+}
+
+/* Prints the counters: every opcode executed, then the busiest bytecode
+ * offsets and opcode pairs */
+void yk_instrument_dump(FILE* file) {
+	fprintf(file, "%-20s %14s %14s\n", "opcode", "count", "cycles");
+	for (YkUint i = 0; i < YK_OPCODES_COUNT; i++) {
+		if (yk_instrument_counts[i] > 0) {
+			fprintf(file, "%-20s %14lu %14lu\n", yk_opcode_names[i],
+					yk_instrument_counts[i], yk_instrument_cycles[i]);
+		}
+	}
+
+	YkInstrumentSite* sites = yk_instrument_sorted_sites();
+	fprintf(file, "\n%-28s %-20s %14s %14s\n", "bytecode+offset", "opcode", "count", "cycles");
+	for (YkUint i = 0; i < min(yk_instrument_sites_count, (YkUint)YK_INSTRUMENT_REPORT_SIZE); i++) {
+		YkObject bytecode = sites[i].bytecode;
+		fprintf(file, "%20s+%-7lu %-20s %14lu %14lu\n",
+				yk_symbol_cstr(YK_PTR(bytecode)->bytecode.name), sites[i].offset,
+				yk_opcode_names[YK_PTR(bytecode)->bytecode.code[sites[i].offset].opcode],
+				sites[i].count, sites[i].cycles);
+	}
+
+	if (yk_instrument_dropped_sites > 0)
+		fprintf(file, "%lu executions at untracked offsets\n", yk_instrument_dropped_sites);
+
+	free(sites);
+
+	YkUint pairs[YK_OPCODES_COUNT * YK_OPCODES_COUNT];
+	YkUint pairs_count = yk_instrument_sorted_pairs(pairs);
+
+	fprintf(file, "\n%-41s %14s\n", "pair", "count");
+	for (YkUint i = 0; i < min(pairs_count, (YkUint)YK_INSTRUMENT_REPORT_SIZE); i++) {
+		fprintf(file, "%-20s %-20s %14lu\n",
+				yk_opcode_names[pairs[i] / YK_OPCODES_COUNT],
+				yk_opcode_names[pairs[i] % YK_OPCODES_COUNT],
+				yk_instrument_pairs[pairs[i]]);
+	}
+}
+
+/* (instrument-counts), returns three lists: (opcode count cycles) for each
+ * opcode executed, (bytecode offset count cycles) for the busiest offsets
+ * and (first second count) for the most frequent pairs of opcodes */
+static YkObject yk_builtin_instrument_counts(YkUint nargs) {
+	YkObject opcodes = YK_NIL, sites = YK_NIL, pairs = YK_NIL, entry = YK_NIL;
+	YK_GC_PROTECT4(opcodes, sites, pairs, entry);
+
+	for (YkUint i = YK_OPCODES_COUNT; i > 0; i--) {
+		if (yk_instrument_counts[i - 1] == 0)
+			continue;
+
+		entry = yk_cons(YK_MAKE_INT(yk_instrument_cycles[i - 1]), YK_NIL);
+		entry = yk_cons(YK_MAKE_INT(yk_instrument_counts[i - 1]), entry);
+		entry = yk_cons(yk_make_symbol_cstr(yk_opcode_names[i - 1]), entry);
+		opcodes = yk_cons(entry, opcodes);
+	}
+
+	YkInstrumentSite* sorted_sites = yk_instrument_sorted_sites();
+	for (YkUint i = min(yk_instrument_sites_count, (YkUint)YK_INSTRUMENT_REPORT_SIZE); i > 0; i--) {
+		entry = yk_cons(YK_MAKE_INT(sorted_sites[i - 1].cycles), YK_NIL);
+		entry = yk_cons(YK_MAKE_INT(sorted_sites[i - 1].count), entry);
+		entry = yk_cons(YK_MAKE_INT(sorted_sites[i - 1].offset), entry);
+		entry = yk_cons(sorted_sites[i - 1].bytecode, entry);
+		sites = yk_cons(entry, sites);
+	}
+
+	free(sorted_sites);
+
+	YkUint sorted_pairs[YK_OPCODES_COUNT * YK_OPCODES_COUNT];
+	YkUint pairs_count = yk_instrument_sorted_pairs(sorted_pairs);
+	for (YkUint i = min(pairs_count, (YkUint)YK_INSTRUMENT_REPORT_SIZE); i > 0; i--) {
+		YkUint pair = sorted_pairs[i - 1];
+		entry = yk_cons(YK_MAKE_INT(yk_instrument_pairs[pair]), YK_NIL);
+		entry = yk_cons(yk_make_symbol_cstr(yk_opcode_names[pair % YK_OPCODES_COUNT]), entry);
+		entry = yk_cons(yk_make_symbol_cstr(yk_opcode_names[pair / YK_OPCODES_COUNT]), entry);
+		pairs = yk_cons(entry, pairs);
+	}
+
+	entry = yk_cons(pairs, YK_NIL);
+	entry = yk_cons(sites, entry);
+	entry = yk_cons(opcodes, entry);
+
+	YK_GC_UNPROTECT;
+	return entry;
+}
+
+static YkObject yk_builtin_instrument_reset(YkUint nargs) {
+	yk_instrument_reset();
+	return YK_NIL;
+}
+
+/* (instrument-trace flag), prints every instruction dispatched to stderr
+ * while flag is not nil */
+static YkObject yk_builtin_instrument_trace(YkUint nargs) {
+	yk_instrument_tracing = yk_lisp_stack_top[0] != YK_NIL;
+	return YK_NIL;
+}
+#endif
+
+static YkObject yk_keyword_quote, yk_keyword_let, yk_keyword_lambda, yk_keyword_setq,
+	yk_keyword_comptime, yk_keyword_do, yk_keyword_if, yk_keyword_dynamic_let,
+	yk_keyword_with_cont, yk_keyword_exit, yk_keyword_loop, yk_keyword_receive,
+	yk_stream_console_output, yk_stream_console_input,
+	yk_make_closure_cfun;
+
+/* Modules
+
+   A module is a file starting with (module name (export symbol...)).
+   Declaring it only reads that first form: its body is compiled and run
+   the first time one of its exports is referenced. */
+
+static YkObject yk_modules;		/* Hash table from names to modules */
+
+#define YK_MODULE_NAME(m)      (YK_PTR(m)->array.data[0])
+#define YK_MODULE_PATH(m)      (YK_PTR(m)->array.data[1])
+#define YK_MODULE_EXPORTS(m)   (YK_PTR(m)->array.data[2])
+#define YK_MODULE_LOADED(m)    (YK_PTR(m)->array.data[3])
+#define YK_MODULE_BYTECODES(m) (YK_PTR(m)->array.data[4])	/* One per top-level form */
+#define YK_MODULE_MTIME(m)     (YK_PTR(m)->array.data[5])	/* Of the file they were compiled from */
+#define YK_MODULE_SIZE 6
+
+static YkObject yk_file_mtime(YkObject path) {
+#ifdef _WIN32
+	return YK_NIL;
+#else
+	struct stat file_stat;
+	if (stat(yk_string_to_c_str(path), &file_stat) != 0)
+		return YK_NIL;
+
+	return YK_MAKE_INT((YkInt)file_stat.st_mtime);
+#endif
+}
+
+static YkObject yk_find_module(YkObject name) {
+	YkObject module = yk_hash_table_ref(yk_modules, name, YK_NIL);
+	YK_ASSERT(module != YK_NIL);	/* Undeclared module */
+
+	return module;
+}
+
+static YkObject yk_declare_module_path(YkObject path) {
+	YkObject declaration = YK_NIL, module = YK_NIL;
+	YK_GC_PROTECT3(path, declaration, module);
+
+	YkReader reader;
+	bool eof;
+	YK_ASSERT(yk_reader_open_file(&reader, yk_string_to_c_str(path)));
+	declaration = yk_read_form(&reader, &eof);
+	yk_reader_close(&reader);
+
+	YK_ASSERT(!eof && YK_CONSP(declaration) &&
+			  YK_CAR(declaration) == yk_make_symbol_cstr("module") &&
+			  YK_CONSP(YK_CDR(declaration)) && YK_SYMBOLP(YK_CAR(YK_CDR(declaration))) &&
+			  YK_CONSP(YK_CDR(YK_CDR(declaration))));
+
+	YkObject name = YK_CAR(YK_CDR(declaration)),
+		exports = YK_CAR(YK_CDR(YK_CDR(declaration)));
+	YK_ASSERT(YK_CONSP(exports) && YK_CAR(exports) == yk_make_symbol_cstr("export"));
+
+	module = yk_hash_table_ref(yk_modules, name, YK_NIL);
+	if (module == YK_NIL || YK_MODULE_LOADED(module) == YK_NIL) {
+		module = yk_make_array(YK_MODULE_SIZE, YK_NIL);
+		YK_MODULE_NAME(module) = name;
+		YK_MODULE_PATH(module) = path;
+		YK_MODULE_EXPORTS(module) = YK_CDR(exports);
+		yk_hash_table_set(yk_modules, name, module);
+
+		/* Symbols already defined elsewhere are left alone */
+		YK_LIST_FOREACH(YK_MODULE_EXPORTS(module), e) {
+			YkObject symbol = YK_CAR(e);
+			YK_ASSERT(YK_SYMBOLP(symbol) && symbol != YK_NIL);
+
+			if (YK_PTR(symbol)->symbol.value == NULL) {
+				YK_PTR(symbol)->symbol.module = module;
+				YK_PTR(symbol)->symbol.declared = 1;
+			}
+		}
+	}
+
+	YK_GC_UNPROTECT;
+	return name;
+}
+
+/* Declares the module of the file at `path', and returns its name */
+YkObject yk_declare_module(const char* path) {
+	return yk_declare_module_path(yk_make_string(path, strlen(path)));
+}
+
+/* Compiles and runs the forms after the declaration one at a time, so that
+ * each one can use the macros defined before it */
+static void yk_module_compile(YkObject module) {
+	YkObject bytecodes = YK_NIL, bytecode = YK_NIL, form = YK_NIL, error = YK_NIL;
+	YK_GC_PROTECT5(module, bytecodes, bytecode, form, error);
+
+	YkReader reader;
+	bool eof;
+	YK_ASSERT(yk_reader_open_file(&reader, yk_string_to_c_str(YK_MODULE_PATH(module))));
+	YK_MODULE_MTIME(module) = yk_file_mtime(YK_MODULE_PATH(module));
+
+	yk_read_form(&reader, &eof);
+	while (form = yk_read_form(&reader, &eof), !eof) {
+		bytecode = yk_make_bytecode_begin(YK_MODULE_NAME(module), 0);
+		error = yk_compile(form, bytecode);
+		if (error != YK_NIL)
+			break;
+
+		bytecodes = yk_cons(bytecode, bytecodes);
+		yk_run(bytecode);
+	}
+
+	yk_reader_close(&reader);
+	YK_MODULE_BYTECODES(module) = yk_nreverse(bytecodes);
+
+	YK_GC_UNPROTECT;
+	YK_ASSERT(error == YK_NIL);
+}
+
+/* Loads `module', running its cached bytecode again unless its file changed
+ * since it was compiled. It may be called in the middle of a run or of a
+ * compilation: the registers and the stack are given back as they were.
+ * Returns whether the module was compiled. */
+static bool yk_module_load(YkObject module) {
+	YkObject value = yk_value_register, code = yk_bytecode_register,
+		reads = yk_expansion_reads;
+	YkInstruction* program_counter = yk_program_counter;
+	YkObject *stack_top = yk_lisp_stack_top, *frame_ptr = yk_lisp_frame_ptr;
+	YK_GC_PROTECT4(module, value, code, reads);
+
+	YkObject mtime = yk_file_mtime(YK_MODULE_PATH(module));
+	bool compile = YK_MODULE_LOADED(module) == YK_NIL || mtime == YK_NIL ||
+		mtime != YK_MODULE_MTIME(module);
+
+	/* A reference from the module itself must not load it again */
+	YK_MODULE_LOADED(module) = yk_tee;
+	YK_LIST_FOREACH(YK_MODULE_EXPORTS(module), e) {
+		YK_PTR(YK_CAR(e))->symbol.module = YK_NIL;
+	}
+
+	yk_lisp_frame_ptr = yk_lisp_stack_top;
+	/* What the module reads isn't read by the code that loaded it */
+	yk_expansion_reads = yk_tee;
+
+	if (compile) {
+		yk_module_compile(module);
+	} else {
+		YK_LIST_FOREACH(YK_MODULE_BYTECODES(module), l) {
+			yk_run(YK_CAR(l));
+		}
+	}
+
+	yk_value_register = value;
+	yk_bytecode_register = code;
+	yk_program_counter = program_counter;
+	yk_lisp_stack_top = stack_top;
+	yk_lisp_frame_ptr = frame_ptr;
+	yk_expansion_reads = reads;
+
+	YK_GC_UNPROTECT;
+	return compile;
+}
+
+/* (declare-module path) */
+static YkObject yk_builtin_declare_module(YkUint nargs) {
+	YkObject path = yk_lisp_stack_top[0];
+	YK_ASSERT(YK_TYPEOF(path) == yk_t_string);
+
+	return yk_declare_module_path(path);
+}
+
+/* (require name), loads a declared module now */
+static YkObject yk_builtin_require(YkUint nargs) {
+	YkObject module = yk_find_module(yk_lisp_stack_top[0]);
+	if (YK_MODULE_LOADED(module) == YK_NIL)
+		yk_module_load(module);
+
+	return YK_MODULE_NAME(module);
+}
+
+/* (reload-module name), runs a module again, recompiling it if its file
+ * changed. Returns whether it was recompiled. */
+static YkObject yk_builtin_reload_module(YkUint nargs) {
+	return yk_module_load(yk_find_module(yk_lisp_stack_top[0])) ? yk_tee : YK_NIL;
+}
+
+static YkObject yk_builtin_module_loadedp(YkUint nargs) {
+	return YK_MODULE_LOADED(yk_find_module(yk_lisp_stack_top[0]));
+}
+
+void yk_init() {
+	yk_gc_stack_size = 0;
+	yk_gc_protected_stack_size = 0;
+
+	yk_stack_create(&yk_lisp_stack, sizeof(YkObject));
+	yk_stack_create(&yk_dynamic_bindings_stack, sizeof(YkDynamicBinding));
+	yk_stack_create(&yk_continuations_stack, sizeof(YkObject));
+
+	yk_lisp_stack_top = YK_STACK_BOTTOM(yk_lisp_stack, YkObject);
+	yk_lisp_frame_ptr = yk_lisp_stack_top;
+	yk_dynamic_bindings_stack_top = YK_STACK_BOTTOM(yk_dynamic_bindings_stack, YkDynamicBinding);
+	yk_continuations_stack_top = YK_STACK_BOTTOM(yk_continuations_stack, YkObject);
+	yk_value_register = YK_NIL;
+	yk_values_count = 1;
+	yk_program_counter = NULL;
+	yk_pending_recompiles = YK_NIL;
+	yk_macro_expansions = YK_NIL;
+	yk_compiled_lambdas = YK_NIL;
+	yk_expansion_reads = YK_NIL;
+
+	yk_jump_stack_size = 0;
+
+	yk_allocator_init();
+	yk_array_allocator_init();
+	yk_symbol_table_init();
+
+	/* Special symbols */
+	yk_tee = yk_make_symbol_cstr("t");
+	YK_PTR(yk_tee)->symbol.value = yk_tee;
+	YK_PTR(yk_tee)->symbol.class_value = yk_tee;
+	YK_PTR(yk_tee)->symbol.type = yk_s_constant;
+
+	yk_symbol_environnement = yk_make_symbol_cstr("*environnement*");
+
+	yk_symbol_type_list = yk_make_symbol_cstr("list");
+	yk_symbol_type_object = yk_make_symbol_cstr("object");
+	yk_symbol_type_number = yk_make_symbol_cstr("number");
+	yk_symbol_type_stream = yk_make_symbol_cstr("stream");
+	yk_symbol_type_int = yk_make_symbol_cstr("int");
+	yk_symbol_type_float = yk_make_symbol_cstr("float");
+	yk_symbol_type_symbol = yk_make_symbol_cstr("symbol");
+	yk_symbol_type_function = yk_make_symbol_cstr("function");
+	yk_symbol_type_array = yk_make_symbol_cstr("array");
+	yk_symbol_type_string = yk_make_symbol_cstr("string");
+	yk_symbol_type_cpointer = yk_make_symbol_cstr("cpointer");
+	yk_symbol_type_string_stream = yk_make_symbol_cstr("string-stream");
+	yk_symbol_type_file_stream = yk_make_symbol_cstr("file-stream");
+	yk_symbol_type_hash_table = yk_make_symbol_cstr("hash-table");
+	yk_symbol_type_persistent_map = yk_make_symbol_cstr("persistent-map");
+	yk_symbol_type_persistent_vector = yk_make_symbol_cstr("persistent-vector");
+	yk_symbol_type_typed_array = yk_make_symbol_cstr("typed-array");
+	yk_symbol_type_sequence = yk_make_symbol_cstr("sequence");
+	yk_symbol_type_class = yk_make_symbol_cstr("class");
+	yk_symbol_type_object_class = yk_make_symbol_cstr("object-class");
+	yk_symbol_type_builtin_class = yk_make_symbol_cstr("builtin-class");
+
+	yk_nil = yk_make_symbol_cstr("nil");
+	YK_PTR(yk_nil)->symbol.value = YK_NIL;
+	YK_PTR(yk_nil)->symbol.type = yk_s_constant;
+
+	yk_class_class = yk_alloc();
+	yk_class_class->t.t = yk_t_instance;
+	yk_class_class->instance.class = yk_class_class;
+	yk_class_class->instance.slots = yk_array_allocator_alloc(sizeof(YkObject) * 4);
+	yk_class_class->instance.slots_count = 4;
+	yk_class_class->instance.slots[0] = yk_symbol_type_class;
+	yk_class_class->instance.slots[1] = yk_tee;
+	yk_class_class->instance.slots[2] = YK_MAKE_INT(3);
+	yk_class_class->instance.slots[3] = YK_NIL;
+
+	YK_PTR(yk_symbol_type_class)->symbol.class_value = yk_class_class;
+
+	yk_class_builtin_class = yk_make_class(yk_class_class, yk_symbol_type_builtin_class, yk_class_class, 3);
+	yk_class_object_class = yk_make_class(yk_class_class, yk_symbol_type_object_class, yk_class_class, 6);
+	yk_class_object = yk_make_class(yk_class_class, yk_symbol_type_object, yk_tee, 0);
+	yk_class_number = yk_make_class(yk_class_builtin_class, yk_symbol_type_number, yk_tee, 0);
+	yk_class_function = yk_make_class(yk_class_builtin_class, yk_symbol_type_function, yk_tee, 0);
+	yk_class_symbol = yk_make_class(yk_class_builtin_class, yk_symbol_type_symbol, yk_tee, 0);
+	yk_class_string = yk_make_class(yk_class_builtin_class, yk_symbol_type_string, yk_tee, 0);
+	yk_class_stream = yk_make_class(yk_class_class, yk_symbol_type_stream, yk_tee, 0);
+	yk_class_string_stream = yk_make_class(yk_class_builtin_class, yk_symbol_type_string_stream, yk_class_stream, 0);
+	yk_class_file_stream = yk_make_class(yk_class_builtin_class, yk_symbol_type_file_stream, yk_class_stream, 0);
+	yk_class_int = yk_make_class(yk_class_builtin_class, yk_symbol_type_int, yk_class_number, 0);
+	yk_class_float = yk_make_class(yk_class_builtin_class, yk_symbol_type_float, yk_class_number, 0);
+
+	yk_keyword_quote = yk_make_symbol_cstr("quote");
+	yk_keyword_let = yk_make_symbol_cstr("let");
+	yk_keyword_setq = yk_make_symbol_cstr("set!");
+	yk_keyword_lambda = yk_make_symbol_cstr("named-lambda");
+	yk_keyword_comptime = yk_make_symbol_cstr("comptime");
+	yk_keyword_do = yk_make_symbol_cstr("do");
+	yk_keyword_if = yk_make_symbol_cstr("if");
+	yk_keyword_dynamic_let = yk_make_symbol_cstr("dynamic-let");
+	yk_keyword_with_cont = yk_make_symbol_cstr("with-cont");
+	yk_keyword_exit = yk_make_symbol_cstr("exit");
+	yk_keyword_loop = yk_make_symbol_cstr("loop");
+	yk_keyword_receive = yk_make_symbol_cstr("receive");
+
+	yk_symbol_file_mode_input = yk_make_symbol_cstr("input");
+	yk_symbol_file_mode_output = yk_make_symbol_cstr("output");
+	yk_symbol_file_mode_append = yk_make_symbol_cstr("append");
+	yk_symbol_file_mode_binary_input = yk_make_symbol_cstr("binary-input");
+	yk_symbol_file_mode_binary_output = yk_make_symbol_cstr("binary-output");
+	yk_symbol_file_mode_binary_append = yk_make_symbol_cstr("binary-append");
+
+	yk_symbol_eof = yk_make_symbol_cstr("eof");
+
+	/* Streams */
+	yk_stream_console_output = yk_make_file_stream(YK_NIL, yk_symbol_file_mode_output, stdout);
+	yk_permanent_gc_protect(yk_stream_console_output);
+
+	yk_stream_console_input = yk_make_file_stream(YK_NIL, yk_symbol_file_mode_input, stdin);
+	yk_permanent_gc_protect(yk_stream_console_input);
+
+	yk_modules = yk_make_hash_table(YK_HASH_EQ, 16);
+	yk_permanent_gc_protect(yk_modules);
+
+	yk_compiled_lambdas = yk_make_hash_table(YK_HASH_EQUAL, 64);
+	yk_expansion_reads = yk_tee;
+
+	yk_var_output = yk_make_symbol_cstr("*output*");
+	YK_PTR(yk_var_output)->symbol.declared = true;
+	YK_PTR(yk_var_output)->symbol.value = yk_stream_console_output;
+
+	/* Functions */
+	YkObject arglist_symbol = yk_make_symbol_cstr("arglist");
+	yk_arglist_cfun = yk_make_global_function(arglist_symbol, 1, yk_arglist);
+
+	yk_permanent_gc_protect(yk_arglist_cfun);
+
+	/* Builtin functions */
+	yk_make_builtin("+", -1, yk_builtin_add);
+	yk_make_builtin("*", -1, yk_builtin_mul);
+	yk_make_builtin("/", -1, yk_builtin_div);
+	yk_make_builtin("-", -2, yk_builtin_sub);
+	yk_make_builtin("**", 2, yk_builtin_pow);
+	yk_make_builtin("mod", 2, yk_builtin_mod);
+
+	yk_make_builtin("=", 2, yk_builtin_neq);
+	yk_make_builtin(">", 2, yk_builtin_nsup);
+	yk_make_builtin("<", 2, yk_builtin_ninf);
+	yk_make_builtin(">=", 2, yk_builtin_nsupeq);
+	yk_make_builtin("<=", 2, yk_builtin_ninfeq);
+
+	yk_make_builtin("eq?", 2, yk_builtin_eq);
+
+	yk_make_builtin(":", 2, yk_builtin_cons);
+	yk_make_builtin("head", 1, yk_builtin_head);
+	yk_make_builtin("tail", 1, yk_builtin_tail);
+	yk_make_builtin("first", 1, yk_builtin_head);
+	yk_make_builtin("second", 1, yk_builtin_second);
+	yk_make_builtin("third", 1, yk_builtin_third);
+	yk_make_builtin("list", -1, yk_builtin_list);
+	yk_make_builtin("length", 1, yk_builtin_length);
+	yk_make_builtin("lambda-list-length", 1, yk_builtin_arguments_length);
+	yk_make_builtin("not", 1, yk_builtin_not);
+	yk_make_builtin("append", -1, yk_builtin_append);
+	yk_make_builtin("reverse", 1, yk_builtin_reverse);
+	yk_make_builtin("reverse!", 1, yk_builtin_nreverse);
+	yk_make_builtin("map", 2, yk_builtin_map);
+	yk_make_builtin("enumerate", 2, yk_builtin_enumerate);
+	yk_make_builtin("filter", 2, yk_builtin_filter);
+	yk_make_builtin("range", 1, yk_builtin_range);
+
+	YkObject array_sym = yk_make_symbol_cstr("array");
+	yk_array_cfun = yk_make_global_function(array_sym, -1, yk_builtin_array);
+	yk_permanent_gc_protect(yk_array_cfun);
+
+	YK_PTR(array_sym)->symbol.value = yk_array_cfun;
+	YK_PTR(array_sym)->symbol.declared = 1;
+	YK_PTR(array_sym)->symbol.type = yk_s_function;
+	YK_PTR(array_sym)->symbol.function_nargs = -1;
+
+	yk_make_closure_cfun = yk_make_global_function(yk_make_symbol_cstr("make-closure"),
+												   2, yk_builtin_make_closure);
+	yk_permanent_gc_protect(yk_make_closure_cfun);
+
+	yk_make_builtin("make-array", 2, yk_builtin_make_array);
+	yk_make_builtin("aref", 2, yk_builtin_aref);
+	yk_make_builtin("aset!", 3, yk_builtin_aset);
+	yk_make_builtin("list->array", 1, yk_builtin_list_to_array);
+	yk_make_builtin("array->list", 1, yk_builtin_array_to_list);
+	yk_make_builtin("vector-push!", 2, yk_builtin_vector_push);
+	yk_make_builtin("vector-pop!", 1, yk_builtin_vector_pop);
+	yk_make_builtin("vector-reserve!", 2, yk_builtin_vector_reserve);
+	yk_make_builtin("vector-length", 1, yk_builtin_vector_length);
+	yk_make_builtin("vector-capacity", 1, yk_builtin_vector_capacity);
+	yk_make_builtin("make-typed-array", -3, yk_builtin_make_typed_array);
+	yk_make_builtin("list->typed-array", 2, yk_builtin_list_to_typed_array);
+	yk_make_builtin("typed-array->list", 1, yk_builtin_typed_array_to_list);
+	yk_make_builtin("typed-array-length", 1, yk_builtin_typed_array_length);
+	yk_make_builtin("typed-array-type", 1, yk_builtin_typed_array_type);
+	yk_make_builtin("typed-array-add!", 3, yk_builtin_typed_array_add);
+	yk_make_builtin("typed-array-sub!", 3, yk_builtin_typed_array_sub);
+	yk_make_builtin("typed-array-mul!", 3, yk_builtin_typed_array_mul);
+	yk_make_builtin("typed-array-div!", 3, yk_builtin_typed_array_div);
+	yk_make_builtin("typed-array-fill!", 2, yk_builtin_typed_array_fill);
+	yk_make_builtin("typed-array-sum", 1, yk_builtin_typed_array_sum);
+	yk_make_builtin("typed-array-dot", 2, yk_builtin_typed_array_dot);
+	yk_make_builtin("typed-array-min", 1, yk_builtin_typed_array_min);
+	yk_make_builtin("typed-array-max", 1, yk_builtin_typed_array_max);
+	yk_make_builtin("seq", 1, yk_builtin_seq);
+	yk_make_builtin("seq-range", -2, yk_builtin_seq_range);
+	yk_make_builtin("generator", 1, yk_builtin_generator);
+	yk_make_builtin("seq-map", 2, yk_builtin_seq_map);
+	yk_make_builtin("seq-filter", 2, yk_builtin_seq_filter);
+	yk_make_builtin("seq-take", 2, yk_builtin_seq_take);
+	yk_make_builtin("seq-next", 1, yk_builtin_seq_next);
+	yk_make_builtin("seq-reduce", 3, yk_builtin_seq_reduce);
+	yk_make_builtin("seq-for-each", 2, yk_builtin_seq_for_each);
+	yk_make_builtin("seq->list", 1, yk_builtin_seq_to_list);
+
+	yk_make_builtin("equal?", 2, yk_builtin_equal);
+	yk_make_builtin("make-hash-table", -1, yk_builtin_make_hash_table);
+	yk_make_builtin("hash-ref", -3, yk_builtin_hash_ref);
+	yk_make_builtin("hash-set!", 3, yk_builtin_hash_set);
+	yk_make_builtin("hash-remove!", 2, yk_builtin_hash_remove);
+	yk_make_builtin("hash-count", 1, yk_builtin_hash_count);
+	yk_make_builtin("hash-for-each", 2, yk_builtin_hash_for_each);
+	yk_make_builtin("pmap", -1, yk_builtin_persistent_map);
+	yk_make_builtin("pmap-ref", -3, yk_builtin_pmap_ref);
+	yk_make_builtin("pmap-set", 3, yk_builtin_pmap_set);
+	yk_make_builtin("pmap-remove", 2, yk_builtin_pmap_remove);
+	yk_make_builtin("pmap-set!", 3, yk_builtin_pmap_set_transient);
+	yk_make_builtin("pmap-remove!", 2, yk_builtin_pmap_remove_transient);
+	yk_make_builtin("pmap-count", 1, yk_builtin_pmap_count);
+	yk_make_builtin("pmap-for-each", 2, yk_builtin_pmap_for_each);
+	yk_make_builtin("pvector", -1, yk_builtin_persistent_vector);
+	yk_make_builtin("pvector-ref", 2, yk_builtin_pvector_ref);
+	yk_make_builtin("pvector-set", 3, yk_builtin_pvector_set);
+	yk_make_builtin("pvector-push", 2, yk_builtin_pvector_push);
+	yk_make_builtin("pvector-pop", 1, yk_builtin_pvector_pop);
+	yk_make_builtin("pvector-set!", 3, yk_builtin_pvector_set_transient);
+	yk_make_builtin("pvector-push!", 2, yk_builtin_pvector_push_transient);
+	yk_make_builtin("pvector-pop!", 1, yk_builtin_pvector_pop_transient);
+	yk_make_builtin("pvector-count", 1, yk_builtin_pvector_count);
+	yk_make_builtin("pvector->list", 1, yk_builtin_pvector_to_list);
+	yk_make_builtin("transient", 1, yk_builtin_transient);
+	yk_make_builtin("persistent!", 1, yk_builtin_persistent);
+
+	yk_make_builtin("make-file-stream", 2, yk_builtin_make_file_stream);
+	yk_make_builtin("make-string-input-stream", 1, yk_builtin_make_input_string_stream);
+	yk_make_builtin("make-string-output-stream", 0, yk_builtin_make_output_string_stream);
+
+	yk_make_builtin("stream-string", 1, yk_builtin_stream_string);
+
+	yk_make_builtin("read-byte", 1, yk_builtin_stream_read_byte);
+	yk_make_builtin("write-byte!", 2, yk_builtin_stream_write_byte);
+	yk_make_builtin("read-char", 1, yk_builtin_stream_read_char);
+	yk_make_builtin("read", 1, yk_builtin_read);
+	yk_make_builtin("write-char!", 2, yk_builtin_stream_write_char);
+	yk_make_builtin("read-bytes!", 2, yk_builtin_stream_read_bytes);
+	yk_make_builtin("write-bytes!", 2, yk_builtin_stream_write_bytes);
+	yk_make_builtin("read-line", 1, yk_builtin_stream_read_line);
+	yk_make_builtin("read-all", 1, yk_builtin_stream_read_all);
+
+	yk_make_builtin("stream-close", 1, yk_builtin_stream_close);
+
+	yk_make_builtin("gc", 0, yk_builtin_gc);
+
+	yk_make_builtin("profile-start", -1, yk_builtin_profile_start);
+	yk_make_builtin("profile-stop", 0, yk_builtin_profile_stop);
+	yk_make_builtin("profile-report", 0, yk_builtin_profile_report);
+	yk_make_builtin("profile-stacks", 0, yk_builtin_profile_stacks);
+
+	yk_make_builtin("declare-module", 1, yk_builtin_declare_module);
+	yk_make_builtin("require", 1, yk_builtin_require);
+	yk_make_builtin("reload-module", 1, yk_builtin_reload_module);
+	yk_make_builtin("module-loaded?", 1, yk_builtin_module_loadedp);
+
+	yk_make_builtin("heap-census", 0, yk_builtin_heap_census);
+	yk_make_builtin("heap-sample-allocations", 1, yk_builtin_heap_sample_allocations);
+	yk_make_builtin("heap-allocation-sites", 0, yk_builtin_heap_allocation_sites);
+
+#if YK_INSTRUMENT
+	yk_make_builtin("instrument-counts", 0, yk_builtin_instrument_counts);
+	yk_make_builtin("instrument-reset", 0, yk_builtin_instrument_reset);
+	yk_make_builtin("instrument-trace", 1, yk_builtin_instrument_trace);
+#endif
+
+	yk_make_builtin("int?", 1, yk_builtin_intp);
+	yk_make_builtin("float?", 1, yk_builtin_floatp);
+	yk_make_builtin("pair?", 1, yk_builtin_consp);
+	yk_make_builtin("null?", 1, yk_builtin_nullp);
+	yk_make_builtin("list?", 1, yk_builtin_listp);
+	yk_make_builtin("symbol?", 1, yk_builtin_symbolp);
+	yk_make_builtin("function?", 1, yk_builtin_functionp);
+
+	yk_make_builtin("documentation", 1, yk_builtin_documentation);
+	yk_make_builtin("disassemble", 1, yk_builtin_disassemble);
+	yk_make_builtin("bound?", 1, yk_builtin_boundp);
+	yk_make_builtin("gensym", 0, yk_builtin_gensym);
+
+	yk_make_builtin("set-global!", 2, yk_builtin_set_global);
+	yk_make_builtin("set-macro!", 2, yk_builtin_set_macro);
+	yk_make_builtin("register-global!", 1, yk_builtin_register_global);
+	yk_make_builtin("register-function!", 2, yk_builtin_register_function);
+
+	yk_make_builtin("make-symbol", 1, yk_builtin_make_symbol);
+	yk_make_builtin("symbol-string", 1, yk_builtin_symbol_string);
+	yk_make_builtin("string-concat", -1, yk_builtin_string_concat);
+	yk_make_builtin("substring", -3, yk_builtin_substring);
+
+	yk_make_builtin("set-class!", 3, yk_builtin_set_class);
+	yk_make_builtin("make-instance", -2, yk_builtin_make_instance);
+	yk_make_builtin("find-class", 1, yk_builtin_find_class);
+	yk_make_builtin("subtype?", 2, yk_builtin_subtypep);
+	yk_make_builtin("set-slot!", 3, yk_builtin_set_slot);
+	yk_make_builtin("get-slot", 2, yk_builtin_get_slot);
+	yk_make_builtin("class-size", 1, yk_builtin_class_size);
+	yk_make_builtin("set-method!", 3, yk_builtin_set_method);
+	yk_make_builtin("call-method", -3, yk_builtin_call_method);
+
+	yk_make_builtin("apply", 2, yk_builtin_apply);
+	yk_make_builtin("values", -1, yk_builtin_values);
+	yk_make_builtin("type-of", 1, yk_builtin_type_of);
+
+	yk_make_builtin("clock", 0, yk_builtin_clock);
+	yk_make_builtin("random", 1, yk_builtin_random);
+
+	yk_make_builtin("print", 1, yk_builtin_print);
+
+	yk_make_builtin("breakpoint", 0, yk_builtin_breakpoint);
+	yk_make_builtin("invoke-debugger", 1, yk_default_debugger);
+
+	/* User interface functions */
+	yk_make_builtin("ps-make-window", 1, yk_builtin_make_window);
+	yk_make_builtin("ps-window-destroy", 1, yk_builtin_window_destroy);
+	yk_make_builtin("ps-make-box", 2, yk_builtin_make_box);
+	yk_make_builtin("ps-window-set-root", 2, yk_builtin_window_set_root);
+	yk_make_builtin("ps-make-button", 2, yk_builtin_make_button);
+	yk_make_builtin("ps-widget-destroy", 1, yk_builtin_widget_destroy);
+}
+
+static void yk_assert(const char* expression, const char* file, uint32_t line) {
+	char error_name[100];
+	snprintf(error_name, sizeof(error_name), "<assertion-error '%s' at %s:%d>", expression, file, line);
+
+	YkObject sym = yk_make_symbol_cstr(error_name);
+
+	yk_funcall("invoke-debugger", 1, sym);
+}
+
+static YkObject yk_intern(YkObject string, bool weak) {
+	char* name = yk_string_to_c_str(string);
+	uint32_t length = YK_PTR(string)->string.size;
+	uint64_t string_hash = yk_hash_bytes(name, length);
+
+	YkSymbolTableEntry* entry = yk_symbol_table_find(name, length, string_hash);
+	if (YK_SYMBOL_TABLE_LIVE(entry))
+		return entry->symbol == yk_nil ? YK_NIL : entry->symbol;
+
+	YkObject sym = YK_NIL;
+	YK_GC_PROTECT2(sym, string);
+
+	sym = yk_alloc();
+
+	sym->symbol.name = string;
+	sym->symbol.hash = string_hash;
+	sym->symbol.value = NULL;
+	sym->symbol.class_value = NULL;
+	sym->symbol.module = YK_NIL;
+	sym->symbol.type = yk_s_normal;
+	sym->symbol.function_nargs = 0;
+	sym->symbol.declared = 0;
+	sym->symbol.inlined = 0;
+	sym->symbol.weak = weak;
+
+	sym = YK_TAG_SYMBOL(sym);
+
+	if (2 * (yk_symbol_table_used + 1) > yk_symbol_table_size) {
+		/* Only grow if the table is not merely full of tombstones */
+		yk_symbol_table_resize(4 * (yk_symbol_table_count + 1) > yk_symbol_table_size ?
+							   2 * yk_symbol_table_size : yk_symbol_table_size);
+	}
+
+	/* The allocation may have collected weak symbols */
+	name = yk_string_to_c_str(string);
+	entry = yk_symbol_table_find(name, length, string_hash);
+
+	if (entry->symbol == NULL)
+		yk_symbol_table_used++;
+	yk_symbol_table_count++;
+
+	entry->symbol = sym;
+	entry->hash = string_hash;
+	entry->length = length;
+
+	YK_GC_UNPROTECT;
+	return sym;
+}
+
+static YkObject yk_make_symbol_from_string(YkObject string) {
+	return yk_intern(string, false);
+}
+
+YkObject yk_make_symbol(const char* name, uint size) {
+	YK_ASSERT(*name != '\0');
+	YkObject string = YK_NIL;
+	YK_GC_PROTECT1(string);
+	string = yk_make_string(name, size);
+	YK_GC_UNPROTECT;
+	return yk_make_symbol_from_string(string);
+}
+
+YkObject yk_make_symbol_cstr(const char* cstr) {
+	return yk_make_symbol(cstr, strlen(cstr));
+}
+
+inline static char* yk_symbol_cstr(YkObject sym) {
+	return yk_string_to_c_str(YK_PTR(sym)->symbol.name);
+}
+
+static YkObject yk_make_continuation(uint16_t offset) {
+	YkObject cont = yk_alloc();
+	cont->continuation.t = yk_t_continuation;
+
+	cont->continuation.lisp_stack_pointer = yk_lisp_stack_top;
+	cont->continuation.lisp_frame_pointer = yk_lisp_frame_ptr;
+	cont->continuation.dynamic_bindings_stack_pointer = yk_dynamic_bindings_stack_top;
+	cont->continuation.bytecode_register = yk_bytecode_register;
+	cont->continuation.program_counter = YK_PTR(yk_bytecode_register)->bytecode.code + offset;
+	cont->continuation.continuations_stack_pointer = yk_continuations_stack_top;
+	cont->continuation.exited = 0;
+	cont->continuation.run_depth = yk_run_depth;
+
+	return cont;
+}
+
+static YkObject yk_make_array(YkUint size, YkObject element) {
+	YkObject array = YK_NIL;
+	YK_GC_PROTECT2(element, array);
+	array = yk_alloc();
+
+	array->array.t = yk_t_array;
+	array->array.size = size;
+	array->array.capacity = size;
+	array->array.dummy = YK_NIL;
+	array->array.data = NULL;
+
+	array->array.data = yk_array_allocator_alloc(size * sizeof(YkObject));
+
+	for (uint i = 0; i < size; i++) {
+		array->array.data[i] = element;
+	}
+
+	YK_GC_UNPROTECT;
+	return array;
+}
+
+/* String of `size' bytes, left for the caller to fill */
+static YkObject yk_alloc_string(YkUint size) {
+	YkObject string = yk_alloc();
+	string->string.t = yk_t_string;
+	string->string.dummy = YK_NIL;
+	string->string.size = 0;
+	string->string.data = NULL;
+	string->string.length = YK_STRING_LENGTH_UNKNOWN;
+	string->string.index = NULL;
+
+	YK_GC_PROTECT1(string);
+	string->string.data = yk_array_allocator_alloc(size + 1);
+	string->string.data[size] = '\0';
+	string->string.size = size;
+	YK_GC_UNPROTECT;
+
+	return string;
+}
+
+static YkObject yk_make_string(const char* cstr, size_t cstr_size) {
+	YkObject string = yk_alloc_string(cstr_size);
+	memcpy(string->string.data, cstr, cstr_size);
+
+	return string;
+}
+
+YkObject yk_cons(YkObject car, YkObject cdr) {
+	YK_GC_PROTECT2(car, cdr);
+
+	YkObject o = yk_alloc();
+	o->cons.car = car;
+	o->cons.cdr = cdr;
+
+	YK_GC_UNPROTECT;
+	return YK_TAG_LIST(o);
+}
+
+#define BYTECODE_DEFAULT_SIZE 8
+
+YkObject yk_make_bytecode_begin(YkObject name, YkInt nargs) {
+	YkObject bytecode = YK_NIL;
+	YK_GC_PROTECT2(bytecode, name);		/* This function can GC */
+
+	bytecode = yk_alloc();
+	bytecode->bytecode.name = name;
+	bytecode->bytecode.docstring = YK_NIL;
+	bytecode->bytecode.code = yk_array_allocator_alloc(8 * sizeof(YkInstruction));
+	bytecode->bytecode.code_size = 0;
+	bytecode->bytecode.code_capacity = 8;
+	bytecode->bytecode.nargs = nargs;
+	bytecode->bytecode.source = YK_NIL;
+
+	YK_GC_UNPROTECT;
+	return YK_TAG(bytecode, yk_t_bytecode);
+}
+
+void yk_bytecode_emit(YkObject bytecode, YkOpcode op, uint16_t modifier, YkObject ptr) {
+	YK_GC_PROTECT1(bytecode);
+
+	YK_ASSERT(YK_BYTECODEP(bytecode));
+	YkObject bytecode_ptr = YK_PTR(bytecode);
+
+	if (bytecode_ptr->bytecode.code_size >= bytecode_ptr->bytecode.code_capacity) {
+		bytecode_ptr->bytecode.code_capacity *= 2;
+		YkInstruction* old_code = bytecode_ptr->bytecode.code;
+		bytecode_ptr->bytecode.code = yk_array_allocator_alloc(sizeof(YkInstruction) * bytecode_ptr->bytecode.code_capacity);
+		memcpy(bytecode_ptr->bytecode.code, old_code, bytecode_ptr->bytecode.code_size * sizeof(YkInstruction));
+	}
+
+	YkInstruction* last_i = bytecode_ptr->bytecode.code + bytecode_ptr->bytecode.code_size++;
+	last_i->ptr = ptr;
+	last_i->modifier = modifier;
+	last_i->opcode = op;
+	YK_GC_UNPROTECT;
+}
+
+static YkObject yk_make_cpointer(void* cptr) {
+	YkObject obj = yk_alloc();
+	obj->pointer.dummy = YK_NIL;
+	obj->pointer.cpointer = cptr;
+	obj->pointer.t = yk_t_cpointer;
+
+	return obj;
+}
+
+static void* yk_cpointer_value(YkObject cpointer) {
+	YK_ASSERT(cpointer->pointer.cpointer != NULL);
+	return cpointer->pointer.cpointer;
+}
+
+static YkObject yk_nreverse(YkObject list) {
+	YK_ASSERT(YK_LISTP(list));
+
+	YkObject current = list,
+		next, previous = YK_NIL,
+		last = YK_NIL;
+
+	while (current != YK_NIL) {
+		next = YK_CDR(current);
+		YK_CDR(current) = previous;
+		previous = current;
+		last = current;
+		current = next;
+	}
+
+	return last;
+}
+
+static YkObject yk_reverse(YkObject list) {
+	YkObject new_list = YK_NIL;
+
+	YK_GC_PROTECT2(new_list, list);
+
+	YK_LIST_FOREACH(list, l) {
+		new_list = yk_cons(YK_CAR(l), new_list);
+	}
+
+	YK_GC_UNPROTECT;
+	return new_list;
+}
+
+static YkObject yk_delete(YkObject element, YkObject partial_list) {
+	YkObject final_list = partial_list,
+		previous = YK_NIL;
+
+	if (partial_list == YK_NIL)
+		return YK_NIL;
+
+	for (YkObject pair = partial_list; pair != YK_NIL; pair = YK_CDR(pair)) {
+		if (YK_CAR(pair) == element) {
+			if (pair == final_list) {
+				final_list = YK_CDR(pair);
+			} else {
+				YK_CDR(previous) = YK_CDR(pair);
+			}
+		}
+
+		previous = pair;
+	}
+
+	return final_list;
+}
+
+#define IS_BLANK(x) ((x) == ' ' || (x) == '\n' || (x) == '\t')
+#define IS_DELIMITER(x) (IS_BLANK(x) || (x) == '(' || (x) == ')' || \
+						 (x) == '"' || (x) == EOF)
+
+/* Reader errors don't return, so the reader is closed before signaling them */
+#define YK_READER_ASSERT(reader, cond)							\
+	do {															\
+		if (!(cond)) {											\
+			yk_reader_close(reader);							\
+			yk_assert(#cond, __FILE__, __LINE__);					\
+		}													\
+	} while (0)
+
+static void yk_reader_init_memory(YkReader* reader, const char* data, size_t size) {
+	memset(reader, 0, offsetof(YkReader, inline_token));
+	reader->data = data;
+	reader->size = size;
+	reader->token = reader->inline_token;
+	reader->token_capacity = YK_READER_INLINE_TOKEN_SIZE;
+}
+
+void yk_reader_init_string(YkReader* reader, const char* string) {
+	yk_reader_init_memory(reader, string, strlen(string));
+}
+
+/* Reads `file' `buffer_size' bytes at a time. The file stays open on close. */
+void yk_reader_init_file(YkReader* reader, FILE* file, size_t buffer_size) {
+	yk_reader_init_memory(reader, NULL, 0);
+	reader->file = file;
+	reader->buffer_size = buffer_size;
+	reader->buffer = malloc(buffer_size);
+}
+
+/* Maps the file at `path' when possible, so that it is paged in as it is
+ * read, and falls back on buffered reads otherwise. */
+bool yk_reader_open_file(YkReader* reader, const char* path) {
+#ifndef _WIN32
+	int fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		struct stat st;
+		void* mapping = MAP_FAILED;
+
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+			mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		close(fd);
+
+		if (mapping != MAP_FAILED) {
+			yk_reader_init_memory(reader, mapping, st.st_size);
+			reader->mapping = mapping;
+			reader->mapping_size = st.st_size;
+			return true;
+		}
+	}
+#endif
+
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+		return false;
+
+	yk_reader_init_file(reader, file, YK_READER_BUFFER_SIZE);
+	reader->owns_file = true;
+	return true;
+}
+
+void yk_reader_close(YkReader* reader) {
+#ifndef _WIN32
+	if (reader->mapping != NULL)
+		munmap(reader->mapping, reader->mapping_size);
+#endif
+
+	if (reader->owns_file)
+		fclose(reader->file);
+
+	if (reader->token != reader->inline_token)
+		free(reader->token);
+
+	free(reader->buffer);
+
+	/* Left empty, so that closing it again does nothing */
+	yk_reader_init_memory(reader, NULL, 0);
+}
+
+static int yk_reader_peek(YkReader* reader) {
+	if (reader->position == reader->size) {
+		if (reader->file == NULL)
+			return EOF;
+
+		reader->size = fread(reader->buffer, 1, reader->buffer_size, reader->file);
+		reader->data = reader->buffer;
+		reader->position = 0;
+
+		if (reader->size == 0)
+			return EOF;
+	}
+
+	return (uchar)reader->data[reader->position];
+}
+
+/* Only text read from a FILE* is copied, in place sources hand out slices */
+static void yk_reader_push_char(YkReader* reader, size_t length, char c) {
+	if (reader->file == NULL)
+		return;
+
+	if (length == reader->token_capacity) {
+		reader->token_capacity *= 2;
+
+		if (reader->token == reader->inline_token) {
+			reader->token = malloc(reader->token_capacity);
+			memcpy(reader->token, reader->inline_token, length);
+		} else {
+			reader->token = realloc(reader->token, reader->token_capacity);
+		}
+	}
+
+	reader->token[length] = c;
+}
+
+static const char* yk_reader_token_text(YkReader* reader, size_t begin_position) {
+	return reader->file == NULL ? reader->data + begin_position : reader->token;
+}
+
+static YkToken yk_reader_get_token(YkReader* reader) {
+	YkToken token;
+	int a;
+
+	while (true) {
+		a = yk_reader_peek(reader);
+
+		if (a == ';') {
+			while ((a = yk_reader_peek(reader)) != '\n' && a != EOF)
+				reader->position++;
+		} else if (IS_BLANK(a)) {
+			reader->position++;
+		} else {
+			break;
+		}
+	}
+
+	if (a == EOF) {
+		token.type = YK_TOKEN_EOF;
+		return token;
+	}
+
+	reader->position++;
+
+	if (a == '(') {
+		token.type = YK_TOKEN_LEFT_PAREN;
+	} else if (a == ')') {
+		token.type = YK_TOKEN_RIGHT_PAREN;
+	} else if (a == '.') {
+		token.type = YK_TOKEN_DOT;
+	} else if (a == '\'') {
+		token.type = YK_TOKEN_QUOTE;
+	} else if (a == '"') {
+		size_t begin_position = reader->position, length = 0;
+
+		while ((a = yk_reader_peek(reader)) != '"') {
+			YK_READER_ASSERT(reader, "No closing double quote" && a != EOF);
+			yk_reader_push_char(reader, length++, a);
+			reader->position++;
+		}
+
+		token.type = YK_TOKEN_STRING;
+		token.data.string_info.data = yk_reader_token_text(reader, begin_position);
+		token.data.string_info.size = length;
+		reader->position++;
+	} else {
+		/* Numbers are recognized while the token is scanned: an optional
+		 * minus sign, then digits with at most one dot */
+		size_t begin_position = reader->position - 1, length = 0;
+		bool number = true, negative = false, dot = false;
+		uint digits = 0;
+		YkInt integer = 0;
+		double mantissa = 0, scale = 1;
+
+		while (true) {
+			yk_reader_push_char(reader, length, a);
+
+			if (!number) {
+				/* Plain symbol, just find its end */
+			} else if (a >= '0' && a <= '9') {
+				integer = integer * 10 + (a - '0');
+				mantissa = mantissa * 10 + (a - '0');
+				digits++;
+
+				if (dot)
+					scale *= 10;
+			} else if (a == '.' && !dot) {
+				dot = true;
+			} else if (a == '-' && length == 0) {
+				negative = true;
+			} else {
+				number = false;
+			}
+
+			length++;
+
+			a = yk_reader_peek(reader);
+			if (IS_DELIMITER(a))
+				break;
+
+			reader->position++;
+		}
+
+		if (number && (digits > 0 || dot)) {
+			if (dot) {
+				token.type = YK_TOKEN_FLOAT;
+				token.data.floating = (negative ? -mantissa : mantissa) / scale;
+			} else {
+				token.type = YK_TOKEN_INT;
+				token.data.integer = negative ? -integer : integer;
+			}
+		} else {
+			token.type = YK_TOKEN_SYMBOL;
+			token.data.string_info.data = yk_reader_token_text(reader, begin_position);
+			token.data.string_info.size = length;
+		}
+	}
+
+	return token;
+}
+
+/* Markers pushed on the reader stack, above the list frames */
+#define YK_READER_QUOTE YK_MAKE_INT('\'')
+#define YK_READER_DOT YK_MAKE_INT('.')
+
+/* Reads the next top-level form of `reader'. Unfinished lists are kept on
+ * an explicit stack of (head . last) frames rather than on the C stack, so
+ * nesting is only bounded by the heap. Sets `eof' at the end of the input. */
+YkObject yk_read_form(YkReader* reader, bool* eof) {
+	YkObject stack = YK_NIL, frame = YK_NIL, value = YK_NIL;
+	YK_GC_PROTECT3(stack, frame, value);
+
+	bool close_expected = false;
+	*eof = false;
+
+	while (true) {
+		YkToken t = yk_reader_get_token(reader);
+
+		YK_READER_ASSERT(reader, "Expected ) after dotted pair" &&
+						 (!close_expected || t.type == YK_TOKEN_RIGHT_PAREN));
+		close_expected = false;
+
+		switch (t.type) {
+		case YK_TOKEN_EOF:
+			YK_READER_ASSERT(reader, "Unexpected end of input" && stack == YK_NIL);
+			*eof = true;
+			YK_GC_UNPROTECT;
+			return YK_NIL;
+		case YK_TOKEN_LEFT_PAREN:
+			frame = yk_cons(YK_NIL, YK_NIL);
+			stack = yk_cons(frame, stack);
+			continue;
+		case YK_TOKEN_QUOTE:
+			stack = yk_cons(YK_READER_QUOTE, stack);
+			continue;
+		case YK_TOKEN_DOT:
+			YK_READER_ASSERT(reader, "Unexpected dot" && YK_CONSP(stack) &&
+							 YK_CONSP(YK_CAR(stack)) && YK_CAR(YK_CAR(stack)) != YK_NIL);
+			stack = yk_cons(YK_READER_DOT, stack);
+			continue;
+		case YK_TOKEN_RIGHT_PAREN:
+			YK_READER_ASSERT(reader, "Unexpected )" && YK_CONSP(stack) && YK_CONSP(YK_CAR(stack)));
+			value = YK_CAR(YK_CAR(stack));
+			stack = YK_CDR(stack);
+			break;
+		case YK_TOKEN_STRING:
+			value = yk_make_string(t.data.string_info.data, t.data.string_info.size);
+			break;
+		case YK_TOKEN_INT:
+			value = YK_MAKE_INT(t.data.integer);
+			break;
+		case YK_TOKEN_FLOAT:
+			value = YK_MAKE_FLOAT(t.data.floating);
+			break;
+		case YK_TOKEN_SYMBOL:
+			value = yk_make_symbol(t.data.string_info.data, t.data.string_info.size);
+			break;
+		}
+
+		/* Hand the value over to the innermost pending frame */
+		while (true) {
+			if (stack == YK_NIL) {
+				YK_GC_UNPROTECT;
+				return value;
+			}
+
+			frame = YK_CAR(stack);
+
+			if (frame == YK_READER_QUOTE) {
+				stack = YK_CDR(stack);
+				value = yk_cons(value, YK_NIL);
+				value = yk_cons(yk_keyword_quote, value);
+				continue;
+			}
+
+			if (frame == YK_READER_DOT) {
+				stack = YK_CDR(stack);
+				YK_CDR(YK_CDR(YK_CAR(stack))) = value;
+				close_expected = true;
+			} else {
+				YkObject cell = yk_cons(value, YK_NIL);
+
+				if (YK_CAR(frame) == YK_NIL)
+					YK_CAR(frame) = cell;
+				else
+					YK_CDR(YK_CDR(frame)) = cell;
+
+				YK_CDR(frame) = cell;
+			}
+
+			break;
+		}
+	}
+}
+
+YkObject yk_read(const char* string) {
+	YkReader reader;
+	bool eof;
+
+	yk_reader_init_string(&reader, string);
+	YkObject r = yk_read_form(&reader, &eof);
+	yk_reader_close(&reader);
+
+	return r;
+}
+
+void yk_print(YkObject o) {
+	YkObject output = YK_PTR(yk_var_output)->symbol.value;
+
+	switch (YK_TYPEOF(o)) {
+	case yk_t_list:
+		if (YK_NULL(o)) {
+			YK_STREAM_WRITE_LITERAL(output, "nil");
+		} else {
+			YkObject c;
+			YK_STREAM_WRITE_LITERAL(output, "(");
+
+			for (c = o; YK_CONSP(c); c = YK_CDR(c)) {
+				yk_print(YK_CAR(c));
+
+				if (YK_CONSP(YK_CDR(c)))
+					YK_STREAM_WRITE_LITERAL(output, " ");
+			}
+
+			if (!YK_NULL(c)) {
+				YK_STREAM_WRITE_LITERAL(output, " . ");
+				yk_print(c);
+			}
+
+			YK_STREAM_WRITE_LITERAL(output, ")");
+		}
+		break;
+	case yk_t_int:
+		yk_stream_write_int(output, yk_signed_fixnum_to_long(YK_INT(o)));
+		break;
+	case yk_t_float:
+		yk_stream_write_float(output, YK_FLOAT(o));
+		break;
+	case yk_t_symbol: {
+		YkObject name = YK_PTR(o)->symbol.name;
+		yk_stream_write(output, YK_PTR(name)->string.data, YK_PTR(name)->string.size);
+		break;
+	}
+	case yk_t_bytecode:
+		yk_stream_format(output, "<bytecode %s at %p>",
+						 yk_symbol_cstr(YK_PTR(o)->bytecode.name),
+						 YK_PTR(o));
+		break;
+	case yk_t_closure:
+		yk_stream_format(output, "<closure at %p closing ", YK_PTR(o));
+		yk_print(YK_PTR(o)->closure.lexical_env);
+		yk_stream_format(output, ">");
+		break;
+	case yk_t_c_proc:
+#if YK_PROFILE
+		yk_stream_format(output, "<compiled-function %s at %p (called %ld times totaling %g s)>",
+						 yk_symbol_cstr(YK_PTR(o)->c_proc.name),
+						 YK_PTR(o), YK_PTR(o)->c_proc.calls,
+						 (YK_PTR(o)->c_proc.time_called) / CLOCKS_PER_SEC);
+#else
+		yk_stream_format(output, "<compiled-function %s at %p>",
+						 yk_symbol_cstr(YK_PTR(o)->c_proc.name),
+						 YK_PTR(o));
+#endif
+		break;
+	case yk_t_array:
+		YK_STREAM_WRITE_LITERAL(output, "[");
+		for (uint i = 0; i < YK_PTR(o)->array.size; i++) {
+			yk_print(YK_PTR(o)->array.data[i]);
+
+			if (i != YK_PTR(o)->array.size - 1)
+				YK_STREAM_WRITE_LITERAL(output, " ");
+		}
+		YK_STREAM_WRITE_LITERAL(output, "]");
+		break;
+	case yk_t_string:
+		YK_STREAM_WRITE_LITERAL(output, "\"");
+		yk_stream_write(output, YK_PTR(o)->string.data, YK_PTR(o)->string.size);
+		YK_STREAM_WRITE_LITERAL(output, "\"");
+		break;
+	case yk_t_file_stream:
+		yk_stream_format(output, "<file stream at %p>", YK_PTR(o));
+		break;
+	case yk_t_hash_table:
+		yk_stream_format(output, "<hash table of %u entries at %p>",
+						 YK_PTR(o)->hash_table.count, YK_PTR(o));
+		break;
+	case yk_t_persistent_map:
+		yk_stream_format(output, "<%s map of %u entries at %p>",
+						 YK_PTR(o)->persistent_map.edit ? "transient" : "persistent",
+						 YK_PTR(o)->persistent_map.count, YK_PTR(o));
+		break;
+	case yk_t_persistent_vector:
+		yk_stream_format(output, "<%s vector of %u elements at %p>",
+						 YK_PTR(o)->persistent_vector.edit ? "transient" : "persistent",
+						 YK_PTR(o)->persistent_vector.count, YK_PTR(o));
+		break;
+	case yk_t_trie_node:
+		yk_stream_format(output, "<trie node at %p>", YK_PTR(o));
+		break;
+	case yk_t_sequence:
+		yk_stream_format(output, "<sequence at %p>", YK_PTR(o));
+		break;
+	case yk_t_typed_array:
+		yk_stream_format(output, "#%s[",
+						 yk_element_names[YK_PTR(o)->typed_array.element_type]);
+		for (uint i = 0; i < YK_PTR(o)->typed_array.size; i++) {
+			yk_print(yk_typed_array_ref(o, i));
+
+			if (i != YK_PTR(o)->typed_array.size - 1)
+				YK_STREAM_WRITE_LITERAL(output, " ");
+		}
+		YK_STREAM_WRITE_LITERAL(output, "]");
+		break;
+	case yk_t_string_stream:
+		yk_stream_format(output, "<string stream at %p>", YK_PTR(o));
+		break;
+	case yk_t_continuation:
+		yk_stream_format(output, "<continuation at %p>", YK_PTR(o));
+		break;
+	case yk_t_cpointer:
+		yk_stream_format(output, "<foreign pointer at %p>", YK_PTR(o));
+		break;
+	case yk_t_instance:
+		if (YK_CLASS_INVALID(YK_CLASS_OF(o))) {
+			yk_stream_format(output, "<invalid instance at %p>", YK_PTR(o));
+		} else {
+			yk_stream_format(output, "<%s at %p>", yk_symbol_cstr(YK_CLASS_NAME(YK_CLASS_OF(o))),
+							 YK_PTR(o));
+		}
+		break;
+	default:
+		yk_stream_format(output, "Unknown type 0x%lx!\n", YK_TYPEOF(o));
+	}
+}
+
+static inline void yk_exit_continuation(YkObject exit, YkObject* cont_stack_top) {
+	YK_ASSERT(!(YK_PTR(exit)->continuation.exited));
+
+	for (YkObject* o_ptr = yk_continuations_stack_top; o_ptr != cont_stack_top; o_ptr++) {
+		YK_PTR(*o_ptr)->continuation.exited = 1;
+	}
+
+	yk_continuations_stack_top = cont_stack_top;
+
+	YkDynamicBinding* ptr = yk_dynamic_bindings_stack_top;
+	YkDynamicBinding* next_ptr = YK_PTR(exit)->continuation.dynamic_bindings_stack_pointer;
+	for (; ptr != next_ptr; ptr++) { /* todo */
+		YK_PTR(ptr->symbol)->symbol.value = ptr->old_value;
+	}
+
+	yk_dynamic_bindings_stack_top = YK_PTR(exit)->continuation.dynamic_bindings_stack_pointer;
+	yk_lisp_stack_top = YK_PTR(exit)->continuation.lisp_stack_pointer;
+	yk_lisp_frame_ptr = YK_PTR(exit)->continuation.lisp_frame_pointer;
+	yk_bytecode_register = YK_PTR(exit)->continuation.bytecode_register;
+	yk_program_counter = YK_PTR(exit)->continuation.program_counter;
+
+	YK_PTR(exit)->continuation.exited = 1;
+
+	if (yk_stack_overflowing) {
+		yk_stack_overflowing =
+			!(yk_stack_rearm(&yk_lisp_stack, (char*)yk_lisp_stack_top) &
+			  yk_stack_rearm(&yk_dynamic_bindings_stack, (char*)yk_dynamic_bindings_stack_top) &
+			  yk_stack_rearm(&yk_continuations_stack, (char*)yk_continuations_stack_top));
+	}
+}
+
+static void yk_debug_info() {
+	printf("\n ______STACK_____\n");
+	YkObject* stack_ptr = yk_lisp_stack_top,
+		*frame_ptr = yk_lisp_frame_ptr;
+	if (yk_lisp_stack_top < YK_STACK_BOTTOM(yk_lisp_stack, YkObject)) {
+		while (stack_ptr < YK_STACK_BOTTOM(yk_lisp_stack, YkObject)) {
+			for (; stack_ptr != frame_ptr; stack_ptr++) {
+				printf(" | ");
+				yk_print(*stack_ptr);
+				printf("\t\t|\n");
+			}
+
+			if (frame_ptr != YK_STACK_BOTTOM(yk_lisp_stack, YkObject)) {
+				printf(" | RET ");
+				yk_print(stack_ptr[2]);
+				printf("\t|\n");
+			}
+
+			frame_ptr = (YkObject*)*stack_ptr;
+			stack_ptr += 3;
+		}
+	}
+	else {
+		printf(" | EMPTY\t|\n");
+	}
+	printf(" ----------------\n");
+
+	printf("VALUE: ");
+	yk_print(yk_value_register);
+	printf("\n");
+}
+
+static void yk_go_back(YkObject value, int code) {
+	assert(yk_jump_stack_size > 0);
+	yk_value_register = value;
+	yk_jump_stack_size = 0;
+
+	longjmp(yk_jump_point, code);
+}
+
+/* Exits to `cont', that may belong to a yk_run outside of the current one */
+static void yk_exit_to(YkObject cont) {
+	uint32_t depth = YK_PTR(cont)->continuation.run_depth;
+	YK_ASSERT(depth <= yk_run_depth);
+
+	if (depth == yk_run_depth) {
+		yk_exit_continuation(cont, YK_PTR(cont)->continuation.continuations_stack_pointer);
+		return;
+	}
+
+	YkRunFrame* frame = yk_run_frame;
+	while (frame->depth != depth) {
+		frame = frame->previous;
+	}
+
+	yk_escape_continuation = cont;
+	longjmp(frame->jump, YK_RUN_ESCAPE);
+}
+
+#define YK_RUN_DEBUG 0
+
+int yk_run(YkObject bytecode) {
+	YK_ASSERT(YK_BYTECODEP(bytecode));
+
+	yk_program_counter = YK_PTR(bytecode)->bytecode.code;
+	yk_bytecode_register = bytecode;
+
+	int return_code = 0;
+	YkInt call_argcount;
+	YkRunFrame frame;
+	frame.depth = ++yk_run_depth;
+	frame.previous = yk_run_frame;
+	yk_run_frame = &frame;
+
+	YkObject local_exit_cont = yk_make_continuation(YK_PTR(bytecode)->bytecode.code_size - 1);
+	YK_GC_PROTECT1(local_exit_cont);
+
+	if (yk_jump_stack_size == 0) {
+		int code = setjmp(yk_jump_point);
+		if (code == 1) {
+			yk_run_frame = &frame;
+			yk_run_depth = frame.depth;
+
+			yk_exit_continuation(local_exit_cont,
+								 YK_STACK_BOTTOM(yk_continuations_stack, YkObject));
+			yk_jump_stack_size++;
+			return_code = -1;
+			goto end;
+		} else if (code == YK_RUN_TAIL_CALL) {
+			printf("Jumped!\n");
+		}
+	}
+
+	yk_jump_stack_size++;
+
+	frame.gc_stack_size = yk_gc_stack_size;
+	frame.jump_stack_size = yk_jump_stack_size;
+
+	int code = setjmp(frame.jump);
+	if (code != 0) {
+		/* Back from a builtin or a nested run, whose C frames are gone */
+		yk_run_frame = &frame;
+		yk_run_depth = frame.depth;
+		yk_gc_stack_size = frame.gc_stack_size;
+		yk_jump_stack_size = frame.jump_stack_size;
+
+		if (code == YK_RUN_ESCAPE) {
+			yk_exit_continuation(yk_escape_continuation,
+								 YK_PTR(yk_escape_continuation)->continuation.continuations_stack_pointer);
+		}
+	}
+
+start:
+#if YK_INSTRUMENT
+	yk_instrument_step(yk_bytecode_register, yk_program_counter);
+#endif
+
+	switch (yk_program_counter->opcode) {
+	case YK_OP_FETCH_LITERAL:
+		yk_value_register = yk_program_counter->ptr;
+		yk_values_count = 1;
+		yk_program_counter++;
+		break;
+	case YK_OP_FETCH_GLOBAL:
+	{
+		YkObject val = YK_PTR(yk_program_counter->ptr)->symbol.value;
+		if (val == NULL && YK_PTR(yk_program_counter->ptr)->symbol.module != YK_NIL) {
+			yk_module_load(YK_PTR(yk_program_counter->ptr)->symbol.module);
+			val = YK_PTR(yk_program_counter->ptr)->symbol.value;
+		}
+
+		YK_ASSERT(val != NULL);	/* Unbound variable */
+
+		if (yk_expansion_reads != yk_tee)
+			yk_record_read(yk_program_counter->ptr);
+
+		yk_value_register = val;
+		yk_values_count = 1;
+		yk_program_counter++;
+	}
+		break;
+	case YK_OP_LEXICAL_VAR:
+		yk_value_register = yk_lisp_stack_top[yk_program_counter->modifier];
+		yk_values_count = 1;
+		yk_program_counter++;
+		break;
+	case YK_OP_PUSH:
+		YK_STACK_RESERVE(yk_lisp_stack, yk_lisp_stack_top, 1);
+
+		YK_LISP_STACK_PUSH(yk_value_register);
+		yk_program_counter++;
+		break;
+	case YK_OP_PREPARE_CALL:
+	{
+		YkInstruction* next_instruction =
+			YK_PTR(yk_bytecode_register)->bytecode.code + yk_program_counter->modifier;
+
+		YK_STACK_RESERVE(yk_lisp_stack, yk_lisp_stack_top, 3);
+
+		YK_LISP_STACK_PUSH(yk_bytecode_register);
+		YK_LISP_STACK_PUSH(next_instruction);
+		YK_LISP_STACK_PUSH(yk_lisp_frame_ptr);
+	}
+
+		yk_lisp_frame_ptr = yk_lisp_stack_top;
+		yk_program_counter++;
+		break;
+	case YK_OP_CALL:
+		call_argcount = yk_program_counter->modifier;
+
+	call_label:
+		if (YK_CLOSUREP(yk_value_register)) {
+			YK_LISP_STACK_PUSH(YK_PTR(yk_value_register)->closure.lexical_env);
+			yk_value_register = YK_PTR(yk_value_register)->closure.bytecode;
+
+			goto bytecode_call_label;
+		}
+		else if (YK_BYTECODEP(yk_value_register)) {
+			YkObject code;
+			YkInt nargs;
+
+		bytecode_call_label:
+			code = yk_value_register;
+			nargs = YK_PTR(code)->bytecode.nargs;
+			if (nargs >= 0) {
+				YK_ASSERT(call_argcount == nargs);
+			} else {
+				YK_ASSERT(call_argcount >= -(nargs + 1));
+			}
+
+			yk_bytecode_register = code;
+			yk_program_counter = YK_PTR(code)->bytecode.code;
+
+			if (yk_profile_pending)
+				yk_profile_sample();
+		}
+		else if (YK_CPROCP(yk_value_register)) {
+			YkObject proc = YK_PTR(yk_value_register);
+			if (proc->c_proc.cfun == yk_builtin_call_method) {
+				/* Dispatched here so the method gets a real (tail) call */
+				yk_value_register = yk_prepare_method_call(call_argcount--);
+				goto call_label;
+			}
+
+			YkInt nargs = proc->c_proc.nargs;
+			if (nargs >= 0) {
+				YK_ASSERT(call_argcount == nargs);
+			}
+			else {
+				YK_ASSERT(call_argcount >= -(nargs + 1));
+			}
+
+			yk_value_register = yk_call_cfun(yk_value_register, call_argcount);
+			yk_lisp_stack_top = yk_lisp_frame_ptr;
+
+			YK_LISP_STACK_POP(yk_lisp_frame_ptr, YkObject**);
+			YK_LISP_STACK_POP(yk_program_counter, YkInstruction**);
+			YK_LISP_STACK_POP(yk_bytecode_register, YkObject*);
+		}
+		else {
+			YK_ASSERT(0);
+		}
+		break;
+	case YK_OP_TAIL_CALL:
+		call_argcount = yk_program_counter->modifier;
+
+	tail_call_label:
+		if (YK_CPROCP(yk_value_register)) {
+			YkObject proc = YK_PTR(yk_value_register);
+			if (proc->c_proc.cfun == yk_builtin_call_method) {
+				yk_value_register = yk_prepare_method_call(call_argcount--);
+				goto tail_call_label;
+			}
+
+			YkInt nargs = proc->c_proc.nargs;
+			if (nargs >= 0) {
+				YK_ASSERT(call_argcount == nargs);
+			}
+			else {
+				YK_ASSERT(call_argcount >= -(nargs + 1));
+			}
+
+			yk_value_register = yk_call_cfun(yk_value_register, call_argcount);
+			yk_lisp_stack_top = yk_lisp_frame_ptr;
+
+			YK_LISP_STACK_POP(yk_lisp_frame_ptr, YkObject**);
+			YK_LISP_STACK_POP(yk_program_counter, YkInstruction**);
+			YK_LISP_STACK_POP(yk_bytecode_register, YkObject*);
+		} else {
+			YkObject code;
+			YkInt nargs, argcount;
+
+			if (YK_CLOSUREP(yk_value_register)) {
+				YK_LISP_STACK_PUSH(YK_PTR(yk_value_register)->closure.lexical_env);
+				code = YK_PTR(yk_value_register)->closure.bytecode;
+				nargs = YK_PTR(code)->bytecode.nargs;
+				argcount = call_argcount + 1;
+			} else if (YK_BYTECODEP(yk_value_register)) {
+				code = yk_value_register;
+				nargs = YK_PTR(code)->bytecode.nargs;
+				argcount = call_argcount;
+			} else {
+				YK_ASSERT(0);
+			}
+
+			if (nargs >= 0) {
+				YK_ASSERT(call_argcount == nargs);
+			} else {
+				YK_ASSERT(call_argcount >= -(nargs + 1));
+			}
+
+			YkObject* stack_ptr = yk_lisp_stack_top + argcount;
+			for (uint i = 0; i < argcount; i++) {
+				*(yk_lisp_frame_ptr - i - 1) = *(stack_ptr - i - 1);
+			}
+
+			yk_lisp_stack_top = yk_lisp_frame_ptr - argcount;
+
+			yk_bytecode_register = code;
+			yk_program_counter = YK_PTR(code)->bytecode.code;
+
+			if (yk_profile_pending)
+				yk_profile_sample();
+		}
+		break;
+	case YK_OP_RET:
+		yk_lisp_stack_top = yk_lisp_frame_ptr;
+		YK_LISP_STACK_POP(yk_lisp_frame_ptr, YkObject**);
+		YK_LISP_STACK_POP(yk_program_counter, YkInstruction**);
+		YK_LISP_STACK_POP(yk_bytecode_register, YkObject*);
+		break;
+	case YK_OP_JMP:
+		yk_program_counter =
+			YK_PTR(yk_bytecode_register)->bytecode.code + yk_program_counter->modifier;
+
+		/* Loops jump back, so they get sampled even without calls */
+		if (yk_profile_pending)
+			yk_profile_sample();
+		break;
+	case YK_OP_JNIL:
+		if (yk_value_register == YK_NIL) {
+			yk_program_counter =
+				YK_PTR(yk_bytecode_register)->bytecode.code + yk_program_counter->modifier;
+		}
+		else {
+			yk_program_counter++;
+		}
+		break;
+	case YK_OP_UNBIND:
+		yk_lisp_stack_top += yk_program_counter->modifier;
+		yk_program_counter++;
+		break;
+	case YK_OP_BIND_DYNAMIC:
+	{
+		YkObject sym = yk_program_counter->ptr;
+		YK_STACK_RESERVE(yk_dynamic_bindings_stack, yk_dynamic_bindings_stack_top, 1);
+		yk_dynamic_bindings_stack_top--;
+		yk_dynamic_bindings_stack_top->symbol = sym;
+		yk_dynamic_bindings_stack_top->old_value = YK_PTR(sym)->symbol.value;
+
+		YK_PTR(sym)->symbol.value = yk_value_register;
+	}
+		yk_program_counter++;
+		break;
+	case YK_OP_UNBIND_DYNAMIC:
 		for (uint16_t i = 0; i < yk_program_counter->modifier; i++) {
 			YK_PTR(yk_dynamic_bindings_stack_top[i].symbol)->symbol.value =
 				yk_dynamic_bindings_stack_top[i].old_value;
@@ -3148,578 +7719,1558 @@ start:
 		yk_dynamic_bindings_stack_top += yk_program_counter->modifier;
 		yk_program_counter++;
 		break;
-	case YK_OP_WITH_CONT:
-	{
-		YkObject cont = yk_make_continuation(yk_program_counter->modifier);
-		YK_PUSH(yk_continuations_stack_top, cont);
-	}
-		yk_program_counter++;
+	case YK_OP_WITH_CONT:
+	{
+		YkObject cont = yk_make_continuation(yk_program_counter->modifier);
+		YK_STACK_RESERVE(yk_continuations_stack, yk_continuations_stack_top, 1);
+		YK_PUSH(yk_continuations_stack_top, cont);
+	}
+		yk_program_counter++;
+		break;
+	case YK_OP_CONT:
+		yk_value_register = yk_continuations_stack_top[yk_program_counter->modifier];
+		yk_values_count = 1;
+		yk_program_counter++;
+		break;
+	case YK_OP_EXIT_LEXICAL_CONT:
+	{
+		YkObject cont = yk_continuations_stack_top[yk_program_counter->modifier];
+		yk_exit_continuation(cont, yk_continuations_stack_top + yk_program_counter->modifier);
+		yk_continuations_stack_top++;
+	}
+		break;
+	case YK_OP_EXIT_CLOSED_CONT:
+	{
+		YkInt offset = YK_INT(yk_program_counter->ptr);
+		YkObject envt = yk_lisp_stack_top[yk_program_counter->modifier];
+		assert(offset < YK_PTR(envt)->array.size);
+		yk_exit_to(YK_PTR(envt)->array.data[offset]);
+	}
+		break;
+	case YK_OP_CLOSED_CONT:
+	{
+		YkInt offset = YK_INT(yk_program_counter->ptr);
+		YkObject envt = yk_lisp_stack_top[yk_program_counter->modifier];
+		assert(offset < YK_PTR(envt)->array.size);
+		yk_value_register = YK_PTR(envt)->array.data[offset];
+		yk_values_count = 1;
+		yk_program_counter++;
+	}
+		break;
+	case YK_OP_EXIT:
+	{
+		YkObject exit;
+		YK_POP(yk_continuations_stack_top, YkObject*, exit);
+		YK_PTR(exit)->continuation.exited = 1;
+		yk_program_counter++;
+	}
+		break;
+	case YK_OP_LEXICAL_SET:
+		yk_lisp_stack_top[yk_program_counter->modifier] = yk_value_register;
+		yk_program_counter++;
+		break;
+	case YK_OP_GLOBAL_SET:
+		if (YK_PTR(yk_program_counter->ptr)->symbol.value == yk_value_register) {
+			yk_program_counter++;
+			break;
+		}
+
+		YK_PTR(yk_program_counter->ptr)->symbol.value = yk_value_register;
+
+		if (YK_PTR(yk_program_counter->ptr)->symbol.inlined) {
+			YkObject value = yk_value_register;
+			YkInstruction* program_counter = yk_program_counter;
+			YK_GC_PROTECT1(value);
+
+			yk_invalidate_inlined(program_counter->ptr);
+
+			yk_program_counter = program_counter;
+			yk_value_register = value;
+			YK_GC_UNPROTECT;
+		}
+
+		yk_program_counter++;
+		break;
+	case YK_OP_CLOSED_VAR:
+	{
+		YkInt offset = YK_INT(yk_program_counter->ptr);
+		YkObject envt = yk_lisp_stack_top[yk_program_counter->modifier];
+		assert(offset < YK_PTR(envt)->array.size);
+		yk_value_register = YK_PTR(envt)->array.data[offset];
+		yk_values_count = 1;
+	}
+		yk_program_counter++;
+		break;
+	case YK_OP_CLOSED_SET:
+	{
+		YkInt offset = YK_INT(yk_program_counter->ptr);
+		YkObject envt = yk_lisp_stack_top[yk_program_counter->modifier];
+		YK_PTR(envt)->array.data[offset] = yk_value_register;
+	}
+		yk_program_counter++;
+		break;
+	case YK_OP_RECEIVE_VALUES:
+	{
+		YkUint count = yk_program_counter->modifier;
+		bool has_rest = yk_program_counter->ptr != YK_NIL;
+
+		if (yk_values_count == 1)
+			yk_values_buffer[0] = yk_value_register;
+
+		YK_STACK_RESERVE(yk_lisp_stack, yk_lisp_stack_top, count + 1);
+
+		for (uint i = 0; i < count; i++) {
+			YkObject value = i < yk_values_count ? yk_values_buffer[i] : YK_NIL;
+			YK_LISP_STACK_PUSH(value);
+		}
+
+		if (has_rest) {
+			YkObject rest = YK_NIL;
+			YK_GC_PROTECT1(rest);
+
+			for (YkInt i = (YkInt)yk_values_count - 1; i >= (YkInt)count; i--) {
+				rest = yk_cons(yk_values_buffer[i], rest);
+			}
+
+			YK_GC_UNPROTECT;
+			YK_LISP_STACK_PUSH(rest);
+		}
+
+		yk_values_count = 1;
+	}
+		yk_program_counter++;
+		break;
+	case YK_OP_FIXNUM_OP:
+	{
+		/* Both operands are known to be fixnums, the right one is popped */
+		YkObject a = yk_value_register, b = yk_lisp_stack_top[0];
+
+		switch (yk_program_counter->modifier) {
+		case YK_ARITH_ADD: yk_value_register = YK_MAKE_INT(YK_INT(a) + YK_INT(b)); break;
+		case YK_ARITH_SUB: yk_value_register = YK_MAKE_INT(YK_INT(a) - YK_INT(b)); break;
+		case YK_ARITH_MUL: yk_value_register = YK_MAKE_INT(YK_INT(a) * YK_INT(b)); break;
+		case YK_ARITH_EQ: yk_value_register = a == b ? yk_tee : YK_NIL; break;
+		case YK_ARITH_LT: yk_value_register = (YkInt)a < (YkInt)b ? yk_tee : YK_NIL; break;
+		case YK_ARITH_GT: yk_value_register = (YkInt)a > (YkInt)b ? yk_tee : YK_NIL; break;
+		case YK_ARITH_LE: yk_value_register = (YkInt)a <= (YkInt)b ? yk_tee : YK_NIL; break;
+		case YK_ARITH_GE: yk_value_register = (YkInt)a >= (YkInt)b ? yk_tee : YK_NIL; break;
+		default: YK_ASSERT(0);
+		}
+
+		yk_lisp_stack_top++;
+		yk_values_count = 1;
+	}
+		yk_program_counter++;
+		break;
+	case YK_OP_FLOAT_OP:
+	{
+		float a = YK_FLOAT(yk_value_register), b = YK_FLOAT(yk_lisp_stack_top[0]);
+
+		switch (yk_program_counter->modifier) {
+		case YK_ARITH_ADD: yk_value_register = YK_MAKE_FLOAT(a + b); break;
+		case YK_ARITH_SUB: yk_value_register = YK_MAKE_FLOAT(a - b); break;
+		case YK_ARITH_MUL: yk_value_register = YK_MAKE_FLOAT(a * b); break;
+		case YK_ARITH_DIV: yk_value_register = YK_MAKE_FLOAT(a / b); break;
+		case YK_ARITH_EQ: yk_value_register = a == b ? yk_tee : YK_NIL; break;
+		case YK_ARITH_LT: yk_value_register = a < b ? yk_tee : YK_NIL; break;
+		case YK_ARITH_GT: yk_value_register = a > b ? yk_tee : YK_NIL; break;
+		case YK_ARITH_LE: yk_value_register = a <= b ? yk_tee : YK_NIL; break;
+		case YK_ARITH_GE: yk_value_register = a >= b ? yk_tee : YK_NIL; break;
+		default: YK_ASSERT(0);
+		}
+
+		yk_lisp_stack_top++;
+		yk_values_count = 1;
+	}
+		yk_program_counter++;
+		break;
+	case YK_OP_AREF:
+	{
+		/* The array and the fixnum index are known, only the bounds are
+		 * left to check: a negative index wraps around to a huge one */
+		YkObject array = yk_value_register;
+		YkUint index = YK_INT(yk_lisp_stack_top[0]);
+
+		YK_ASSERT(index < YK_PTR(array)->array.size);
+
+		yk_value_register = YK_PTR(array)->array.data[index];
+		yk_lisp_stack_top++;
+		yk_values_count = 1;
+	}
+		yk_program_counter++;
+		break;
+	case YK_OP_GET_SLOT:
+	{
+		YkObject instance = yk_value_register;
+		YkUint slot = yk_program_counter->modifier;
+
+		YK_ASSERT(slot < instance->instance.slots_count &&
+				  !YK_CLASS_INVALID(instance->instance.class));
+
+		yk_value_register = instance->instance.slots[slot];
+		yk_values_count = 1;
+	}
+		yk_program_counter++;
+		break;
+	case YK_OP_END:
+		yk_lisp_stack_top = yk_lisp_frame_ptr;
+		goto end;
+		break;
+	default:
+		raise(SIGINT);
+	}
+
+#if YK_RUN_DEBUG
+	yk_debug_info();
+#endif
+
+	goto start;
+
+end:
+	yk_jump_stack_size--;
+	yk_run_frame = frame.previous;
+	yk_run_depth = frame.depth - 1;
+
+	if (yk_run_depth == 0 && yk_pending_recompiles != YK_NIL)
+		yk_recompile_pending();
+
+#if YK_RUN_DEBUG
+	yk_debug_info();
+#endif
+
+	YK_GC_UNPROTECT;
+	return return_code;
+}
+
+char* yk_opcode_names[] = {
+	[YK_OP_FETCH_LITERAL] = "fetch-literal",
+	[YK_OP_FETCH_GLOBAL] = "fetch-global",
+	[YK_OP_LEXICAL_VAR] = "lexical-var",
+	[YK_OP_PUSH] = "push",
+	[YK_OP_PREPARE_CALL] = "prepare-call",
+	[YK_OP_CALL] = "call",
+	[YK_OP_TAIL_CALL] = "tail-call",
+	[YK_OP_RET] = "ret",
+	[YK_OP_JMP] = "jmp",
+	[YK_OP_JNIL] = "jnil",
+	[YK_OP_UNBIND] = "unbind",
+	[YK_OP_BIND_DYNAMIC] = "bind-dynamic",
+	[YK_OP_UNBIND_DYNAMIC] = "unbind-dynamic",
+	[YK_OP_WITH_CONT] = "with-cont",
+	[YK_OP_CONT] = "cont",
+	[YK_OP_CLOSED_CONT] = "closed-cont",
+	[YK_OP_EXIT_LEXICAL_CONT] = "exit-lexical-cont",
+	[YK_OP_EXIT_CLOSED_CONT] = "exit-closed-cont",
+	[YK_OP_LEXICAL_SET] = "lexical-set",
+	[YK_OP_GLOBAL_SET] = "global-set",
+	[YK_OP_CLOSED_VAR] = "closed-var",
+	[YK_OP_CLOSED_SET] = "closed-set",
+	[YK_OP_BOX] = "box",
+	[YK_OP_UNBOX] = "unbox",
+	[YK_OP_EXIT] = "exit",
+	[YK_OP_RECEIVE_VALUES] = "receive-values",
+	[YK_OP_FIXNUM_OP] = "fixnum-op",
+	[YK_OP_FLOAT_OP] = "float-op",
+	[YK_OP_AREF] = "aref",
+	[YK_OP_GET_SLOT] = "get-slot",
+	[YK_OP_END] = "end"
+};
+
+void yk_bytecode_disassemble(YkObject bytecode) {
+	if (YK_CLOSUREP(bytecode))
+		bytecode = YK_PTR(bytecode)->closure.bytecode;
+
+	YK_ASSERT(YK_BYTECODEP(bytecode));
+
+	printf("Bytecode ");
+	yk_print(YK_PTR(bytecode)->bytecode.name);
+	printf("\n");
+
+	for (uint i = 0; i < YK_PTR(bytecode)->bytecode.code_size; i++) {
+		YkInstruction instruction = YK_PTR(bytecode)->bytecode.code[i];
+		printf("%d\t(%s", i, yk_opcode_names[instruction.opcode]);
+
+		if (instruction.opcode == YK_OP_CLOSED_VAR ||
+			instruction.opcode == YK_OP_CLOSED_SET)
+		{
+			printf(" ");
+			yk_print(instruction.ptr);
+			printf(" %u)\n", instruction.modifier);
+		} else if (instruction.opcode == YK_OP_FETCH_LITERAL ||
+				   instruction.opcode == YK_OP_FETCH_GLOBAL  ||
+				   instruction.opcode == YK_OP_GLOBAL_SET    ||
+				   instruction.opcode == YK_OP_BIND_DYNAMIC  ||
+				   instruction.opcode == YK_OP_UNBIND_DYNAMIC)
+		{
+			printf(" ");
+			yk_print(instruction.ptr);
+			printf(")\n");
+		} else if (instruction.opcode == YK_OP_PUSH ||
+				   instruction.opcode == YK_OP_RET)
+		{
+			printf(")\n");
+		} else {
+			printf(" %u)\n", instruction.modifier);
+		}
+	}
+}
+
+void yk_w_undeclared_var_init(YkWarning* warning, char* file, uint32_t line,
+							  uint32_t character, YkObject symbol)
+{
+	warning->type = YK_W_UNDECLARED_VARIABLE;
+
+	warning->file = file;
+	warning->line = line;
+
+	warning->character = character;
+	warning->warning.undeclared_variable.symbol = symbol;
+}
+
+void yk_w_wrong_number_of_arguments_init(YkWarning* warning, char* file, uint32_t line,
+										 uint32_t character, YkObject function_symbol,
+										 YkInt expected_number, YkUint given_number)
+{
+	warning->type = YK_W_WRONG_NUMBER_OF_ARGUMENTS;
+	warning->file = file;
+	warning->line = line;
+	warning->character = character;
+
+	warning->warning.wrong_number_of_arguments.function_symbol = function_symbol;
+	warning->warning.wrong_number_of_arguments.expected_number = expected_number;
+	warning->warning.wrong_number_of_arguments.given_number = given_number;
+}
+
+void yk_w_assigning_to_function_init(YkWarning* warning, char* file, uint32_t line,
+									 uint32_t character, YkObject function_symbol)
+{
+	warning->type = YK_W_WRONG_NUMBER_OF_ARGUMENTS;
+	warning->file = file;
+	warning->line = line;
+	warning->character = character;
+
+	warning->warning.assigning_to_function.function_symbol = function_symbol;
+}
+
+void yk_w_dynamic_bind_function_init(YkWarning* warning, char* file, uint32_t line,
+									 uint32_t character, YkObject function_symbol)
+{
+	warning->type = YK_W_DYNAMIC_BIND_FUNCTION;
+	warning->file = file;
+	warning->line = line;
+	warning->character = character;
+
+	warning->warning.dynamic_bind_function.function_symbol = function_symbol;
+}
+
+void yk_w_print(YkWarning* w) {
+	switch (w->type) {
+	case YK_W_UNDECLARED_VARIABLE:
+		printf("Undeclared variable: %s at %s:%d\n",
+			   yk_symbol_cstr(w->warning.undeclared_variable.symbol),
+			   w->file, w->line);
+		break;
+	case YK_W_WRONG_NUMBER_OF_ARGUMENTS:
+		printf("Wrong number of arguments for %s: expected %ld, got %ld at %s:%d\n",
+			   yk_symbol_cstr(w->warning.wrong_number_of_arguments.function_symbol),
+			   w->warning.wrong_number_of_arguments.expected_number,
+			   w->warning.wrong_number_of_arguments.given_number,
+			   w->file, w->line);
 		break;
-	case YK_OP_CONT:
-		yk_value_register = yk_continuations_stack_top[yk_program_counter->modifier];
-		yk_program_counter++;
+	case YK_W_ASSIGNING_TO_FUNCTION:
+		printf("Assignment to variable '%s' declared as a function at %s:%d\n",
+			   yk_symbol_cstr(w->warning.assigning_to_function.function_symbol),
+			   w->file, w->line);
 		break;
-	case YK_OP_EXIT_LEXICAL_CONT:
-	{
-		YkObject cont = yk_continuations_stack_top[yk_program_counter->modifier];
-		yk_exit_continuation(cont, yk_continuations_stack_top + yk_program_counter->modifier);
-		yk_continuations_stack_top++;
-	}
+	case YK_W_DYNAMIC_BIND_FUNCTION:
+		printf("Dynamic binding to the variable '%s' declared as a function at %s:%d\n",
+			   yk_symbol_cstr(w->warning.assigning_to_function.function_symbol),
+			   w->file, w->line);
 		break;
-	case YK_OP_EXIT_CLOSED_CONT:
-	{
-		YkInt offset = YK_INT(yk_program_counter->ptr);
-		YkObject envt = yk_lisp_stack_top[yk_program_counter->modifier];
-		assert(offset < YK_PTR(envt)->array.size);
-		YkObject cont = YK_PTR(envt)->array.data[offset];
-		yk_exit_continuation(cont, yk_continuations_stack_top + yk_program_counter->modifier);
 	}
-		break;
-	case YK_OP_CLOSED_CONT:
-	{
-		YkInt offset = YK_INT(yk_program_counter->ptr);
-		YkObject envt = yk_lisp_stack_top[yk_program_counter->modifier];
-		assert(offset < YK_PTR(envt)->array.size);
-		yk_value_register = YK_PTR(envt)->array.data[offset];
-		yk_program_counter++;
+}
+
+/* Returns the warnings that still hold, in the order they were found */
+YkWarning* yk_w_remove_untrue(YkWarning* warnings) {
+	YkWarning* kept = NULL;
+
+	while (warnings != NULL) {
+		YkWarning* next = warnings->next;
+
+		if (warnings->type != YK_W_UNDECLARED_VARIABLE ||
+			!YK_PTR(warnings->warning.undeclared_variable.symbol)->symbol.declared)
+		{
+			warnings->next = kept;
+			kept = warnings;
+		}
+
+		warnings = next;
 	}
-		break;
-	case YK_OP_EXIT:
-	{
-		YkObject exit;
-		YK_POP(yk_continuations_stack_top, YkObject*, exit);
-		YK_PTR(exit)->continuation.exited = 1;
-		yk_program_counter++;
+
+	return kept;
+}
+
+/* Compiler region: everything the compiler allocates for its bookkeeping
+ * lives in a stack of chunks. yk_compile releases what it allocated in one
+ * go when it ends, and an outermost compilation releases everything, even
+ * what was left by a compilation an error jumped out of. */
+#define YK_COMPILER_CHUNK_SIZE 0x10000
+
+typedef struct YkCompilerChunk {
+	struct YkCompilerChunk* previous;
+	YkUint size;
+	YkUint used;
+	YkUint data[];
+} YkCompilerChunk;
+
+typedef struct {
+	YkCompilerChunk* chunk;
+	YkUint used;
+} YkCompilerMark;
+
+static YkCompilerChunk* yk_compiler_chunk;
+
+static void* yk_compiler_alloc(size_t size) {
+	YkUint words = (size + sizeof(YkUint) - 1) / sizeof(YkUint);
+	YkCompilerChunk* chunk = yk_compiler_chunk;
+
+	if (chunk == NULL || chunk->used + words > chunk->size) {
+		YkUint chunk_words = YK_COMPILER_CHUNK_SIZE / sizeof(YkUint);
+		if (words > chunk_words)
+			chunk_words = words;
+
+		chunk = malloc(sizeof(YkCompilerChunk) + chunk_words * sizeof(YkUint));
+		chunk->previous = yk_compiler_chunk;
+		chunk->size = chunk_words;
+		chunk->used = 0;
+		yk_compiler_chunk = chunk;
 	}
-		break;
-	case YK_OP_LEXICAL_SET:
-		yk_lisp_stack_top[yk_program_counter->modifier] = yk_value_register;
-		yk_program_counter++;
-		break;
-	case YK_OP_GLOBAL_SET:
-		YK_PTR(yk_program_counter->ptr)->symbol.value = yk_value_register;
-		yk_program_counter++;
-		break;
-	case YK_OP_CLOSED_VAR:
-	{
-		YkInt offset = YK_INT(yk_program_counter->ptr);
-		YkObject envt = yk_lisp_stack_top[yk_program_counter->modifier];
-		assert(offset < YK_PTR(envt)->array.size);
-		yk_value_register = YK_PTR(envt)->array.data[offset];
+
+	void* p = &chunk->data[chunk->used];
+	chunk->used += words;
+
+	return p;
+}
+
+static YkCompilerMark yk_compiler_mark() {
+	YkCompilerMark mark;
+	mark.chunk = yk_compiler_chunk;
+	mark.used = yk_compiler_chunk != NULL ? yk_compiler_chunk->used : 0;
+
+	return mark;
+}
+
+/* Frees what was allocated after `mark'. The first chunk is kept for the
+ * next compilation. */
+static void yk_compiler_release(YkCompilerMark mark) {
+	while (yk_compiler_chunk != mark.chunk && yk_compiler_chunk->previous != NULL) {
+		YkCompilerChunk* previous = yk_compiler_chunk->previous;
+		free(yk_compiler_chunk);
+		yk_compiler_chunk = previous;
 	}
-		yk_program_counter++;
-		break;
-	case YK_OP_CLOSED_SET:
-	{
-		YkInt offset = YK_INT(yk_program_counter->ptr);
-		YkObject envt = yk_lisp_stack_top[yk_program_counter->modifier];
-		YK_PTR(envt)->array.data[offset] = yk_value_register;
+
+	if (yk_compiler_chunk != NULL)
+		yk_compiler_chunk->used = yk_compiler_chunk == mark.chunk ? mark.used : 0;
+}
+
+static YkWarning* yk_push_warning(YkCompilerState* state) {
+	YkWarning* warning = yk_compiler_alloc(sizeof(YkWarning));
+	warning->next = *state->warnings;
+	*state->warnings = warning;
+
+	return warning;
+}
+
+#define YK_COMPILER_SYMBOL_BIT(symbol) ((uint64_t)1 << (yk_hash_word((YkUint)(symbol)) & 63))
+
+static inline bool yk_compiler_var_named(YkCompilerVar* var) {
+	return var->type == YK_VAR_NORMAL || var->type == YK_VAR_BOXED;
+}
+
+static YkCompilerVar* yk_compiler_var_link(YkCompilerVar* var, YkCompilerVar* next) {
+	var->next = next;
+	var->symbols = next != NULL ? next->symbols : 0;
+	var->depth = (var->type == YK_VAR_RETURN ? 3 : 1) + (next != NULL ? next->depth : 0);
+	var->environnement = var->type == YK_VAR_ENVIRONNEMENT ? var :
+		next != NULL ? next->environnement : NULL;
+
+	if (yk_compiler_var_named(var))
+		var->symbols |= YK_COMPILER_SYMBOL_BIT(var->symbol);
+
+	return var;
+}
+
+static YkCompilerVar* yk_make_compiler_var(YkObject sym, YkCompilerVar* next) {
+	YkCompilerVar* var = yk_compiler_alloc(sizeof(YkCompilerVar));
+	var->symbol = sym;
+	var->type = YK_VAR_NORMAL;
+	var->value_type = yk_t_start;
+
+	return yk_compiler_var_link(var, next);
+}
+
+static YkCompilerVar* yk_compiler_var_copy(YkCompilerVar* model, YkCompilerVar* next) {
+	YkCompilerVar* var = yk_compiler_alloc(sizeof(YkCompilerVar));
+	var->symbol = model->symbol;
+	var->type = model->type;
+	var->value_type = model->value_type;
+
+	return yk_compiler_var_link(var, next);
+}
+
+static YkCompilerVar* yk_make_environnement_var(YkCompilerVar* next) {
+	YkCompilerVar* var = yk_compiler_alloc(sizeof(YkCompilerVar));
+	var->symbol = yk_symbol_environnement;
+	var->type = YK_VAR_ENVIRONNEMENT;
+	var->value_type = yk_t_start;
+
+	return yk_compiler_var_link(var, next);
+}
+
+static YkCompilerVar* yk_make_return_var(YkCompilerVar* next) {
+	YkCompilerVar* var = yk_compiler_alloc(sizeof(YkCompilerVar));
+	var->symbol = YK_NIL;
+	var->type = YK_VAR_RETURN;
+	var->value_type = yk_t_start;
+
+	return yk_compiler_var_link(var, next);
+}
+
+static YkCompilerVar* yk_make_unused_var(YkCompilerVar* next) {
+	YkCompilerVar* var = yk_compiler_alloc(sizeof(YkCompilerVar));
+	var->symbol = YK_NIL;
+	var->type = YK_VAR_UNUSED;
+	var->value_type = yk_t_start;
+
+	return yk_compiler_var_link(var, next);
+}
+
+static YkClosedVar* yk_make_closed_var(YkCompilerVar* lexical_stack, YkClosedVar* next) {
+	YkClosedVar* closed_vars = yk_compiler_alloc(sizeof(YkClosedVar));
+	closed_vars->lexical_stack = lexical_stack;
+	closed_vars->next = next;
+	closed_vars->symbols = (lexical_stack != NULL ? lexical_stack->symbols : 0) |
+		(next != NULL ? next->symbols : 0);
+
+	return closed_vars;
+}
+
+static YkCompilerVar* yk_lexical_var(YkObject symbol, YkCompilerVar* lexical_stack) {
+	if (lexical_stack == NULL || !(lexical_stack->symbols & YK_COMPILER_SYMBOL_BIT(symbol)))
+		return NULL;
+
+	for (YkCompilerVar* i = lexical_stack; i != NULL; i = i->next) {
+		if (yk_compiler_var_named(i) && i->symbol == symbol)
+			return i;
+	}
+
+	return NULL;
+}
+
+static bool yk_closed_vars_member(YkObject element, YkClosedVar* closed) {
+	if (closed == NULL || !(closed->symbols & YK_COMPILER_SYMBOL_BIT(element)))
+		return false;
+
+	for (YkClosedVar* clvar = closed; clvar != NULL; clvar = clvar->next) {
+		if (yk_lexical_var(element, clvar->lexical_stack) != NULL)
+			return true;
+	}
+
+	return false;
+}
+
+static YkCompilerVar* yk_compiler_vars_nreverse(YkCompilerVar* vars) {
+	YkCompilerVar *current = vars,
+		*next, *previous = NULL,
+		*last = NULL;
+
+	while (current != NULL) {
+		next = current->next;
+		yk_compiler_var_link(current, previous);
+		previous = current;
+		last = current;
+		current = next;
+	}
+
+	return last;
+}
+
+static YkCompilerVar* yk_compiler_vars_reverse(YkCompilerVar* vars) {
+	YkCompilerVar* new_vars = NULL;
+
+	for (YkCompilerVar* v = vars; v != NULL; v = v->next) {
+		new_vars = yk_compiler_var_copy(v, new_vars);
+	}
+
+	return new_vars;
+}
+
+static YkUint yk_compiler_vars_length(YkCompilerVar* vars) {
+	YkUint i = 0;
+
+	for (YkCompilerVar* cvar = vars; cvar != NULL; cvar = cvar->next)
+		i++;
+
+	return 0;
+}
+
+/* Unlinks the variables named `element'. The summaries of the variables
+ * before them go stale: the list must only be copied afterwards. */
+static YkCompilerVar* yk_compiler_vars_delete(YkObject element, YkCompilerVar* partial_list) {
+	YkCompilerVar *final_list = partial_list,
+		*previous = NULL;
+
+	if (partial_list == NULL)
+		return NULL;
+
+	for (YkCompilerVar* var = partial_list; var != NULL; var = var->next) {
+		if ((var->type == YK_VAR_NORMAL || var->type == YK_VAR_BOXED) &&
+			var->symbol == element)
+		{
+			if (var == final_list) {
+				final_list = var->next;
+			} else {
+				previous->next = var->next;
+			}
+		}
+
+		previous = var;
+	}
+
+	return final_list;
+}
+
+static YkCompilerVar* yk_compiler_vars_append(YkCompilerVar* a, YkCompilerVar* b) {
+	YkCompilerVar* result = NULL;
+
+	for (YkCompilerVar* v = a; v != NULL; v = v->next) {
+		result = yk_compiler_var_copy(v, result);
 	}
-		yk_program_counter++;
-		break;
-	case YK_OP_END:
-		yk_lisp_stack_top = yk_lisp_frame_ptr;
-		goto end;
-		break;
-	default:
-		raise(SIGINT);
+
+	for (YkCompilerVar* v = b; v != NULL; v = v->next) {
+		result = yk_compiler_var_copy(v, result);
 	}
 
-#if YK_RUN_DEBUG
-	yk_debug_info();
-#endif
+	return yk_compiler_vars_nreverse(result);
+}
 
-	goto start;
+/* Offsets are the difference of the depths, return addresses taking three
+ * slots */
+YkInt yk_lexical_offset(YkObject symbol, YkCompilerVar* lexical_stack) {
+	YkCompilerVar* var = yk_lexical_var(symbol, lexical_stack);
 
-end:
-	yk_jump_stack_size--;
+	return var != NULL ? (YkInt)(lexical_stack->depth - var->depth) : -1;
+}
 
-#if YK_RUN_DEBUG
-	yk_debug_info();
-#endif
+YkInt yk_lexical_environnement_offset(YkCompilerVar* lexical_stack) {
+	if (lexical_stack == NULL || lexical_stack->environnement == NULL)
+		return -1;
+
+	return lexical_stack->depth - lexical_stack->environnement->depth;
+}
+
+YkObject yk_normalize_list(YkObject list) {
+	YkObject normal = YK_NIL, l = YK_NIL;
+	YK_GC_PROTECT2(normal, l);
+
+	for (l = list; YK_CONSP(l); l = YK_CDR(l)) {
+		normal = yk_cons(YK_CAR(l), normal);
+	}
+
+	if (l != YK_NIL) {
+		normal = yk_cons(l, normal);
+	}
 
 	YK_GC_UNPROTECT;
-	return return_code;
+	return yk_nreverse(normal);
 }
 
-char* yk_opcode_names[] = {
-	[YK_OP_FETCH_LITERAL] = "fetch-literal",
-	[YK_OP_FETCH_GLOBAL] = "fetch-global",
-	[YK_OP_LEXICAL_VAR] = "lexical-var",
-	[YK_OP_PUSH] = "push",
-	[YK_OP_PREPARE_CALL] = "prepare-call",
-	[YK_OP_CALL] = "call",
-	[YK_OP_TAIL_CALL] = "tail-call",
-	[YK_OP_RET] = "ret",
-	[YK_OP_JMP] = "jmp",
-	[YK_OP_JNIL] = "jnil",
-	[YK_OP_UNBIND] = "unbind",
-	[YK_OP_BIND_DYNAMIC] = "bind-dynamic",
-	[YK_OP_UNBIND_DYNAMIC] = "unbind-dynamic",
-	[YK_OP_WITH_CONT] = "with-cont",
-	[YK_OP_EXIT_LEXICAL_CONT] = "exit-lexical-cont",
-	[YK_OP_EXIT_CLOSED_CONT] = "exit-closed-cont",
-	[YK_OP_LEXICAL_SET] = "lexical-set",
-	[YK_OP_GLOBAL_SET] = "global-set",
-	[YK_OP_CLOSED_VAR] = "closed-var",
-	[YK_OP_CLOSED_SET] = "closed-set",
-	[YK_OP_BOX] = "box",
-	[YK_OP_UNBOX] = "unbox",
-	[YK_OP_EXIT] = "exit",
-	[YK_OP_END] = "end"
-};
+void yk_compiler_state_init(YkCompilerState* state, YkObject expr, YkWarning** warnings) {
+	state->expr = expr;
 
-void yk_bytecode_disassemble(YkObject bytecode) {
-	if (YK_CLOSUREP(bytecode))
-		bytecode = YK_PTR(bytecode)->closure.bytecode;
+	state->cont_stack = NULL;
+	state->lexical_stack = NULL;
 
-	YK_ASSERT(YK_BYTECODEP(bytecode));
+	state->warnings = warnings;
 
-	printf("Bytecode ");
-	yk_print(YK_PTR(bytecode)->bytecode.name);
-	printf("\n");
+	state->var_upenvs = NULL;
+	state->cont_upenvs = NULL;
 
-	for (uint i = 0; i < YK_PTR(bytecode)->bytecode.code_size; i++) {
-		YkInstruction instruction = YK_PTR(bytecode)->bytecode.code[i];
-		printf("%d\t(%s", i, yk_opcode_names[instruction.opcode]);
+	state->closed_vars = NULL;
+	state->closed_conts = NULL;
 
-		if (instruction.opcode == YK_OP_CLOSED_VAR ||
-			instruction.opcode == YK_OP_CLOSED_SET)
-		{
-			printf(" ");
-			yk_print(instruction.ptr);
-			printf(" %u)\n", instruction.modifier);
-		} else if (instruction.opcode == YK_OP_FETCH_LITERAL ||
-				   instruction.opcode == YK_OP_FETCH_GLOBAL  ||
-				   instruction.opcode == YK_OP_GLOBAL_SET    ||
-				   instruction.opcode == YK_OP_BIND_DYNAMIC  ||
-				   instruction.opcode == YK_OP_UNBIND_DYNAMIC)
-		{
-			printf(" ");
-			yk_print(instruction.ptr);
-			printf(")\n");
-		} else if (instruction.opcode == YK_OP_PUSH ||
-				   instruction.opcode == YK_OP_RET)
-		{
-			printf(")\n");
+	state->inline_owner = YK_NIL;
+	state->is_inlined = false;
+
+	state->is_tail = false;
+}
+
+static void yk_compile_loop(YkObject bytecode, YkCompilerState* state);
+static void yk_compile_let(YkObject bytecode, YkCompilerState* state,
+						   YkObject bindings, YkObject body);
+
+static void yk_compile_with_push(YkObject bytecode, YkCompilerState* state) {
+	state->is_tail = false;
+	yk_compile_loop(bytecode, state);
+	yk_bytecode_emit(bytecode, YK_OP_PUSH, 0, YK_NIL);
+
+	state->lexical_stack = yk_make_unused_var(state->lexical_stack);
+}
+
+static void yk_compile_combo(YkObject bytecode, YkCompilerState* new_state,
+							 YkObject combo, bool is_tail)
+{
+	YK_LIST_FOREACH(combo, e) {
+		bool compiled_is_tail = false;
+		if (is_tail && !(YK_CONSP(YK_CDR(e))))
+			compiled_is_tail = true;
+
+		new_state->expr = YK_CAR(e);
+		new_state->is_tail = compiled_is_tail;
+
+		yk_compile_loop(bytecode, new_state);
+	}
+}
+
+static void yk_compile_variable(YkObject bytecode, YkCompilerState* state,
+								YkObject symbol, bool is_assign)
+{
+	YkCompilerVar* lexical_stack = state->lexical_stack;
+	YkInt offset = yk_lexical_offset(symbol, lexical_stack);
+
+	if (offset >= 0) {
+		YkOpcode op = is_assign ? YK_OP_LEXICAL_SET : YK_OP_LEXICAL_VAR;
+		yk_bytecode_emit(bytecode, op, offset, YK_NIL);
+	} else {
+		if (state->closed_vars != NULL) {
+			printf("test: ");
+			yk_print(symbol);
+			printf("\n");
+
+			printf("==START==\n");
+			for (YkCompilerVar* e = state->closed_vars; e != NULL; e = e->next) {
+				printf(" t: %d, s: ", e->type);
+				yk_print(e->symbol);
+				printf("\n");
+			}
+			printf("==END==\n");
+		}
+
+		int k = yk_lexical_offset(symbol, state->closed_vars);
+
+		if (k >= 0) {
+			YkInt offset = k;
+			int environnement_offset = yk_lexical_environnement_offset(state->lexical_stack);
+
+			YkOpcode op = is_assign ? YK_OP_CLOSED_SET : YK_OP_CLOSED_VAR;
+			yk_bytecode_emit(bytecode, op, environnement_offset, YK_MAKE_INT(offset));
+		} else if (YK_PTR(symbol)->symbol.type == yk_s_constant) {
+			yk_bytecode_emit(bytecode, YK_OP_FETCH_LITERAL, 0, YK_PTR(symbol)->symbol.value);
 		} else {
-			printf(" %u)\n", instruction.modifier);
+			if (YK_PTR(symbol)->symbol.value == NULL && !YK_PTR(symbol)->symbol.declared) {
+				YkWarning* warning = yk_push_warning(state);
+				yk_w_undeclared_var_init(warning, "NONE", 0, 0, symbol);
+			} else if (is_assign && YK_PTR(symbol)->symbol.type == yk_s_function) {
+				YkWarning* w = yk_push_warning(state);
+				yk_w_assigning_to_function_init(w, "None", 0, 0, symbol);
+			}
+
+			YkOpcode op = is_assign ? YK_OP_GLOBAL_SET : YK_OP_FETCH_GLOBAL;
+			yk_bytecode_emit(bytecode, op, 0, symbol);
 		}
 	}
 }
 
-void yk_w_undeclared_var_init(YkWarning* warning, char* file, uint32_t line,
-							  uint32_t character, YkObject symbol)
-{
-	warning->type = YK_W_UNDECLARED_VARIABLE;
+/* Returns the C function of the builtin named by `symbol', or NULL if the
+ * symbol is lexically bound or does not name a builtin. */
+static YkCfun yk_builtin_cfun(YkObject symbol, YkCompilerState* state, YkObject env) {
+	if (!YK_SYMBOLP(symbol) || symbol == YK_NIL ||
+		yk_lexical_var(symbol, state->lexical_stack) != NULL ||
+		yk_lexical_var(symbol, state->closed_vars) != NULL)
+	{
+		return NULL;
+	}
 
-	warning->file = file;
-	warning->line = line;
+	YK_LIST_FOREACH(env, e) {
+		if (YK_CAR(YK_CAR(e)) == symbol)
+			return NULL;
+	}
 
-	warning->character = character;
-	warning->warning.undeclared_variable.symbol = symbol;
+	YkObject value = YK_PTR(symbol)->symbol.value;
+	if (value == NULL || !YK_CPROCP(value))
+		return NULL;
+
+	return YK_PTR(value)->c_proc.cfun;
 }
 
-void yk_w_wrong_number_of_arguments_init(YkWarning* warning, char* file, uint32_t line,
-										 uint32_t character, YkObject function_symbol,
-										 YkInt expected_number, YkUint given_number)
-{
-	warning->type = YK_W_WRONG_NUMBER_OF_ARGUMENTS;
-	warning->file = file;
-	warning->line = line;
-	warning->character = character;
+static YkType yk_number_type(YkType a, YkType b) {
+	if (a == yk_t_int && b == yk_t_int)
+		return yk_t_int;
 
-	warning->warning.wrong_number_of_arguments.function_symbol = function_symbol;
-	warning->warning.wrong_number_of_arguments.expected_number = expected_number;
-	warning->warning.wrong_number_of_arguments.given_number = given_number;
+	if ((a == yk_t_int || a == yk_t_float) && (b == yk_t_int || b == yk_t_float))
+		return yk_t_float;
+
+	return yk_t_start;
 }
 
-void yk_w_assigning_to_function_init(YkWarning* warning, char* file, uint32_t line,
-									 uint32_t character, YkObject function_symbol)
-{
-	warning->type = YK_W_WRONG_NUMBER_OF_ARGUMENTS;
-	warning->file = file;
-	warning->line = line;
-	warning->character = character;
+/* Infers the type of the value of `expr', or yk_t_start if it cannot be
+ * proven. `env' is an alist from the symbols bound inside the expression
+ * being analysed to their types, as fixnums. */
+static YkType yk_infer_type(YkObject expr, YkCompilerState* state, YkObject env) {
+	switch (YK_TYPEOF(expr)) {
+	case yk_t_int:
+	case yk_t_float:
+	case yk_t_string:
+	case yk_t_array:
+	case yk_t_instance:
+		return YK_TYPEOF(expr);
+	case yk_t_symbol:
+	{
+		YK_LIST_FOREACH(env, e) {
+			if (YK_CAR(YK_CAR(e)) == expr)
+				return YK_INT(YK_CDR(YK_CAR(e)));
+		}
 
-	warning->warning.assigning_to_function.function_symbol = function_symbol;
+		YkCompilerVar* var = yk_lexical_var(expr, state->lexical_stack);
+		if (var != NULL)
+			return var->value_type;
+
+		if (yk_lexical_var(expr, state->closed_vars) == NULL &&
+			YK_PTR(expr)->symbol.type == yk_s_constant)
+		{
+			YkType type = YK_TYPEOF(YK_PTR(expr)->symbol.value);
+			if (type == yk_t_int || type == yk_t_float)
+				return type;
+		}
+
+		return yk_t_start;
+	}
+	case yk_t_list:
+		if (expr != YK_NIL)
+			break;
+	default:
+		return yk_t_start;
+	}
+
+	YkObject first = YK_CAR(expr), args = YK_CDR(expr);
+
+	if (first == yk_keyword_if) {
+		YkType then_type = yk_infer_type(YK_CAR(YK_CDR(args)), state, env),
+			else_type = yk_t_start;
+
+		if (YK_CONSP(YK_CDR(YK_CDR(args))))
+			else_type = yk_infer_type(YK_CAR(YK_CDR(YK_CDR(args))), state, env);
+
+		return then_type == else_type ? then_type : yk_t_start;
+	} else if (first == yk_keyword_do) {
+		YkType type = yk_t_start;
+		YK_LIST_FOREACH(args, e) {
+			if (!YK_CONSP(YK_CDR(e)))
+				type = yk_infer_type(YK_CAR(e), state, env);
+		}
+
+		return type;
+	}
+
+	YkCfun cfun = yk_builtin_cfun(first, state, env);
+
+	if (cfun == yk_builtin_add || cfun == yk_builtin_sub ||
+		cfun == yk_builtin_mul || cfun == yk_builtin_div)
+	{
+		/* A single argument to / is inverted as a float */
+		if (cfun == yk_builtin_div && !YK_CONSP(YK_CDR(args)))
+			return yk_t_float;
+
+		YkType type = yk_t_int;
+		YK_LIST_FOREACH(args, a) {
+			type = yk_number_type(type, yk_infer_type(YK_CAR(a), state, env));
+		}
+
+		return type;
+	} else if (cfun == yk_builtin_make_array || cfun == yk_builtin_list_to_array) {
+		return yk_t_array;
+	} else if (cfun == yk_builtin_make_typed_array || cfun == yk_builtin_list_to_typed_array) {
+		return yk_t_typed_array;
+	} else if (cfun == yk_builtin_make_instance) {
+		return yk_t_instance;
+	} else if (cfun == yk_builtin_string_concat || cfun == yk_builtin_substring) {
+		return yk_t_string;
+	} else if (cfun == yk_builtin_length) {
+		return yk_t_int;
+	}
+
+	return yk_t_start;
+}
+
+/* Notes that the code being expanded or compiled read `symbol', with the
+ * value and class it has now */
+static void yk_record_read(YkObject symbol) {
+	YK_LIST_FOREACH(yk_expansion_reads, e) {
+		if (YK_CAR(YK_CAR(e)) == symbol)
+			return;
+	}
+
+	YkObject read = YK_NIL;
+	YK_GC_PROTECT2(symbol, read);
+
+	read = yk_cons(YK_PTR(symbol)->symbol.value, YK_PTR(symbol)->symbol.class_value);
+	read = yk_cons(symbol, read);
+	yk_expansion_reads = yk_cons(read, yk_expansion_reads);
+
+	YK_GC_UNPROTECT;
 }
 
-void yk_w_dynamic_bind_function_init(YkWarning* warning, char* file, uint32_t line,
-									 uint32_t character, YkObject function_symbol)
-{
-	warning->type = YK_W_DYNAMIC_BIND_FUNCTION;
-	warning->file = file;
-	warning->line = line;
-	warning->character = character;
+/* Adds `reads', recorded earlier, to the ones being recorded */
+static void yk_merge_reads(YkObject reads) {
+	YK_GC_PROTECT1(reads);
 
-	warning->warning.dynamic_bind_function.function_symbol = function_symbol;
-}
+	YK_LIST_FOREACH(reads, e) {
+		bool recorded = false;
+		YK_LIST_FOREACH(yk_expansion_reads, r) {
+			recorded = recorded || YK_CAR(YK_CAR(r)) == YK_CAR(YK_CAR(e));
+		}
 
-void yk_w_print(YkWarning* w) {
-	switch (w->type) {
-	case YK_W_UNDECLARED_VARIABLE:
-		printf("Undeclared variable: %s at %s:%d\n",
-			   yk_symbol_cstr(w->warning.undeclared_variable.symbol),
-			   w->file, w->line);
-		break;
-	case YK_W_WRONG_NUMBER_OF_ARGUMENTS:
-		printf("Wrong number of arguments for %s: expected %ld, got %ld at %s:%d\n",
-			   yk_symbol_cstr(w->warning.wrong_number_of_arguments.function_symbol),
-			   w->warning.wrong_number_of_arguments.expected_number,
-			   w->warning.wrong_number_of_arguments.given_number,
-			   w->file, w->line);
-		break;
-	case YK_W_ASSIGNING_TO_FUNCTION:
-		printf("Assignment to variable '%s' declared as a function at %s:%d\n",
-			   yk_symbol_cstr(w->warning.assigning_to_function.function_symbol),
-			   w->file, w->line);
-		break;
-	case YK_W_DYNAMIC_BIND_FUNCTION:
-		printf("Dynamic binding to the variable '%s' declared as a function at %s:%d\n",
-			   yk_symbol_cstr(w->warning.assigning_to_function.function_symbol),
-			   w->file, w->line);
-		break;
+		if (!recorded)
+			yk_expansion_reads = yk_cons(YK_CAR(e), yk_expansion_reads);
 	}
+
+	YK_GC_UNPROTECT;
 }
 
-void yk_w_remove_untrue(DynamicArray* warnings) {
-	for (uint i = 0; i < warnings->size;) {
-		YkWarning* w = dynamic_array_at(warnings, i);
-		if (w->type == YK_W_UNDECLARED_VARIABLE &&
-			YK_PTR(w->warning.undeclared_variable.symbol)->symbol.declared)
+/* Whether the globals and classes of `reads' still have the values read */
+static bool yk_reads_current(YkObject reads) {
+	YK_LIST_FOREACH(reads, e) {
+		YkObject symbol = YK_CAR(YK_CAR(e)), read = YK_CDR(YK_CAR(e));
+
+		if (YK_PTR(symbol)->symbol.value != YK_CAR(read) ||
+			YK_PTR(symbol)->symbol.class_value != YK_CDR(read))
 		{
-			dynamic_array_remove(warnings, i);
-		} else {
-			i++;
+			return false;
 		}
 	}
+
+	return true;
 }
 
-static YkCompilerVar* yk_make_compiler_var(YkObject sym, YkCompilerVar* next) {
-	YkCompilerVar* var = malloc(sizeof(YkCompilerVar));
-	var->symbol = sym;
-	var->type = YK_VAR_NORMAL;
-	var->value_type = yk_t_start;
-	var->next = next;
+/* Entries are (bytecode . reads). Lambdas with the same source may come
+ * from unrelated sites, so only the one still defining its name is
+ * reused: anonymous lambdas are compiled again at each site. */
+static bool yk_cached_lambda_current(YkObject entry) {
+	YkObject lambda = YK_CAR(entry);
 
-	return var;
+	return YK_PTR(YK_PTR(lambda)->bytecode.name)->symbol.value == lambda &&
+		yk_reads_current(YK_CDR(entry));
 }
 
-static YkCompilerVar* yk_compiler_var_copy(YkCompilerVar* model, YkCompilerVar* next) {
-	YkCompilerVar* var = malloc(sizeof(YkCompilerVar));
-	var->symbol = model->symbol;
-	var->type = model->type;
-	var->value_type = model->value_type;
-	var->next = next;
+/* Called by the GC, before marking */
+static void yk_flush_compiler_caches() {
+	yk_macro_expansions = YK_NIL;
 
-	return var;
-}
+	if (yk_compiled_lambdas == YK_NIL)
+		return;
 
-static YkCompilerVar* yk_make_environnement_var(YkCompilerVar* next) {
-	YkCompilerVar* var = malloc(sizeof(YkCompilerVar));
-	var->symbol = yk_symbol_environnement;
-	var->type = YK_VAR_ENVIRONNEMENT;
-	var->value_type = yk_t_start;
-	var->next = next;
+	YkHashTable* table = &YK_PTR(yk_compiled_lambdas)->hash_table;
+	YkObject* arrays[2] = { table->entries, table->old_entries };
+	YkUint capacities[2] = { table->capacity, table->old_capacity };
 
-	return var;
+	for (uint a = 0; a < 2; a++) {
+		for (YkUint i = 0; arrays[a] != NULL && i < capacities[a]; i++) {
+			YkObject* pair = &arrays[a][2 * i];
+			if (!YK_HASH_LIVE(pair[0]))
+				continue;
+
+			if (!yk_cached_lambda_current(pair[1])) {
+				pair[0] = YK_HASH_TOMBSTONE;
+				pair[1] = YK_NIL;
+				table->count--;
+			}
+		}
+	}
 }
 
-static YkCompilerVar* yk_make_return_var(YkCompilerVar* next) {
-	YkCompilerVar* var = malloc(sizeof(YkCompilerVar));
-	var->symbol = YK_NIL;
-	var->type = YK_VAR_RETURN;
-	var->value_type = yk_t_start;
-	var->next = next;
+/* Whether `symbol' names a macro. The module exporting it is loaded
+ * first, since its macros have to be defined to be expanded. */
+static bool yk_macro_operator(YkObject symbol) {
+	if (!YK_SYMBOLP(symbol) || symbol == YK_NIL)
+		return false;
 
-	return var;
+	if (YK_PTR(symbol)->symbol.module != YK_NIL)
+		yk_module_load(YK_PTR(symbol)->symbol.module);
+
+	return YK_PTR(symbol)->symbol.type == yk_s_macro;
 }
 
-static YkCompilerVar* yk_make_unused_var(YkCompilerVar* next) {
-	YkCompilerVar* var = malloc(sizeof(YkCompilerVar));
-	var->symbol = YK_NIL;
-	var->type = YK_VAR_UNUSED;
-	var->value_type = yk_t_start;
-	var->next = next;
+/* Same without loading anything: the exports of a module that isn't
+ * loaded yet may be macros */
+static bool yk_maybe_macro_operator(YkObject symbol) {
+	return YK_SYMBOLP(symbol) && symbol != YK_NIL &&
+		(YK_PTR(symbol)->symbol.type == yk_s_macro || YK_PTR(symbol)->symbol.module != YK_NIL);
+}
 
-	return var;
+/* Expands a use of the macro `YK_CAR(expr)'. The compiler asks for the
+ * same expansion several times, so expansions are looked up before calling
+ * the expander. Expanders may read globals and classes, like `class' reads
+ * the size of the parent class, so an expansion is only reused while what
+ * its expander read is unchanged. */
+static YkObject yk_macroexpand_1(YkObject expr) {
+	YkObject symbol = YK_CAR(expr),
+		expander = YK_PTR(symbol)->symbol.value,
+		key = YK_NIL, entry = YK_NIL, outer_reads = yk_expansion_reads;
+	YK_GC_PROTECT5(symbol, expander, key, entry, outer_reads);
+
+	key = yk_cons(expander, expr);
+	if (yk_macro_expansions != YK_NIL)
+		entry = yk_hash_table_ref(yk_macro_expansions, key, YK_NIL);
+
+	if (entry == YK_NIL || !yk_reads_current(YK_CDR(entry))) {
+		yk_expansion_reads = YK_NIL;
+		yk_record_read(symbol);
+
+		entry = yk_apply(expander, YK_CDR(expr));
+		entry = yk_cons(entry, yk_expansion_reads);
+		yk_expansion_reads = outer_reads;
+
+		/* The expander may have collected the table */
+		if (yk_macro_expansions == YK_NIL)
+			yk_macro_expansions = yk_make_hash_table(YK_HASH_EQUAL, 64);
+
+		yk_hash_table_set(yk_macro_expansions, key, entry);
+	}
+
+	if (yk_expansion_reads != yk_tee)
+		yk_merge_reads(YK_CDR(entry));
+
+	YK_GC_UNPROTECT;
+	return YK_CAR(entry);
 }
 
-static YkClosedVar* yk_make_closed_var(YkCompilerVar* lexical_stack, YkClosedVar* next) {
-	YkClosedVar* closed_vars = malloc(sizeof(YkClosedVar));
-	closed_vars->lexical_stack = lexical_stack;
-	closed_vars->next = next;
+static YkObject yk_collect_assignments(YkObject expr, YkCompilerState* state,
+									   YkObject env, YkObject sites);
 
-	return closed_vars;
+static YkObject yk_collect_assignments_combo(YkObject exprs, YkCompilerState* state,
+											 YkObject env, YkObject sites)
+{
+	YK_GC_PROTECT2(exprs, env);
+
+	YK_LIST_FOREACH(exprs, e) {
+		sites = yk_collect_assignments(YK_CAR(e), state, env, sites);
+	}
+
+	YK_GC_UNPROTECT;
+	return sites;
 }
 
-static void yk_closed_vars_destroy_until(YkClosedVar* vars, YkClosedVar* limit) {
-	while (vars != limit) {
-		YkClosedVar* next = vars->next;
-#ifdef _DEBUG
-		m_bzero(vars, sizeof(YkClosedVar));
-#endif
-		free(vars);
-		vars = next;
+/* Adds the symbols of a lambda list to `env', with no known type */
+static YkObject yk_env_bind_unknown(YkObject lambda_list, YkObject env) {
+	YkObject l;
+	YK_GC_PROTECT2(lambda_list, env);
+
+	for (l = lambda_list; YK_CONSP(l); l = YK_CDR(l)) {
+		env = yk_cons(yk_cons(YK_CAR(l), YK_MAKE_INT(yk_t_start)), env);
 	}
+
+	if (l != YK_NIL)
+		env = yk_cons(yk_cons(l, YK_MAKE_INT(yk_t_start)), env);
+
+	YK_GC_UNPROTECT;
+	return env;
 }
 
-static bool yk_closed_vars_member(YkObject element, YkClosedVar* closed) {
-	for (YkClosedVar* clvar = closed; clvar != NULL; clvar = clvar->next) {
-		for (YkCompilerVar* cvar = clvar->lexical_stack; cvar != NULL; cvar = cvar->next) {
-			if ((cvar->type == YK_VAR_NORMAL || cvar->type == YK_VAR_BOXED) &&
-				cvar->symbol == element)
-			{
-				return true;
+/* Pushes on `sites' every (set! symbol value) inside `expr', as
+ * (place value . env): the place is the binding of `symbol' in `env', or
+ * `symbol' itself when it is bound outside of `expr'. The initial values
+ * of the variables bound by a let count as assignments to them. Macros are
+ * expanded, like in yk_find_closed_vars. */
+static YkObject yk_collect_assignments(YkObject expr, YkCompilerState* state,
+									   YkObject env, YkObject sites)
+{
+	if (!YK_CONSP(expr))
+		return sites;
+
+	YkObject first = YK_CAR(expr), body_env = env, place = YK_NIL;
+	YK_GC_PROTECT5(expr, env, sites, body_env, place);
+
+	if (first == yk_keyword_quote || first == yk_keyword_comptime) {
+	} else if (first == yk_keyword_setq) {
+		YkObject symbol = YK_CAR(YK_CDR(expr));
+
+		place = symbol;
+		YK_LIST_FOREACH(env, e) {
+			if (YK_CAR(YK_CAR(e)) == symbol) {
+				place = YK_CAR(e);
+				break;
 			}
 		}
+
+		place = yk_cons(place, yk_cons(YK_CAR(YK_CDR(YK_CDR(expr))), env));
+		sites = yk_cons(place, sites);
+		sites = yk_collect_assignments(YK_CAR(YK_CDR(YK_CDR(expr))), state, env, sites);
+	} else if (first == yk_keyword_let) {
+		YK_LIST_FOREACH(YK_CAR(YK_CDR(expr)), l) {
+			YkObject value = YK_CAR(YK_CDR(YK_CAR(l)));
+
+			sites = yk_collect_assignments(value, state, env, sites);
+
+			place = yk_cons(YK_CAR(YK_CAR(l)), YK_MAKE_INT(yk_infer_type(value, state, env)));
+			body_env = yk_cons(place, body_env);
+			place = yk_cons(place, yk_cons(YK_CAR(YK_CDR(YK_CAR(l))), env));
+			sites = yk_cons(place, sites);
+		}
+
+		sites = yk_collect_assignments_combo(YK_CDR(YK_CDR(expr)), state, body_env, sites);
+	} else if (first == yk_keyword_receive) {
+		body_env = yk_env_bind_unknown(YK_CAR(YK_CDR(expr)), env);
+
+		sites = yk_collect_assignments(YK_CAR(YK_CDR(YK_CDR(expr))), state, env, sites);
+		sites = yk_collect_assignments_combo(YK_CDR(YK_CDR(YK_CDR(expr))), state, body_env, sites);
+	} else if (first == yk_keyword_lambda) {
+		body_env = yk_env_bind_unknown(YK_CAR(YK_CDR(YK_CDR(expr))), env);
+
+		sites = yk_collect_assignments_combo(YK_CDR(YK_CDR(YK_CDR(expr))), state, body_env, sites);
+	} else if (first == yk_keyword_dynamic_let) {
+		YK_LIST_FOREACH(YK_CAR(YK_CDR(expr)), l) {
+			sites = yk_collect_assignments(YK_CAR(YK_CDR(YK_CAR(l))), state, env, sites);
+		}
+
+		sites = yk_collect_assignments_combo(YK_CDR(YK_CDR(expr)), state, env, sites);
+	} else if (yk_macro_operator(first)) {
+		body_env = yk_macroexpand_1(expr);
+
+		sites = yk_collect_assignments(body_env, state, env, sites);
+	} else {
+		sites = yk_collect_assignments_combo(expr, state, env, sites);
 	}
 
-	return false;
+	YK_GC_UNPROTECT;
+	return sites;
 }
 
-static YkCompilerVar* yk_compiler_vars_nreverse(YkCompilerVar* vars) {
-	YkCompilerVar *current = vars,
-		*next, *previous = NULL,
-		*last = NULL;
+/* Recognizes (int? var) and (float? var) on a lexical variable */
+static YkCompilerVar* yk_type_test(YkObject expr, YkCompilerState* state, YkType* type) {
+	if (!YK_CONSP(expr) || !YK_CONSP(YK_CDR(expr)) || YK_CDR(YK_CDR(expr)) != YK_NIL)
+		return NULL;
 
-	while (current != NULL) {
-		next = current->next;
-		current->next = previous;
-		previous = current;
-		last = current;
-		current = next;
-	}
+	YkCfun cfun = yk_builtin_cfun(YK_CAR(expr), state, YK_NIL);
+	YkObject arg = YK_CAR(YK_CDR(expr));
 
-	return last;
+	if (cfun == yk_builtin_intp)
+		*type = yk_t_int;
+	else if (cfun == yk_builtin_floatp)
+		*type = yk_t_float;
+	else
+		return NULL;
+
+	if (!YK_SYMBOLP(arg) || arg == YK_NIL)
+		return NULL;
+
+	return yk_lexical_var(arg, state->lexical_stack);
 }
 
-static YkCompilerVar* yk_compiler_vars_reverse(YkCompilerVar* vars) {
-	YkCompilerVar* new_vars = NULL;
+/* Compiles calls to arithmetic builtins, aref and get-slot into unchecked
+ * instructions when the types of their arguments are proven. Returns false
+ * if the call has to go through the generic builtin. */
+static bool yk_compile_specialized(YkObject bytecode, YkCompilerState* state) {
+	YkObject args = YK_CDR(state->expr);
+	YkCfun cfun = yk_builtin_cfun(YK_CAR(state->expr), state, YK_NIL);
+	YkUint argcount = yk_length(args);
 
-	for (YkCompilerVar* v = vars; v != NULL; v = v->next) {
-		new_vars = yk_compiler_var_copy(v, new_vars);
+	if (cfun == NULL)
+		return false;
+
+	YkCompilerState new_state = *state;
+	new_state.is_tail = false;
+
+	if (cfun == yk_builtin_get_slot) {
+		YkObject slot = YK_CONSP(YK_CDR(args)) ? YK_CAR(YK_CDR(args)) : YK_NIL;
+
+		if (argcount != 2 || !YK_INTP(slot) || YK_INT(slot) > UINT16_MAX ||
+			yk_infer_type(YK_CAR(args), state, YK_NIL) != yk_t_instance)
+		{
+			return false;
+		}
+
+		new_state.expr = YK_CAR(args);
+		yk_compile_loop(bytecode, &new_state);
+		yk_bytecode_emit(bytecode, YK_OP_GET_SLOT, YK_INT(slot), YK_NIL);
+
+		return true;
 	}
 
-	return new_vars;
-}
+	YkOpcode op;
+	YkArithOp arith = YK_ARITH_ADD;
+	bool variadic = true;
 
-static YkUint yk_compiler_vars_length(YkCompilerVar* vars) {
-	YkUint i = 0;
+	if (cfun == yk_builtin_aref) {
+		if (argcount != 2 ||
+			yk_infer_type(YK_CAR(args), state, YK_NIL) != yk_t_array ||
+			yk_infer_type(YK_CAR(YK_CDR(args)), state, YK_NIL) != yk_t_int)
+		{
+			return false;
+		}
 
-	for (YkCompilerVar* cvar = vars; cvar != NULL; cvar = cvar->next)
-		i++;
+		op = YK_OP_AREF;
+	} else {
+		if (cfun == yk_builtin_add) arith = YK_ARITH_ADD;
+		else if (cfun == yk_builtin_sub) arith = YK_ARITH_SUB;
+		else if (cfun == yk_builtin_mul) arith = YK_ARITH_MUL;
+		else if (cfun == yk_builtin_div) arith = YK_ARITH_DIV;
+		else {
+			variadic = false;
+
+			if (cfun == yk_builtin_neq) arith = YK_ARITH_EQ;
+			else if (cfun == yk_builtin_ninf) arith = YK_ARITH_LT;
+			else if (cfun == yk_builtin_nsup) arith = YK_ARITH_GT;
+			else if (cfun == yk_builtin_ninfeq) arith = YK_ARITH_LE;
+			else if (cfun == yk_builtin_nsupeq) arith = YK_ARITH_GE;
+			else return false;
+		}
 
-	return 0;
+		if (argcount < 2 || (!variadic && argcount != 2))
+			return false;
+
+		YkType type = yk_infer_type(YK_CAR(args), state, YK_NIL);
+		if (type != yk_t_int && type != yk_t_float)
+			return false;
+
+		YK_LIST_FOREACH(YK_CDR(args), a) {
+			if (yk_infer_type(YK_CAR(a), state, YK_NIL) != type)
+				return false;
+		}
+
+		/* Integer division stays generic */
+		if (type == yk_t_int && arith == YK_ARITH_DIV)
+			return false;
+
+		op = type == yk_t_int ? YK_OP_FIXNUM_OP : YK_OP_FLOAT_OP;
+	}
+
+	/* Operands are evaluated right to left like the arguments of a call,
+	 * the first one ends up in the value register and each instruction
+	 * pops the next one */
+	YkObject rest = yk_reverse(YK_CDR(args));
+	YK_GC_PROTECT1(rest);
+
+	YK_LIST_FOREACH(rest, e) {
+		new_state.expr = YK_CAR(e);
+		yk_compile_with_push(bytecode, &new_state);
+	}
+
+	new_state.expr = YK_CAR(args);
+	new_state.is_tail = false;
+	yk_compile_loop(bytecode, &new_state);
+
+	for (YkUint i = 1; i < argcount; i++)
+		yk_bytecode_emit(bytecode, op, arith, YK_NIL);
+
+	YK_GC_UNPROTECT;
+	return true;
 }
 
-static YkCompilerVar* yk_compiler_vars_delete(YkObject element, YkCompilerVar* partial_list) {
-	YkCompilerVar *final_list = partial_list,
-		*previous = NULL;
+#define YK_FOLD_MAX_ARGS 8
 
-	if (partial_list == NULL)
-		return NULL;
+static bool yk_fold_call(YkObject expr, YkCompilerState* state, YkObject* value);
 
-	for (YkCompilerVar* var = partial_list; var != NULL; var = var->next) {
-		if ((var->type == YK_VAR_NORMAL || var->type == YK_VAR_BOXED) &&
-			var->symbol == element)
+static bool yk_constant_value(YkObject expr, YkCompilerState* state, YkObject* value) {
+	if (YK_INTP(expr) || YK_FLOATP(expr) || expr == YK_NIL) {
+		*value = expr;
+		return true;
+	} else if (YK_SYMBOLP(expr)) {
+		if (YK_PTR(expr)->symbol.type != yk_s_constant ||
+			yk_lexical_var(expr, state->lexical_stack) != NULL ||
+			yk_lexical_var(expr, state->closed_vars) != NULL)
 		{
-			if (var == final_list) {
-				final_list = var->next;
-			} else {
-				previous->next = var->next;
-			}
+			return false;
 		}
 
-		previous = var;
+		*value = YK_PTR(expr)->symbol.value;
+		return true;
+	} else if (YK_CONSP(expr)) {
+		if (YK_CAR(expr) == yk_keyword_quote && YK_CONSP(YK_CDR(expr))) {
+			*value = YK_CAR(YK_CDR(expr));
+			return true;
+		}
+
+		return yk_fold_call(expr, state, value);
 	}
 
-	return final_list;
+	return false;
 }
 
-static YkCompilerVar* yk_compiler_vars_append(YkCompilerVar* a, YkCompilerVar* b) {
-	YkCompilerVar* result = NULL;
+/* Computes at compile-time a call to a builtin without side effects whose
+ * arguments are all constant. Calls that would signal an error are left
+ * for run-time. */
+static bool yk_fold_call(YkObject expr, YkCompilerState* state, YkObject* value) {
+	YkCfun cfun = yk_builtin_cfun(YK_CAR(expr), state, YK_NIL);
+	YkObject args[YK_FOLD_MAX_ARGS];
+	YkUint argcount = 0;
 
-	for (YkCompilerVar* v = a; v != NULL; v = v->next) {
-		result = yk_compiler_var_copy(v, result);
+	if (cfun == NULL)
+		return false;
+
+	bool arithmetic = cfun == yk_builtin_add || cfun == yk_builtin_sub ||
+		cfun == yk_builtin_mul || cfun == yk_builtin_div;
+	bool binary_arithmetic = cfun == yk_builtin_pow || cfun == yk_builtin_mod ||
+		cfun == yk_builtin_neq || cfun == yk_builtin_ninf || cfun == yk_builtin_nsup ||
+		cfun == yk_builtin_ninfeq || cfun == yk_builtin_nsupeq;
+	bool predicate = cfun == yk_builtin_intp || cfun == yk_builtin_floatp ||
+		cfun == yk_builtin_nullp || cfun == yk_builtin_consp || cfun == yk_builtin_listp ||
+		cfun == yk_builtin_symbolp || cfun == yk_builtin_not;
+
+	if (!arithmetic && !binary_arithmetic && !predicate && cfun != yk_builtin_eq)
+		return false;
+
+	YK_LIST_FOREACH(YK_CDR(expr), a) {
+		if (argcount == YK_FOLD_MAX_ARGS ||
+			!yk_constant_value(YK_CAR(a), state, &args[argcount]))
+		{
+			return false;
+		}
+
+		argcount++;
 	}
 
-	for (YkCompilerVar* v = b; v != NULL; v = v->next) {
-		result = yk_compiler_var_copy(v, result);
+	if (predicate && argcount != 1)
+		return false;
+
+	if ((binary_arithmetic || cfun == yk_builtin_eq) && argcount != 2)
+		return false;
+
+	if (arithmetic || binary_arithmetic) {
+		for (YkUint i = 0; i < argcount; i++) {
+			if (!YK_INTP(args[i]) && !YK_FLOATP(args[i]))
+				return false;
+
+			/* Dividing by zero is left to run-time */
+			if ((cfun == yk_builtin_div || cfun == yk_builtin_mod) && i > 0 &&
+				(args[i] == YK_MAKE_INT(0) || (YK_FLOATP(args[i]) && YK_FLOAT(args[i]) == 0.f)))
+			{
+				return false;
+			}
+		}
+
+		if ((cfun == yk_builtin_sub || cfun == yk_builtin_div) && argcount == 0)
+			return false;
+
+		if (cfun == yk_builtin_mod && (!YK_INTP(args[0]) || !YK_INTP(args[1])))
+			return false;
 	}
 
-	return yk_compiler_vars_nreverse(result);
+	*value = yk_apply_n(YK_PTR(YK_CAR(expr))->symbol.value, argcount, args);
+	return true;
 }
 
-static void yk_compiler_vars_destroy_until(YkCompilerVar* vars, YkCompilerVar* limit) {
-	while (vars != limit) {
-		YkCompilerVar* next = vars->next;
-#ifdef _DEBUG
-		m_bzero(vars, sizeof(YkClosedVar));
-#endif
-		free(vars);
-		vars = next;
+#define YK_INLINE_MAX_SIZE 24
+
+/* Checks that `expr', part of the body of a function to inline, is small
+ * and simple enough, and that none of its free symbols would be captured by
+ * the lexical environment of the call site. */
+static bool yk_inlinable_body(YkObject expr, YkObject params, YkObject name,
+							  YkCompilerState* state, YkUint* size)
+{
+	if (YK_SYMBOLP(expr)) {
+		if (expr == name)
+			return false;
+
+		return expr == YK_NIL || yk_member(expr, params) ||
+			(yk_lexical_var(expr, state->lexical_stack) == NULL &&
+			 yk_lexical_var(expr, state->closed_vars) == NULL);
 	}
-}
 
-static void yk_compiler_vars_destroy(YkCompilerVar* vars) {
-	yk_compiler_vars_destroy_until(vars, NULL);
-}
+	if (!YK_CONSP(expr))
+		return true;
 
-YkInt yk_lexical_offset(YkObject symbol, YkCompilerVar* lexical_stack) {
-	YkInt j = 0;
-	YkCompilerVar* i;
+	YkObject first = YK_CAR(expr), l;
+
+	if (first == yk_keyword_quote) {
+		(*size)++;
+		return true;
+	}
 
-	for (i = lexical_stack; i != NULL; i = i->next) {
-		if ((i->type == YK_VAR_NORMAL || i->type == YK_VAR_BOXED)
-			&& i->symbol == symbol)
+	if (first == yk_keyword_lambda || first == yk_keyword_comptime ||
+		first == yk_keyword_with_cont || first == yk_keyword_exit ||
+		first == yk_keyword_receive || first == yk_keyword_dynamic_let ||
+		yk_maybe_macro_operator(first))
+	{
+		return false;
+	}
+
+	for (l = expr; YK_CONSP(l); l = YK_CDR(l)) {
+		if (++(*size) > YK_INLINE_MAX_SIZE ||
+			!yk_inlinable_body(YK_CAR(l), params, name, state, size))
 		{
-			break;
+			return false;
 		}
+	}
 
-		if (i->type == YK_VAR_RETURN) {
-			j += 3;
-		} else {
-			j++;
-		}
+	return l == YK_NIL;
+}
+
+static void yk_record_inline(YkObject callee, YkObject owner) {
+	for (YkUint i = 0; i < yk_inline_dependencies_count; i++) {
+		if (yk_inline_dependencies[i].callee == callee && yk_inline_dependencies[i].owner == owner)
+			return;
 	}
 
-	if (i != NULL) {
-		return j;
-	} else {
-		return -1;
+	if (yk_inline_dependencies_count == yk_inline_dependencies_capacity) {
+		yk_inline_dependencies_capacity = yk_inline_dependencies_capacity == 0 ?
+			16 : 2 * yk_inline_dependencies_capacity;
+		yk_inline_dependencies = realloc(yk_inline_dependencies, yk_inline_dependencies_capacity *
+										 sizeof(YkInlineDependency));
 	}
-}
 
-YkInt yk_lexical_environnement_offset(YkCompilerVar* lexical_stack) {
-	YkInt j = 0;
-	YkCompilerVar* i;
+	yk_inline_dependencies[yk_inline_dependencies_count].callee = callee;
+	yk_inline_dependencies[yk_inline_dependencies_count].owner = owner;
+	yk_inline_dependencies_count++;
 
-	for (i = lexical_stack; i != NULL; i = i->next) {
-		if (i->type == YK_VAR_ENVIRONNEMENT) {
-			break;
-		}
+	YK_PTR(callee)->symbol.inlined = 1;
+}
 
-		if (i->type == YK_VAR_RETURN) {
-			j += 3;
-		} else {
-			j++;
-		}
+static bool yk_inlined_into(YkObject owner) {
+	for (YkUint i = 0; i < yk_inline_dependencies_count; i++) {
+		if (yk_inline_dependencies[i].owner == owner)
+			return true;
 	}
 
-	if (i != NULL) {
-		return j;
-	} else {
-		return -1;
-	}
+	return false;
 }
 
-YkObject yk_normalize_list(YkObject list) {
-	YkObject normal = YK_NIL, l = YK_NIL;
-	YK_GC_PROTECT2(normal, l);
+static void yk_inline_dependencies_sweep() {
+	YkUint live = 0;
 
-	for (l = list; YK_CONSP(l); l = YK_CDR(l)) {
-		normal = yk_cons(YK_CAR(l), normal);
-	}
+	for (YkUint i = 0; i < yk_inline_dependencies_count; i++) {
+		YkInlineDependency* d = &yk_inline_dependencies[i];
 
-	if (l != YK_NIL) {
-		normal = yk_cons(l, normal);
+		if (YK_MARKED(d->callee) && YK_MARKED(d->owner))
+			yk_inline_dependencies[live++] = *d;
 	}
 
-	YK_GC_UNPROTECT;
-	return yk_nreverse(normal);
+	yk_inline_dependencies_count = live;
 }
 
-void yk_compiler_state_init(YkCompilerState* state, YkObject expr, DynamicArray* warnings) {
-	state->expr = expr;
+/* The body of the named-lambda `source', without its docstring */
+static YkObject yk_inline_body(YkObject source) {
+	YkObject body = YK_CDR(YK_CDR(YK_CDR(source)));
 
-	state->cont_stack = NULL;
-	state->lexical_stack = NULL;
+	if (YK_CONSP(body) && YK_TYPEOF(YK_CAR(body)) == yk_t_string && YK_CONSP(YK_CDR(body)))
+		body = YK_CDR(body);
 
-	state->warnings = warnings;
+	return body;
+}
 
-	state->var_upenvs = NULL;
-	state->cont_upenvs = NULL;
+/* Whether calls to a function could be inlined somewhere, i.e. where no
+ * lexical variable captures its free symbols */
+static bool yk_may_inline(YkObject params, YkObject body, YkObject name) {
+	YkCompilerState state;
+	memset(&state, 0, sizeof(state));
+	YkUint size = 0;
 
-	state->closed_vars = NULL;
-	state->closed_conts = NULL;
+	/* Functions with a rest list are never inlined */
+	YkObject l;
+	for (l = params; YK_CONSP(l); l = YK_CDR(l));
+	if (l != YK_NIL)
+		return false;
 
-	state->is_tail = false;
+	return yk_inlinable_body(body, params, name, &state, &size);
 }
 
-static void yk_compile_loop(YkObject bytecode, YkCompilerState* state);
+/* Replaces a call to a small global function by its body, as a let binding
+ * its parameters. Returns false if the call cannot be inlined. */
+static bool yk_compile_inlined(YkObject bytecode, YkCompilerState* state) {
+	YkObject symbol = YK_CAR(state->expr), args = YK_CDR(state->expr);
 
-static void yk_compile_with_push(YkObject bytecode, YkCompilerState* state) {
-	state->is_tail = false;
-	yk_compile_loop(bytecode, state);
-	yk_bytecode_emit(bytecode, YK_OP_PUSH, 0, YK_NIL);
+	if (state->is_inlined || state->inline_owner == yk_tee ||
+		!YK_SYMBOLP(symbol) || symbol == YK_NIL ||
+		YK_PTR(symbol)->symbol.type != yk_s_function ||
+		yk_lexical_var(symbol, state->lexical_stack) != NULL ||
+		yk_lexical_var(symbol, state->closed_vars) != NULL)
+	{
+		return false;
+	}
 
-	state->lexical_stack = yk_make_unused_var(state->lexical_stack);
-}
+	YkObject function = YK_PTR(symbol)->symbol.value;
+	if (function == NULL || !YK_BYTECODEP(function) ||
+		YK_PTR(function)->bytecode.source == YK_NIL ||
+		YK_PTR(function)->bytecode.nargs != (YkInt)yk_length(args))
+	{
+		return false;
+	}
 
-static void yk_compile_combo(YkObject bytecode, YkCompilerState* new_state,
-							 YkObject combo, bool is_tail)
-{
-	YK_LIST_FOREACH(combo, e) {
-		bool compiled_is_tail = false;
-		if (is_tail && !(YK_CONSP(YK_CDR(e))))
-			compiled_is_tail = true;
+	YkObject source = YK_PTR(function)->bytecode.source;
+	YkObject params = YK_CAR(YK_CDR(YK_CDR(source)));
+	YkObject body = yk_inline_body(source);
+	YkUint size = 0;
 
-		new_state->expr = YK_CAR(e);
-		new_state->is_tail = compiled_is_tail;
+	if (!yk_inlinable_body(body, params, symbol, state, &size))
+		return false;
 
-		yk_compile_loop(bytecode, new_state);
+	YkObject bindings = YK_NIL;
+	YK_GC_PROTECT3(source, body, bindings);
+
+	/* Bound in reverse to evaluate the arguments right to left, like a call */
+	YkObject p = params;
+	YK_LIST_FOREACH(args, a) {
+		bindings = yk_cons(yk_cons(YK_CAR(p), yk_cons(YK_CAR(a), YK_NIL)), bindings);
+		p = YK_CDR(p);
 	}
+
+	if (YK_BYTECODEP(state->inline_owner))
+		yk_record_inline(symbol, state->inline_owner);
+
+	YkCompilerState new_state = *state;
+	new_state.is_inlined = true;
+
+	yk_compile_let(bytecode, &new_state, bindings, body);
+
+	YK_GC_UNPROTECT;
+	return true;
 }
 
-static void yk_compile_variable(YkObject bytecode, YkCompilerState* state,
-								YkObject symbol, bool is_assign)
+/* Types the variables from `vars' down to `until': each one starts with the
+ * type of its initial value, and keeps it only if all of its assignments in
+ * `body' agree with it. Dropping a type may invalidate others, hence the
+ * fixed point, over the assignments of `body' collected in a single walk. */
+static void yk_infer_let_types(YkCompilerVar* vars, YkCompilerVar* until,
+							   YkObject body, YkCompilerState* body_state)
 {
-	YkCompilerVar* lexical_stack = state->lexical_stack;
-	YkInt offset = yk_lexical_offset(symbol, lexical_stack);
+	YkObject sites = YK_NIL;
+	YK_GC_PROTECT2(body, sites);
 
-	if (offset >= 0) {
-		YkOpcode op = is_assign ? YK_OP_LEXICAL_SET : YK_OP_LEXICAL_VAR;
-		yk_bytecode_emit(bytecode, op, offset, YK_NIL);
-	} else {
-		if (state->closed_vars != NULL) {
-			printf("test: ");
-			yk_print(symbol);
-			printf("\n");
+	sites = yk_collect_assignments_combo(body, body_state, YK_NIL, sites);
 
-			printf("==START==\n");
-			for (YkCompilerVar* e = state->closed_vars; e != NULL; e = e->next) {
-				printf(" t: %d, s: ", e->type);
-				yk_print(e->symbol);
-				printf("\n");
-			}
-			printf("==END==\n");
-		}
+	bool changed = true;
+	while (changed) {
+		changed = false;
 
-		int k = yk_lexical_offset(symbol, state->closed_vars);
+		YK_LIST_FOREACH(sites, s) {
+			YkObject place = YK_CAR(YK_CAR(s)),
+				value = YK_CAR(YK_CDR(YK_CAR(s))),
+				env = YK_CDR(YK_CDR(YK_CAR(s)));
 
-		if (k >= 0) {
-			YkInt offset = k;
-			int environnement_offset = yk_lexical_environnement_offset(state->lexical_stack);
+			YkCompilerVar* var = NULL;
+			YkType type;
 
-			YkOpcode op = is_assign ? YK_OP_CLOSED_SET : YK_OP_CLOSED_VAR;
-			yk_bytecode_emit(bytecode, op, environnement_offset, YK_MAKE_INT(offset));
-		} else if (YK_PTR(symbol)->symbol.type == yk_s_constant) {
-			yk_bytecode_emit(bytecode, YK_OP_FETCH_LITERAL, 0, YK_PTR(symbol)->symbol.value);
-		} else {
-			if (YK_PTR(symbol)->symbol.value == NULL && !YK_PTR(symbol)->symbol.declared) {
-				YkWarning* warning = dynamic_array_push_back(state->warnings, 1);
-				yk_w_undeclared_var_init(warning, "NONE", 0, 0, symbol);
-			} else if (is_assign && YK_PTR(symbol)->symbol.type == yk_s_function) {
-				YkWarning* w = dynamic_array_push_back(state->warnings, 1);
-				yk_w_assigning_to_function_init(w, "None", 0, 0, symbol);
+			if (YK_CONSP(place)) {
+				type = YK_INT(YK_CDR(place));
+			} else {
+				for (var = vars; var != until && var->symbol != place; var = var->next);
+				if (var == until)
+					continue;
+
+				type = var->value_type;
 			}
 
-			YkOpcode op = is_assign ? YK_OP_GLOBAL_SET : YK_OP_FETCH_GLOBAL;
-			yk_bytecode_emit(bytecode, op, 0, symbol);
+			if (type != yk_t_start && yk_infer_type(value, body_state, env) != type) {
+				if (var != NULL)
+					var->value_type = yk_t_start;
+				else
+					YK_CDR(place) = YK_MAKE_INT(yk_t_start);
+
+				changed = true;
+			}
 		}
 	}
+
+	YK_GC_UNPROTECT;
 }
 
 static void yk_compile_let(YkObject bytecode, YkCompilerState* state,
@@ -3736,16 +9287,51 @@ static void yk_compile_let(YkObject bytecode, YkCompilerState* state,
 
 		yk_compile_with_push(bytecode, &new_state);
 		body_lexical_stack = yk_make_compiler_var(YK_CAR(pair), body_lexical_stack);
+		body_lexical_stack->value_type = yk_infer_type(YK_CAR(YK_CDR(pair)), state, YK_NIL);
 		bindings_count++;
 	}
 
 	new_state = *state;
 	new_state.lexical_stack = body_lexical_stack;
 
+	yk_infer_let_types(body_lexical_stack, state->lexical_stack, body, &new_state);
+
 	yk_compile_combo(bytecode, &new_state, body, state->is_tail);
 	yk_bytecode_emit(bytecode, YK_OP_UNBIND, bindings_count, YK_NIL);
+}
+
+static void yk_compile_receive(YkObject bytecode, YkCompilerState* state,
+							   YkObject formals, YkObject producer, YkObject body)
+{
+	YkUint count = 0;
+	YkCompilerVar* body_lexical_stack = state->lexical_stack;
+
+	YkCompilerState new_state = *state;
+	new_state.expr = producer;
+	new_state.is_tail = false;
+
+	yk_compile_loop(bytecode, &new_state);
+
+	YkObject l;
+	for (l = formals; YK_CONSP(l); l = YK_CDR(l)) {
+		YK_ASSERT(YK_SYMBOLP(YK_CAR(l)));
+		body_lexical_stack = yk_make_compiler_var(YK_CAR(l), body_lexical_stack);
+		count++;
+	}
+
+	bool has_rest = l != YK_NIL;
+	if (has_rest) {
+		YK_ASSERT(YK_SYMBOLP(l));
+		body_lexical_stack = yk_make_compiler_var(l, body_lexical_stack);
+	}
 
-	yk_compiler_vars_destroy_until(body_lexical_stack, state->lexical_stack);
+	yk_bytecode_emit(bytecode, YK_OP_RECEIVE_VALUES, count, has_rest ? yk_tee : YK_NIL);
+
+	new_state = *state;
+	new_state.lexical_stack = body_lexical_stack;
+
+	yk_compile_combo(bytecode, &new_state, body, state->is_tail);
+	yk_bytecode_emit(bytecode, YK_OP_UNBIND, count + has_rest, YK_NIL);
 }
 
 static void yk_compile_dynamic_let(YkObject bytecode, YkCompilerState* state,
@@ -3767,7 +9353,7 @@ static void yk_compile_dynamic_let(YkObject bytecode, YkCompilerState* state,
 		yk_bytecode_emit(bytecode, YK_OP_BIND_DYNAMIC, 0, YK_CAR(pair));
 
 		if (YK_PTR(YK_CAR(pair))->symbol.type == yk_s_function) {
-			YkWarning* w = dynamic_array_push_back(state->warnings, 1);
+			YkWarning* w = yk_push_warning(state);
 			yk_w_dynamic_bind_function_init(w, "None", 0, 0, YK_CAR(pair));
 		}
 
@@ -3850,6 +9436,23 @@ static YkCompilerVar* yk_find_closed_vars(YkObject expr, YkClosedVar* upenvs, Yk
 																	   upenvs, body_env),
 							   closed);
 			YK_GC_UNPROTECT;
+		} else if (first == yk_keyword_receive) {
+			YkObject body_env = env, l;
+			YK_GC_PROTECT1(body_env);
+
+			closed = yk_find_closed_vars(YK_CAR(YK_CDR(YK_CDR(expr))), upenvs, env);
+
+			for (l = YK_CAR(YK_CDR(expr)); YK_CONSP(l); l = YK_CDR(l)) {
+				body_env = yk_cons(YK_CAR(l), body_env);
+			}
+
+			if (l != YK_NIL)
+				body_env = yk_cons(l, body_env);
+
+			closed = yk_compiler_vars_append(yk_find_closed_vars_combo(YK_CDR(YK_CDR(YK_CDR(expr))),
+																	   upenvs, body_env),
+											 closed);
+			YK_GC_UNPROTECT;
 		} else if (first == yk_keyword_lambda) {
 			YkObject lambda_env = yk_normalize_list(YK_CAR(YK_CDR(YK_CDR(expr))));
 			YK_GC_PROTECT1(lambda_env);
@@ -3900,8 +9503,9 @@ static YkCompilerVar* yk_find_closed_vars(YkObject expr, YkClosedVar* upenvs, Yk
 			closed = yk_find_closed_vars_combo(body, upenvs, env);
 		} else {
 			YkObject operand = YK_CAR(expr);
-			if (YK_SYMBOLP(operand) && YK_PTR(operand)->symbol.type == yk_s_macro) {
-				YkObject macro_return =	yk_apply(YK_PTR(operand)->symbol.value, YK_CDR(expr));
+			if (yk_macro_operator(operand)) {
+				YkObject macro_return = yk_macroexpand_1(expr);
+				YK_GC_UNPROTECT;
 				return yk_find_closed_vars(macro_return, upenvs, env);
 			}
 
@@ -3952,6 +9556,11 @@ static YkCompilerVar* yk_find_closed_conts(YkObject expr, YkClosedVar* upenvs, Y
 
 			closed = yk_compiler_vars_append(yk_find_closed_conts_combo(YK_CDR(YK_CDR(expr)), upenvs, env),
 											 closed);
+		} else if (first == yk_keyword_receive) {
+			closed = yk_compiler_vars_append(yk_find_closed_conts(YK_CAR(YK_CDR(YK_CDR(expr))),
+																  upenvs, env),
+											 yk_find_closed_conts_combo(YK_CDR(YK_CDR(YK_CDR(expr))),
+																		upenvs, env));
 		} else if (first == yk_keyword_lambda) {
 			YkObject lambda_body = YK_CDR(YK_CDR(YK_CDR(expr)));
 			closed = yk_find_closed_conts_combo(lambda_body, upenvs, env);
@@ -4007,8 +9616,9 @@ static YkCompilerVar* yk_find_closed_conts(YkObject expr, YkClosedVar* upenvs, Y
 			closed = yk_find_closed_conts_combo(body, upenvs, env);
 		} else {
 			YkObject operand = YK_CAR(expr);
-			if (YK_SYMBOLP(operand) && YK_PTR(operand)->symbol.type == yk_s_macro) {
-				YkObject macro_return =	yk_apply(YK_PTR(operand)->symbol.value, YK_CDR(expr));
+			if (yk_macro_operator(operand)) {
+				YkObject macro_return = yk_macroexpand_1(expr);
+				YK_GC_UNPROTECT;
 				return yk_find_closed_conts(macro_return, upenvs, env);
 			}
 
@@ -4023,11 +9633,85 @@ static YkCompilerVar* yk_find_closed_conts(YkObject expr, YkClosedVar* upenvs, Y
 static void yk_compile_exit(YkObject bytecode, YkCompilerState* state,
 							YkObject symbol, YkObject value_body, bool in_value_reg);
 
+/* Conservatively tells whether `symbol' may be referenced in `expr'. Macro
+ * calls are assumed to reference it, since their expansion isn't known yet. */
+static bool yk_may_reference(YkObject expr, YkObject symbol) {
+	if (expr == symbol)
+		return true;
+
+	if (!YK_CONSP(expr))
+		return false;
+
+	YkObject first = YK_CAR(expr), l;
+	if (first == yk_keyword_quote)
+		return false;
+
+	if (yk_maybe_macro_operator(first))
+		return true;
+
+	for (l = expr; YK_CONSP(l); l = YK_CDR(l)) {
+		if (yk_may_reference(YK_CAR(l), symbol))
+			return true;
+	}
+
+	return l == symbol;
+}
+
+/* A lambda compiled outside of any other function and lexical scope can't
+ * have free variables: its bytecode only depends on its source and on the
+ * macros it expanded, so it is kept to be reused. */
+static bool yk_lambda_cacheable(YkCompilerState* state) {
+	if (state->inline_owner != YK_NIL || state->is_inlined ||
+		state->var_upenvs != NULL || state->cont_stack != NULL)
+	{
+		return false;
+	}
+
+	for (YkCompilerVar* i = state->lexical_stack; i != NULL; i = i->next) {
+		if (i->type != YK_VAR_RETURN && i->type != YK_VAR_UNUSED)
+			return false;
+	}
+
+	return true;
+}
+
+/* Entry of the bytecode compiled earlier from `source', or nil if there
+ * is none that can be reused */
+static YkObject yk_cached_lambda(YkObject source) {
+	if (yk_compiled_lambdas == YK_NIL)
+		return YK_NIL;
+
+	YkObject entry = yk_hash_table_ref(yk_compiled_lambdas, source, YK_NIL);
+	if (entry == YK_NIL || !yk_cached_lambda_current(entry))
+		return YK_NIL;
+
+	return entry;
+}
+
 static void yk_compile_lambda(YkObject bytecode, YkCompilerState* state, YkObject name,
 							  YkObject arglist, YkObject body)
 {
-	YkObject lambda_bytecode = YK_NIL;
-	YK_GC_PROTECT1(lambda_bytecode);
+	YkObject lambda_bytecode = YK_NIL, outer_reads = YK_NIL, entry = YK_NIL;
+	YK_GC_PROTECT3(lambda_bytecode, outer_reads, entry);
+
+	bool cacheable = yk_lambda_cacheable(state);
+	if (cacheable) {
+		entry = yk_cached_lambda(state->expr);
+
+		if (entry != YK_NIL) {
+			yk_bytecode_emit(bytecode, YK_OP_FETCH_LITERAL, 0, YK_CAR(entry));
+
+			if (yk_expansion_reads != yk_tee)
+				yk_merge_reads(YK_CDR(entry));
+
+			YK_GC_UNPROTECT;
+			return;
+		}
+
+		/* Saved for a compilation started by one of the macros */
+		outer_reads = yk_expansion_reads;
+		yk_expansion_reads = YK_NIL;
+	}
 
 	YkCompilerVar *lambda_lexical_stack = NULL,
 		*found_closed_conts, *found_closed_vars,
@@ -4054,8 +9738,15 @@ static void yk_compile_lambda(YkObject bytecode, YkCompilerState* state, YkObjec
 	}
 
 	YkUint argcount_index = YK_PTR(lambda_bytecode)->bytecode.code_size;
+	bool rest_used = argcount < 0 && yk_may_reference(body, l);
+
+	if (argcount < 0 && !rest_used) {
+		/* The rest list is never looked at: don't cons it */
+		yk_bytecode_emit(lambda_bytecode, YK_OP_FETCH_LITERAL, 0, YK_NIL);
+		yk_bytecode_emit(lambda_bytecode, YK_OP_PUSH, 0, YK_NIL);
 
-	if (argcount < 0) {
+		lambda_lexical_stack = yk_make_compiler_var(l, lambda_lexical_stack);
+	} else if (argcount < 0) {
 		YkUint size = YK_PTR(lambda_bytecode)->bytecode.code_size + 5,
 			offset = -argcount - 1;
 
@@ -4083,12 +9774,24 @@ static void yk_compile_lambda(YkObject bytecode, YkCompilerState* state, YkObjec
 	new_state.closed_vars = found_closed_vars;
 	new_state.closed_conts = found_closed_conts;
 
+	/* A function without free variables can be compiled again alone from
+	 * its source, so other functions can be inlined into it */
+	if (state->inline_owner == YK_NIL && state->var_upenvs == NULL &&
+		found_closed_vars == NULL && found_closed_conts == NULL)
+	{
+		YK_PTR(lambda_bytecode)->bytecode.source = state->expr;
+		new_state.inline_owner = lambda_bytecode;
+	} else if (state->inline_owner == YK_NIL) {
+		new_state.inline_owner = yk_tee;
+	}
+
 	if (found_closed_vars != NULL || found_closed_conts != NULL) {
 		reversed_closed_vars = yk_compiler_vars_reverse(found_closed_vars);
 		reversed_closed_conts = yk_compiler_vars_reverse(found_closed_conts);
 
 		if (argcount < 0) {
-			YK_PTR(lambda_bytecode)->bytecode.code[argcount_index + 1].ptr = YK_MAKE_INT(-argcount);
+			if (rest_used)
+				YK_PTR(lambda_bytecode)->bytecode.code[argcount_index + 1].ptr = YK_MAKE_INT(-argcount);
 
 			lambda_lexical_stack = lambda_lexical_stack->next;
 			lambda_lexical_stack = yk_make_compiler_var(l, yk_make_environnement_var(lambda_lexical_stack));
@@ -4136,9 +9839,6 @@ static void yk_compile_lambda(YkObject bytecode, YkCompilerState* state, YkObjec
 			closed_size++;
 		}
 
-		yk_compiler_vars_destroy(reversed_closed_vars);
-		yk_compiler_vars_destroy(reversed_closed_conts);
-
 		yk_bytecode_emit(bytecode, YK_OP_FETCH_LITERAL, 0, yk_array_cfun);
 		yk_bytecode_emit(bytecode, YK_OP_CALL, closed_size, YK_NIL);
 		YK_PTR(bytecode)->bytecode.code[prep_call_index + 1].modifier = YK_PTR(bytecode)->bytecode.code_size;
@@ -4162,12 +9862,25 @@ static void yk_compile_lambda(YkObject bytecode, YkCompilerState* state, YkObjec
 		yk_bytecode_emit(bytecode, YK_OP_FETCH_LITERAL, 0, lambda_bytecode);
 	}
 
-	yk_compiler_vars_destroy(found_closed_vars);
-	yk_compiler_vars_destroy(found_closed_conts);
-	yk_compiler_vars_destroy(lambda_lexical_stack);
+	/* The source is only kept to inline the function elsewhere, or to
+	 * compile it again when a function inlined into it changes */
+	if (new_state.inline_owner == lambda_bytecode && !yk_inlined_into(lambda_bytecode) &&
+		!yk_may_inline(arglist, body, name))
+	{
+		YK_PTR(lambda_bytecode)->bytecode.source = YK_NIL;
+	}
+
+	if (cacheable) {
+		entry = yk_cons(lambda_bytecode, yk_expansion_reads);
+		yk_expansion_reads = outer_reads;
+
+		if (yk_expansion_reads != yk_tee)
+			yk_merge_reads(YK_CDR(entry));
 
-	yk_closed_vars_destroy_until(new_var_upenvs, state->var_upenvs);
-	yk_closed_vars_destroy_until(new_cont_upenvs, state->cont_upenvs);
+		if (yk_compiled_lambdas == YK_NIL)
+			yk_compiled_lambdas = yk_make_hash_table(YK_HASH_EQUAL, 64);
+		yk_hash_table_set(yk_compiled_lambdas, state->expr, entry);
+	}
 
 	YK_GC_UNPROTECT;
 }
@@ -4184,10 +9897,26 @@ static void yk_compile_if(YkObject bytecode, YkCompilerState* state, YkObject co
 	YkUint branch_offset = YK_PTR(bytecode)->bytecode.code_size;
 	yk_bytecode_emit(bytecode, YK_OP_JNIL, 69, YK_NIL);
 
+	/* A type predicate on a variable proves its type in the then branch */
+	YkType tested_type;
+	YkCompilerVar* tested = yk_type_test(cond_clause, state, &tested_type);
+
+	if (tested != NULL && tested->value_type == yk_t_start) {
+		tested->value_type = tested_type;
+
+		YkObject then_body = yk_cons(then_clause, YK_NIL);
+		yk_infer_let_types(tested, tested->next, then_body, state);
+	} else {
+		tested = NULL;
+	}
+
 	new_state.is_tail = state->is_tail;
 	new_state.expr = then_clause;
 	yk_compile_loop(bytecode, &new_state);
 
+	if (tested != NULL)
+		tested->value_type = yk_t_start;
+
 	YkUint else_offset = YK_PTR(bytecode)->bytecode.code_size;
 	YK_PTR(bytecode)->bytecode.code[branch_offset].modifier = else_offset + 1;
 	yk_bytecode_emit(bytecode, YK_OP_JMP, 69, YK_NIL);
@@ -4247,20 +9976,21 @@ static void yk_compile_call(YkObject bytecode, YkCompilerState* state) {
 
 	YkCompilerState new_state = *state;
 
-	if (YK_SYMBOLP(YK_CAR(state->expr)) &&
-		YK_PTR(YK_CAR(state->expr))->symbol.type == yk_s_macro)
-	{
-		YkObject macro_return =	yk_apply(YK_PTR(YK_CAR(state->expr))->symbol.value,
-										 YK_CDR(state->expr));
-
-		yk_print(macro_return);
-		printf("\n");
-
-		new_state.expr = macro_return;
+	if (yk_macro_operator(YK_CAR(state->expr))) {
+		new_state.expr = yk_macroexpand_1(state->expr);
 		yk_compile_loop(bytecode, &new_state);
 		return;
 	}
 
+	YkObject folded;
+	if (yk_fold_call(state->expr, state, &folded)) {
+		yk_bytecode_emit(bytecode, YK_OP_FETCH_LITERAL, 0, folded);
+		return;
+	}
+
+	if (yk_compile_inlined(bytecode, state) || yk_compile_specialized(bytecode, state))
+		return;
+
 	YkObject arguments = YK_NIL, new_stack = YK_NIL;
 	YK_GC_PROTECT2(arguments, new_stack);
 	uint64_t prepare_call_offset;
@@ -4290,11 +10020,11 @@ static void yk_compile_call(YkObject bytecode, YkCompilerState* state) {
 
 			if (function_nargs < 0) {
 				if ((YkInt)argcount < -(function_nargs + 1)) {
-					YkWarning* warning = dynamic_array_push_back(state->warnings, 1);
+					YkWarning* warning = yk_push_warning(state);
 					yk_w_wrong_number_of_arguments_init(warning, "NONE", 0, 0, sym, function_nargs, argcount);
 				}
 			} else if (function_nargs != (YkInt)argcount) {
-				YkWarning* warning = dynamic_array_push_back(state->warnings, 1);
+				YkWarning* warning = yk_push_warning(state);
 				yk_w_wrong_number_of_arguments_init(warning, "NONE", 0, 0, sym, function_nargs, argcount);
 			}
 		}
@@ -4327,6 +10057,11 @@ static void yk_compile_loop(YkObject bytecode, YkCompilerState* state) {
 	case yk_t_file_stream:
 	case yk_t_string_stream:
 	case yk_t_string:
+	case yk_t_hash_table:
+	case yk_t_persistent_map:
+	case yk_t_persistent_vector:
+	case yk_t_typed_array:
+	case yk_t_sequence:
 		yk_bytecode_emit(bytecode, YK_OP_FETCH_LITERAL, 0, state->expr);
 		break;
 	case yk_t_symbol:
@@ -4349,6 +10084,14 @@ static void yk_compile_loop(YkObject bytecode, YkCompilerState* state) {
 			YkObject body = YK_CDR(YK_CDR(state->expr));
 
 			yk_compile_let(bytecode, state, bindings, body);
+		} else if (first == yk_keyword_receive) {
+			YK_ASSERT(yk_length(state->expr) >= 3);
+
+			YkObject formals = YK_CAR(YK_CDR(state->expr));
+			YkObject producer = YK_CAR(YK_CDR(YK_CDR(state->expr)));
+			YkObject body = YK_CDR(YK_CDR(YK_CDR(state->expr)));
+
+			yk_compile_receive(bytecode, state, formals, producer, body);
 		} else if (first == yk_keyword_dynamic_let) {
 			YkObject bindings = YK_CAR(YK_CDR(state->expr));
 			YkObject body = YK_CDR(YK_CDR(state->expr));
@@ -4419,21 +10162,148 @@ end:
 	YK_GC_UNPROTECT;
 }
 
+/* Whether `bytecode' may be running, or be resumed by a continuation */
+static bool yk_bytecode_active(YkObject bytecode) {
+	if (yk_bytecode_register == bytecode)
+		return true;
+
+	for (YkObject* o = yk_lisp_stack_top; o != YK_STACK_BOTTOM(yk_lisp_stack, YkObject); o++) {
+		if (*o == bytecode)
+			return true;
+	}
+
+	for (YkObject* c = yk_continuations_stack_top;
+		 c != YK_STACK_BOTTOM(yk_continuations_stack, YkObject); c++)
+	{
+		if (YK_PTR(*c)->continuation.bytecode_register == bytecode)
+			return true;
+	}
+
+	return false;
+}
+
+/* Compiles `owner' again from its source, into the same bytecode object so
+ * that every reference to it sees the new code */
+static void yk_recompile(YkObject owner) {
+	YkObject source = YK_PTR(owner)->bytecode.source, bytecode = YK_NIL, fresh = YK_NIL;
+	YK_GC_PROTECT4(owner, source, bytecode, fresh);
+
+	/* Its current code and the dependencies recorded for it go together */
+	YkUint live = 0;
+	for (YkUint i = 0; i < yk_inline_dependencies_count; i++) {
+		if (yk_inline_dependencies[i].owner != owner)
+			yk_inline_dependencies[live++] = yk_inline_dependencies[i];
+	}
+	yk_inline_dependencies_count = live;
+
+	if (yk_compiled_lambdas != YK_NIL)
+		yk_hash_table_remove(yk_compiled_lambdas, source);
+
+	bytecode = yk_make_bytecode_begin(yk_make_symbol_cstr("recompile-bytecode"), 0);
+
+	/* A lambda without free variables compiles to a single literal */
+	if (yk_compile(source, bytecode) == YK_NIL &&
+		YK_PTR(bytecode)->bytecode.code[0].opcode == YK_OP_FETCH_LITERAL &&
+		YK_BYTECODEP(YK_PTR(bytecode)->bytecode.code[0].ptr))
+	{
+		fresh = YK_PTR(bytecode)->bytecode.code[0].ptr;
+
+		/* The old code goes away with `fresh' */
+		YkBytecode old = YK_PTR(owner)->bytecode;
+		YK_PTR(owner)->bytecode.code = YK_PTR(fresh)->bytecode.code;
+		YK_PTR(owner)->bytecode.code_size = YK_PTR(fresh)->bytecode.code_size;
+		YK_PTR(owner)->bytecode.code_capacity = YK_PTR(fresh)->bytecode.code_capacity;
+		YK_PTR(owner)->bytecode.source = YK_PTR(fresh)->bytecode.source;
+		YK_PTR(fresh)->bytecode.code = old.code;
+		YK_PTR(fresh)->bytecode.code_size = old.code_size;
+		YK_PTR(fresh)->bytecode.code_capacity = old.code_capacity;
+		YK_PTR(fresh)->bytecode.source = YK_NIL;
+
+		for (YkUint i = 0; i < yk_inline_dependencies_count; i++) {
+			if (yk_inline_dependencies[i].owner == fresh)
+				yk_inline_dependencies[i].owner = owner;
+		}
+
+		if (yk_compiled_lambdas != YK_NIL) {
+			YkObject entry = yk_hash_table_ref(yk_compiled_lambdas, source, NULL);
+			if (entry != NULL && YK_CAR(entry) == fresh)
+				YK_CAR(entry) = owner;
+		}
+	}
+
+	YK_GC_UNPROTECT;
+}
+
+static void yk_recompile_pending() {
+	YkObject pending = yk_pending_recompiles, value = yk_value_register;
+	YkUint values_count = yk_values_count;
+	YK_GC_PROTECT2(pending, value);
+
+	yk_pending_recompiles = YK_NIL;
+
+	YK_LIST_FOREACH(pending, p) {
+		yk_recompile(YK_CAR(p));
+	}
+
+	yk_value_register = value;
+	yk_values_count = values_count;
+	YK_GC_UNPROTECT;
+}
+
+/* Called when the global value of a function that was inlined changes:
+ * the bytecodes it was inlined into are compiled again from their source,
+ * right away if they are not running, or else once yk_run returns to C. */
+static void yk_invalidate_inlined(YkObject symbol) {
+	YkObject owners = YK_NIL;
+	YK_GC_PROTECT2(symbol, owners);
+
+	YkUint live = 0;
+	for (YkUint i = 0; i < yk_inline_dependencies_count; i++) {
+		if (yk_inline_dependencies[i].callee == symbol)
+			owners = yk_cons(yk_inline_dependencies[i].owner, owners);
+		else
+			yk_inline_dependencies[live++] = yk_inline_dependencies[i];
+	}
+	yk_inline_dependencies_count = live;
+
+	YK_PTR(symbol)->symbol.inlined = 0;
+
+	YK_LIST_FOREACH(owners, o) {
+		YkObject owner = YK_CAR(o);
+
+		if (yk_bytecode_active(owner)) {
+			if (!yk_member(owner, yk_pending_recompiles))
+				yk_pending_recompiles = yk_cons(owner, yk_pending_recompiles);
+		} else {
+			yk_recompile(owner);
+		}
+	}
+
+	YK_GC_UNPROTECT;
+}
+
 YkObject yk_compile(YkObject forms, YkObject bytecode) {
 	YK_ASSERT(YK_BYTECODEP(bytecode));
 
 	YkUint older_jump_stack_size = yk_jump_stack_size;
+	YkRunFrame* older_run_frame = yk_run_frame;
+	uint32_t older_run_depth = yk_run_depth;
 	YkObject retval = YK_NIL;
+	YkCompilerMark mark = yk_compiler_mark();
+	YK_GC_PROTECT2(forms, bytecode);
 
 	if (yk_jump_stack_size == 0) {
+		/* Nothing else is being compiled */
+		mark.chunk = NULL;
+		mark.used = 0;
+
 		yk_jump_stack_size++;
 		if (setjmp(yk_jump_point)) {
 			goto error;
 		}
 	}
 
-	DynamicArray warnings;
-	DYNAMIC_ARRAY_CREATE(&warnings, YkWarning);
+	YkWarning* warnings = NULL;
 
 	YkCompilerState state;
 	yk_compiler_state_init(&state, forms, &warnings);
@@ -4441,23 +10311,29 @@ YkObject yk_compile(YkObject forms, YkObject bytecode) {
 	yk_compile_loop(bytecode, &state);
 	yk_bytecode_emit(bytecode, YK_OP_END, 0, YK_NIL);
 
-	yk_w_remove_untrue(&warnings);
-	if (warnings.size != 0) {
+	warnings = yk_w_remove_untrue(warnings);
+	if (warnings != NULL) {
 		printf("======WARNINGS====\n");
 
-		for (uint i = 0; i < warnings.size; i++) {
-			yk_w_print(dynamic_array_at(&warnings, i));
+		for (YkWarning* w = warnings; w != NULL; w = w->next) {
+			yk_w_print(w);
 		}
 	}
 
 	goto end;
 
 error:
+	yk_expansion_reads = yk_tee;
+	yk_run_frame = older_run_frame;
+	yk_run_depth = older_run_depth;
+
 	printf("Error ");
 	yk_print(yk_value_register);
 	printf(" when compiling!\n");
 	retval = yk_value_register;
 end:
+	yk_compiler_release(mark);
 	yk_jump_stack_size = older_jump_stack_size;
+	YK_GC_UNPROTECT;
 	return retval;
 }
@@ -25,7 +25,13 @@ typedef enum {
 	yk_t_string,
 	yk_t_cpointer,
 	yk_t_string_stream,
-	yk_t_file_stream
+	yk_t_file_stream,
+	yk_t_hash_table,
+	yk_t_trie_node,
+	yk_t_persistent_map,
+	yk_t_persistent_vector,
+	yk_t_typed_array,
+	yk_t_sequence
 } YkType;
 
 union YkUnion;
@@ -75,6 +81,11 @@ typedef union YkUnion *YkObject;
 #define YK_FILE_STREAMP(x) ((x)->t.t == yk_t_file_stream)
 #define YK_STRING_STREAMP(x) ((x)->t.t == yk_t_string_stream)
 #define YK_STREAMP(x) (YK_FILE_STREAMP(x) || YK_STRING_STREAMP(x))
+#define YK_HASH_TABLEP(x) (YK_TYPEOF(x) == yk_t_hash_table)
+#define YK_PERSISTENT_MAPP(x) (YK_TYPEOF(x) == yk_t_persistent_map)
+#define YK_PERSISTENT_VECTORP(x) (YK_TYPEOF(x) == yk_t_persistent_vector)
+#define YK_TYPED_ARRAYP(x) (YK_TYPEOF(x) == yk_t_typed_array)
+#define YK_SEQUENCEP(x) (YK_TYPEOF(x) == yk_t_sequence)
 
 #define YK_TYPEOF(x) ((YK_IMMEDIATE(x) == 0) ? YK_PTR(x)->t.t : YK_IMMEDIATE(x))
 
@@ -151,9 +162,27 @@ typedef enum {
 	YK_OP_CLOSED_SET,
 	YK_OP_BOX,
 	YK_OP_UNBOX,
+	YK_OP_RECEIVE_VALUES,
+	YK_OP_FIXNUM_OP,
+	YK_OP_FLOAT_OP,
+	YK_OP_AREF,
+	YK_OP_GET_SLOT,
 	YK_OP_END
 } YkOpcode;
 
+/* Modifier of the FIXNUM_OP and FLOAT_OP instructions */
+typedef enum {
+	YK_ARITH_ADD = 0,
+	YK_ARITH_SUB,
+	YK_ARITH_MUL,
+	YK_ARITH_DIV,
+	YK_ARITH_EQ,
+	YK_ARITH_LT,
+	YK_ARITH_GT,
+	YK_ARITH_LE,
+	YK_ARITH_GE
+} YkArithOp;
+
 typedef struct {
 	enum {
 		YK_TOKEN_LEFT_PAREN,
@@ -169,7 +198,7 @@ typedef struct {
 
 	union {
 		struct {
-			uint32_t begin_index;
+			const char* data;
 			uint32_t size;
 		} string_info;
 
@@ -178,6 +207,30 @@ typedef struct {
 	} data;
 } YkToken;
 
+#define YK_READER_BUFFER_SIZE 0x10000
+#define YK_READER_INLINE_TOKEN_SIZE 128
+
+/* Source of text for the reader. Strings and mapped files are read in
+ * place; a FILE* is read through `buffer', and tokens straddling two
+ * refills are gathered in `token'. */
+typedef struct {
+	const char* data;
+	size_t size;
+	size_t position;
+
+	FILE* file;
+	bool owns_file;
+	char* buffer;
+	size_t buffer_size;
+
+	void* mapping;
+	size_t mapping_size;
+
+	char* token;
+	size_t token_capacity;
+	char inline_token[YK_READER_INLINE_TOKEN_SIZE];
+} YkReader;
+
 /* Yuki types */
 typedef YkObject (*YkCfun)(YkUint nargs);
 
@@ -189,8 +242,8 @@ typedef struct {
 typedef struct {
 	YkObject value;
 	YkObject class_value;
-	YkObject next_sym;
 	YkObject name;
+	YkObject module;	/* Module to load when the symbol is referenced, or nil */
 	uint64_t hash;
 	int32_t function_nargs;
 	enum YkSymbolType {
@@ -200,10 +253,26 @@ typedef struct {
 		yk_s_macro
 	} type;
 	uint8_t declared;
+	uint8_t inlined;	/* The global function was inlined somewhere */
+	uint8_t weak;		/* The symbol table does not keep it alive (gensyms) */
 } YkSymbol;
 
 #define YK_PROFILE 0
 
+/* Sampling profiler: entries of the sample buffer, frames kept per sample
+ * and default interval between samples, in microseconds */
+#define YK_PROFILE_BUFFER_SIZE 0x40000
+#define YK_PROFILE_MAX_DEPTH 256
+#define YK_PROFILE_DEFAULT_INTERVAL 1000
+
+/* Instrumented builds of yk_run count the instructions executed per opcode,
+ * per bytecode offset and per pair of consecutive opcodes.
+ * YK_INSTRUMENT_CYCLES adds the cycles they took, read with rdtsc (x86 only) */
+#define YK_INSTRUMENT 0
+#define YK_INSTRUMENT_CYCLES 0
+#define YK_INSTRUMENT_SITES_SIZE 0x10000
+#define YK_INSTRUMENT_REPORT_SIZE 32
+
 typedef struct {
 	YkObject name;
 	YkObject docstring;
@@ -228,6 +297,7 @@ typedef struct {
 	YkInstruction* code;
 	YkUint code_size;
 	YkUint code_capacity;
+	YkObject source;	/* The named-lambda form, if it can be recompiled alone */
 } YkBytecode;
 
 typedef struct {
@@ -247,8 +317,9 @@ typedef struct {
 	YkObject* lisp_frame_pointer;
 	YkDynamicBinding* dynamic_bindings_stack_pointer;
 	YkInstruction* program_counter;
-	YkObject dummmy;
+	YkObject* continuations_stack_pointer;
 	uint8_t exited;
+	uint32_t run_depth;	/* Depth of the yk_run it belongs to */
 } YkContinuation;
 
 typedef struct {
@@ -266,10 +337,121 @@ typedef struct {
 	YkObject* data;
 } YkArray;
 
+typedef enum {
+	YK_HASH_EQ,
+	YK_HASH_EQUAL
+} YkHashTest;
+
+/* Open addressing hash table. `entries' holds `capacity' key/value pairs.
+ * When growing, the previous pairs are kept in `old_entries' and moved a
+ * few buckets at a time by later updates, so no single update pays for the
+ * whole resize. */
+typedef struct {
+	YkObject dummy;
+	YkType t;
+	uint32_t count;
+
+	YkObject* entries;
+	YkObject* old_entries;
+	uint32_t capacity;
+	uint32_t used;			/* Live pairs and tombstones in `entries' */
+	uint32_t old_capacity;
+	uint32_t migrated;		/* Buckets of `old_entries' already moved */
+	uint8_t test;
+} YkHashTable;
+
+/* Node of a persistent map or vector, whose `size' slots are in the array
+ * arena. Map nodes are indexed by `bitmap' and hold key/value pairs, or a
+ * NULL key followed by a child node. `edit' is the transient allowed to
+ * change the node in place, 0 if none. */
+typedef struct {
+	YkObject dummy;
+	YkType t;
+	uint32_t bitmap;
+	YkObject* slots;
+	uint32_t size;
+	uint32_t edit;
+} YkTrieNode;
+
+/* Hash array mapped trie. A transient has a non-zero `edit'. */
+typedef struct {
+	YkObject dummy;
+	YkType t;
+	uint32_t count;
+	YkObject root;
+	uint32_t edit;
+} YkPersistentMap;
+
+/* Bit-partitioned vector trie of 32-way nodes, the last (up to) 32
+ * elements being kept apart in `tail'. */
+typedef struct {
+	YkObject dummy;
+	YkType t;
+	uint32_t count;
+	YkObject root;
+	YkObject tail;
+	uint32_t shift;
+	uint32_t edit;
+} YkPersistentVector;
+
+typedef enum {
+	YK_ELEMENT_U8 = 0,
+	YK_ELEMENT_I32,
+	YK_ELEMENT_F32,
+	YK_ELEMENT_F64
+} YkElementType;
+
+typedef void (*YkFinalizer)(void* data);
+
+/* Array of `size' unboxed numbers of the same type, `stride' bytes apart.
+ * Its data is in the array arena, unless it is a `foreign' view over host
+ * memory, on which `finalizer' (if any) is called once it is collected. */
+typedef struct {
+	YkObject dummy;
+	YkType t;
+	uint8_t element_type;
+	uint8_t foreign;
+	uint32_t size;
+	uint32_t stride;
+	void* data;
+	YkFinalizer finalizer;
+} YkTypedArray;
+
+typedef enum {
+	YK_SEQUENCE_DONE = 0,
+	YK_SEQUENCE_RANGE,
+	YK_SEQUENCE_LIST,
+	YK_SEQUENCE_ARRAY,
+	YK_SEQUENCE_GENERATOR,
+	YK_SEQUENCE_MAP,
+	YK_SEQUENCE_FILTER,
+	YK_SEQUENCE_TAKE
+} YkSequenceKind;
+
+/* Lazy sequence, producing its elements one at a time on demand. Ranges
+ * count from `index' to `end' by `step'; lists and arrays are walked
+ * through `source'; generators call `function' until it returns eof; the
+ * other kinds pull from the sequence `source', take counting in `index'
+ * up to `end'. */
+typedef struct {
+	YkObject dummy;
+	YkType t;
+	uint8_t kind;
+	YkObject source;
+	YkObject function;
+	YkInt index;
+	YkInt end;
+	YkInt step;
+} YkSequence;
+
 #define YK_STREAM_FINISHED_BIT 0x1
 #define YK_STREAM_BINARY_BIT   0x2
 #define YK_STREAM_READ_BIT     0x4
 #define YK_STREAM_WRITE_BIT    0x8
+/* The buffer of a string stream is also the data of a string */
+#define YK_STREAM_SHARED_BIT   0x10
+
+#define YK_FILE_STREAM_BUFFER_SIZE 0x10000
 
 typedef struct {
 	YkObject dummy;
@@ -290,12 +472,21 @@ typedef struct {
 	uint8_t flags;
 } YkStringStream;
 
+#define YK_STRING_LENGTH_UNKNOWN UINT32_MAX
+#define YK_STRING_INDEX_STRIDE 64
+
+/* UTF-8 text of `size' bytes and `length' characters, the latter counted
+ * the first time it is needed. Strings that are not pure ASCII (where both
+ * agree) get an `index' of the byte offset of every
+ * YK_STRING_INDEX_STRIDE-th character on their first random access. */
 typedef struct {
 	YkObject dummy;
 	YkType t;
 
 	uint32_t size;
 	char* data;
+	uint32_t length;
+	uint32_t* index;
 } YkString;
 
 typedef struct {
@@ -329,6 +520,12 @@ union YkUnion {
 	YkBytecode bytecode;
 	YkContinuation continuation;
 	YkArray array;
+	YkHashTable hash_table;
+	YkTrieNode trie_node;
+	YkPersistentMap persistent_map;
+	YkPersistentVector persistent_vector;
+	YkTypedArray typed_array;
+	YkSequence sequence;
 	YkString string;
 	YkStringStream string_stream;
 	YkFileStream file_stream;
@@ -339,7 +536,7 @@ union YkUnion {
 
 ct_assert(sizeof(union YkUnion) % 16 == 0);
 
-typedef struct {
+typedef struct YkWarning {
 	enum {
 		YK_W_UNDECLARED_VARIABLE,
 		YK_W_WRONG_NUMBER_OF_ARGUMENTS,
@@ -370,9 +567,12 @@ typedef struct {
 			YkObject function_symbol;
 		} dynamic_bind_function;
 	} warning;
+
+	struct YkWarning* next;
 } YkWarning;
 
 void yk_init();
+void yk_set_stack_max_size(YkUint size);
 YkObject yk_cons(YkObject car, YkObject cdr);
 void yk_print(YkObject o);
 YkObject yk_make_symbol(const char* name, uint size);
@@ -380,14 +580,36 @@ YkObject yk_make_bytecode_begin(YkObject name, YkInt nargs);
 void yk_bytecode_emit(YkObject bytecode, YkOpcode op, uint16_t modifier, YkObject ptr);
 void yk_bytecode_disassemble(YkObject bytecode);
 YkObject yk_read(const char* string);
+void yk_reader_init_string(YkReader* reader, const char* string);
+void yk_reader_init_file(YkReader* reader, FILE* file, size_t buffer_size);
+bool yk_reader_open_file(YkReader* reader, const char* path);
+void yk_reader_close(YkReader* reader);
+YkObject yk_read_form(YkReader* reader, bool* eof);
 YkObject yk_compile(YkObject forms, YkObject bytecode);
+YkObject yk_declare_module(const char* path);
 int yk_run(YkObject bytecode);
+bool yk_profile_start(YkUint interval);
+void yk_profile_stop();
+#if YK_INSTRUMENT
+void yk_instrument_dump(FILE* file);
+void yk_instrument_reset();
+#endif
 
 YkObject yk_make_output_string_stream();
 YkObject yk_stream_string(YkObject stream);
 char* yk_string_to_c_str(YkObject string);
 YkObject yk_make_symbol_cstr(const char* cstr);
 
+YkObject yk_hash_table_ref(YkObject table, YkObject key, YkObject default_value);
+void yk_hash_table_set(YkObject table, YkObject key, YkObject value);
+bool yk_hash_table_remove(YkObject table, YkObject key);
+
+/* Wraps `size' elements of `type', `stride' bytes apart (0 if packed), at
+ * `data' without copying them. The memory must outlive the view, which
+ * calls `finalizer' (unless NULL) on `data' once it is collected. */
+YkObject yk_make_buffer_view(void* data, YkElementType type, YkUint size, YkUint stride,
+							 YkFinalizer finalizer);
+
 /* Public variables */
 extern YkObject yk_var_output;
 extern YkObject yk_value_register;